@@ -20,6 +20,14 @@ def main(bagfile):
     # Change these to match your desired output CSV filenames
     odom_csv_file = "odometry.csv"
     gps_csv_file = "gps.csv"
+    detections_csv_file = "detections.csv"
+
+    # Tag detection topics and the camera names used in camera_config
+    detection_topics = {
+        "/l/tag_detections": "lCam",
+        "/r/tag_detections": "rCam",
+        "/m/tag_detections": "mCam",
+    }
 
     # Open the bag
     bag = rosbag.Bag(bagfile, 'r')
@@ -55,10 +63,20 @@ def main(bagfile):
             # msg.latitude, msg.longitude, msg.altitude
             gps_writer.writerow([t.to_sec(), msg.latitude, msg.longitude, msg.altitude])
 
+    # Tag detections for the offline replay (replay_detections_csv), tag position in the camera optical frame
+    with open(detections_csv_file, 'w', newline='') as f_det:
+        det_writer = csv.writer(f_det)
+        det_writer.writerow(["time", "camera", "id", "x", "y", "z"])
+        for topic, msg, t in bag.read_messages(topics=list(detection_topics.keys())):
+            for detection in msg.detections:
+                p = detection.pose.pose.pose.position
+                det_writer.writerow([t.to_sec(), detection_topics[topic], detection.id[0], p.x, p.y, p.z])
+
     bag.close()
     print("Extraction complete!")
     print("Odometry saved to:", odom_csv_file)
     print("GPS saved to:", gps_csv_file)
+    print("Detections saved to:", detections_csv_file)
 
 if __name__ == "__main__":
     if len(sys.argv) < 2:
@@ -0,0 +1,412 @@
+// micro_benchmark.cpp
+// Baseline timings of the geometric, detection, filtering and graph maintenance kernels on
+// synthetic inputs from tens to hundreds of thousands of poses / tags / particles, so that each
+// hot-path change can be quantified against the previous numbers.
+// The SE(2) kernels are first checked against gtsam::Pose2 on random inputs; the run exits
+// with 1 if any of them disagrees by more than 1e-9.
+// Usage: aprilslamcpp_micro_benchmark [--max-size 100000] [--filter name] [--csv results.csv]
+
+#include "estimator.h"
+#include "estimator_access.h"
+#include "particle_filter.h"
+#include "publishing_utils.h"
+#include "se2.h"
+#include <gtsam/slam/BetweenFactor.h>
+#include <gtsam/slam/PriorFactor.h>
+#include <gtsam/sam/BearingRangeFactor.h>
+#include <boost/make_shared.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace aprilslam {
+
+// Fills the estimator state the way a long localisation run would, without solving; the
+// maintenance stages are then called directly through detail::EstimatorAccess
+struct EstimatorInternals {
+    typedef detail::EstimatorAccess Access;
+
+    // n poses driving round a rectangular loop between two rows of tags; every pose observes
+    // the tags within 2 m of it
+    static void populate(Estimator& estimator, int n, const std::map<int, gtsam::Point2>& tags) {
+        gtsam::NonlinearFactorGraph graph;
+        gtsam::Values estimates;
+        std::map<gtsam::Symbol, std::set<gtsam::Symbol>> poseToLandmarks;
+
+        const double lap = 2.0 * (100.0 + 3.0);
+        gtsam::Pose2 previous;
+        for (int i = 1; i <= n; ++i) {
+            // Arc length 0.1 m per pose along the loop
+            double s = std::fmod(0.1 * i, lap);
+            gtsam::Pose2 pose = s < 100.0 ? gtsam::Pose2(0.0, s, M_PI / 2)
+                              : s < 103.0 ? gtsam::Pose2(s - 100.0, 100.0, 0.0)
+                              : s < 203.0 ? gtsam::Pose2(3.0, 100.0 - (s - 103.0), -M_PI / 2)
+                                          : gtsam::Pose2(3.0 - (s - 203.0), 0.0, M_PI);
+            gtsam::Symbol x('X', i);
+            estimates.insert(x, pose);
+            if (i > 1) {
+                graph.add(gtsam::BetweenFactor<gtsam::Pose2>(
+                    gtsam::Symbol('X', i - 1), x, previous.between(pose), Access::odometryNoise(estimator)));
+            }
+            std::set<gtsam::Symbol> seen;
+            for (const auto& tag : tags) {
+                if (std::abs(tag.second.y() - pose.y()) > 2.0 || pose.range(tag.second) > 2.0) continue;
+                gtsam::Symbol l('L', tag.first);
+                graph.add(gtsam::BearingRangeFactor<gtsam::Pose2, gtsam::Point2, gtsam::Rot2, double>(
+                    x, l, pose.bearing(tag.second), pose.range(tag.second), Access::bearingRangeNoise(estimator)));
+                if (!estimates.exists(l)) estimates.insert(l, tag.second);
+                seen.insert(l);
+            }
+            poseToLandmarks[x] = seen;
+            previous = pose;
+        }
+        Access::setHistory(estimator, graph, estimates, poseToLandmarks);
+    }
+    // Turns the populated state into a calibration problem: first pose anchored, every initial
+    // estimate perturbed (seeded, so two estimators get the same problem)
+    static void perturb(Estimator& estimator, unsigned int seed) {
+        std::mt19937 rng(seed);
+        std::normal_distribution<double> position(0.0, 0.2), heading(0.0, 0.05);
+        const gtsam::Values& estimates = estimator.estimates();
+        gtsam::Symbol first('X', 1);
+        gtsam::NonlinearFactorGraph graph = Access::graph(estimator);
+        graph.add(gtsam::PriorFactor<gtsam::Pose2>(first, estimates.at<gtsam::Pose2>(first), Access::priorNoise(estimator)));
+        gtsam::Values perturbed;
+        for (const auto& key_value : estimates) {
+            gtsam::Symbol key(key_value.key);
+            if (key.chr() == 'X') {
+                const gtsam::Pose2& pose = estimates.at<gtsam::Pose2>(key);
+                perturbed.insert(key, gtsam::Pose2(pose.x() + position(rng), pose.y() + position(rng), pose.theta() + heading(rng)));
+            } else {
+                const gtsam::Point2& point = estimates.at<gtsam::Point2>(key);
+                perturbed.insert(key, gtsam::Point2(point.x() + position(rng), point.y() + position(rng)));
+            }
+        }
+        Access::setHistory(estimator, graph, perturbed, Access::poseToLandmarks(estimator));
+    }
+    static void prune(Estimator& estimator, int maxPoses) { Access::prune(estimator, maxPoses); }
+    static void smooth(Estimator& estimator, int window) { Access::smooth(estimator, window); }
+    static bool loopClosure(Estimator& estimator, const std::set<gtsam::Symbol>& detected) {
+        return Access::loopClosure(estimator, detected);
+    }
+};
+
+}
+
+using namespace aprilslam;
+
+namespace {
+
+struct Result {
+    std::string name;
+    long n;
+    long reps;
+    double seconds;     // per call
+};
+
+std::string filter;
+std::vector<Result> results;
+
+// Repeats `run` (after an untimed `setup`) until 0.2 s have been timed, at least 3 and at most
+// 100000 times, and reports the mean time per call and per element
+void measure(const std::string& name, long n, const std::function<void()>& setup, const std::function<void()>& run) {
+    if (!filter.empty() && name.find(filter) == std::string::npos) return;
+    double timed = 0.0;
+    long reps = 0;
+    while ((timed < 0.2 || reps < 3) && reps < 100000) {
+        if (setup) setup();
+        auto start = std::chrono::steady_clock::now();
+        run();
+        timed += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        ++reps;
+    }
+    results.push_back({name, n, reps, timed / reps});
+    std::printf("%-28s %9ld %8ld %14.3f %12.2f\n", name.c_str(), n, reps, 1e6 * timed / reps, 1e9 * timed / reps / n);
+    std::fflush(stdout);
+}
+
+// Result sink so the optimiser keeps the work
+volatile double sink;
+
+// Two rows of tags 3 m apart, one every 0.5 m along a 100 m tunnel, ids from 0
+std::map<int, gtsam::Point2> tunnelTags() {
+    std::map<int, gtsam::Point2> tags;
+    for (int i = 0; i <= 200; ++i) {
+        tags[2 * i] = gtsam::Point2(-0.5, 0.5 * i);
+        tags[2 * i + 1] = gtsam::Point2(3.5, 0.5 * i);
+    }
+    return tags;
+}
+
+// n detections with random ids and optical-frame positions
+apriltag_ros::AprilTagDetectionArray::ConstPtr detectionArray(int n, std::mt19937& rng) {
+    std::uniform_real_distribution<double> pos(-2.0, 2.0);
+    std::uniform_int_distribution<int> id(0, 1000);
+    auto msg = boost::make_shared<apriltag_ros::AprilTagDetectionArray>();
+    msg->detections.resize(n);
+    for (auto& detection : msg->detections) {
+        detection.id.push_back(id(rng));
+        detection.pose.pose.pose.position.x = pos(rng);
+        detection.pose.pose.pose.position.y = pos(rng);
+        detection.pose.pose.pose.position.z = std::abs(pos(rng)) + 0.3;
+    }
+    return msg;
+}
+
+// Largest difference of the se2 kernels from gtsam::Pose2 over random poses and points, with
+// angles compared on the circle
+bool checkSE2Accuracy(std::mt19937& rng) {
+    std::uniform_real_distribution<double> coord(-50.0, 50.0);
+    std::uniform_real_distribution<double> angle(-20.0, 20.0);
+    std::uniform_real_distribution<double> huge(-1e6, 1e6);
+    auto angleDiff = [](double a, double b) { return std::abs(std::remainder(a - b, 2.0 * M_PI)); };
+    auto poseDiff = [&](const se2::Pose& a, const gtsam::Pose2& b) {
+        return std::max({std::abs(a.x - b.x()), std::abs(a.y - b.y()), angleDiff(a.theta, b.theta())});
+    };
+    double between = 0.0, compose = 0.0, from = 0.0, to = 0.0, bearing = 0.0, wrap = 0.0;
+    bool inRange = true;
+    for (int i = 0; i < 100000; ++i) {
+        gtsam::Pose2 a(coord(rng), coord(rng), angle(rng)), b(coord(rng), coord(rng), angle(rng));
+        gtsam::Point2 p(coord(rng), coord(rng));
+        se2::Frame frame(a);
+        between = std::max(between, poseDiff(se2::between(se2::fromPose2(a), se2::fromPose2(b)), a.between(b)));
+        compose = std::max(compose, poseDiff(se2::compose(se2::fromPose2(a), se2::fromPose2(b)), a.compose(b)));
+        double wx, wy, bx, by;
+        frame.transformFrom(p.x(), p.y(), wx, wy);
+        frame.transformTo(p.x(), p.y(), bx, by);
+        from = std::max(from, (gtsam::Point2(wx, wy) - a.transformFrom(p)).cwiseAbs().maxCoeff());
+        to = std::max(to, (gtsam::Point2(bx, by) - a.transformTo(p)).cwiseAbs().maxCoeff());
+        bearing = std::max(bearing, angleDiff(frame.bearingTo(p.x(), p.y()), a.bearing(p).theta()));
+        for (double t : {angle(rng), huge(rng)}) {
+            const double w = se2::wrapAngle(t), wb = se2::wrapAngleBranchless(t);
+            inRange = inRange && w >= -M_PI && w < M_PI && wb >= -M_PI && wb <= M_PI;
+            wrap = std::max({wrap, angleDiff(w, std::atan2(std::sin(t), std::cos(t))), angleDiff(wb, w)});
+        }
+    }
+    std::printf("se2 vs gtsam::Pose2 max error: between %.2e compose %.2e transformFrom %.2e transformTo %.2e "
+                "bearing %.2e wrap %.2e\n", between, compose, from, to, bearing, wrap);
+    // Angles near 1e6 rad carry ~1e-10 of rounding in sin/cos themselves
+    const bool ok = inRange && std::max({between, compose, from, to, bearing, wrap}) < 1e-9;
+    if (!ok) std::printf("se2 accuracy check FAILED\n");
+    return ok;
+}
+
+}
+
+int main(int argc, char** argv) {
+    long maxSize = 100000;
+    std::string csv;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--max-size" && i + 1 < argc) maxSize = std::atol(argv[++i]);
+        else if (arg == "--filter" && i + 1 < argc) filter = argv[++i];
+        else if (arg == "--csv" && i + 1 < argc) csv = argv[++i];
+        else {
+            std::fprintf(stderr, "unknown argument %s\n", arg.c_str());
+            return 2;
+        }
+    }
+    std::vector<long> sizes;
+    for (long n = 10; n <= maxSize; n *= 10) sizes.push_back(n);
+
+    std::mt19937 rng(42);
+    if (!checkSE2Accuracy(rng)) return 1;
+    std::uniform_real_distribution<double> coord(-50.0, 50.0);
+    std::uniform_real_distribution<double> angle(-20.0, 20.0);
+    std::printf("%-28s %9s %8s %14s %12s\n", "benchmark", "n", "reps", "us/call", "ns/item");
+
+    // Geometry: n pose pairs / angles per call
+    for (long n : sizes) {
+        std::vector<gtsam::Pose2> poses(n + 1);
+        std::vector<double> angles(n);
+        for (auto& pose : poses) pose = gtsam::Pose2(coord(rng), coord(rng), angle(rng));
+        for (auto& a : angles) a = angle(rng);
+        measure("relPoseFG", n, nullptr, [&]() {
+            double acc = 0.0;
+            for (long i = 0; i < n; ++i) acc += relPoseFG(poses[i], poses[i + 1]).x();
+            sink = acc;
+        });
+        measure("wrapToPi", n, nullptr, [&]() {
+            double acc = 0.0;
+            for (long i = 0; i < n; ++i) acc += wrapToPi(angles[i]);
+            sink = acc;
+        });
+        // gtsam::Pose2 against the se2 kernels on the same inputs
+        measure("Pose2::between", n, nullptr, [&]() {
+            double acc = 0.0;
+            for (long i = 0; i < n; ++i) acc += poses[i].between(poses[i + 1]).x();
+            sink = acc;
+        });
+        measure("se2::between", n, nullptr, [&]() {
+            double acc = 0.0;
+            for (long i = 0; i < n; ++i) acc += se2::between(se2::fromPose2(poses[i]), se2::fromPose2(poses[i + 1])).x;
+            sink = acc;
+        });
+        measure("Pose2::compose", n, nullptr, [&]() {
+            double acc = 0.0;
+            for (long i = 0; i < n; ++i) acc += poses[i].compose(poses[i + 1]).x();
+            sink = acc;
+        });
+        measure("se2::compose", n, nullptr, [&]() {
+            double acc = 0.0;
+            for (long i = 0; i < n; ++i) acc += se2::compose(se2::fromPose2(poses[i]), se2::fromPose2(poses[i + 1])).x;
+            sink = acc;
+        });
+        measure("fmod wrap", n, nullptr, [&]() {
+            double acc = 0.0;
+            for (long i = 0; i < n; ++i) {
+                double a = std::fmod(angles[i] + M_PI, 2 * M_PI);
+                acc += (a < 0 ? a + 2 * M_PI : a) - M_PI;
+            }
+            sink = acc;
+        });
+        measure("se2::wrapAngles", n, nullptr, [&]() {
+            se2::wrapAngles(angles.data(), static_cast<size_t>(n));
+            sink = angles[0];
+        });
+        // One pose, n points: per-point Pose2 calls against the batched kernels
+        std::vector<double> px(n), py(n), wx(n), wy(n), bearing(n), range(n);
+        for (long i = 0; i < n; ++i) {
+            px[i] = coord(rng);
+            py[i] = coord(rng);
+        }
+        measure("Pose2::transformFrom+bearing", n, nullptr, [&]() {
+            double acc = 0.0;
+            for (long i = 0; i < n; ++i) {
+                gtsam::Point2 w = poses[0].transformFrom(gtsam::Point2(px[i], py[i]));
+                acc += std::atan2(w.y(), w.x()) + w.norm();
+            }
+            sink = acc;
+        });
+        measure("se2::transformFrom+bearing", n, nullptr, [&]() {
+            se2::transformFrom(se2::Frame(poses[0]), px.data(), py.data(), wx.data(), wy.data(), static_cast<size_t>(n));
+            se2::bearingRange(wx.data(), wy.data(), bearing.data(), range.data(), static_cast<size_t>(n));
+            sink = bearing[0] + range[0];
+        });
+    }
+
+    // Detection ingestion: n detections in one array, and spread over three cameras
+    std::vector<CameraInfo> cameras(3);
+    const char* names[3] = {"lCam", "rCam", "mCam"};
+    const Eigen::Vector3d extrinsics[3] = {Eigen::Vector3d(0.0, 0.2, M_PI / 2), Eigen::Vector3d(0.0, -0.2, -M_PI / 2), Eigen::Vector3d(0.3, 0.0, 0.0)};
+    for (int c = 0; c < 3; ++c) {
+        cameras[c].name = names[c];
+        setCameraExtrinsic(cameras[c], extrinsics[c]);
+    }
+    DetectionBatch batch;
+    for (long n : sizes) {
+        auto msg = detectionArray(static_cast<int>(n), rng);
+        measure("processDetections", n, [&]() { batch.clear(); }, [&]() {
+            processDetections(msg, cameras[2], 2, batch);
+        });
+        std::map<std::string, apriltag_ros::AprilTagDetectionArray::ConstPtr> perCamera;
+        for (int c = 0; c < 3; ++c) perCamera[names[c]] = detectionArray(static_cast<int>(std::max(1L, n / 3)), rng);
+        measure("getCamDetections", 3 * std::max(1L, n / 3), nullptr, [&]() {
+            getCamDetections(cameras, perCamera, batch);
+        });
+    }
+
+    // Particle filter: n particles against the tags visible from one pose
+    std::map<int, gtsam::Point2> tags = tunnelTags();
+    const gtsam::Pose2 truth(1.5, 50.0, M_PI / 2);
+    std::vector<int> Id;
+    std::vector<Eigen::Vector2d> tagPos;
+    for (const auto& tag : tags) {
+        gtsam::Point2 local = truth.transformTo(tag.second);
+        if (local.x() > 0.2 && local.norm() < 4.0) {
+            Id.push_back(tag.first);
+            tagPos.push_back(Eigen::Vector2d(local.x(), local.y()));
+        }
+    }
+    for (long n : sizes) {
+        measure("initParticlesFromFirstTag", n, nullptr, [&]() {
+            sink = initParticlesFromFirstTag(Id, tagPos, tags, static_cast<int>(n)).size();
+        });
+        PFParams params;
+        params.seed = 42;
+        params.threads = 1;
+        params.essThreshold = 1.0;
+        params.minParticles = params.maxParticles = n;
+        ParticleFilter pf(params);
+        measure("particleFilter.step", n, [&]() { pf.setParticles(initParticlesFromFirstTag(Id, tagPos, tags, static_cast<int>(n))); },
+                [&]() { pf.step(Id, tagPos, tags); });
+    }
+
+    // Graph maintenance on an n-pose history (calls are destructive, the state is rebuilt untimed)
+    Estimator estimator;
+    std::set<gtsam::Symbol> farAway = {gtsam::Symbol('L', 100000)};
+    for (long n : sizes) {
+        const int poses = static_cast<int>(n);
+        bool populated = false;
+        auto populateOnce = [&]() {
+            if (!populated) EstimatorInternals::populate(estimator, poses, tags);
+            populated = true;
+        };
+        measure("pruneGraphByPoseCount", n, [&]() { EstimatorInternals::populate(estimator, poses, tags); },
+                [&]() { EstimatorInternals::prune(estimator, std::max(1, poses / 2)); });
+        populated = false;
+        measure("smoothTrajectory", n, populateOnce, [&]() { EstimatorInternals::smooth(estimator, 5); });
+        // Worst case: no closure found, every keyframe in the history is visited
+        measure("checkLoopClosure", n, populateOnce, [&]() { sink = EstimatorInternals::loopClosure(estimator, farAway); });
+    }
+
+    // Calibration solve on an n-pose drive: monolithic against parallel submaps, a chordal
+    // initial estimate and coarse-to-fine levels (up to 10 000 poses)
+    EstimatorOptions monolithicOptions;
+    monolithicOptions.incremental = false;
+    EstimatorOptions submapOptions = monolithicOptions;
+    submapOptions.submaps.maxPoses = 500;
+    EstimatorOptions chordalOptions = monolithicOptions;
+    chordalOptions.useChordalInit = true;
+    EstimatorOptions coarseOptions = monolithicOptions;
+    coarseOptions.coarseToFine.decimation = {16, 4};
+    Estimator monolithic(monolithicOptions), submapped(submapOptions), chordal(chordalOptions), coarse(coarseOptions);
+    for (long n : sizes) {
+        if (n < 100 || n > 10000) continue;
+        const int poses = static_cast<int>(n);
+        auto problem = [&](Estimator& estimator) {
+            EstimatorInternals::populate(estimator, poses, tags);
+            EstimatorInternals::perturb(estimator, 7);
+        };
+        measure("optimiseAll monolithic", n, [&]() { problem(monolithic); }, [&]() { monolithic.optimiseAll(); });
+        measure("optimiseAll submaps", n, [&]() { problem(submapped); }, [&]() { submapped.optimiseAll(); });
+        double difference = 0.0;
+        for (const auto& landmark : monolithic.landmarks()) {
+            auto it = submapped.landmarks().find(landmark.first);
+            if (it != submapped.landmarks().end()) difference = std::max(difference, (it->second - landmark.second).norm());
+        }
+        std::printf("  %d submaps, largest tag difference to the monolithic solve %.2e m\n", submapped.submapReport().submaps, difference);
+        measure("optimiseAll chordal", n, [&]() { problem(chordal); }, [&]() { chordal.optimiseAll(); });
+        std::printf("  LM iterations %zu from the odometry guess, %zu from the chordal estimate (init %.2e s)\n",
+                    monolithic.solverIterations(), chordal.solverIterations(), chordal.chordalInitReport().time);
+        measure("optimiseAll coarse-to-fine", n, [&]() { problem(coarse); }, [&]() { coarse.optimiseAll(); });
+        std::printf("  LM iterations %zu at full resolution after levels of 16 and 4\n", coarse.solverIterations());
+    }
+
+    // Map loading: n tags written once to a temporary file
+    for (long n : sizes) {
+        std::map<int, gtsam::Point2> map;
+        for (long i = 0; i < n; ++i) map[static_cast<int>(i)] = gtsam::Point2(coord(rng), coord(rng));
+        const std::string file = "/tmp/aprilslam_micro_benchmark_landmarks.csv";
+        saveLandmarksToCSV(map, file);
+        measure("loadLandmarksFromCSV", n, nullptr, [&]() { sink = loadLandmarksFromCSV(file).size(); });
+        std::remove(file.c_str());
+    }
+
+    if (!csv.empty()) {
+        std::ofstream out(csv);
+        out << "benchmark,n,reps,us_per_call,ns_per_item\n";
+        for (const Result& r : results) {
+            out << r.name << "," << r.n << "," << r.reps << "," << 1e6 * r.seconds << "," << 1e9 * r.seconds / r.n << "\n";
+        }
+        std::printf("results written to %s\n", csv.c_str());
+    }
+    return 0;
+}
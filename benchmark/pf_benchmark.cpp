@@ -0,0 +1,167 @@
+// pf_benchmark.cpp
+// Particles per second of the initialisation particle filter against the number of threads,
+// work to convergence with adaptive sizing, the localisation node's convergence test on a drive
+// down the row, and latency of the closed-form multi-tag alignment.
+// Usage: aprilslamcpp_pf_benchmark [max_particles] [iterations]
+
+#include "particle_filter.h"
+#include "pose_alignment.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+using namespace aprilslam;
+
+int main(int argc, char** argv) {
+    const int maxParticles = argc > 1 ? std::atoi(argv[1]) : 100000;
+    const int iterations = argc > 2 ? std::atoi(argv[2]) : 10;
+    const int hw = std::max(1u, std::thread::hardware_concurrency());
+
+    // Synthetic polytunnel: two rows of tags 1.5 m apart, robot between them
+    std::map<int, gtsam::Point2> savedLandmarks;
+    for (int i = 0; i < 200; ++i) {
+        savedLandmarks[2 * i] = gtsam::Point2(-0.75, 0.5 * i);
+        savedLandmarks[2 * i + 1] = gtsam::Point2(0.75, 0.5 * i);
+    }
+    const gtsam::Pose2 truth(0.0, 20.0, M_PI / 2);
+    std::vector<int> Id;
+    std::vector<Eigen::Vector2d> tagPos;
+    for (const auto& lm : savedLandmarks) {
+        gtsam::Point2 local = truth.transformTo(lm.second);
+        if (local.x() > 0.2 && local.norm() < 4.0) {
+            Id.push_back(lm.first);
+            tagPos.push_back(Eigen::Vector2d(local.x(), local.y()));
+        }
+    }
+    std::printf("visible tags: %zu, hardware threads: %d\n", Id.size(), hw);
+    std::printf("%10s %8s %14s %12s\n", "particles", "threads", "particles/s", "ms/step");
+
+    // Powers of two up to the hardware thread count, plus the hardware thread count itself
+    std::vector<int> threadCounts;
+    for (int t = 1; t < hw; t *= 2) threadCounts.push_back(t);
+    threadCounts.push_back(hw);
+
+    for (int n = 1000; n <= maxParticles; n *= 10) {
+        for (int threads : threadCounts) {
+            PFParams params;
+            params.threads = threads;
+            params.seed = 42;
+            // Fixed size and resampling every step so each row times the same work
+            params.essThreshold = 1.0;
+            params.minParticles = params.maxParticles = n;
+            ParticleFilter pf(params);
+            pf.setParticles(initParticlesFromFirstTag(Id, tagPos, savedLandmarks, n));
+
+            auto start = std::chrono::steady_clock::now();
+            for (int it = 0; it < iterations; ++it) {
+                pf.step(Id, tagPos, savedLandmarks);
+            }
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::printf("%10d %8d %14.0f %12.3f\n", n, threads,
+                        double(n) * iterations / elapsed, 1e3 * elapsed / iterations);
+        }
+    }
+
+    // Work spent to converge, fixed size against ESS-triggered resampling with KLD sizing
+    std::printf("\n%10s %8s %12s %14s %10s\n", "mode", "steps", "final N", "updates", "error [m]");
+    for (bool adaptive : {false, true}) {
+        PFParams params;
+        params.seed = 42;
+        params.maxParticles = maxParticles;
+        params.minParticles = adaptive ? 200 : maxParticles;
+        params.essThreshold = adaptive ? 0.5 : 1.0;
+        ParticleFilter pf(params);
+        pf.setParticles(initParticlesFromFirstTag(Id, tagPos, savedLandmarks, maxParticles));
+
+        // Converged once the mean moves less than 2 cm between steps
+        size_t updates = 0;
+        int steps = 0;
+        Eigen::Vector3d est = pf.mean();
+        while (steps < 50) {
+            updates += pf.size();
+            pf.step(Id, tagPos, savedLandmarks);
+            ++steps;
+            Eigen::Vector3d next = pf.mean();
+            const bool converged = (next.head<2>() - est.head<2>()).norm() < 0.02;
+            est = next;
+            if (converged) break;
+        }
+        std::printf("%10s %8d %12zu %14zu %10.3f\n", adaptive ? "adaptive" : "fixed", steps, pf.size(), updates,
+                    std::hypot(est(0) - truth.x(), est(1) - truth.y()));
+    }
+
+    // The node's convergence test (std below twice the settled spread, ESS >= 0.5, three steps in
+    // a row) while driving 0.2 m per step, fed by odometry, seeing every tag or only the nearest
+    PFParams nodeParams;
+    nodeParams.seed = 42;
+    const Eigen::Vector2d settled = steadyStateStd(nodeParams);
+    std::printf("\nthresholds %.3f m / %.3f rad (settled spread %.3f m / %.3f rad)\n",
+                2.0 * settled(0), 2.0 * settled(1), settled(0), settled(1));
+    std::printf("%10s %8s %10s %12s %12s\n", "tags", "steps", "error [m]", "error [rad]", "pos std [m]");
+    const gtsam::Pose2 motion(0.2, 0.0, 0.0);
+    for (bool single : {false, true}) {
+        ParticleFilter pf(nodeParams);
+        gtsam::Pose2 pose = truth;
+        std::vector<int> seenId;
+        std::vector<Eigen::Vector2d> seenPos;
+        auto observe = [&]() {
+            seenId.clear();
+            seenPos.clear();
+            double nearest = 1e9;
+            for (const auto& lm : savedLandmarks) {
+                gtsam::Point2 local = pose.transformTo(lm.second);
+                if (local.x() <= 0.2 || local.norm() >= 4.0) continue;
+                if (single && local.norm() >= nearest) continue;
+                if (single) {
+                    nearest = local.norm();
+                    seenId.clear();
+                    seenPos.clear();
+                }
+                seenId.push_back(lm.first);
+                seenPos.push_back(Eigen::Vector2d(local.x(), local.y()));
+            }
+        };
+        observe();
+        pf.setParticles(initParticlesFromFirstTag(seenId, seenPos, savedLandmarks, 20000));
+        int steps = 0;
+        int inRow = 0;
+        double posStd = 0.0;
+        while (steps < 100 && inRow < 3) {
+            pose = pose.compose(motion);
+            observe();
+            pf.step(seenId, seenPos, savedLandmarks, motion);
+            ++steps;
+            const Eigen::Matrix3d cov = pf.covariance();
+            posStd = std::sqrt(std::max(cov(0, 0), cov(1, 1)));
+            const bool ok = posStd < 2.0 * settled(0) && std::sqrt(cov(2, 2)) < 2.0 * settled(1) &&
+                            pf.effectiveSampleSize() / pf.size() >= 0.5;
+            inRow = ok ? inRow + 1 : 0;
+        }
+        const Eigen::Vector3d est = pf.mean();
+        std::printf("%10s %8d %10.3f %12.3f %12.3f%s\n", single ? "nearest" : "all", steps,
+                    std::hypot(est(0) - pose.x(), est(1) - pose.y()),
+                    std::abs(std::remainder(est(2) - pose.theta(), 2.0 * M_PI)), posStd,
+                    inRow < 3 ? "  (not converged)" : "");
+    }
+
+    // Closed-form alignment, with one tag displaced to exercise the RANSAC rejection
+    std::vector<Eigen::Vector2d> corrupted = tagPos;
+    corrupted[0] += Eigen::Vector2d(1.5, -1.0);
+    AlignmentParams alignParams;
+    alignParams.seed = 42;
+    AlignmentResult alignment;
+    const int repeats = 10000;
+    auto start = std::chrono::steady_clock::now();
+    bool ok = true;
+    for (int r = 0; r < repeats; ++r) {
+        ok &= alignTagsToMap(Id, corrupted, savedLandmarks, alignParams, alignment);
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("\nclosed-form: %s, %zu/%zu inliers, error %.4f m / %.4f rad, %.2f us per solve\n",
+                ok ? "ok" : "failed", alignment.inliers.size(), Id.size(),
+                std::hypot(alignment.pose.x() - truth.x(), alignment.pose.y() - truth.y()),
+                std::abs(alignment.pose.theta() - truth.theta()), 1e6 * elapsed / repeats);
+    return 0;
+}
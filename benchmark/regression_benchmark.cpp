@@ -0,0 +1,390 @@
+// regression_benchmark.cpp
+// Accuracy and throughput of the localisation estimator on a recorded run, compared against a
+// stored baseline. A recorded map-frame trajectory (refined_odometry.csv) is the reference:
+// odometry is rebuilt from its increments with seeded drift, and tag detections are simulated
+// from ground_truth.csv rigidly aligned onto the calibrated map, so every run sees the same input
+// and the calibrated map keeps its real errors against the tags.
+// refined_odometry.csv is an earlier output of this estimator, not an independent measurement:
+// the simulated sensors follow it exactly, so ATE / RPE are the error of this run on that
+// simulated drive, not the accuracy on the real one. Only the landmark RMSE is measured against
+// independent data (the surveyed ground_truth.csv).
+//
+// Usage: aprilslamcpp_regression_benchmark [--trajectory config/backup/loc2bad/refined_odometry.csv]
+//            [--map config/afteroptimisation.csv] [--ground-truth config/ground_truth.csv]
+//            [--params config/params_localisation.yaml] [--baseline benchmark/regression_baseline.csv]
+//            [--write-baseline] [--seed 42] [--max-range 3.5]
+//            [--accuracy-tolerance 0.05] [--latency-tolerance 0.25]
+// Exits with 1 when a metric is worse than the baseline by more than its tolerance, and with 2
+// when there is no baseline to compare against.
+
+#include "estimator.h"
+#include "pose_alignment.h"
+#include "stage_metrics.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace aprilslam;
+
+namespace {
+
+struct StampedPose {
+    double stamp;
+    gtsam::Pose2 pose;
+};
+
+// time,x,y,theta as written by publishRefinedOdom / the raw odometry log
+std::vector<StampedPose> loadTrajectory(const std::string& filename) {
+    std::vector<StampedPose> trajectory;
+    std::ifstream file(filename);
+    std::string line;
+    std::getline(file, line);  // header
+    while (std::getline(file, line)) {
+        std::stringstream ss(line);
+        std::string cell;
+        double v[4];
+        int n = 0;
+        while (n < 4 && std::getline(ss, cell, ',')) v[n++] = std::atof(cell.c_str());
+        if (n == 4) trajectory.push_back({v[0], gtsam::Pose2(v[1], v[2], v[3])});
+    }
+    return trajectory;
+}
+
+// Flat "key: value" entries and "parent/child" lists of the node yaml, enough for the estimator settings
+std::map<std::string, std::vector<std::string>> loadYaml(const std::string& filename) {
+    std::map<std::string, std::vector<std::string>> params;
+    std::ifstream file(filename);
+    std::string line, parent, key;
+    while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        size_t indent = line.find_first_not_of(' ');
+        if (indent == std::string::npos) continue;
+        std::string text = line.substr(indent);
+        while (!text.empty() && (text.back() == ' ' || text.back() == '\r')) text.pop_back();
+        if (text.compare(0, 2, "- ") == 0) {
+            params[key].push_back(text.substr(2));
+            continue;
+        }
+        size_t colon = text.find(':');
+        if (colon == std::string::npos) continue;
+        std::string name = text.substr(0, colon);
+        std::string value = text.substr(colon + 1);
+        value.erase(0, value.find_first_not_of(' '));
+        if (indent == 0) parent = name;
+        key = indent == 0 ? name : parent + "/" + name;
+        if (!value.empty()) params[key].push_back(value);
+    }
+    return params;
+}
+
+void applyParams(const std::map<std::string, std::vector<std::string>>& params, EstimatorOptions& options) {
+    auto number = [&params](const std::string& key, double& value) {
+        auto it = params.find(key);
+        if (it != params.end() && !it->second.empty()) value = std::atof(it->second[0].c_str());
+    };
+    auto integer = [&number](const std::string& key, int& value) {
+        double v = value;
+        number(key, v);
+        value = static_cast<int>(v);
+    };
+    auto flag = [&params](const std::string& key, bool& value) {
+        auto it = params.find(key);
+        if (it != params.end() && !it->second.empty()) value = it->second[0] == "true";
+    };
+    auto sigmas = [&params](const std::string& key, auto& value) {
+        auto it = params.find(key);
+        if (it == params.end() || it->second.size() != static_cast<size_t>(value.size())) return;
+        for (int i = 0; i < value.size(); ++i) value(i) = std::atof(it->second[i].c_str());
+    };
+
+    sigmas("noise_models/odometry", options.odometrySigmas);
+    sigmas("noise_models/prior", options.priorSigmas);
+    sigmas("noise_models/bearing_range", options.bearingRangeSigmas);
+    sigmas("noise_models/point", options.pointSigmas);
+    sigmas("noise_models/loopClosureNoise", options.loopClosureSigmas);
+    number("add2graph_threshold", options.add2graphThreshold);
+    number("stationary_position_threshold", options.stationaryPositionThreshold);
+    number("stationary_rotation_threshold", options.stationaryRotationThreshold);
+    flag("useisam2", options.useIsam2);
+    flag("batch_optimisation", options.batchOptimisation);
+    flag("usekeyframe", options.useKeyframe);
+    number("distanceThreshold", options.distanceThreshold);
+    number("rotationThreshold", options.rotationThreshold);
+    flag("fuseduplicatedetections", options.fuseDuplicateDetections);
+    flag("useprunebysize", options.usePruneBySize);
+    integer("maxfactors", options.maxPoses);
+    flag("useloopclosure", options.useLoopClosure);
+    number("historyKeyframeSearchRadius", options.historyKeyframeSearchRadius);
+    integer("historyKeyframeSearchNum", options.historyKeyframeSearchNum);
+    integer("requiredReobservedLandmarks", options.requiredReobservedLandmarks);
+    flag("useoutlierremoval", options.useOutlierRemoval);
+    number("jumpCombinedThreshold", options.jumpCombinedThreshold);
+    integer("outlierRemovalStartIndex_", options.outlierRemovalStartIndex);
+    flag("usetrajsmoothing", options.useTrajSmoothing);
+    integer("smoothingwindow", options.smoothingWindow);
+    integer("smoothingStartIndex_", options.smoothingStartIndex);
+    flag("userelocalisation", options.useRelocalisation);
+    number("reloc_residual_threshold", options.relocalisation.residualThreshold);
+    integer("reloc_trigger_count", options.relocalisation.triggerCount);
+    integer("reloc_window", options.relocalisation.window);
+    number("reloc_min_correction", options.relocalisation.minCorrection);
+    number("reloc_min_heading_correction", options.relocalisation.minHeadingCorrection);
+}
+
+// Ground truth moved into the frame of the calibrated map (rigid fit over the shared ids)
+bool alignGroundTruth(const std::map<int, gtsam::Point2>& groundTruth,
+                      const std::map<int, gtsam::Point2>& map,
+                      std::map<int, gtsam::Point2>& aligned) {
+    std::vector<Eigen::Vector2d> from, to;
+    for (const auto& tag : groundTruth) {
+        auto it = map.find(tag.first);
+        if (it == map.end()) continue;
+        from.push_back(Eigen::Vector2d(tag.second.x(), tag.second.y()));
+        to.push_back(Eigen::Vector2d(it->second.x(), it->second.y()));
+    }
+    gtsam::Pose2 transform;
+    if (!rigidAlign2D(from, to, transform)) return false;
+    aligned.clear();
+    for (const auto& tag : groundTruth) {
+        aligned[tag.first] = transform.transformFrom(tag.second);
+    }
+    return true;
+}
+
+double landmarkRMSE(const std::map<int, gtsam::Point2>& estimate, const std::map<int, gtsam::Point2>& truth) {
+    double sum = 0.0;
+    int n = 0;
+    for (const auto& tag : estimate) {
+        auto it = truth.find(tag.first);
+        if (it == truth.end()) continue;
+        sum += (tag.second - it->second).squaredNorm();
+        ++n;
+    }
+    return n ? std::sqrt(sum / n) : 0.0;
+}
+
+struct Metric {
+    std::string name;
+    double value;
+    bool accuracy;      // accuracy metrics use the accuracy tolerance, the rest are timings
+    bool higherIsBetter;
+};
+
+std::map<std::string, double> loadBaseline(const std::string& filename) {
+    std::map<std::string, double> baseline;
+    std::ifstream file(filename);
+    std::string line;
+    std::getline(file, line);  // header
+    while (std::getline(file, line)) {
+        size_t comma = line.find(',');
+        if (comma == std::string::npos) continue;
+        baseline[line.substr(0, comma)] = std::atof(line.c_str() + comma + 1);
+    }
+    return baseline;
+}
+
+}
+
+int main(int argc, char** argv) {
+    std::string trajectoryFile = "config/backup/loc2bad/refined_odometry.csv";
+    std::string mapFile = "config/afteroptimisation.csv";
+    std::string groundTruthFile = "config/ground_truth.csv";
+    std::string paramsFile = "config/params_localisation.yaml";
+    std::string baselineFile = "benchmark/regression_baseline.csv";
+    bool writeBaseline = false;
+    unsigned int seed = 42;
+    double maxRange = 3.5;
+    double accuracyTolerance = 0.05;
+    double latencyTolerance = 0.25;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--write-baseline") writeBaseline = true;
+        else if (arg == "--trajectory" && hasValue) trajectoryFile = argv[++i];
+        else if (arg == "--map" && hasValue) mapFile = argv[++i];
+        else if (arg == "--ground-truth" && hasValue) groundTruthFile = argv[++i];
+        else if (arg == "--params" && hasValue) paramsFile = argv[++i];
+        else if (arg == "--baseline" && hasValue) baselineFile = argv[++i];
+        else if (arg == "--seed" && hasValue) seed = static_cast<unsigned int>(std::atoi(argv[++i]));
+        else if (arg == "--max-range" && hasValue) maxRange = std::atof(argv[++i]);
+        else if (arg == "--accuracy-tolerance" && hasValue) accuracyTolerance = std::atof(argv[++i]);
+        else if (arg == "--latency-tolerance" && hasValue) latencyTolerance = std::atof(argv[++i]);
+        else {
+            std::fprintf(stderr, "unknown argument %s\n", arg.c_str());
+            return 2;
+        }
+    }
+
+    std::vector<StampedPose> reference = loadTrajectory(trajectoryFile);
+    std::map<int, gtsam::Point2> map = loadLandmarksFromCSV(mapFile);
+    std::map<int, gtsam::Point2> groundTruth = loadLandmarksFromCSV(groundTruthFile);
+    std::map<int, gtsam::Point2> trueTags;
+    if (reference.size() < 2 || map.empty() || !alignGroundTruth(groundTruth, map, trueTags)) {
+        std::fprintf(stderr, "need a trajectory, a map and a ground truth sharing at least two tags\n");
+        return 2;
+    }
+
+    EstimatorOptions options;
+    applyParams(loadYaml(paramsFile), options);
+    options.incremental = true;
+    options.usePriorTagTable = true;
+    options.skipUnknownTags = true;
+    StageMetrics metrics;
+    Estimator estimator(options);
+    estimator.setMetrics(&metrics);
+    estimator.setPriorMap(map);
+    estimator.setInitialPose(reference.front().pose);
+
+    // Simulated sensors: odometry drifts with distance travelled, tags within range are seen
+    // with a fixed bearing-range noise, tighter than noise_models/bearing_range the estimator
+    // weights them with
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> unit(0.0, 1.0);
+    const double sigmaBearing = 0.02, sigmaRange = 0.05;
+    gtsam::Pose2 odom;
+    DetectionBatch batch;
+
+    LatencyHistogram stepLatency;
+    double estimatorTime = 0.0;
+    std::vector<gtsam::Pose2> estimates;
+    estimates.reserve(reference.size());
+    int keyframes = 0;
+
+    for (size_t k = 0; k < reference.size(); ++k) {
+        if (k > 0) {
+            gtsam::Pose2 delta = reference[k - 1].pose.between(reference[k].pose);
+            const double dist = std::hypot(delta.x(), delta.y());
+            delta = gtsam::Pose2(delta.x() + 0.02 * dist * unit(rng),
+                                 delta.y() + 0.02 * dist * unit(rng),
+                                 delta.theta() + (0.01 * std::abs(delta.theta()) + 0.002 * dist) * unit(rng));
+            odom = odom.compose(delta);
+        }
+
+        Stopwatch watch;
+        OdometryStep step = estimator.addOdometry(reference[k].stamp, odom);
+        if (step == OdometryStep::Keyframe) {
+            batch.clear();
+            const gtsam::Pose2& truth = reference[k].pose;
+            for (const auto& tag : trueTags) {
+                gtsam::Point2 local = truth.transformTo(tag.second);
+                const double range = local.norm() + sigmaRange * unit(rng);
+                if (range > maxRange || range <= 0.0) continue;
+                const double bearing = std::atan2(local.y(), local.x()) + sigmaBearing * unit(rng);
+                const size_t i = batch.size();
+                batch.resize(i + 1);
+                batch.ids[i] = tag.first;
+                batch.camera[i] = 0;
+                batch.x[i] = range * std::cos(bearing);
+                batch.y[i] = range * std::sin(bearing);
+                batch.bearing[i] = bearing;
+                batch.range[i] = range;
+                batch.count[i] = 1;
+            }
+            estimator.addDetections(batch);
+            ++keyframes;
+        }
+        const double elapsed = watch.elapsed();
+        if (step != OdometryStep::Stationary) {
+            stepLatency.record(elapsed);
+        }
+        estimatorTime += elapsed;
+
+        gtsam::Pose2 estimate = estimates.empty() ? reference.front().pose : estimates.back();
+        estimator.currentPose(estimate);
+        estimates.push_back(estimate);
+    }
+
+    // Absolute trajectory error in the map frame, no alignment: the run starts at the reference pose
+    double ateSum = 0.0, headingSum = 0.0;
+    for (size_t k = 0; k < reference.size(); ++k) {
+        ateSum += (estimates[k].translation() - reference[k].pose.translation()).squaredNorm();
+        const double dtheta = wrapToPi(estimates[k].theta() - reference[k].pose.theta());
+        headingSum += dtheta * dtheta;
+    }
+    // Relative pose error over 10 samples (about a second of driving)
+    const size_t rpeDelta = 10;
+    double rpeTransSum = 0.0, rpeRotSum = 0.0;
+    size_t rpeCount = 0;
+    for (size_t k = 0; k + rpeDelta < reference.size(); ++k) {
+        gtsam::Pose2 refRel = reference[k].pose.between(reference[k + rpeDelta].pose);
+        gtsam::Pose2 estRel = estimates[k].between(estimates[k + rpeDelta]);
+        gtsam::Pose2 error = refRel.between(estRel);
+        rpeTransSum += error.translation().squaredNorm();
+        rpeRotSum += error.theta() * error.theta();
+        ++rpeCount;
+    }
+    const double n = static_cast<double>(reference.size());
+
+    std::vector<Metric> results = {
+        {"landmark_rmse_m", landmarkRMSE(estimator.landmarks(), trueTags), true, false},
+        {"ate_rmse_m", std::sqrt(ateSum / n), true, false},
+        {"ate_heading_rmse_rad", std::sqrt(headingSum / n), true, false},
+        {"rpe_trans_rmse_m", rpeCount ? std::sqrt(rpeTransSum / rpeCount) : 0.0, true, false},
+        {"rpe_rot_rmse_rad", rpeCount ? std::sqrt(rpeRotSum / rpeCount) : 0.0, true, false},
+        {"step_p50_ms", 1e3 * stepLatency.percentile(0.50), false, false},
+        {"step_p95_ms", 1e3 * stepLatency.percentile(0.95), false, false},
+        {"step_p99_ms", 1e3 * stepLatency.percentile(0.99), false, false},
+        {"step_max_ms", 1e3 * stepLatency.max(), false, false},
+        {"steps_per_s", estimatorTime > 0.0 ? n / estimatorTime : 0.0, false, true},
+    };
+
+    std::printf("reference: %s (an earlier estimator output, the simulated run follows it exactly; "
+                "ATE / RPE are relative to it, landmark rmse to %s)\n", trajectoryFile.c_str(), groundTruthFile.c_str());
+    std::printf("samples: %zu, keyframes: %d, tags: %zu, prior map rmse vs ground truth: %.4f m\n",
+                reference.size(), keyframes, map.size(), landmarkRMSE(map, trueTags));
+    std::printf("%-22s %8s %8s %8s %8s %8s\n", "stage", "count", "p50 ms", "p95 ms", "p99 ms", "max ms");
+    for (size_t i = 0; i < StageMetrics::kStages; ++i) {
+        const LatencyHistogram& hist = metrics.histogram(static_cast<Stage>(i));
+        if (hist.count() == 0) continue;
+        std::printf("%-22s %8lu %8.3f %8.3f %8.3f %8.3f\n", stageName(static_cast<Stage>(i)),
+                    static_cast<unsigned long>(hist.count()), 1e3 * hist.percentile(0.50),
+                    1e3 * hist.percentile(0.95), 1e3 * hist.percentile(0.99), 1e3 * hist.max());
+    }
+
+    if (writeBaseline) {
+        std::ofstream file(baselineFile);
+        if (!file) {
+            std::fprintf(stderr, "could not write %s\n", baselineFile.c_str());
+            return 2;
+        }
+        file << "metric,value\n";
+        for (const Metric& metric : results) {
+            file << metric.name << "," << metric.value << "\n";
+        }
+        std::printf("baseline written to %s\n", baselineFile.c_str());
+    }
+
+    std::map<std::string, double> baseline = writeBaseline ? std::map<std::string, double>() : loadBaseline(baselineFile);
+    // Without a baseline nothing is checked, which must not pass as a green gate
+    const bool missingBaseline = !writeBaseline && baseline.empty();
+    if (missingBaseline) {
+        std::fprintf(stderr, "no baseline at %s, run with --write-baseline on the reference machine to store one\n",
+                     baselineFile.c_str());
+    }
+    int regressions = 0;
+    std::printf("\n%-22s %12s %12s %9s\n", "metric", "value", "baseline", "change");
+    for (const Metric& metric : results) {
+        auto it = baseline.find(metric.name);
+        if (it == baseline.end()) {
+            std::printf("%-22s %12.4f %12s %9s\n", metric.name.c_str(), metric.value, "-", "-");
+            continue;
+        }
+        const double base = it->second;
+        const double change = base != 0.0 ? (metric.value - base) / std::abs(base) : 0.0;
+        const double tolerance = metric.accuracy ? accuracyTolerance : latencyTolerance;
+        // Millimetre / milliradian noise on near-zero errors is not a regression
+        const bool worse = metric.higherIsBetter ? change < -tolerance
+                                                 : change > tolerance && metric.value - base > (metric.accuracy ? 1e-3 : 0.0);
+        if (worse) ++regressions;
+        std::printf("%-22s %12.4f %12.4f %+8.1f%%%s\n", metric.name.c_str(), metric.value, base, 100.0 * change,
+                    worse ? "  REGRESSION" : "");
+    }
+    if (missingBaseline) return 2;
+    return regressions > 0 ? 1 : 0;
+}
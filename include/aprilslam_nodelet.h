@@ -0,0 +1,39 @@
+#ifndef APRILSLAM_NODELET_H
+#define APRILSLAM_NODELET_H
+
+#include <memory>
+#include <nodelet/nodelet.h>
+#include <ros/ros.h>
+
+namespace aprilslam {
+
+// Runs a node class inside a nodelet manager. Loaded next to the apriltag_ros detector nodelets,
+// detections and odometry are handed over as shared pointers instead of being serialised through
+// TCPROS. The node keeps its own sensor / estimation callback queues, served by the same spinners
+// main() would start. The node is built non-blocking (it waits for TF on a timer) and never shuts
+// ROS down, which would stop the whole manager.
+template <class Node>
+class SlamNodelet : public nodelet::Nodelet {
+private:
+    void onInit() override {
+        ros::NodeHandle nh = getNodeHandle();
+        int sensor_threads = 1, estimation_threads = 1;
+        nh.param("sensor_threads", sensor_threads, 1);
+        nh.param("estimation_threads", estimation_threads, 1);
+
+        node_.reset(new Node(nh, false));
+        sensorSpinner_.reset(new ros::AsyncSpinner(sensor_threads, node_->sensorQueue()));
+        estimationSpinner_.reset(new ros::AsyncSpinner(estimation_threads, node_->estimationQueue()));
+        sensorSpinner_->start();
+        estimationSpinner_->start();
+    }
+
+    // Spinners are declared after the node so they stop before it is destroyed
+    std::unique_ptr<Node> node_;
+    std::unique_ptr<ros::AsyncSpinner> sensorSpinner_;
+    std::unique_ptr<ros::AsyncSpinner> estimationSpinner_;
+};
+
+}
+
+#endif
@@ -1,11 +1,24 @@
 #ifndef APRIL_SLAM_H
 #define APRIL_SLAM_H
+#include "estimator.h"
 #include "publishing_utils.h"
+#include "detection_buffer.h"
+#include "landmark_tiles.h"
+#include "particle_filter.h"
+#include "pose_alignment.h"
+#include "relocalisation_monitor.h"
+#include "replay.h"
 #include <ros/ros.h>
 #include <ros/package.h>
+#include <ros/callback_queue.h>
+#include <atomic>
+#include <mutex>
 #include <tf2_ros/buffer.h>
 #include <geometry_msgs/TransformStamped.h>
 #include <nav_msgs/Odometry.h>
+#include <std_msgs/String.h>
+#include <std_msgs/Float64.h>
+#include <std_srvs/Trigger.h>
 #include <gtsam/nonlinear/ISAM2.h>
 #include <gtsam/nonlinear/NonlinearFactorGraph.h>
 #include <gtsam/slam/BetweenFactor.h>
@@ -39,36 +52,56 @@
 
 namespace aprilslam {
 
+// ROS adapter around Estimator: converts messages, aligns detections, runs the initialisation
+// and publishes the estimates. The graph itself lives in aprilslam_core (estimator.h).
 class aprilslamcpp {
 public:
-    explicit aprilslamcpp(ros::NodeHandle node_handle); // Constructor
+    // Standalone nodes may block on TF and shut ROS down. In a nodelet (standalone = false) the
+    // extrinsics are retried on a timer and data is ignored until they are known.
+    explicit aprilslamcpp(ros::NodeHandle node_handle, bool standalone = true); // Constructor
     ~aprilslamcpp(); // Deconstructor
-    void initializeGTSAM(); // Method to initialize GTSAM components
     gtsam::Pose2 translateOdomMsg(const nav_msgs::Odometry::ConstPtr& msg); // Removed redundant class scope
-    void ISAM2Optimise(); //ISAM optimiser
-    gtsam::Values SAMOptimise(); //SAM optimiser
-    bool movementExceedsThreshold(const gtsam::Pose2& poseSE2);
-    void initializeFirstPose(const gtsam::Pose2& poseSE2, gtsam::Pose2& pose0);
-    gtsam::Pose2 predictNextPose(const gtsam::Pose2& poseSE2);
-    void updateOdometryPose(const gtsam::Pose2& poseSE2);
-    void generate2bePublished();
-    std::set<gtsam::Symbol> updateGraphWithLandmarks(std::set<gtsam::Symbol> detectedLandmarksCurrentPos, const std::pair<std::vector<int>, std::vector<Eigen::Vector2d>>& detections);
     void addOdomFactor(const nav_msgs::Odometry::ConstPtr& msg);
-    void checkLoopClosure(const std::set<gtsam::Symbol>& detectedLandmarks);
-    bool shouldAddKeyframe(const gtsam::Pose2& lastPose, const gtsam::Pose2& currentPose, std::set<gtsam::Symbol> oldlandmarks, std::set<gtsam::Symbol> detectedLandmarksCurrentPos);
     void cameraCallback(const apriltag_ros::AprilTagDetectionArray::ConstPtr& msg, const std::string& camera_name);
+    int cameraIndex(const std::string& camera_name) const;
     void mCamCallback(const apriltag_ros::AprilTagDetectionArray::ConstPtr& msg);
     void rCamCallback(const apriltag_ros::AprilTagDetectionArray::ConstPtr& msg);
     void lCamCallback(const apriltag_ros::AprilTagDetectionArray::ConstPtr& msg);
     void cmdVelCallback(const geometry_msgs::Twist::ConstPtr& msg);
     void pfInitCallback(const ros::TimerEvent& event);
-    void pruneGraphByPoseCount(int maxPoses);
-    void smoothTrajectory(int window_size); 
-    double computePoseDelta(const gtsam::Pose2& oldPose, const gtsam::Pose2& newPose);
+    void publishPFInitStatus(const std::string& status);
+    bool pfInitStatusService(std_srvs::Trigger::Request& req, std_srvs::Trigger::Response& res);
+    bool pfInitRestartService(std_srvs::Trigger::Request& req, std_srvs::Trigger::Response& res);
     bool getStaticTransform(const std::string& target_frame,
                     const std::string& source_frame,
-                    tf2::Transform& out_tf);
+                    tf2::Transform& out_tf,
+                    double timeout = 2.0);
+    // One lookup of every camera extrinsic not known yet, true once all are known
+    bool lookupCameraExtrinsics(double timeout);
+    // False when the camera extrinsics could not be found, the node then does nothing
+    bool ready() const { return ready_; }
+    void finaliseCalibration();
+    void metricsCallback(const ros::TimerEvent& event);
+    void dumpMetrics();
+    void writeTrace();
+    void updateLandmarkTiles(const gtsam::Pose2& pose, bool force);
+    // Callback queues served by separate spinners in main()
+    ros::CallbackQueue* sensorQueue() { return &sensorQueue_; }
+    ros::CallbackQueue* estimationQueue() { return &estimationQueue_; }
+    // Offline replay drives the callbacks directly, see replay.h
+    const std::vector<aprilslam::CameraInfo>& cameraInfos() const { return camera_infos_; }
+    bool needsInitialisation() const { return usePFinitialise && !pfInitialized_; }
 private:
+    // Declared first so they outlive every subscriber and timer attached to them
+    ros::CallbackQueue sensorQueue_;      // Camera detections, never blocked by the solver
+    ros::CallbackQueue estimationQueue_;  // Odometry, optimisation and timers
+    std::vector<bool> extrinsicKnown_;    // per camera_infos_ entry, from config or TF
+    std::atomic<bool> ready_{false};
+    bool standalone_;
+    ros::Timer extrinsic_timer_;          // Retries the extrinsics in a nodelet
+    std::mutex detectionMutex_;           // Guards camera_detections_, detectionBuffer_, received_camera_names_
+    std::mutex estimateMutex_;            // Guards estimator_ and the initialisation state
+    ros::NodeHandle sensor_nh_;
     ros::Timer check_data_timer_;  // Declare the timer here
     ros::Publisher path_pub_;
     ros::Publisher odom_traj_pub_;
@@ -80,6 +113,10 @@ private:
     // camera info
     std::vector<aprilslam::CameraInfo> camera_infos_;
     std::map<std::string, apriltag_ros::AprilTagDetectionArray::ConstPtr> camera_detections_;
+    DetectionBatch detectionBatch_;  // Reused every step to avoid reallocating the detection arrays
+    DetectionBuffer detectionBuffer_; // Time-indexed detections, consumed once by the pose they belong to
+    OdometryBuffer odomBuffer_;       // Recent raw odometry for interpolating the pose at a detection stamp
+    double detectionBufferHorizon_;
     XmlRpc::XmlRpcValue camera_list;
     std::vector<ros::Subscriber> camera_subscribers_;
     std::set<std::string> received_camera_names_;
@@ -97,19 +134,8 @@ private:
     tf2_ros::Buffer tf_buffer_;
     tf2_ros::TransformListener tf_listener_;
     tf2_ros::TransformBroadcaster tf_broadcaster;
-    // gtsam variables
-    std::map<gtsam::Symbol, std::map<gtsam::Symbol, std::tuple<double, double>>> poseToLandmarkMeasurementsMap;  //storing X-L pair
-    std::map<gtsam::Key, gtsam::Point2> historicLandmarks;     // Maintain a persistent storage for historic landmarks
-    gtsam::Values landmarkEstimates;  // for unwhitten error computing 
-    gtsam::NonlinearFactorGraph keyframeGraph_;  // Keyframe graph: All keyframes and associated landmarks
-    gtsam::Values keyframeEstimates_;            // Estimates for keyframes
-    gtsam::Values Estimates_visulisation;
-    gtsam::Pose2 Key_previous_pos;
-    gtsam::Symbol previousKeyframeSymbol;
-    gtsam::ISAM2 isam_;
-    gtsam::Pose2 lastPoseSE2_;
-    gtsam::Pose2 lastPoseSE2_vis;
-    gtsam::Pose2 lastPose_;
+    // Graph, gating, keyframing and optimisation
+    Estimator estimator_;
     
     // initialisation variable
     gtsam::Pose2 pose0;
@@ -122,84 +148,72 @@ private:
     double rngVar_;
     double brngVar_;
     double pfInitStartTime_;
-    std::vector<Eigen::Vector3d> x_P_pf_;
+    ParticleFilter pf_;
+    bool useclosedforminit;        // solve pose0 directly when two or more known tags are visible
+    AlignmentParams alignParams_;
+    // Calibration: previous map the session is aligned to and refined against
+    std::map<int, gtsam::Point2> warmStartMap_;
+    double warmStartSigma_;        // [m] prior on the re-observed tags, 0 uses them as initial estimate only
+    ros::Publisher reloc_status_pub_;
+    // PF convergence test and retry policy
+    double pfConvergePosStd_;      // largest position std [m] accepted as converged
+    double pfConvergeThetaStd_;    // largest heading std [rad] accepted as converged
+    double pfConvergeEss_;         // smallest ESS / N accepted as converged
+    int pfConvergeSteps_;          // consecutive converged steps before the estimate is accepted
+    int pfConvergedCount_ = 0;
+    int pfMaxRetries_;             // attempts before giving up, 0 retries forever
+    int pfAttempt_ = 0;
+    gtsam::Pose2 pfLastOdom_;      // odometry at the previous PF step
+    bool pfHaveOdom_ = false;
+    std::string pfStatus_;
+    ros::Publisher pf_status_pub_;
+    ros::Publisher pf_progress_pub_;
+    ros::ServiceServer pf_status_srv_;
+    ros::ServiceServer pf_restart_srv_;
     std::map<int, gtsam::Point2> savedLandmarks;
+    // Prior map split into tiles on disk, only those around the robot are in savedLandmarks
+    LandmarkTileMap landmarkTiles_;
+    bool useLandmarkTiles_ = false;
+    double tileUpdateDistance_;    // robot travel [m] between two tile updates
+    gtsam::Pose2 lastTilePose_;
 
     std::vector<std::string> possibleIds_; // Predefined tags in the environment
-    std::map<int, gtsam::Symbol> tagToNodeIDMap_; // Map from tag IDs to node IDs
-    int index_of_pose;
-    bool batchOptimisation_;
-    // Noise Models
-    gtsam::noiseModel::Diagonal::shared_ptr odometryNoise;
-    gtsam::noiseModel::Diagonal::shared_ptr priorNoise;
-    gtsam::noiseModel::Diagonal::shared_ptr brNoise;
-    gtsam::noiseModel::Diagonal::shared_ptr pointNoise;
-    gtsam::noiseModel::Diagonal::shared_ptr loopClosureNoise;
-    double add2graph_threshold;
     std::string map_frame_id;
-    gtsam::Pose2 initial_pose;
     // std::string ud_frame;
     std::string odom_trajectory_frame;
     std::string robot_frame;
     std::string odom_frame;
     std::string pathtosavelandmarkcsv;
     std::string pathtoloadlandmarkcsv;
-    double maxfactors; // Allowed total number of factors in the graph before pruning
-    bool useprunebysize;
-    // For loop closure 
-    bool useloopclosure;
-    double historyKeyframeSearchRadius;
-    int historyKeyframeSearchNum;
-    int requiredReobservedLandmarks;
-
-    double stationary_position_threshold;
-    double stationary_rotation_threshold;
     bool savetaglocation;
     bool usepriortagtable;
-    std::map<gtsam::Symbol, std::set<gtsam::Symbol>> poseToLandmarks; // Maps pose index to a set of detected landmark IDs, e.g. X1: L1,L2,L3.
-    // For keyframe
-    double distanceThreshold;
-    double rotationThreshold;
-    std::vector<double> xyTrans_lcam_baselink;
-    std::vector<double> xyTrans_rcam_baselink;
-    std::vector<double> xyTrans_mcam_baselink;
     std::string lCam_topic;
     std::string rCam_topic;
     std::string mCam_topic;
     std::string cmd_topic;
-    Eigen::Vector3d lcam_baselink_transform;
-    Eigen::Vector3d rcam_baselink_transform;
-    Eigen::Vector3d mcam_baselink_transform;
-    std::set<gtsam::Symbol> detectedLandmarksHistoric;
-
-    // Symbol of the pose that currently has a prior
-    gtsam::FastMap<gtsam::Symbol, bool> priorAddedToPose;
 
     // Flag to ensure SAMOptimise is called at the end 
-    bool mCam_data_received_, rCam_data_received_, lCam_data_received_;
     bool optimizationExecuted_;
     double accumulated_time_;  // Accumulated time since last valid data
 
-    // Optimisation type: true for ISAM2, false for SAM
-    bool useisam2;
-
-    // Use keyframe or not
-    bool usekeyframe;
-
     std::ofstream refined_odom_csv;
     std::ofstream raw_odom_csv;
 
-    // Some Heuristic things
-    double jumpTranslationThreshold;
-    double jumpRotationThreshold;
-    double jumpCombinedThreshold;
-    int smoothingStartIndex_;
-    int smoothingwindow;
-    int outlierRemovalStartIndex_;
-    gtsam::Symbol previousframeSymbol;
-    gtsam::Pose2 lastPose_for_jump;
-    bool useoutlierremoval;
-    bool usetrajsmoothing;
+    // Detection latency from the image stamp, to compare node and nodelet transport
+    ros::Publisher arrival_latency_pub_;   // until the detection array reaches cameraCallback
+    ros::Publisher pose_latency_pub_;      // until the pose using it is published
+    double poseLatencySum_ = 0.0;
+    double poseLatencyMax_ = 0.0;
+    long poseLatencyCount_ = 0;
+
+    // Per-stage latency histograms, published as diagnostics and written to metricsFile_ on shutdown
+    StageMetrics metrics_;
+    ros::Publisher metrics_pub_;
+    ros::Timer metrics_timer_;
+    std::string metricsFile_;
+    // Callback and stage timeline in Chrome trace format, written to traceFile_ on shutdown
+    TraceRecorder trace_;
+    std::string traceFile_;
     };
 } 
 
@@ -0,0 +1,34 @@
+#ifndef CHORDAL_INIT_H
+#define CHORDAL_INIT_H
+
+#include <gtsam/nonlinear/NonlinearFactorGraph.h>
+#include <gtsam/nonlinear/Values.h>
+#include <string>
+
+namespace aprilslam {
+
+    struct ChordalInitReport {
+        size_t poses = 0;
+        size_t landmarks = 0;
+        size_t rows = 0;                // weighted linear equations
+        double errorBefore = 0.0;       // graph error at the given / the linear estimate
+        double errorAfter = 0.0;
+        double time = 0.0;              // seconds
+        std::string skipped;            // why no estimate was returned, empty when it was
+    };
+
+    // Globally consistent starting point for a 2D pose / tag graph without iterating, in two
+    // linear least-squares solves. Orientations first: each rotation is relaxed to a free
+    // (cos, sin) pair, which makes odometry, pose priors and the bearing-range observations
+    // (tag = t + R z) all linear, and is then projected back to an angle. Positions second: with
+    // the orientations fixed, pose and tag positions are again linear. Uses the Pose2 between
+    // and prior factors, Point2 priors and the bearing-range factors; other factors are left to
+    // the nonlinear solve. The frame is fixed by a pose prior or by priors on two or more tags
+    // (e.g. a warm start against a previous map); false, with report->skipped set, without one.
+    bool chordalInitialise(const gtsam::NonlinearFactorGraph& graph,
+                           const gtsam::Values& initial,
+                           gtsam::Values& result,
+                           ChordalInitReport* report = nullptr);
+}
+
+#endif
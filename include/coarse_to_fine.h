@@ -0,0 +1,33 @@
+#ifndef COARSE_TO_FINE_H
+#define COARSE_TO_FINE_H
+
+#include <gtsam/nonlinear/NonlinearFactorGraph.h>
+#include <gtsam/nonlinear/Values.h>
+#include <vector>
+
+namespace aprilslam {
+
+    struct CoarseToFineParams {
+        std::vector<int> decimation;    // keep every k-th pose per coarse level, coarsest first (e.g. {16, 4}), empty = off
+        int levelIterations = 0;        // LM iterations per coarse level, 0 = until converged
+    };
+
+    struct CoarseToFineReport {
+        std::vector<size_t> poses;      // poses solved at each level
+        std::vector<double> times;      // seconds per level, including the interpolation
+    };
+
+    // Initial estimate of a calibration graph (poses 'X' in drive order, tags 'L') from solves
+    // of decimated versions of it. At each level every k-th pose is kept, the odometry between
+    // kept poses is composed into one factor and tag observations of dropped poses are moved to
+    // the kept pose before them through the composed odometry. The correction the coarse solve
+    // applies to the kept poses is blended along the dropped poses in between, and the next
+    // level starts from the corrected trajectory. Only large-scale drift is fixed this way, the
+    // full-resolution solve is left to the caller.
+    gtsam::Values coarseToFineInitialise(const gtsam::NonlinearFactorGraph& graph,
+                                         const gtsam::Values& initial,
+                                         const CoarseToFineParams& params,
+                                         CoarseToFineReport* report = nullptr);
+}
+
+#endif
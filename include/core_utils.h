@@ -0,0 +1,76 @@
+#ifndef CORE_UTILS_H
+#define CORE_UTILS_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include <Eigen/Dense>
+#include <gtsam/geometry/Pose2.h>
+#include "se2.h"
+
+// Types and helpers shared by the estimator and the ROS nodes. Nothing in here may depend on ROS,
+// they are part of the aprilslam_core library.
+namespace aprilslam {
+     // Camera 
+    struct CameraInfo {
+        std::string name;
+        std::string topic;
+        std::string frame_id;            // <--- NEW
+        Eigen::Vector3d transform;
+        // Extrinsic preprocessed once at configuration time (see setCameraExtrinsic)
+        Eigen::Matrix2d rotation = Eigen::Matrix2d::Identity();
+        Eigen::Vector2d translation = Eigen::Vector2d::Zero();
+    };
+
+    // Tag detections of all cameras for one step, stored as structure-of-arrays in the base_link frame
+    struct DetectionBatch {
+        std::vector<int> ids;
+        std::vector<int> camera;         // index into camera_infos
+        std::vector<double> x;
+        std::vector<double> y;
+        std::vector<double> bearing;
+        std::vector<double> range;
+        // Number of raw observations merged into each entry; entries with count > 1 carry
+        // their fused (bearing, range) covariance, the others use the default noise model
+        std::vector<int> count;
+        std::vector<double> cov_bb;
+        std::vector<double> cov_br;
+        std::vector<double> cov_rr;
+
+        size_t size() const { return ids.size(); }
+        bool empty() const { return ids.empty(); }
+        void clear();
+        void reserve(size_t n);
+        void resize(size_t n);
+        Eigen::Vector2d tagPos(size_t i) const { return Eigen::Vector2d(x[i], y[i]); }
+        Eigen::Matrix2d covariance(size_t i) const {
+            return (Eigen::Matrix2d() << cov_bb[i], cov_br[i], cov_br[i], cov_rr[i]).finished();
+        }
+    };
+    // Axis-aligned box of (part of) the map
+    struct MapBounds {
+        double xmin = 0.0;
+        double xmax = 0.0;
+        double ymin = 0.0;
+        double ymax = 0.0;
+    };
+    // Box around the landmarks, grown by `margin` on every side
+    MapBounds landmarkBounds(const std::map<int, gtsam::Point2>& landmarks, double margin = 0.0);
+    void saveLandmarksToCSV(const std::map<int, gtsam::Point2>& landmarks, const std::string& filename);
+    std::map<int, gtsam::Point2> loadLandmarksFromCSV(const std::string& filename);
+    void setCameraExtrinsic(CameraInfo& cam, const Eigen::Vector3d& transform);
+    int fuseDuplicateDetections(DetectionBatch& batch, double sigma_bearing, double sigma_range);
+    // Angle in [-pi, pi), see se2::wrapAngle
+    inline double wrapToPi(double angle) { return se2::wrapAngle(angle); }
+    // PoseSE2 in the frame of lastPoseSE2, heading difference wrapped
+    inline gtsam::Pose2 relPoseFG(const gtsam::Pose2& lastPoseSE2, const gtsam::Pose2& PoseSE2) {
+        return se2::toPose2(se2::between(se2::fromPose2(lastPoseSE2), se2::fromPose2(PoseSE2)));
+    }
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef DETECTION_BUFFER_H
+#define DETECTION_BUFFER_H
+
+#include "publishing_utils.h"
+#include <deque>
+#include <vector>
+#include <gtsam/geometry/Pose2.h>
+#include <apriltag_ros/AprilTagDetectionArray.h>
+
+namespace aprilslam {
+
+    // One detection array together with the camera it came from and its header stamp
+    struct StampedDetections {
+        double stamp;
+        int camera;                      // index into camera_infos
+        apriltag_ros::AprilTagDetectionArray::ConstPtr msg;
+    };
+
+    // Short history of raw odometry poses used to look up the robot pose at a detection stamp
+    class OdometryBuffer {
+    public:
+        explicit OdometryBuffer(double horizon = 2.0) : horizon_(horizon) {}
+        void setHorizon(double horizon) { horizon_ = horizon; }
+        void push(double stamp, const gtsam::Pose2& pose);
+        // Linear interpolation between the two bracketing samples, false if the stamp is not covered
+        bool interpolate(double stamp, gtsam::Pose2& pose, double tolerance = 0.05) const;
+        bool empty() const { return buffer_.empty(); }
+        double latestStamp() const { return buffer_.empty() ? 0.0 : buffer_.back().first; }
+    private:
+        std::deque<std::pair<double, gtsam::Pose2>> buffer_;
+        double horizon_;
+    };
+
+    // Per-camera time-ordered queue of detection arrays, every array is handed out exactly once
+    class DetectionBuffer {
+    public:
+        explicit DetectionBuffer(double horizon = 2.0) : horizon_(horizon), latest_(0.0) {}
+        void setHorizon(double horizon) { horizon_ = horizon; }
+        void push(int camera, double stamp, const apriltag_ros::AprilTagDetectionArray::ConstPtr& msg);
+        // Move every array stamped at or before `stamp` into `out`
+        void popUntil(double stamp, std::vector<StampedDetections>& out);
+        size_t size() const;
+    private:
+        std::vector<std::deque<StampedDetections>> queues_;
+        double horizon_;
+        double latest_;
+    };
+
+    // Re-express detections [begin, end) of the batch in a different body frame
+    void transformDetections(DetectionBatch& batch, size_t begin, const gtsam::Pose2& delta);
+
+    // Consume the buffered detections up to `stamp` and express the newest array of each camera
+    // in the body frame of `odomPose`, using the odometry pose interpolated at the array's own
+    // stamp. Older arrays of the same camera are discarded. Returns the number of arrays skipped
+    // because no odometry covered their stamp. `newest_stamp`, if given,
+    // receives the stamp of the newest array used (left untouched when none was).
+    int collectAlignedDetections(DetectionBuffer& detection_buffer,
+                                 const OdometryBuffer& odom_buffer,
+                                 const std::vector<CameraInfo>& camera_infos,
+                                 double stamp,
+                                 const gtsam::Pose2& odomPose,
+                                 DetectionBatch& batch,
+                                 double* newest_stamp = nullptr);
+}
+
+#endif
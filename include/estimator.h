@@ -0,0 +1,260 @@
+#ifndef ESTIMATOR_H
+#define ESTIMATOR_H
+
+#include "chordal_init.h"
+#include "coarse_to_fine.h"
+#include "core_utils.h"
+#include "keyframe_policy.h"
+#include "observation_budget.h"
+#include "odometry_preintegration.h"
+#include "relocalisation_monitor.h"
+#include "stage_metrics.h"
+#include "submap_solver.h"
+#include "trace_recorder.h"
+#include <map>
+#include <set>
+#include <vector>
+#include <Eigen/Dense>
+#include <gtsam/nonlinear/ISAM2.h>
+#include <gtsam/nonlinear/NonlinearFactorGraph.h>
+#include <gtsam/nonlinear/Values.h>
+#include <gtsam/inference/Symbol.h>
+#include <gtsam/linear/NoiseModel.h>
+#include <gtsam/geometry/Pose2.h>
+
+namespace aprilslam {
+
+    namespace detail { struct EstimatorAccess; }
+
+    struct EstimatorOptions {
+        // Noise sigmas: odometry / prior / loop closure on (x, y, theta), bearing-range, landmark prior on (x, y)
+        Eigen::Vector3d odometrySigmas = Eigen::Vector3d(3.0, 30.0, 3.0);
+        Eigen::Vector3d priorSigmas = Eigen::Vector3d(0.1, 0.3, 0.1);
+        Eigen::Vector3d loopClosureSigmas = Eigen::Vector3d(0.5, 5.0, 0.5);
+        Eigen::Vector2d bearingRangeSigmas = Eigen::Vector2d(0.1, 0.8);
+        Eigen::Vector2d pointSigmas = Eigen::Vector2d(0.001, 0.001);
+        double add2graphThreshold = 0.2;            // bearing error gate for re-observed landmarks [rad]
+
+        // Odometry below both thresholds does not create a pose
+        double stationaryPositionThreshold = 0.05;
+        double stationaryRotationThreshold = 0.1;
+
+        // Localisation solves after every keyframe, calibration only builds the graph for optimiseAll()
+        bool incremental = true;
+        bool useIsam2 = false;
+        bool batchOptimisation = true;              // one batch LM solve before the first iSAM2 update
+
+        bool useKeyframe = false;
+        double distanceThreshold = 0.5;
+        double rotationThreshold = 5.0;
+        // Odometry factor between keyframes with a covariance integrated over the segment
+        // instead of the fixed odometrySigmas
+        bool preintegrateOdometry = false;
+        PreintegrationParams preintegration;
+        // With useKeyframe: keyframes chosen by the expected information gain of the map tags in
+        // view (uncertainty grown by the preintegration model) instead of the thresholds
+        bool adaptiveKeyframes = false;
+        KeyframePolicyParams keyframePolicy;
+
+        bool usePriorTagTable = false;              // anchor the landmarks of setPriorMap() with prior factors
+        bool skipUnknownTags = false;               // ignore tags missing from the prior map
+        bool fuseDuplicateDetections = true;
+        ObservationBudgetParams observationBudget;  // most informative detections per pose only
+
+        bool usePruneBySize = false;
+        int maxPoses = 50;
+
+        bool useLoopClosure = false;
+        double historyKeyframeSearchRadius = 3.0;
+        int historyKeyframeSearchNum = 40;
+        int requiredReobservedLandmarks = 3;
+
+        bool useOutlierRemoval = false;
+        double jumpCombinedThreshold = 1.0;
+        int outlierRemovalStartIndex = 20;
+
+        bool useTrajSmoothing = false;
+        int smoothingWindow = 5;
+        int smoothingStartIndex = 20;
+
+        bool useRelocalisation = false;             // needs usePriorTagTable
+        RelocalisationParams relocalisation;
+
+        SubmapParams submaps;                       // optimiseAll() in parallel submaps when maxPoses > 0
+        bool useChordalInit = false;                // linear initial estimate for optimiseAll()
+        CoarseToFineParams coarseToFine;            // decimated solves before optimiseAll() polishes at full resolution
+    };
+
+    // Result of feeding one odometry sample
+    enum class OdometryStep {
+        Stationary,     // below the stationary thresholds, nothing changed
+        Pose,           // new pose propagated by odometry only
+        Keyframe        // new graph node, pass its detections to addDetections()
+    };
+
+    // What happened while a keyframe was processed, for the caller to log and visualise
+    struct KeyframeEvents {
+        int fusedDetections = 0;
+        int budgetDropped = 0;                      // detections left out by the observation budget
+        bool relocalised = false;
+        gtsam::Pose2 anchor;                        // relocalised pose of the keyframe
+        gtsam::Pose2 previousEstimate;              // estimate it replaced
+        bool jumpRejected = false;
+        double jump = 0.0;
+        bool loopClosure = false;
+        int loopClosureKeyframe = 0;                // pose index the keyframe was closed against
+        gtsam::Pose2 loopClosureCurrentPose;
+        gtsam::Pose2 loopClosureKeyframePose;
+        double optimisationTime = -1.0;             // seconds, negative if no solve ran
+    };
+
+    // Tag SLAM back end: graph building, gating, keyframing, pruning, loop closure and
+    // optimisation behind a plain C++ interface. Odometry and detections go in, estimates come
+    // out; publishing, message conversion and threading are left to the caller. Not
+    // thread-safe, the ROS nodes serialise access with their estimate mutex.
+    class Estimator {
+    public:
+        explicit Estimator(const EstimatorOptions& options = EstimatorOptions());
+        const EstimatorOptions& options() const { return options_; }
+
+        // Calibrated tag positions, used as priors and by the relocalisation search
+        void setPriorMap(const std::map<int, gtsam::Point2>& landmarks) { savedLandmarks_ = landmarks; }
+        const std::map<int, gtsam::Point2>& priorMap() const { return savedLandmarks_; }
+        // Prior map that changes while running (LandmarkTileMap): anchors the tags new to the
+        // graph and, in batch mode, drops the priors of tags that left the map and are no longer
+        // observed by any pose in the graph
+        void updatePriorMap(const std::map<int, gtsam::Point2>& landmarks);
+
+        // Map pose of the first graph node, must be set before the first odometry sample
+        void setInitialPose(const gtsam::Pose2& pose0) { pose0_ = pose0; }
+
+        // Feed one raw odometry pose (odom frame). After a Keyframe result the detections of that
+        // keyframe must be passed to addDetections() before the next sample.
+        OdometryStep addOdometry(double stamp, const gtsam::Pose2& odomPose);
+
+        // Detections in the body frame of the pending keyframe. Adds the landmark factors and,
+        // in incremental mode, runs the solver. Fused duplicates are removed from the batch.
+        KeyframeEvents addDetections(DetectionBatch& detections);
+
+        // Batch solve of the whole graph (calibration), replaces the estimates with the result
+        const gtsam::Values& optimiseAll();
+        // Multi-session calibration, before optimiseAll(): solves the session on its own (one LM
+        // solve), moves it and its unary priors into the frame of a previous map using the
+        // optimised positions of the tags both contain and starts the re-observed tags from their
+        // previous positions. With priorSigma > 0 [m] those tags are also tied to the previous map
+        // by priors, which then replace the start pose prior and their first-sighting priors;
+        // optimiseAll() refines from there. Previous tags not seen again stay out of
+        // the solve. False if the session cannot be aligned, it is then left solved in its own frame.
+        bool alignToMap(const std::map<int, gtsam::Point2>& previousMap, const AlignmentParams& params,
+                        double priorSigma, AlignmentResult& result);
+
+        // Drop the graph and restart it at the current pose index from a relocalised pose
+        void reanchor(const gtsam::Pose2& anchor);
+
+        int poseIndex() const { return index_of_pose; }
+        bool keyframePending() const { return pendingKeyframe_; }
+        // Every pose, keyframe or not, as published (X symbols)
+        const gtsam::Values& trajectory() const { return Estimates_visulisation; }
+        // Current working estimates of the graph, landmarks included
+        const gtsam::Values& estimates() const { return keyframeEstimates_; }
+        // Latest landmark estimates by tag id
+        const std::map<int, gtsam::Point2>& landmarks() const { return landmarks_; }
+        bool currentPose(gtsam::Pose2& pose) const;
+
+        // Per-stage timing of every keyframe, off while null
+        void setMetrics(StageMetrics* metrics) { metrics_ = metrics; }
+        // Timeline spans of the same stages with graph size and solver iterations, off while null
+        void setTrace(TraceRecorder* trace) { trace_ = trace; }
+
+        long fusedFactorsSaved() const { return fusedFactorsSaved_; }
+        long budgetDropped() const { return budgetDropped_; }
+        const SubmapReport& submapReport() const { return submapReport_; }
+        const ChordalInitReport& chordalInitReport() const { return chordalInitReport_; }
+        const CoarseToFineReport& coarseToFineReport() const { return coarseToFineReport_; }
+        // LM iterations of the latest monolithic batch solve
+        size_t solverIterations() const { return lastIterations_; }
+        // Expected information gain [nats] of the latest adaptive keyframe decision
+        double lastInformationGain() const { return lastInformationGain_; }
+        int relocalisations() const { return relocalisations_; }
+        const RelocalisationMonitor& relocalisationMonitor() const { return relocMonitor_; }
+
+    private:
+        friend struct detail::EstimatorAccess;  // src/estimator_access.h, benchmarks and tests only
+
+        void initializeGTSAM();
+        void ISAM2Optimise();
+        gtsam::Values SAMOptimise();
+        bool movementExceedsThreshold(const gtsam::Pose2& poseSE2);
+        void initializeFirstPose(const gtsam::Pose2& poseSE2);
+        void addPriorLandmarks();
+        gtsam::Pose2 predictNextPose(const gtsam::Pose2& poseSE2);
+        void updateOdometryPose(const gtsam::Pose2& poseSE2);
+        void generate2bePublished();
+        void updateLandmarks(const gtsam::Values& values);
+        std::set<gtsam::Symbol> updateGraphWithLandmarks(std::set<gtsam::Symbol> detectedLandmarksCurrentPos, const DetectionBatch& detections);
+        bool informativeKeyframe(double stamp, const gtsam::Pose2& predictedPose);
+        void updateKeyframeUncertainty(const gtsam::Pose2& keyframePose);
+        bool shouldAddKeyframe(const gtsam::Pose2& lastPose, const gtsam::Pose2& currentPose, std::set<gtsam::Symbol> oldlandmarks, std::set<gtsam::Symbol> detectedLandmarksCurrentPos);
+        void checkLoopClosure(const std::set<gtsam::Symbol>& detectedLandmarks, KeyframeEvents& events);
+        void pruneGraphByPoseCount(int maxPoses);
+        void smoothTrajectory(int window_size);
+        double computePoseDelta(const gtsam::Pose2& oldPose, const gtsam::Pose2& newPose);
+
+        EstimatorOptions options_;
+        gtsam::noiseModel::Diagonal::shared_ptr odometryNoise;
+        gtsam::noiseModel::Diagonal::shared_ptr priorNoise;
+        gtsam::noiseModel::Diagonal::shared_ptr brNoise;
+        gtsam::noiseModel::Diagonal::shared_ptr pointNoise;
+        gtsam::noiseModel::Diagonal::shared_ptr loopClosureNoise;
+
+        std::map<int, gtsam::Point2> savedLandmarks_;
+        SubmapReport submapReport_;
+        ChordalInitReport chordalInitReport_;
+        CoarseToFineReport coarseToFineReport_;
+        std::map<int, gtsam::Point2> landmarks_;
+        gtsam::Pose2 pose0_;
+
+        gtsam::NonlinearFactorGraph keyframeGraph_;  // Keyframe graph: All keyframes and associated landmarks
+        gtsam::Values keyframeEstimates_;            // Estimates for keyframes
+        gtsam::Values landmarkEstimates;             // for unwhitten error computing
+        gtsam::Values Estimates_visulisation;
+        gtsam::ISAM2 isam_;
+        bool batchPending_;
+        int index_of_pose;
+        gtsam::Pose2 Key_previous_pos;
+        gtsam::Symbol previousKeyframeSymbol;
+        gtsam::Pose2 lastPoseSE2_;
+        gtsam::Pose2 lastPoseSE2_vis;
+        gtsam::Pose2 lastPose_;
+        gtsam::Pose2 lastPose_for_jump;
+        std::set<gtsam::Symbol> detectedLandmarksHistoric;
+        std::map<gtsam::Symbol, std::set<gtsam::Symbol>> poseToLandmarks; // Maps pose index to a set of detected landmark IDs, e.g. X1: L1,L2,L3.
+        gtsam::FastMap<gtsam::Symbol, bool> priorAddedToPose;  // Symbol of the pose that currently has a prior
+
+        // Keyframe opened by addOdometry() and waiting for its detections
+        bool pendingKeyframe_;
+        double pendingStamp_;
+        gtsam::Pose2 pendingOdomPose_;
+        gtsam::Pose2 pendingPredictedPose_;
+
+        OdometryPreintegrator preintegrator_;        // odometry since the latest keyframe
+        gtsam::Pose2 lastIntegratedOdom_;            // raw odometry pose of the latest integrated sample
+        double lastKeyframeStamp_;
+        double lastInformationGain_;
+        Eigen::Matrix3d keyframeCovariance_;         // approximate marginal of the latest keyframe
+        std::set<int> keyframeTags_;                 // map tags in view of the latest keyframe
+
+        long fusedFactorsSaved_;
+        int keyframeBudgetDropped_;                  // by the latest updateGraphWithLandmarks()
+        long budgetDropped_;
+        StageMetrics* metrics_;
+        double gatingTime_;                          // accumulated over one keyframe
+        TraceRecorder* trace_;
+        size_t lastIterations_;                      // of the latest batch solve
+        double lastError_;
+        RelocalisationMonitor relocMonitor_;
+        int relocalisations_;
+    };
+}
+
+#endif
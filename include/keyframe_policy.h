@@ -0,0 +1,42 @@
+#ifndef KEYFRAME_POLICY_H
+#define KEYFRAME_POLICY_H
+
+#include <Eigen/Dense>
+#include <gtsam/geometry/Point2.h>
+#include <gtsam/geometry/Pose2.h>
+#include <map>
+#include <vector>
+
+namespace aprilslam {
+
+    struct KeyframePolicyParams {
+        double minInformationGain = 0.1;    // [nats] expected gain that makes a pose a keyframe
+        double maxRate = 2.0;               // [Hz] most keyframes per second, 0 = unlimited
+        double visibilityRange = 8.0;       // [m] map tags closer than this are expected to be seen
+        double maxDistance = 5.0;           // [m] keyframe anyway after this far without one (no tags in view), 0 = never
+    };
+
+    // Fisher information J^T R^-1 J of bearing-range observations of tags at `tags` (body frame)
+    // on a body-frame perturbation (dx, dy, dtheta); zero without tags
+    Eigen::Matrix3d observationInformation(const std::vector<Eigen::Vector2d>& tags,
+                                           const Eigen::Vector2d& bearingRangeSigmas);
+
+    // Expected information gain of observations carrying `information` about a pose currently
+    // known up to `poseCovariance` (robot frame): the mutual information
+    // 0.5 log det(I + Sigma J^T R^-1 J). Grows with the pose uncertainty, with the number of tags
+    // and with how well their bearings spread around the robot.
+    double expectedInformationGain(const Eigen::Matrix3d& poseCovariance, const Eigen::Matrix3d& information);
+
+    // Covariance of that pose once the observations are added, (I + Sigma J^T R^-1 J)^-1 Sigma
+    Eigen::Matrix3d observedCovariance(const Eigen::Matrix3d& poseCovariance, const Eigen::Matrix3d& information);
+
+    // Covariance of a pose `delta` ahead of a keyframe known up to `keyframeCovariance`, with
+    // `segmentCovariance` the odometry uncertainty in between (both in their own robot frame)
+    Eigen::Matrix3d propagateCovariance(const Eigen::Matrix3d& keyframeCovariance, const gtsam::Pose2& delta,
+                                        const Eigen::Matrix3d& segmentCovariance);
+
+    // Map tags within `range` of a pose by id, in its body frame
+    std::map<int, Eigen::Vector2d> visibleTags(const gtsam::Pose2& pose, const std::map<int, gtsam::Point2>& landmarks, double range);
+}
+
+#endif
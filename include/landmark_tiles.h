@@ -0,0 +1,90 @@
+#ifndef LANDMARK_TILES_H
+#define LANDMARK_TILES_H
+
+#include "core_utils.h"
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <gtsam/geometry/Point2.h>
+
+namespace aprilslam {
+
+    struct TileParams {
+        double loadRadius = 30.0;   // tiles closer than this [m] to the robot are loaded
+        double evictRadius = 45.0;  // loaded tiles further than this [m] are dropped (hysteresis)
+        size_t maxTiles = 16;       // upper bound on loaded tiles, least recently used go first
+    };
+
+    // Landmarks added to and removed from the active map by one update
+    struct TileChange {
+        std::vector<int> loaded;
+        std::vector<int> evicted;
+        bool empty() const { return loaded.empty() && evicted.empty(); }
+    };
+
+    // Prior tag map split into spatial tiles on disk, of which only the neighbourhood of the
+    // robot is kept in memory. A tile directory holds one landmark CSV per tile (same format as
+    // saveLandmarksToCSV) and an index.csv with the bounding box and id range of every tile, so
+    // tiles may be grid cells or hand-made (e.g. one per polytunnel). Only the index is read
+    // when the map is opened.
+    class LandmarkTileMap {
+    public:
+        explicit LandmarkTileMap(const TileParams& params = TileParams());
+        void setParams(const TileParams& params) { params_ = params; }
+        const TileParams& params() const { return params_; }
+
+        // Reads index.csv of the directory, nothing is loaded yet
+        bool open(const std::string& directory);
+        bool isOpen() const { return !tiles_.empty(); }
+
+        // Loads the tiles within loadRadius of (x, y) and evicts those beyond evictRadius or
+        // above maxTiles. When more than maxTiles tiles are within loadRadius only the nearest
+        // maxTiles are loaded, so they are not evicted and read again on the next update.
+        // Returns true if the active map changed.
+        bool update(double x, double y, TileChange* change = nullptr);
+        // Loads the tile holding `id` when its position is not known yet (initialisation). Every
+        // tile read for the search is remembered by its ids, so no tile is read twice to find a
+        // tag and ids in no tile are not searched again.
+        bool loadTileWithTag(int id, TileChange* change = nullptr);
+
+        // Landmarks of the loaded tiles
+        const std::map<int, gtsam::Point2>& active() const { return active_; }
+        MapBounds bounds() const { return bounds_; }
+        size_t tileCount() const { return tiles_.size(); }
+        size_t loadedTiles() const;
+        size_t loadedLandmarks() const { return active_.size(); }
+
+    private:
+        struct Tile {
+            std::string file;
+            MapBounds box;
+            int minId;
+            int maxId;
+            bool loaded = false;
+            bool indexed = false;      // its ids are in tileOfId_
+            unsigned long lastUsed = 0;
+            std::vector<int> ids;      // ids of the loaded landmarks, to evict them again
+        };
+
+        double distance(const Tile& tile, double x, double y) const;
+        bool load(Tile& tile, TileChange* change);
+        void evict(Tile& tile, TileChange* change);
+
+        TileParams params_;
+        std::string directory_;
+        std::vector<Tile> tiles_;
+        std::map<int, gtsam::Point2> active_;
+        std::map<int, size_t> tileOfId_;   // id -> tile, filled as tiles are read
+        std::set<int> missingIds_;         // ids found in no tile
+        MapBounds bounds_;
+        unsigned long clock_;
+        bool warnedOverBudget_;
+    };
+
+    // Splits a landmark map into square tiles of `tileSize` metres and writes them with their
+    // index to `directory` (which must exist)
+    bool writeLandmarkTiles(const std::map<int, gtsam::Point2>& landmarks, const std::string& directory, double tileSize);
+}
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef OBSERVATION_BUDGET_H
+#define OBSERVATION_BUDGET_H
+
+#include "core_utils.h"
+#include <Eigen/Dense>
+#include <vector>
+
+namespace aprilslam {
+
+    struct ObservationBudgetParams {
+        int maxObservations = 0;        // bearing-range factors per pose, 0 = all detections
+        double estimatedTagSigma = 0.5; // [m] position uncertainty of a tag only estimated from earlier observations
+    };
+
+    // Greedy choice of the `budget` detections that add the most information on the pose: each
+    // step takes the detection with the largest log det gain of the pose information matrix,
+    // starting from `poseInformation`. A detection's bearing-range noise is inflated by the
+    // uncertainty of its tag (tagSigmas, isotropic), so distant detections, whose bearings say
+    // little about the position, uncertain tags and tags at bearings already covered rank low.
+    // Detections flagged in `firstSightings` tell nothing about the pose but are the only way a
+    // tag enters the graph: they are always kept and the budget applies to the others only.
+    // Returns one flag per detection; all true when the re-observations fit the budget.
+    std::vector<bool> selectInformativeObservations(const DetectionBatch& detections,
+                                                    const std::vector<double>& tagSigmas,
+                                                    const Eigen::Vector2d& bearingRangeSigmas,
+                                                    const Eigen::Matrix3d& poseInformation,
+                                                    int budget,
+                                                    const std::vector<bool>& firstSightings = std::vector<bool>());
+}
+
+#endif
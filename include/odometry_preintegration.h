@@ -0,0 +1,52 @@
+#ifndef ODOMETRY_PREINTEGRATION_H
+#define ODOMETRY_PREINTEGRATION_H
+
+#include <Eigen/Dense>
+#include <gtsam/geometry/Pose2.h>
+#include <gtsam/linear/NoiseModel.h>
+
+namespace aprilslam {
+
+    struct PreintegrationParams {
+        // Sigma growth of (x, y, theta) in the robot frame per square-root metre travelled, and
+        // of theta per square-root radian turned (random walk: variances add up along the segment)
+        Eigen::Vector3d sigmasPerMetre = Eigen::Vector3d(0.05, 0.05, 0.01);
+        double thetaSigmaPerRadian = 0.05;
+        Eigen::Vector3d minSigmas = Eigen::Vector3d(0.01, 0.01, 0.005);   // floor for short segments
+        double maxPositionSigma = 0.0;      // [m] a segment this uncertain forces a keyframe, 0 = off
+    };
+
+    // Odometry between two keyframes integrated into one relative pose with its covariance.
+    // Every increment is composed onto the segment and its noise is propagated to the segment
+    // end: Sigma <- Ad(u^-1) Sigma Ad(u^-1)^T + Q(u), in the tangent space of the end pose as
+    // GTSAM's BetweenFactor<Pose2> expects.
+    class OdometryPreintegrator {
+    public:
+        explicit OdometryPreintegrator(const PreintegrationParams& params = PreintegrationParams());
+        void setParams(const PreintegrationParams& params) { params_ = params; }
+
+        // Starts a new segment at the current keyframe
+        void reset();
+        // Odometry increment in the frame of the previous sample
+        void integrate(const gtsam::Pose2& increment);
+
+        const gtsam::Pose2& delta() const { return delta_; }
+        // Covariance of delta(), including the minSigmas floor
+        Eigen::Matrix3d covariance() const;
+        gtsam::SharedNoiseModel noiseModel() const;
+        // Largest position sigma of the segment [m]
+        double positionSigma() const;
+        bool exceedsUncertainty() const;
+        double distance() const { return distance_; }
+        int steps() const { return steps_; }
+
+    private:
+        PreintegrationParams params_;
+        gtsam::Pose2 delta_;
+        Eigen::Matrix3d covariance_;
+        double distance_;
+        int steps_;
+    };
+}
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef PARTICLE_FILTER_H
+#define PARTICLE_FILTER_H
+
+#include "core_utils.h"
+#include <vector>
+#include <map>
+#include <random>
+#include <cstdint>
+#include <Eigen/Dense>
+#include <gtsam/geometry/Pose2.h>
+
+namespace aprilslam {
+
+    // Particles stored as structure-of-arrays so the per-particle loops stay contiguous
+    struct ParticleSet {
+        std::vector<double> x;
+        std::vector<double> y;
+        std::vector<double> theta;
+        std::vector<double> w;
+
+        size_t size() const { return x.size(); }
+        bool empty() const { return x.empty(); }
+        void resize(size_t n);
+        void clear();
+        Eigen::Vector3d particle(size_t i) const { return Eigen::Vector3d(x[i], y[i], theta[i]); }
+    };
+
+    struct PFParams {
+        double rngVar = 0.2;        // range measurement variance
+        double brngVar = 0.1;       // bearing measurement variance
+        double sigmaPos = 0.05;     // diffusion per step on x, y [m]
+        double sigmaTheta = 0.02;   // diffusion per step on heading [rad]
+        double motionNoise = 0.1;   // extra noise as a fraction of the odometry motion of a step
+        int threads = 1;            // 0 uses all hardware threads
+        std::uint64_t seed = 0;     // 0 seeds from std::random_device
+        double essThreshold = 0.5;  // resample when ESS drops below this fraction of N
+        // KLD-sampling: enough particles that the K-L error of the binned posterior stays below
+        // kldEpsilon with probability given by the normal quantile kldZ
+        double kldEpsilon = 0.05;
+        double kldZ = 2.33;
+        double binSize = 0.5;       // histogram bin on x, y [m]
+        double binTheta = 0.2;      // histogram bin on heading [rad]
+        size_t minParticles = 500;
+        size_t maxParticles = 100000;
+    };
+
+    // Bootstrap particle filter used for the global pose initialisation. Prediction and
+    // weighting run over fixed blocks of particles, each block drawing from its own RNG
+    // stream seeded from (seed, iteration, block), so results do not depend on the
+    // number of threads.
+    class ParticleFilter {
+    public:
+        static constexpr size_t kBlockSize = 4096;
+
+        explicit ParticleFilter(const PFParams& params = PFParams());
+        void setParams(const PFParams& params);
+        const PFParams& params() const { return params_; }
+
+        void setParticles(const ParticleSet& particles);
+        const ParticleSet& particles() const { return particles_; }
+        size_t size() const { return particles_.size(); }
+        bool empty() const { return particles_.empty(); }
+        void clear();
+
+        // One predict / weight / resample iteration against tags with known map positions.
+        // `motion` is the odometry since the previous step (robot frame), applied to every particle.
+        void step(const std::vector<int>& Id,
+                  const std::vector<Eigen::Vector2d>& tagPos,
+                  const std::map<int, gtsam::Point2>& savedLandmarks,
+                  const gtsam::Pose2& motion = gtsam::Pose2());
+
+        // Weighted mean position and circular mean heading of the particle set
+        Eigen::Vector3d mean() const;
+
+        // Weighted covariance of (x, y, theta), heading residuals taken about the circular mean
+        Eigen::Matrix3d covariance() const;
+
+        // Effective sample size 1 / sum(w^2) of the normalised weights
+        double effectiveSampleSize() const;
+
+        // Particle count needed for `bins` occupied histogram bins, clamped to [minParticles, maxParticles]
+        size_t kldSampleCount(size_t bins) const;
+
+        // Deterministic RNG stream for a block of a given iteration
+        std::mt19937_64 stream(std::uint64_t block) const;
+
+    private:
+        void predictAndWeight(size_t begin, size_t end, std::mt19937_64& gen, const gtsam::Pose2& motion,
+                              const std::vector<double>& lx, const std::vector<double>& ly,
+                              const std::vector<double>& zr, const std::vector<double>& zb);
+        void normalise();
+        size_t occupiedBins(const std::vector<double>& cumsum, size_t draws) const;
+        void resample();
+
+        PFParams params_;
+        ParticleSet particles_;
+        ParticleSet scratch_;
+        std::vector<double> cumsum_;
+        std::uint64_t seed_;
+        std::uint64_t iteration_;
+        // Constants precomputed from params_
+        double invRngVar_;
+        double invBrngVar_;
+    };
+
+    // Position and heading std the filter settles at while a tag stays in view: the fixed point
+    // P = (P + q) m / (P + q + m) of diffusion q and one tag's range / bearing variance m. More
+    // tags only tighten it, so convergence thresholds derived from it can be met.
+    Eigen::Vector2d steadyStateStd(const PFParams& params);
+
+    // Grid of Ninit particles over the area (e.g. LandmarkTileMap::bounds()), random headings
+    ParticleSet initParticles(int Ninit, const MapBounds& area);
+    ParticleSet initParticlesFromFirstTag(
+        const std::vector<int>& Id,
+        const std::vector<Eigen::Vector2d>& tagPos,
+        const std::map<int, gtsam::Point2>& savedLandmarks,
+        int Ninit);
+}
+
+#endif
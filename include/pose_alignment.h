@@ -0,0 +1,40 @@
+#ifndef POSE_ALIGNMENT_H
+#define POSE_ALIGNMENT_H
+
+#include <vector>
+#include <map>
+#include <Eigen/Dense>
+#include <gtsam/geometry/Pose2.h>
+
+namespace aprilslam {
+
+    struct AlignmentParams {
+        double inlierThreshold = 0.3;   // map-frame residual [m] for a tag to count as an inlier
+        int minInliers = 2;             // tags that must agree on the pose
+        double minBaseline = 0.3;       // shortest map distance [m] between the two tags of a hypothesis
+        int maxIterations = 200;        // pair hypotheses tried; all pairs are tried when there are fewer
+        unsigned int seed = 0;          // 0 seeds from std::random_device
+    };
+
+    struct AlignmentResult {
+        gtsam::Pose2 pose;              // base_link pose in the map frame
+        std::vector<int> inliers;       // indices into the input observations
+        double rmse = 0.0;              // map-frame residual over the inliers [m]
+    };
+
+    // Least-squares 2D rigid transform (rotation + translation, no scale) taking the body-frame
+    // points onto the map points. Returns false if fewer than two points are given.
+    bool rigidAlign2D(const std::vector<Eigen::Vector2d>& body,
+                      const std::vector<Eigen::Vector2d>& map,
+                      gtsam::Pose2& pose);
+
+    // Closed-form robot pose from tags with known map positions. Two-tag hypotheses are scored
+    // by their inliers (RANSAC), and the best consensus set is refitted in least squares.
+    bool alignTagsToMap(const std::vector<int>& Id,
+                        const std::vector<Eigen::Vector2d>& tagPos,
+                        const std::map<int, gtsam::Point2>& savedLandmarks,
+                        const AlignmentParams& params,
+                        AlignmentResult& result);
+}
+
+#endif
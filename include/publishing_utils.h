@@ -1,6 +1,8 @@
 #ifndef PUBLISHING_UTILS_H
 #define PUBLISHING_UTILS_H
 
+#include "core_utils.h"
+#include "stage_metrics.h"
 #include <visualization_msgs/MarkerArray.h>
 #include <nav_msgs/Path.h>
 #include <map>
@@ -18,21 +20,16 @@
 #include <cmath>
 #include <geometry_msgs/Pose.h>
 #include <geometry_msgs/PoseArray.h>
+#include <geometry_msgs/PoseWithCovarianceStamped.h>
 #include <std_msgs/Header.h>
 #include <nav_msgs/Odometry.h>
 #include <geometry_msgs/TransformStamped.h>
 #include <tf2_ros/transform_broadcaster.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
 #include <random>
 #include <algorithm>
 
 namespace aprilslam {
-     // Camera 
-    struct CameraInfo {
-        std::string name;
-        std::string topic;
-        std::string frame_id;            // <--- NEW
-        Eigen::Vector3d transform;
-    };
     void visualizeLoopClosure(ros::Publisher& lc_pub, const gtsam::Pose2& currentPose, const gtsam::Pose2& keyframePose, int currentPoseIndex, const std::string& frame_id);
     void publishMapToOdomTF(tf2_ros::TransformBroadcaster& tf_broadcaster, 
                             const gtsam::Values& result, int latest_index, 
@@ -47,29 +44,16 @@ namespace aprilslam {
                         const ros::Time& stamp);
     void publishLandmarks(ros::Publisher& landmark_pub, const std::map<int, gtsam::Point2>& landmarks, const std::string& frame_id);
     void publishPath(ros::Publisher& path_pub, const gtsam::Values& result, int max_index, const std::string& frame_id);
-    void saveLandmarksToCSV(const std::map<int, gtsam::Point2>& landmarks, const std::string& filename);
-    std::map<int, gtsam::Point2> loadLandmarksFromCSV(const std::string& filename);
+    void publishPoseWithCovariance(ros::Publisher& pub, const Eigen::Vector3d& pose, const Eigen::Matrix3d& cov, const std::string& frame_id);
+    // One DiagnosticStatus per pipeline stage with its count and latency percentiles in ms
+    void publishMetrics(ros::Publisher& pub, const StageMetrics& metrics, const std::string& node_name);
     void processDetections(const apriltag_ros::AprilTagDetectionArray::ConstPtr& cam_msg, 
-        const Eigen::Vector3d& xyTrans_cam_baselink, 
-        std::vector<int>& Ids, 
-        std::vector<Eigen::Vector2d>& tagPoss);
-    std::pair<std::vector<int>, std::vector<Eigen::Vector2d>> getCamDetections(const std::vector<CameraInfo>& camera_infos,
-                 const std::map<std::string, apriltag_ros::AprilTagDetectionArray::ConstPtr>& camera_detections);
-    std::vector<Eigen::Vector3d> initParticles(int Ninit);
-    std::vector<Eigen::Vector3d> particleFilter(const std::vector<int>& Id,
-        const std::vector<Eigen::Vector2d>& tagPos,
-        const std::map<int, gtsam::Point2>& savedLandmarks,
-        std::vector<Eigen::Vector3d>& x_P,
-        int N,
-        double rngVar,
-        double brngVar);
-    std::vector<Eigen::Vector3d> initParticlesFromFirstTag(
-        const std::vector<int>& Id,
-        const std::vector<Eigen::Vector2d>& tagPos,
-        const std::map<int, gtsam::Point2>& savedLandmarks,
-        int Ninit);
-    double wrapToPi(double angle);
-    gtsam::Pose2 relPoseFG(const gtsam::Pose2& lastPoseSE2, const gtsam::Pose2& PoseSE2);
+        const CameraInfo& cam,
+        int camera_index,
+        DetectionBatch& batch);
+    void getCamDetections(const std::vector<CameraInfo>& camera_infos,
+                 const std::map<std::string, apriltag_ros::AprilTagDetectionArray::ConstPtr>& camera_detections,
+                 DetectionBatch& batch);
 }
 
 #endif
@@ -0,0 +1,64 @@
+#ifndef RELOCALISATION_MONITOR_H
+#define RELOCALISATION_MONITOR_H
+
+#include "core_utils.h"
+#include "pose_alignment.h"
+#include <deque>
+#include <vector>
+#include <map>
+#include <gtsam/geometry/Pose2.h>
+
+namespace aprilslam {
+
+    struct RelocalisationParams {
+        double residualThreshold = 1.0; // median map-frame tag residual [m] counted as disagreement
+        int triggerCount = 5;           // consecutive disagreeing keyframes before a global search
+        int window = 10;                // keyframes of observations stacked for the search
+        double minCorrection = 0.5;     // re-anchor only if the found pose is at least this far [m] off
+        double minHeadingCorrection = 0.2; // ... or its heading at least this far [rad] off
+        AlignmentParams alignment;
+    };
+
+    // Watches the agreement between the prior map tags and the current estimate. After a
+    // sustained disagreement it searches the map for the pose that explains the tags of the
+    // last few keyframes (stacked through odometry), independently of the current estimate.
+    class RelocalisationMonitor {
+    public:
+        explicit RelocalisationMonitor(const RelocalisationParams& params = RelocalisationParams());
+        void setParams(const RelocalisationParams& params) { params_ = params; }
+        const RelocalisationParams& params() const { return params_; }
+
+        // Feed one keyframe: raw odometry pose, current map estimate and the detections in its
+        // body frame. Returns true and sets `anchor` to the map pose of this keyframe when the
+        // graph should be re-anchored.
+        bool update(double stamp,
+                    const gtsam::Pose2& odomPose,
+                    const gtsam::Pose2& estimate,
+                    const DetectionBatch& detections,
+                    const std::map<int, gtsam::Point2>& savedLandmarks,
+                    gtsam::Pose2& anchor);
+        void reset();
+
+        double lastResidual() const { return lastResidual_; }
+        int disagreeingKeyframes() const { return count_; }
+        double disagreementStart() const { return since_; }  // stamp of the first disagreeing keyframe
+        const AlignmentResult& lastSearch() const { return lastSearch_; }
+
+    private:
+        struct Frame {
+            gtsam::Pose2 odom;
+            std::vector<int> ids;
+            std::vector<Eigen::Vector2d> tagPos;
+        };
+
+        RelocalisationParams params_;
+        std::deque<Frame> frames_;
+        std::vector<double> residuals_;
+        AlignmentResult lastSearch_;
+        int count_;
+        double since_;
+        double lastResidual_;
+    };
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "publishing_utils.h"
+#include <functional>
+#include <string>
+#include <vector>
+#include <nav_msgs/Odometry.h>
+#include <tf2_ros/buffer.h>
+#include <apriltag_ros/AprilTagDetectionArray.h>
+
+namespace aprilslam {
+
+    // One recorded message: odometry, or the tag detections of one camera
+    struct ReplayMessage {
+        double stamp;                    // header stamp, the replay clock
+        std::string camera;              // camera name, empty for odometry
+        nav_msgs::Odometry::ConstPtr odom;
+        apriltag_ros::AprilTagDetectionArray::ConstPtr detections;
+    };
+
+    struct ReplayStats {
+        size_t messages = 0;
+        double dataDuration = 0.0;       // stamp span of the replayed data [s]
+        double wallTime = 0.0;           // time the replay took [s]
+    };
+
+    // Odometry and camera detection topics of a bag, sorted by header stamp
+    bool loadReplayBag(const std::string& path,
+                       const std::string& odom_topic,
+                       const std::vector<CameraInfo>& camera_infos,
+                       std::vector<ReplayMessage>& messages);
+
+    // Every transform on /tf_static of a bag, added to `buffer` as static so the camera extrinsics
+    // resolve without a live TF tree. Returns the number of transforms read.
+    size_t loadBagStaticTransforms(const std::string& path, tf2_ros::Buffer& buffer);
+
+    // CSV recordings, sorted by stamp. Odometry as time,x,y,z,heading (degrees, see bags/get_tra.py);
+    // detections as time,camera,id,x,y,z with the tag position in the camera optical frame, rows
+    // sharing time and camera form one detection array.
+    bool loadReplayCSV(const std::string& odom_csv,
+                       const std::string& detections_csv,
+                       std::vector<ReplayMessage>& messages);
+
+    // Hand every message to `dispatch` as fast as possible. ros::Time::now() is set to each
+    // message stamp first, so all timing in the estimator follows the recording. `tick` stands
+    // in for ROS timers and is called every `tick_period` seconds of recorded time.
+    ReplayStats runReplay(const std::vector<ReplayMessage>& messages,
+                          const std::function<void(const ReplayMessage&)>& dispatch,
+                          double tick_period = 0.0,
+                          const std::function<void()>& tick = std::function<void()>());
+}
+
+#endif
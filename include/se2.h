@@ -0,0 +1,156 @@
+#ifndef SE2_H
+#define SE2_H
+
+#include <cmath>
+#include <cstddef>
+#include <gtsam/geometry/Pose2.h>
+
+// Inlined SE(2) kernels for the per-odometry, per-detection and per-particle paths. Poses are
+// plain (x, y, theta) triples; every function does one sincos at most and no allocation.
+// Results match gtsam::Pose2 (between, compose, transformTo/From, bearing, range) to rounding.
+namespace aprilslam {
+namespace se2 {
+
+    constexpr double kPi = 3.14159265358979323846;
+    constexpr double kTwoPi = 2.0 * kPi;
+
+    // Wrap to [-pi, pi). Angles already in range return unchanged, others are reduced by a whole
+    // number of turns (correct for negative angles as well). NaN and infinities give NaN.
+    constexpr double wrapAngle(double angle) {
+        if (angle >= -kPi && angle < kPi) return angle;
+        if (!(angle - angle == 0.0)) return angle - angle;
+        const double turns = (angle + kPi) / kTwoPi;
+        // Beyond 2^62 turns the spacing of doubles exceeds a turn, no heading is left
+        if (turns >= 4.6e18 || turns <= -4.6e18) return 0.0;
+        long long k = static_cast<long long>(turns);
+        if (static_cast<double>(k) > turns) --k;   // floor for negative turns
+        double wrapped = angle - kTwoPi * static_cast<double>(k);
+        // Rounding can land one ulp outside the interval
+        if (wrapped >= kPi) wrapped -= kTwoPi;
+        if (wrapped < -kPi) wrapped += kTwoPi;
+        return wrapped;
+    }
+
+    // Same result without branches, for loops the compiler should vectorise
+    inline double wrapAngleBranchless(double angle) {
+        return angle - kTwoPi * std::floor((angle + kPi) / kTwoPi);
+    }
+
+    struct SinCos {
+        double s;
+        double c;
+    };
+
+    // One libm call for both, instead of relying on the compiler to fuse sin and cos
+    inline SinCos sinCos(double angle) {
+        SinCos r;
+#if defined(__GNUC__)
+        __builtin_sincos(angle, &r.s, &r.c);
+#else
+        r.s = std::sin(angle);
+        r.c = std::cos(angle);
+#endif
+        return r;
+    }
+
+    struct Pose {
+        double x;
+        double y;
+        double theta;
+    };
+
+    inline Pose fromPose2(const gtsam::Pose2& pose) { return {pose.x(), pose.y(), pose.theta()}; }
+    inline gtsam::Pose2 toPose2(const Pose& pose) { return gtsam::Pose2(pose.x, pose.y, pose.theta); }
+
+    // Pose with its heading sine and cosine cached, for transforming many points from one pose
+    struct Frame {
+        double x;
+        double y;
+        double theta;
+        double s;
+        double c;
+
+        explicit Frame(const Pose& pose) : x(pose.x), y(pose.y), theta(pose.theta) {
+            const SinCos sc = sinCos(pose.theta);
+            s = sc.s;
+            c = sc.c;
+        }
+        explicit Frame(const gtsam::Pose2& pose) : Frame(fromPose2(pose)) {}
+
+        // Body-frame point into the world frame (Pose2::transformFrom)
+        void transformFrom(double bx, double by, double& wx, double& wy) const {
+            wx = x + c * bx - s * by;
+            wy = y + s * bx + c * by;
+        }
+        // World-frame point into the body frame (Pose2::transformTo)
+        void transformTo(double wx, double wy, double& bx, double& by) const {
+            const double dx = wx - x;
+            const double dy = wy - y;
+            bx = c * dx + s * dy;
+            by = -s * dx + c * dy;
+        }
+        // Bearing of a world-frame point seen from this pose, wrapped (Pose2::bearing)
+        double bearingTo(double wx, double wy) const {
+            double bx, by;
+            transformTo(wx, wy, bx, by);
+            return std::atan2(by, bx);
+        }
+        // Signed offset of a world-frame point perpendicular to the heading
+        double lateralOffset(double wx, double wy) const {
+            return -s * (wx - x) + c * (wy - y);
+        }
+    };
+
+    // b in the frame of a with the heading difference wrapped (Pose2::between)
+    inline Pose between(const Pose& a, const Pose& b) {
+        const SinCos sc = sinCos(a.theta);
+        const double dx = b.x - a.x;
+        const double dy = b.y - a.y;
+        return {sc.c * dx + sc.s * dy, -sc.s * dx + sc.c * dy, wrapAngle(b.theta - a.theta)};
+    }
+
+    // d applied in the frame of a (Pose2::compose)
+    inline Pose compose(const Pose& a, const Pose& d) {
+        const SinCos sc = sinCos(a.theta);
+        return {a.x + sc.c * d.x - sc.s * d.y, a.y + sc.s * d.x + sc.c * d.y, wrapAngle(a.theta + d.theta)};
+    }
+
+    // Movement test without the square root: true if the position changed by at least
+    // `distance` or the heading by at least `angle`
+    inline bool movedAtLeast(const Pose& a, const Pose& b, double distance, double angle) {
+        const double dx = b.x - a.x;
+        const double dy = b.y - a.y;
+        return dx * dx + dy * dy >= distance * distance || std::abs(wrapAngle(b.theta - a.theta)) >= angle;
+    }
+
+    // Batch variants over contiguous arrays (structure of arrays, as DetectionBatch and
+    // ParticleSet store them). Output arrays may alias the inputs.
+
+    // Body-frame points into the frame of `pose`
+    inline void transformFrom(const Frame& pose, const double* bx, const double* by, double* wx, double* wy, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            const double px = bx[i];
+            const double py = by[i];
+            wx[i] = pose.x + pose.c * px - pose.s * py;
+            wy[i] = pose.y + pose.s * px + pose.c * py;
+        }
+    }
+
+    // Bearing and range of points relative to the origin
+    inline void bearingRange(const double* x, const double* y, double* bearing, double* range, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            range[i] = std::sqrt(x[i] * x[i] + y[i] * y[i]);
+            bearing[i] = std::atan2(y[i], x[i]);
+        }
+    }
+
+    // Wrap every angle to [-pi, pi)
+    inline void wrapAngles(double* angle, size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            angle[i] = wrapAngleBranchless(angle[i]);
+        }
+    }
+}
+}
+
+#endif
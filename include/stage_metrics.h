@@ -0,0 +1,99 @@
+#ifndef STAGE_METRICS_H
+#define STAGE_METRICS_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace aprilslam {
+
+    // Fixed-size log-linear latency histogram: kSubBuckets buckets per power of two of microseconds,
+    // from 1 us up to about an hour. Recording is a frexp and an increment, percentiles are
+    // reported at the upper edge of their bucket (within 1/kSubBuckets of the true value).
+    class LatencyHistogram {
+    public:
+        static constexpr int kSubBuckets = 8;
+        static constexpr int kOctaves = 32;
+
+        LatencyHistogram() { reset(); }
+        void record(double seconds);
+        void reset();
+
+        std::uint64_t count() const { return count_; }
+        double mean() const { return count_ ? sum_ / count_ : 0.0; }
+        double max() const { return max_; }
+        // Smallest bucket edge below which a fraction q of the samples lie, in seconds
+        double percentile(double q) const;
+
+    private:
+        std::array<std::uint64_t, kSubBuckets * kOctaves> buckets_;
+        std::uint64_t count_;
+        double sum_;
+        double max_;
+    };
+
+    // Per-keyframe stages of the estimation pipeline
+    enum class Stage {
+        DetectionGathering,
+        Gating,
+        GraphUpdate,
+        Relocalisation,
+        Solve,
+        Pruning,
+        LoopClosure,
+        Smoothing,
+        Publishing,
+        Logging,
+        Count
+    };
+    const char* stageName(Stage stage);
+
+    class StageMetrics {
+    public:
+        static constexpr size_t kStages = static_cast<size_t>(Stage::Count);
+
+        void record(Stage stage, double seconds) { stages_[static_cast<size_t>(stage)].record(seconds); }
+        const LatencyHistogram& histogram(Stage stage) const { return stages_[static_cast<size_t>(stage)]; }
+        void reset();
+        // One row per stage: stage,count,mean_ms,p50_ms,p95_ms,p99_ms,max_ms
+        bool writeCSV(const std::string& filename) const;
+
+    private:
+        std::array<LatencyHistogram, kStages> stages_;
+    };
+
+    // Wall-clock seconds since construction or the previous lap()
+    class Stopwatch {
+    public:
+        Stopwatch() : start_(std::chrono::steady_clock::now()) {}
+        double elapsed() const { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count(); }
+        double lap() {
+            auto now = std::chrono::steady_clock::now();
+            double seconds = std::chrono::duration<double>(now - start_).count();
+            start_ = now;
+            return seconds;
+        }
+    private:
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    // Records the time until destruction (or stop()) into a stage, no-op without metrics
+    class StageTimer {
+    public:
+        StageTimer(StageMetrics* metrics, Stage stage) : metrics_(metrics), stage_(stage) {}
+        ~StageTimer() { stop(); }
+        double stop() {
+            double seconds = watch_.elapsed();
+            if (metrics_) metrics_->record(stage_, seconds);
+            metrics_ = nullptr;
+            return seconds;
+        }
+    private:
+        StageMetrics* metrics_;
+        Stage stage_;
+        Stopwatch watch_;
+    };
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef SUBMAP_SOLVER_H
+#define SUBMAP_SOLVER_H
+
+#include <gtsam/nonlinear/NonlinearFactorGraph.h>
+#include <gtsam/nonlinear/Values.h>
+
+namespace aprilslam {
+
+    struct SubmapParams {
+        int maxPoses = 0;               // most poses per submap, 0 solves the graph in one piece
+        int minPoses = 30;              // a submap is not closed at a row end before this many poses
+        double turnAngle = 2.5;         // heading change [rad] since the submap start that marks a row end
+        int threads = 0;                // parallel submap solves, 0 = hardware concurrency
+        double separatorSigma = 0.05;   // [m] trust in a submap's tag position when merging
+        int refineIterations = 2;       // full-graph LM iterations from the merged estimate, 0 = none
+    };
+
+    struct SubmapReport {
+        int submaps = 0;
+        int separatorTags = 0;          // tags seen by more than one submap
+        int crossFactors = 0;           // odometry factors joining consecutive submaps
+        int ignoredFactors = 0;         // other factors spanning submaps, only seen by the refinement
+        int failedSolves = 0;           // submap, separator or refinement solves that threw, their input was kept
+        double solveTime = 0.0;         // seconds, parallel submap solves
+        double mergeTime = 0.0;         // seconds, separator problem
+        double refineTime = 0.0;        // seconds, full-graph refinement
+    };
+
+    // Divide-and-conquer batch solve of a calibration graph (poses 'X', tags 'L'). The drive is
+    // cut into submaps of consecutive poses, at row ends (a turn of turnAngle) or after maxPoses.
+    // Submaps are solved independently on a thread pool, each in its own gauge. The separator
+    // problem then estimates one rigid transform per submap together with the tags shared
+    // between submaps, from the tag positions each submap found and the odometry across the
+    // cuts. A few LM iterations on the full graph from the merged estimate remove what the
+    // separator approximation leaves.
+    gtsam::Values solveInSubmaps(const gtsam::NonlinearFactorGraph& graph,
+                                 const gtsam::Values& initial,
+                                 const SubmapParams& params,
+                                 SubmapReport* report = nullptr);
+}
+
+#endif
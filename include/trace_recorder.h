@@ -0,0 +1,100 @@
+#ifndef TRACE_RECORDER_H
+#define TRACE_RECORDER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace aprilslam {
+
+    // Timeline of callback and stage spans in the Chrome trace event format, opened with
+    // chrome://tracing or ui.perfetto.dev. Spans are kept in memory as complete ("X") events
+    // up to a fixed capacity and written by write(). Names, categories and argument keys must
+    // be string literals, they are stored as pointers. A disabled recorder costs one branch
+    // per span and never reads the clock.
+    class TraceRecorder {
+    public:
+        static constexpr int kMaxArgs = 4;
+        struct Arg {
+            const char* key;
+            double value;
+        };
+        struct Event {
+            const char* name;
+            const char* category;
+            double begin;       // seconds since the recorder was created
+            double duration;
+            int thread;
+            int numArgs;
+            Arg args[kMaxArgs];
+        };
+
+        explicit TraceRecorder(size_t capacity = 1 << 20);
+
+        void setEnabled(bool enabled) { enabled_.store(enabled, std::memory_order_relaxed); }
+        bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+        double now() const { return std::chrono::duration<double>(std::chrono::steady_clock::now() - origin_).count(); }
+
+        // Thread-safe; events past the capacity are counted and dropped
+        void record(Event event);
+        void setCapacity(size_t capacity);
+        size_t size() const;
+        size_t dropped() const;
+        void clear();
+
+        // JSON trace with one track per recording thread
+        bool write(const std::string& filename, const std::string& processName = "aprilslam") const;
+
+    private:
+        int threadIndex(std::thread::id id);
+
+        std::atomic<bool> enabled_;
+        std::chrono::steady_clock::time_point origin_;
+        size_t capacity_;
+        mutable std::mutex mutex_;
+        std::vector<Event> events_;
+        std::vector<std::thread::id> threads_;
+        size_t dropped_;
+    };
+
+    // Records a span from construction to destruction, no-op without an enabled recorder
+    class TraceSpan {
+    public:
+        TraceSpan(TraceRecorder* recorder, const char* name, const char* category = "estimator")
+            : recorder_(recorder && recorder->enabled() ? recorder : nullptr) {
+            if (recorder_) {
+                event_.name = name;
+                event_.category = category;
+                event_.numArgs = 0;
+                event_.begin = recorder_->now();
+            }
+        }
+        ~TraceSpan() { stop(); }
+        TraceSpan(const TraceSpan&) = delete;
+        TraceSpan& operator=(const TraceSpan&) = delete;
+
+        // Extra value shown with the span, e.g. graph size or iteration count
+        void arg(const char* key, double value) {
+            if (recorder_ && event_.numArgs < TraceRecorder::kMaxArgs) {
+                event_.args[event_.numArgs++] = {key, value};
+            }
+        }
+        bool active() const { return recorder_ != nullptr; }
+        void stop() {
+            if (!recorder_) return;
+            event_.duration = recorder_->now() - event_.begin;
+            recorder_->record(event_);
+            recorder_ = nullptr;
+        }
+
+    private:
+        TraceRecorder* recorder_;
+        TraceRecorder::Event event_;
+    };
+}
+
+#endif
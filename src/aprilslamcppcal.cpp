@@ -3,9 +3,15 @@
 
 namespace aprilslam {
 // Constructor
-aprilslamcpp::aprilslamcpp(ros::NodeHandle node_handle)
-    : nh_(node_handle), tf_listener_(tf_buffer_) { 
+aprilslamcpp::aprilslamcpp(ros::NodeHandle node_handle, bool standalone)
+    : standalone_(standalone), nh_(node_handle), tf_listener_(tf_buffer_) { 
     
+    // Sensor ingestion and estimation are served from separate callback queues
+    nh_.setCallbackQueue(&estimationQueue_);
+    sensor_nh_ = nh_;
+    sensor_nh_.setCallbackQueue(&sensorQueue_);
+    optimizationExecuted_ = false;
+
     // Read topics and corresponding frame
     std::string odom_topic, trajectory_topic;
     nh_.getParam("odom_topic", odom_topic);
@@ -13,8 +19,11 @@ aprilslamcpp::aprilslamcpp(ros::NodeHandle node_handle)
     nh_.getParam("map_frame_id", map_frame_id);
     nh_.getParam("robot_frame", robot_frame);
 
+    // Estimator settings, see estimator.h
+    EstimatorOptions options;
+
     // Read batch optimization flag
-    nh_.getParam("batch_optimisation", batchOptimisation_);
+    nh_.getParam("batch_optimisation", options.batchOptimisation);
 
     // Read noise models
     std::vector<double> odometry_noise, prior_noise, bearing_range_noise, point_noise;
@@ -24,11 +33,11 @@ aprilslamcpp::aprilslamcpp(ros::NodeHandle node_handle)
     nh_.getParam("noise_models/point", point_noise);
 
     // Read error threshold for a landmark to be added to the graph
-    nh_.getParam("add2graph_threshold", add2graph_threshold);    
+    nh_.getParam("add2graph_threshold", options.add2graphThreshold);    
 
     // Stationary conditions
-    nh_.getParam("stationary_position_threshold", stationary_position_threshold);
-    nh_.getParam("stationary_rotation_threshold", stationary_rotation_threshold);
+    nh_.getParam("stationary_position_threshold", options.stationaryPositionThreshold);
+    nh_.getParam("stationary_rotation_threshold", options.stationaryRotationThreshold);
 
     // Read calibration and localization settings
     std::string package_path = ros::package::getPath("aprilslamcpp");
@@ -39,8 +48,40 @@ aprilslamcpp::aprilslamcpp(ros::NodeHandle node_handle)
     // Construct the full paths
     pathtosavelandmarkcsv = package_path + "/" + save_path;
     pathtoloadlandmarkcsv = package_path + "/" + load_path;
+
+    // Stage latency histograms: publishing period [s] (0 disables the topic) and CSV written on shutdown
+    double metrics_period;
+    std::string metrics_file;
+    nh_.param("metrics_period", metrics_period, 5.0);
+    nh_.param<std::string>("metrics_file", metrics_file, "");
+    if (!metrics_file.empty()) {
+        metricsFile_ = metrics_file[0] == '/' ? metrics_file : package_path + "/" + metrics_file;
+    }
+
+    // Timeline trace of every callback and stage, off unless trace_file is set
+    std::string trace_file;
+    int trace_max_events;
+    nh_.param<std::string>("trace_file", trace_file, "");
+    nh_.param("trace_max_events", trace_max_events, 1000000);
+    if (!trace_file.empty()) {
+        traceFile_ = trace_file[0] == '/' ? trace_file : package_path + "/" + trace_file;
+        trace_.setCapacity(static_cast<size_t>(std::max(trace_max_events, 0)));
+        trace_.setEnabled(true);
+    }
     nh_.getParam("savetaglocation", savetaglocation);
     nh_.getParam("usepriortagtable", usepriortagtable);
+    options.usePriorTagTable = usepriortagtable;
+
+    // Detections are kept this long (seconds) waiting for the pose they belong to
+    nh_.param("detection_buffer_horizon", detectionBufferHorizon_, 2.0);
+    detectionBuffer_.setHorizon(detectionBufferHorizon_);
+    odomBuffer_.setHorizon(detectionBufferHorizon_);
+
+    // Merge same-tag observations from overlapping cameras into one factor
+    nh_.param("fuseduplicatedetections", options.fuseDuplicateDetections, true);
+    // Bound on the bearing-range factors per pose, the most informative detections are kept
+    nh_.param("max_observations_per_pose", options.observationBudget.maxObservations, 0);
+    nh_.param("budget_estimated_tag_sigma", options.observationBudget.estimatedTagSigma, 0.5);
 
     // Load camera topics
     if (nh_.getParam("camera_config/cameras", camera_list) && camera_list.getType() == XmlRpc::XmlRpcValue::TypeArray) {
@@ -54,60 +95,72 @@ aprilslamcpp::aprilslamcpp(ros::NodeHandle node_handle)
             Eigen::Vector3d transform(0.0, 0.0, 0.0);
 
             camera_infos_.emplace_back(CameraInfo{name, topic, frame_id, transform});
+
+            // Optional extrinsic: [x, y, yaw] in the robot frame, used instead of TF
+            bool known = false;
+            if (camera_list[i].hasMember("extrinsic") && camera_list[i]["extrinsic"].getType() == XmlRpc::XmlRpcValue::TypeArray
+                && camera_list[i]["extrinsic"].size() == 3) {
+                for (int k = 0; k < 3; ++k) {
+                    XmlRpc::XmlRpcValue& v = camera_list[i]["extrinsic"][k];
+                    transform(k) = v.getType() == XmlRpc::XmlRpcValue::TypeInt ? static_cast<int>(v) : static_cast<double>(v);
+                }
+                setCameraExtrinsic(camera_infos_.back(), transform);
+                ROS_INFO("Extrinsic from config for [%s]: (%.2f, %.2f, %.2f rad)",
+                         name.c_str(), transform(0), transform(1), transform(2));
+                known = true;
+            }
+            extrinsicKnown_.push_back(known);
         }
     } else {
         ROS_WARN("Failed to load camera_config/cameras or invalid format.");
     }
 
-    // Wait for static transforms using frame_id
-    for (auto& cam : camera_infos_) {
-        tf2::Transform tf;
-        const int max_attempts = 20;
-        const ros::Duration retry_interval(0.5);
-        bool success = false;
-
-        for (int attempt = 0; attempt < max_attempts; ++attempt) {
-            if (getStaticTransform(robot_frame, cam.frame_id, tf)) {
-                
-                tf2::Vector3 trans = tf.getOrigin();
-                tf2::Quaternion rot = tf.getRotation();
-
-                // Convert to Eigen
-                Eigen::Vector3d tf_trans(trans.x(), trans.y(), trans.z());
-                Eigen::Quaterniond tf_rot(rot.w(), rot.x(), rot.y(), rot.z());
-                Eigen::Matrix3d R = tf_rot.toRotationMatrix();
-
-                Eigen::Vector3d z_axis_robot = R.col(2); 
-                z_axis_robot.z() = 0.0;  
-                z_axis_robot.normalize();  
-                double yaw = std::atan2(z_axis_robot.y(), z_axis_robot.x()); 
-
-                // Final transform
-                cam.transform = Eigen::Vector3d(tf_trans.x(), tf_trans.y(), yaw);
-                ROS_INFO("TF loaded for [%s] (%s): (%.2f, %.2f, %.2f rad)",
-                        cam.name.c_str(), cam.frame_id.c_str(), tf_trans.x(), tf_trans.y(), yaw);
-                success = true;
-                break;
-            } else {
-                ROS_WARN("Waiting for static TF from %s to %s... (attempt %d)",
-                        robot_frame.c_str(), cam.frame_id.c_str(), attempt + 1);
-                retry_interval.sleep();
-            }
-        }
+    // Offline replay has no live TF tree: the bag's /tf_static stands in for it and nothing is
+    // waited for
+    std::string replay_bag, replay_odometry_csv;
+    nh_.param<std::string>("replay_bag", replay_bag, "");
+    nh_.param<std::string>("replay_odometry_csv", replay_odometry_csv, "");
+    const bool replaying = !replay_bag.empty() || !replay_odometry_csv.empty();
+    if (!replay_bag.empty()) {
+        ROS_INFO("Read %zu static transforms from %s", loadBagStaticTransforms(replay_bag, tf_buffer_), replay_bag.c_str());
+    }
 
-        if (!success) {
-            ROS_ERROR("Failed to get static transform for camera %s (%s). Shutting down.",
-                    cam.name.c_str(), cam.frame_id.c_str());
-            ros::shutdown();
-            return;
+    // Wait for static transforms using frame_id. Inside a nodelet manager the constructor must
+    // not block, the lookup is tried once here and then retried on a timer.
+    const bool wait = standalone_ && !replaying;
+    const int max_attempts = wait ? 20 : 1;
+    const ros::Duration retry_interval(0.5);
+    bool success = false;
+    for (int attempt = 0; attempt < max_attempts && !success; ++attempt) {
+        success = lookupCameraExtrinsics(wait ? 2.0 : 0.0);
+        if (!success && attempt + 1 < max_attempts) {
+            ROS_WARN("Waiting for static TF from the cameras to %s... (attempt %d)", robot_frame.c_str(), attempt + 1);
+            retry_interval.sleep();
+        }
+    }
+    if (!success && !standalone_) {
+        ROS_WARN("Camera extrinsics not on TF yet, data is ignored until they are");
+        extrinsic_timer_ = nh_.createTimer(ros::Duration(0.5), [this](const ros::TimerEvent&) {
+            if (!lookupCameraExtrinsics(0.0)) return;
+            ROS_INFO("Camera extrinsics loaded");
+            ready_ = true;
+            extrinsic_timer_.stop();
+        });
+    } else if (!success) {
+        for (size_t c = 0; c < camera_infos_.size(); ++c) {
+            if (extrinsicKnown_[c]) continue;
+            ROS_ERROR("Failed to get static transform for camera %s (%s)%s.", camera_infos_[c].name.c_str(),
+                      camera_infos_[c].frame_id.c_str(), replaying ? ", set its extrinsic in camera_config" : "");
         }
+        return;
     }
+    ready_ = success;
 
-    // Initialize noise models
-    odometryNoise = gtsam::noiseModel::Diagonal::Sigmas((gtsam::Vector(3) << odometry_noise[0], odometry_noise[1], odometry_noise[2]).finished());
-    priorNoise = gtsam::noiseModel::Diagonal::Sigmas((gtsam::Vector(3) << prior_noise[0], prior_noise[1], prior_noise[2]).finished());
-    brNoise = gtsam::noiseModel::Diagonal::Sigmas((gtsam::Vector(2) << bearing_range_noise[0], bearing_range_noise[1]).finished());
-    pointNoise = gtsam::noiseModel::Diagonal::Sigmas((gtsam::Vector(2) << point_noise[0], point_noise[1]).finished());
+    // Noise models
+    options.odometrySigmas = Eigen::Vector3d(odometry_noise[0], odometry_noise[1], odometry_noise[2]);
+    options.priorSigmas = Eigen::Vector3d(prior_noise[0], prior_noise[1], prior_noise[2]);
+    options.bearingRangeSigmas = Eigen::Vector2d(bearing_range_noise[0], bearing_range_noise[1]);
+    options.pointSigmas = Eigen::Vector2d(point_noise[0], point_noise[1]);
 
     // Total number of IDs
     int total_tags;
@@ -122,17 +175,48 @@ aprilslamcpp::aprilslamcpp(ros::NodeHandle node_handle)
     double inactivity_threshold;
     nh_.getParam("inactivity_threshold", inactivity_threshold);
 
-    // Initialize GTSAM components
-    initializeGTSAM();
-    // Index to keep track of the sequential pose.
-    index_of_pose = 1;
-    // Initialize the factor graphs
-    keyframeGraph_ = gtsam::NonlinearFactorGraph();
+    // Final solve split into submaps solved in parallel and merged over the shared tags
+    nh_.param("submap_max_poses", options.submaps.maxPoses, 0);
+    nh_.param("submap_min_poses", options.submaps.minPoses, 30);
+    nh_.param("submap_turn_angle", options.submaps.turnAngle, 2.5);
+    nh_.param("submap_threads", options.submaps.threads, 0);
+    nh_.param("submap_separator_sigma", options.submaps.separatorSigma, 0.05);
+    nh_.param("submap_refine_iterations", options.submaps.refineIterations, 2);
+    // Linear (chordal) initial estimate of the whole graph before the nonlinear solve
+    nh_.param("chordal_init", options.useChordalInit, false);
+    // Coarse-to-fine: solves on every k-th pose (coarsest first) before the full-resolution solve
+    nh_.param("coarse_decimation", options.coarseToFine.decimation, std::vector<int>());
+    nh_.param("coarse_level_iterations", options.coarseToFine.levelIterations, 0);
+
+    // Calibration keeps every pose and solves the whole graph once, in finaliseCalibration()
+    options.incremental = false;
+    estimator_ = Estimator(options);
+    if (usepriortagtable) {
+        estimator_.setPriorMap(loadLandmarksFromCSV(pathtoloadlandmarkcsv));
+    }
+
+    // Multi-session refinement: the session is aligned onto an existing map when it is solved,
+    // only the tags seen again or new are refined and the rest of the map is kept as it was
+    std::string warmstart_map;
+    nh_.param<std::string>("warmstart_map", warmstart_map, "");
+    nh_.param("warmstart_prior_sigma", warmStartSigma_, 0.05);
+    nh_.param("warmstart_inlier_threshold", alignParams_.inlierThreshold, 0.3);
+    nh_.param("warmstart_min_inliers", alignParams_.minInliers, 3);
+    if (!warmstart_map.empty()) {
+        if (usepriortagtable) {
+            ROS_WARN("warmstart_map is ignored with usepriortagtable, the session is already in the prior map frame");
+        } else {
+            warmStartMap_ = loadLandmarksFromCSV(warmstart_map[0] == '/' ? warmstart_map : package_path + "/" + warmstart_map);
+            ROS_INFO("Warm start from %s: %zu tags", warmstart_map.c_str(), warmStartMap_.size());
+        }
+    }
+    estimator_.setMetrics(&metrics_);
+    estimator_.setTrace(&trace_);
 
     // Initialize camera subscribers
     for (const auto& cam : camera_infos_) {
-        ros::Subscriber sub = nh_.subscribe<apriltag_ros::AprilTagDetectionArray>(
-            cam.topic, 1,
+        ros::Subscriber sub = sensor_nh_.subscribe<apriltag_ros::AprilTagDetectionArray>(
+            cam.topic, 10,
             boost::bind(&aprilslamcpp::cameraCallback, this, _1, cam.name)
         );
         camera_subscribers_.push_back(sub);
@@ -143,19 +227,33 @@ aprilslamcpp::aprilslamcpp(ros::NodeHandle node_handle)
     path_pub_ = nh_.advertise<nav_msgs::Path>(trajectory_topic, 1, true);
     landmark_pub_ = nh_.advertise<visualization_msgs::MarkerArray>("landmarks", 1, true);
     path.header.frame_id = map_frame_id; 
+    metrics_pub_ = nh_.advertise<diagnostic_msgs::DiagnosticArray>("metrics", 1, true);
+    if (metrics_period > 0.0) {
+        metrics_timer_ = nh_.createTimer(ros::Duration(metrics_period), &aprilslamcpp::metricsCallback, this);
+    }
 
     // Timer to periodically check if valid data has been received by any camera
+    accumulated_time_ = 0.0;
     check_data_timer_ = nh_.createTimer(ros::Duration(2.0), [this, inactivity_threshold](const ros::TimerEvent&) {
-        if (!received_camera_names_.empty()) {
-            accumulated_time_ = 0.0;
+        bool received = false;
+        {
+            std::lock_guard<std::mutex> lock(detectionMutex_);
+            received = !received_camera_names_.empty();
             received_camera_names_.clear();  // Reset for next cycle
+        }
+        if (received) {
+            accumulated_time_ = 0.0;
         } else {
             accumulated_time_ += 2.0;
             ROS_WARN("No new valid data received from any camera. Accumulated time: %.1f seconds", accumulated_time_);
 
             if (accumulated_time_ >= inactivity_threshold) {
-                ROS_ERROR("No valid data from any camera for %.1f seconds. Shutting down.", inactivity_threshold);
-                this->~aprilslamcpp();  // Trigger the destructor
+                ROS_ERROR("No valid data from any camera for %.1f seconds. %s", inactivity_threshold,
+                          standalone_ ? "Shutting down." : "Landmarks saved, the nodelet stays loaded.");
+                check_data_timer_.stop();
+                finaliseCalibration();
+                // A nodelet shares ROS with the whole manager
+                if (standalone_) ros::shutdown();
             }
         }
     });
@@ -163,37 +261,79 @@ aprilslamcpp::aprilslamcpp(ros::NodeHandle node_handle)
 
 // Destructor implementation
 aprilslamcpp::~aprilslamcpp() {
-    ROS_INFO("Node is shutting down. Executing SAMOptimise().");
-
-    std::map<int, gtsam::Point2> landmarks_unoptimised;
-    for (const auto& key_value : keyframeEstimates_) {
-        gtsam::Key key = key_value.key;  // Get the key
-        if (gtsam::Symbol(key).chr() == 'L') {
-            gtsam::Point2 point = keyframeEstimates_.at<gtsam::Point2>(key);  // Access the Point2 value
-            landmarks_unoptimised[gtsam::Symbol(key).index()] = point;
-        }
+    finaliseCalibration();
+}
+
+// Final batch optimisation and map export, runs once either on inactivity or on shutdown
+void aprilslamcpp::finaliseCalibration() {
+    std::lock_guard<std::mutex> estimateLock(estimateMutex_);
+    if (optimizationExecuted_) {
+        return;
     }
+    ROS_INFO("Node is shutting down. Running the final batch solve.");
+    ROS_INFO("Duplicate tag observations fused: %ld factors saved.", estimator_.fusedFactorsSaved());
 
+    // Initial guesses, kept next to the optimised map for comparison
     if (savetaglocation) {
-        saveLandmarksToCSV(landmarks_unoptimised, pathtoloadlandmarkcsv);
+        saveLandmarksToCSV(estimator_.landmarks(), pathtoloadlandmarkcsv);
     }
-    
-    gtsam::Values result = SAMOptimise();
-    keyframeEstimates_ = result;
-    
-    // Extract landmark estimates from the result
-    std::map<int, gtsam::Point2> landmarks;
-    for (const auto& key_value : keyframeEstimates_) {
-        gtsam::Key key = key_value.key;  // Get the key
-        if (gtsam::Symbol(key).chr() == 'L') {
-            gtsam::Point2 point = keyframeEstimates_.at<gtsam::Point2>(key);  // Access the Point2 value
-            landmarks[gtsam::Symbol(key).index()] = point;
+
+    bool warmStarted = false;
+    if (!warmStartMap_.empty()) {
+        AlignmentResult alignment;
+        warmStarted = estimator_.alignToMap(warmStartMap_, alignParams_, warmStartSigma_, alignment);
+        if (warmStarted) {
+            ROS_INFO("Session aligned to the previous map: x = %.3f, y = %.3f, theta = %.3f, %zu shared tags, rmse = %.3f m",
+                     alignment.pose.x(), alignment.pose.y(), alignment.pose.theta(), alignment.inliers.size(), alignment.rmse);
+        } else {
+            ROS_WARN("Could not align the session to the previous map, solving it on its own");
+        }
+    }
+
+    Stopwatch solveWatch;
+    estimator_.optimiseAll();
+    const double solveTime = solveWatch.elapsed();
+    if (estimator_.options().useChordalInit) {
+        const ChordalInitReport& init = estimator_.chordalInitReport();
+        if (init.skipped.empty()) {
+            ROS_INFO("Chordal initialisation: %zu poses, %zu tags in %.3f s, graph error %.3g -> %.3g",
+                     init.poses, init.landmarks, init.time, init.errorBefore, init.errorAfter);
+        } else {
+            ROS_WARN("Chordal initialisation skipped (%s), solving from the odometry guess", init.skipped.c_str());
+        }
+    }
+    const CoarseToFineReport& levels = estimator_.coarseToFineReport();
+    for (size_t i = 0; i < levels.poses.size(); ++i) {
+        ROS_INFO("Coarse level %zu: %zu poses in %.2f s", i + 1, levels.poses[i], levels.times[i]);
+    }
+    if (estimator_.options().submaps.maxPoses > 0) {
+        const SubmapReport& report = estimator_.submapReport();
+        ROS_INFO("Submap solve: %d submaps, %d shared tags, %d cross factors (%d left to the refinement), "
+                 "solve %.2f s, merge %.2f s, refine %.2f s",
+                 report.submaps, report.separatorTags, report.crossFactors, report.ignoredFactors,
+                 report.solveTime, report.mergeTime, report.refineTime);
+        if (report.failedSolves > 0) {
+            ROS_WARN("Submap solve: %d solves failed and kept their initial estimate", report.failedSolves);
+        }
+    } else {
+        ROS_INFO("Batch solve: %zu LM iterations", estimator_.solverIterations());
+    }
+    ROS_INFO("Total solve time %.2f s", solveTime);
+
+    // Refined and new tags over the previous map, the tags not seen this session are kept
+    std::map<int, gtsam::Point2> landmarks = estimator_.landmarks();
+    if (warmStarted) {
+        std::map<int, gtsam::Point2> merged = warmStartMap_;
+        for (const auto& landmark : landmarks) {
+            merged[landmark.first] = landmark.second;
         }
+        ROS_INFO("Map update: %zu of %zu tags refined or added this session", landmarks.size(), merged.size());
+        landmarks.swap(merged);
     }
 
     // Publish the pose and landmarks
     aprilslam::publishLandmarks(landmark_pub_, landmarks, map_frame_id);
-    aprilslam::publishPath(path_pub_, keyframeEstimates_, index_of_pose, map_frame_id);
+    aprilslam::publishPath(path_pub_, estimator_.estimates(), estimator_.poseIndex(), map_frame_id);
 
     // Save the landmarks into a CSV file if required
     if (savetaglocation) {
@@ -201,27 +341,80 @@ aprilslamcpp::~aprilslamcpp() {
     }
     optimizationExecuted_ = true;
     ROS_INFO("SAMOptimise() executed successfully.");
+    dumpMetrics();
+    writeTrace();
+}
+
+void aprilslamcpp::metricsCallback(const ros::TimerEvent& event) {
+    TraceSpan span(&trace_, "metrics_callback", "callback");
+    std::lock_guard<std::mutex> estimateLock(estimateMutex_);
+    aprilslam::publishMetrics(metrics_pub_, metrics_, ros::this_node::getName());
+}
+
+void aprilslamcpp::dumpMetrics() {
+    for (size_t i = 0; i < StageMetrics::kStages; ++i) {
+        Stage stage = static_cast<Stage>(i);
+        const LatencyHistogram& hist = metrics_.histogram(stage);
+        if (hist.count() == 0) continue;
+        ROS_INFO("%-20s n = %6lu  p50 %8.2f ms  p95 %8.2f ms  p99 %8.2f ms  max %8.2f ms",
+                 stageName(stage), static_cast<unsigned long>(hist.count()),
+                 1e3 * hist.percentile(0.50), 1e3 * hist.percentile(0.95),
+                 1e3 * hist.percentile(0.99), 1e3 * hist.max());
+    }
+    if (!metricsFile_.empty()) {
+        if (metrics_.writeCSV(metricsFile_)) {
+            ROS_INFO("Stage metrics written to %s", metricsFile_.c_str());
+        } else {
+            ROS_WARN("Could not write stage metrics to %s", metricsFile_.c_str());
+        }
+    }
+}
+
+void aprilslamcpp::writeTrace() {
+    if (traceFile_.empty()) return;
+    if (trace_.dropped() > 0) {
+        ROS_WARN("Trace buffer full, %zu spans were dropped (raise trace_max_events)", trace_.dropped());
+    }
+    if (trace_.write(traceFile_, ros::this_node::getName())) {
+        ROS_INFO("Trace with %zu spans written to %s", trace_.size(), traceFile_.c_str());
+    } else {
+        ROS_WARN("Could not write the trace to %s", traceFile_.c_str());
+    }
 }
 
 // Callback function for Cam topic
 void aprilslamcpp::cameraCallback(
     const apriltag_ros::AprilTagDetectionArray::ConstPtr& msg,
-    const std::string& camera_name) {    
+    const std::string& camera_name) {
+    if (!ready_) return;
+    TraceSpan span(&trace_, "camera_callback", "callback");
+    span.arg("detections", msg->detections.size());    
+    std::lock_guard<std::mutex> lock(detectionMutex_);
     if (!msg->detections.empty()) {
         camera_detections_[camera_name] = msg;
+        detectionBuffer_.push(cameraIndex(camera_name), msg->header.stamp.toSec(), msg);
         received_camera_names_.insert(camera_name);
     } else {
         camera_detections_.erase(camera_name);
     }
 }
 
+int aprilslamcpp::cameraIndex(const std::string& camera_name) const {
+    for (size_t c = 0; c < camera_infos_.size(); ++c) {
+        if (camera_infos_[c].name == camera_name) return static_cast<int>(c);
+    }
+    return -1;
+}
+
 bool aprilslamcpp::getStaticTransform(const std::string& target_frame,
                                       const std::string& source_frame,
-                                      tf2::Transform& out_tf) {
+                                      tf2::Transform& out_tf,
+                                      double timeout) {
+    TraceSpan span(&trace_, "tf_lookup", "tf");
     try {
         geometry_msgs::TransformStamped transform_stamped =
             tf_buffer_.lookupTransform(target_frame, source_frame,
-                                       ros::Time(0), ros::Duration(2.0));
+                                       ros::Time(0), ros::Duration(timeout));
         tf2::fromMsg(transform_stamped.transform, out_tf);
         return true;
     } catch (tf2::TransformException& ex) {
@@ -231,13 +424,36 @@ bool aprilslamcpp::getStaticTransform(const std::string& target_frame,
     }
 }
 
-// Initialization of GTSAM components
-void aprilslamcpp::initializeGTSAM() { 
-    // Initialize graph parameters and stores them in isam_.
-    gtsam::ISAM2Params parameters;
-    parameters.relinearizeThreshold = 0.1;
-    parameters.relinearizeSkip = 1;
-    isam_ = gtsam::ISAM2(parameters);
+bool aprilslamcpp::lookupCameraExtrinsics(double timeout) {
+    bool all = true;
+    for (size_t c = 0; c < camera_infos_.size(); ++c) {
+        if (extrinsicKnown_[c]) continue;
+        CameraInfo& cam = camera_infos_[c];
+        tf2::Transform tf;
+        if (!getStaticTransform(robot_frame, cam.frame_id, tf, timeout)) {
+            all = false;
+            continue;
+        }
+        tf2::Vector3 trans = tf.getOrigin();
+        tf2::Quaternion rot = tf.getRotation();
+
+        // Convert to Eigen
+        Eigen::Vector3d tf_trans(trans.x(), trans.y(), trans.z());
+        Eigen::Quaterniond tf_rot(rot.w(), rot.x(), rot.y(), rot.z());
+        Eigen::Matrix3d R = tf_rot.toRotationMatrix();
+
+        Eigen::Vector3d z_axis_robot = R.col(2);
+        z_axis_robot.z() = 0.0;
+        z_axis_robot.normalize();
+        double yaw = std::atan2(z_axis_robot.y(), z_axis_robot.x());
+
+        // Final transform, rotation precomputed once for all detections
+        setCameraExtrinsic(cam, Eigen::Vector3d(tf_trans.x(), tf_trans.y(), yaw));
+        ROS_INFO("TF loaded for [%s] (%s): (%.2f, %.2f, %.2f rad)",
+                 cam.name.c_str(), cam.frame_id.c_str(), tf_trans.x(), tf_trans.y(), yaw);
+        extrinsicKnown_[c] = true;
+    }
+    return all;
 }
 
 gtsam::Pose2 aprilslamcpp::translateOdomMsg(const nav_msgs::Odometry::ConstPtr& msg) {
@@ -255,186 +471,66 @@ gtsam::Pose2 aprilslamcpp::translateOdomMsg(const nav_msgs::Odometry::ConstPtr&
     return gtsam::Pose2(x, y, yaw);
 }
 
-gtsam::Values aprilslamcpp::SAMOptimise() {    
-    // Perform batch optimization using Levenberg-Marquardt optimizer
-    gtsam::LevenbergMarquardtOptimizer batchOptimizer(keyframeGraph_, keyframeEstimates_);
-    gtsam::Values result = batchOptimizer.optimize();
-    return result;
-}
-
-// Check if movement exceeds the stationary thresholds
-bool aprilslam::aprilslamcpp::movementExceedsThreshold(const gtsam::Pose2& poseSE2) {
-    double position_change = std::hypot(poseSE2.x() - lastPoseSE2_.x(), poseSE2.y() - lastPoseSE2_.y());
-    double rotation_change = std::abs(wrapToPi(poseSE2.theta() - lastPoseSE2_.theta()));
-    return position_change >= stationary_position_threshold || rotation_change >= stationary_rotation_threshold;
-}
-
-// Handle initialization of the first pose
-void aprilslam::aprilslamcpp::initializeFirstPose(const gtsam::Pose2& poseSE2, gtsam::Pose2& pose0) {
-    lastPoseSE2_ = poseSE2;
-    lastPoseSE2_vis = poseSE2;
-    keyframeGraph_.add(gtsam::PriorFactor<gtsam::Pose2>(gtsam::Symbol('X', 1), pose0, priorNoise));
-    keyframeEstimates_.insert(gtsam::Symbol('X', 1), pose0);
-    Estimates_visulisation.insert(gtsam::Symbol('X', 1), pose0);
-    lastPose_ = pose0; // Keep track of the last pose for odolandmarkKeymetry calculation
-    // Load calibrated landmarks as priors if available
-    if (usepriortagtable) {
-    std::map<int, gtsam::Point2> savedLandmarks = loadLandmarksFromCSV(pathtoloadlandmarkcsv);
-        for (const auto& landmark : savedLandmarks) {
-            gtsam::Symbol landmarkKey('L', landmark.first);
-            keyframeGraph_.add(gtsam::PriorFactor<gtsam::Point2>(landmarkKey, landmark.second, pointNoise));
-            keyframeEstimates_.insert(landmarkKey, landmark.second);
-            landmarkEstimates.insert(landmarkKey, landmark.second);
-        }
-    }
-    Key_previous_pos = pose0;
-    previousKeyframeSymbol = gtsam::Symbol('X', 1);
-}
-
-// Predict the next pose based on odometry
-gtsam::Pose2 aprilslam::aprilslamcpp::predictNextPose(const gtsam::Pose2& poseSE2) {
-    gtsam::Pose2 odometry = relPoseFG(lastPoseSE2_, poseSE2);
-    // gtsam::Pose2 adjustedOdometry = odometryDirection(odometry, linear_x_velocity_);
-    return lastPose_.compose(odometry);
-}
-
-// Update the graph with landmarks detections
-std::set<gtsam::Symbol> aprilslam::aprilslamcpp::updateGraphWithLandmarks(
-    std::set<gtsam::Symbol> detectedLandmarksCurrentPos, 
-    const std::pair<std::vector<int>, std::vector<Eigen::Vector2d>>& detections) {
-
-    // Access the elements of the std::pair   
-    const std::vector<int>& Id = detections.first;
-    const std::vector<Eigen::Vector2d>& tagPos = detections.second;
-
-    if (!Id.empty()) {
-        for (size_t n = 0; n < Id.size(); ++n) {
-            int tag_number = Id[n];        
-            Eigen::Vector2d landSE2 = tagPos[n];
-
-            // Compute prior location of the landmark using the current robot pose
-            double theta = lastPose_.theta();
-            Eigen::Rotation2Dd rotation(theta);  // Create a 2D rotation matrix
-            Eigen::Vector2d rotatedPosition = rotation * landSE2;  // Rotate the position into the robot's frame
-            gtsam::Point2 priorLand(rotatedPosition.x() + lastPose_.x(), rotatedPosition.y() + lastPose_.y());
-
-            // Compute bearing and range
-            double bearing = std::atan2(landSE2(1), landSE2(0));
-            double range = std::sqrt(landSE2(0) * landSE2(0) + landSE2(1) * landSE2(1));
-
-            // Construct the landmark key
-            gtsam::Symbol landmarkKey('L', tag_number);  
-
-            // Check if the landmark has been observed before
-            if (detectedLandmarksHistoric.find(landmarkKey) != detectedLandmarksHistoric.end()) {
-                    // Existing landmark
-                    gtsam::BearingRangeFactor<gtsam::Pose2, gtsam::Point2, gtsam::Rot2, double> factor(
-                        gtsam::Symbol('X', index_of_pose), landmarkKey, gtsam::Rot2::fromAngle(bearing), range, brNoise
-                    );
-                    gtsam::Vector error = factor.unwhitenedError(landmarkEstimates);
-
-                    // Threshold for ||projection - measurement||
-                    if (fabs(error[0]) < add2graph_threshold) keyframeGraph_.add(factor);
-            } 
-            else {
-                // If the current landmark was not detected in the calibration run 
-                // Or it's on calibration mode
-                if (!landmarkEstimates.exists(landmarkKey) || !usepriortagtable) {
-                // New landmark detected
-                detectedLandmarksHistoric.insert(landmarkKey);
-                // Check if the key already exists in keyframeEstimates_ before inserting
-                if (keyframeEstimates_.exists(landmarkKey)) {
-                } else {
-                    keyframeEstimates_.insert(landmarkKey, priorLand); // Simple initial estimate
-                }
-
-                // Check if the key already exists in landmarkEstimates before inserting
-                if (landmarkEstimates.exists(landmarkKey)) {
-                } else {
-                    landmarkEstimates.insert(landmarkKey, priorLand);
-                }
-
-                // Add a prior for the landmark position to help with initial estimation.
-                keyframeGraph_.add(gtsam::PriorFactor<gtsam::Point2>(
-                    landmarkKey, priorLand, pointNoise)
-                );
-                }
-                // Add a bearing-range observation for this landmark to the graph
-                gtsam::BearingRangeFactor<gtsam::Pose2, gtsam::Point2, gtsam::Rot2, double> factor(
-                    gtsam::Symbol('X', index_of_pose), landmarkKey, gtsam::Rot2::fromAngle(bearing), range, brNoise
-                );
-                keyframeGraph_.add(factor);
-            }
-            // Store the bearing and range measurements in the map
-            poseToLandmarkMeasurementsMap[gtsam::Symbol('X', index_of_pose)][landmarkKey] = std::make_tuple(bearing, range); 
-        }
-    }
-    return detectedLandmarksCurrentPos;
-}
-
 void aprilslam::aprilslamcpp::addOdomFactor(const nav_msgs::Odometry::ConstPtr& msg) {
+    // Camera extrinsics not known yet (nodelet still waiting on TF)
+    if (!ready_) return;
+    // Opened before the lock so waiting on the optimiser shows up in the span
+    TraceSpan span(&trace_, "odom_callback", "callback");
+    std::lock_guard<std::mutex> estimateLock(estimateMutex_);
     // Convert the incoming odometry message to a simpler (x, y, theta) format using a previously defined method
     gtsam::Pose2 poseSE2 = translateOdomMsg(msg);
 
-    // Store the initial pose for relative calculations
-    pose0 = gtsam::Pose2(0.0, 0.0, 0.0); // Prior at origin
-
-    // Check if the movement exceeds the thresholds
-    if (!movementExceedsThreshold(poseSE2)) return;
-
-    index_of_pose += 1; // Increment the pose index for each new odometry message
-    if (index_of_pose == 2) initializeFirstPose(poseSE2, pose0);
-
-    // Predict the next pose based on odometry and add it as an initial estimate
-    gtsam::Pose2 predictedPose = predictNextPose(poseSE2);
+    // Remember where the robot was, detections are aligned to their own stamp later
+    double odom_stamp = msg->header.stamp.toSec();
+    odomBuffer_.push(odom_stamp, poseSE2);
 
-    // Determine if this pose should be a keyframe
-    gtsam::Symbol currentKeyframeSymbol('X', index_of_pose);
+    // Every pose that moved is a keyframe in calibration mode
+    if (estimator_.addOdometry(odom_stamp, poseSE2) != OdometryStep::Keyframe) return;
 
-    // Add odometry factor
-    keyframeEstimates_.insert(gtsam::Symbol('X', index_of_pose), predictedPose);
-    if (previousKeyframeSymbol) {
-        gtsam::Pose2 relativePose = Key_previous_pos.between(predictedPose);
-        keyframeGraph_.add(gtsam::BetweenFactor<gtsam::Pose2>(previousKeyframeSymbol, currentKeyframeSymbol, relativePose, odometryNoise));
+    int dropped = 0;
+    {
+        StageTimer timer(&metrics_, Stage::DetectionGathering);
+        TraceSpan gatherSpan(&trace_, "collect_detections");
+        std::lock_guard<std::mutex> lock(detectionMutex_);
+        dropped = collectAlignedDetections(detectionBuffer_, odomBuffer_, camera_infos_, odom_stamp, poseSE2, detectionBatch_);
     }
-        
-    // Update the last pose and initial estimates for the next iteration
-    lastPose_ = predictedPose;
-    landmarkEstimates.insert(gtsam::Symbol('X', index_of_pose), predictedPose);
-
-    std::set<gtsam::Symbol> detectedLandmarksCurrentPos;
-    
-    // Iterate through all landmark detected IDs
-    auto detections = getCamDetections(camera_infos_, camera_detections_);
-    if (!detections.first.empty()) {
-        detectedLandmarksCurrentPos = updateGraphWithLandmarks(detectedLandmarksCurrentPos, detections);
+    if (dropped > 0) {
+        ROS_WARN("Dropped %d detection arrays without odometry at their stamp", dropped);
     }
-    
-    lastPoseSE2_ = poseSE2;
-    Key_previous_pos = predictedPose;
-
-    // Visulisation
-    previousKeyframeSymbol = gtsam::Symbol('X', index_of_pose);
-     // Extract landmark estimates from the result
-    std::map<int, gtsam::Point2> landmarks;
-    for (const auto& key_value : keyframeEstimates_) {
-        gtsam::Key key = key_value.key;  // Get the key
-        if (gtsam::Symbol(key).chr() == 'L') {
-            gtsam::Point2 point = keyframeEstimates_.at<gtsam::Point2>(key);  // Access the Point2 value
-            landmarks[gtsam::Symbol(key).index()] = point;
-        }
+    KeyframeEvents events = estimator_.addDetections(detectionBatch_);
+    if (events.fusedDetections > 0) {
+        ROS_DEBUG("Fused duplicate tag observations: %d factors saved (%ld total)", events.fusedDetections, estimator_.fusedFactorsSaved());
+    }
+    if (events.budgetDropped > 0) {
+        ROS_DEBUG("Observation budget: %d detections left out (%ld total)", events.budgetDropped, estimator_.budgetDropped());
     }
+
     // Publish the pose and landmarks
-    aprilslam::publishLandmarks(landmark_pub_, landmarks, map_frame_id);
-    aprilslam::publishPath(path_pub_, keyframeEstimates_, index_of_pose, map_frame_id);
+    {
+        StageTimer timer(&metrics_, Stage::Publishing);
+        TraceSpan publishSpan(&trace_, "publish_map", "publishing");
+        aprilslam::publishLandmarks(landmark_pub_, estimator_.landmarks(), map_frame_id);
+        aprilslam::publishPath(path_pub_, estimator_.estimates(), estimator_.poseIndex(), map_frame_id);
+    }
 
     // Save the landmarks into a CSV file if required
     if (savetaglocation) {
-        saveLandmarksToCSV(landmarks, pathtosavelandmarkcsv);
+        StageTimer timer(&metrics_, Stage::Logging);
+        TraceSpan csvSpan(&trace_, "save_landmarks_csv", "logging");
+        saveLandmarksToCSV(estimator_.landmarks(), pathtosavelandmarkcsv);
     }
 }
 }
 
+#ifdef APRILSLAM_NODELET
+#include "aprilslam_nodelet.h"
+#include <pluginlib/class_list_macros.h>
+
+namespace aprilslam {
+class CalibrationNodelet : public SlamNodelet<aprilslamcpp> {};
+}
+PLUGINLIB_EXPORT_CLASS(aprilslam::CalibrationNodelet, nodelet::Nodelet)
+#else
 int main(int argc, char **argv) {
     // Initialize the ROS system and specify the name of the node
     ros::init(argc, argv, "april_slam_cpp");
@@ -444,9 +540,51 @@ int main(int argc, char **argv) {
 
     // Create an instance of the aprilslamcpp class, passing in the node handle
     aprilslam::aprilslamcpp slamNode(nh);
+    if (!slamNode.ready()) {
+        return 1;
+    }
 
-    // ROS enters a loop, pumping callbacks. Internally, it will call all the callbacks waiting to be called at that point in time.
-    ros::spin();
+    // Offline replay: feed a recording straight into the callbacks instead of spinning
+    std::string replay_bag, replay_odometry_csv, replay_detections_csv;
+    nh.param<std::string>("replay_bag", replay_bag, "");
+    nh.param<std::string>("replay_odometry_csv", replay_odometry_csv, "");
+    nh.param<std::string>("replay_detections_csv", replay_detections_csv, "");
+    if (!replay_bag.empty() || !replay_odometry_csv.empty()) {
+        std::vector<aprilslam::ReplayMessage> messages;
+        std::string odom_topic;
+        nh.getParam("odom_topic", odom_topic);
+        bool loaded = !replay_bag.empty()
+            ? aprilslam::loadReplayBag(replay_bag, odom_topic, slamNode.cameraInfos(), messages)
+            : aprilslam::loadReplayCSV(replay_odometry_csv, replay_detections_csv, messages);
+        if (!loaded) {
+            return 1;
+        }
+
+        aprilslam::ReplayStats stats = aprilslam::runReplay(messages,
+            [&slamNode](const aprilslam::ReplayMessage& m) {
+                if (m.odom) slamNode.addOdomFactor(m.odom);
+                else slamNode.cameraCallback(m.detections, m.camera);
+            });
+        ROS_INFO("Replayed %zu messages covering %.1f s in %.1f s (%.1fx real time)",
+                 stats.messages, stats.dataDuration, stats.wallTime,
+                 stats.wallTime > 0.0 ? stats.dataDuration / stats.wallTime : 0.0);
+
+        // End of the recording plays the role of the inactivity timeout
+        slamNode.finaliseCalibration();
+        return 0;
+    }
+
+    // Detections are ingested on their own threads so they never wait for the solver
+    int sensor_threads = 1, estimation_threads = 1;
+    nh.param("sensor_threads", sensor_threads, 1);
+    nh.param("estimation_threads", estimation_threads, 1);
+    ros::AsyncSpinner sensorSpinner(sensor_threads, slamNode.sensorQueue());
+    ros::AsyncSpinner estimationSpinner(estimation_threads, slamNode.estimationQueue());
+    sensorSpinner.start();
+    estimationSpinner.start();
+
+    ros::waitForShutdown();
 
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -1,5 +1,6 @@
 #include "aprilslamheader.h"
 #include "publishing_utils.h"
+#include <sys/stat.h>
 
 namespace aprilslam {
 
@@ -20,9 +21,14 @@ gtsam::Pose2 odometryDirection(const gtsam::Pose2& odometry, double cmd_vel_line
 }
 
 // Constructor
-aprilslamcpp::aprilslamcpp(ros::NodeHandle node_handle)
-    : nh_(node_handle), tf_listener_(tf_buffer_){ 
+aprilslamcpp::aprilslamcpp(ros::NodeHandle node_handle, bool standalone)
+    : standalone_(standalone), nh_(node_handle), tf_listener_(tf_buffer_){ 
     
+    // Sensor ingestion and estimation are served from separate callback queues
+    nh_.setCallbackQueue(&estimationQueue_);
+    sensor_nh_ = nh_;
+    sensor_nh_.setCallbackQueue(&sensorQueue_);
+
     // Read topics and corresponding frame
     std::string odom_topic, trajectory_topic;
     nh_.getParam("odom_topic", odom_topic);
@@ -33,8 +39,11 @@ aprilslamcpp::aprilslamcpp(ros::NodeHandle node_handle)
     // nh_.getParam("ud_frame", ud_frame);
 
 
+    // Estimator settings, see estimator.h
+    EstimatorOptions options;
+
     // Read batch optimization flag
-    nh_.getParam("batch_optimisation", batchOptimisation_);
+    nh_.getParam("batch_optimisation", options.batchOptimisation);
 
     // Read noise models
     std::vector<double> odometry_noise, prior_noise, bearing_range_noise, point_noise, loop_ClosureNoise;
@@ -45,11 +54,13 @@ aprilslamcpp::aprilslamcpp(ros::NodeHandle node_handle)
     nh_.getParam("noise_models/loopClosureNoise", loop_ClosureNoise);
 
     // Read error thershold for a landmark to be added to the graph
-    nh_.getParam("add2graph_threshold", add2graph_threshold);
+    nh_.getParam("add2graph_threshold", options.add2graphThreshold);
 
     // Read Prune conditions
+    double maxfactors = options.maxPoses;
     nh_.getParam("maxfactors", maxfactors);
-    nh_.getParam("useprunebysize", useprunebysize);
+    options.maxPoses = static_cast<int>(maxfactors);
+    nh_.getParam("useprunebysize", options.usePruneBySize);
 
     // Read initilisation conditions
     nh_.getParam("N_particles", N_particles);
@@ -59,21 +70,94 @@ aprilslamcpp::aprilslamcpp(ros::NodeHandle node_handle)
     nh_.getParam("brngVar", brngVar_);
     pfInitStartTime_ = 0.0;
 
+    // Particle filter threading and seeding (0 = all cores / random seed)
+    int pf_threads, pf_seed, pf_min_particles;
+    nh_.param("pf_threads", pf_threads, 0);
+    nh_.param("pf_seed", pf_seed, 0);
+    PFParams pfParams;
+    pfParams.rngVar = rngVar_;
+    pfParams.brngVar = brngVar_;
+    pfParams.threads = pf_threads;
+    pfParams.seed = static_cast<std::uint64_t>(pf_seed);
+    // Prediction: odometry since the previous PF step plus a small diffusion
+    nh_.param("pf_sigma_pos", pfParams.sigmaPos, 0.05);
+    nh_.param("pf_sigma_theta", pfParams.sigmaTheta, 0.02);
+    nh_.param("pf_motion_noise", pfParams.motionNoise, 0.1);
+
+    // Resampling trigger and KLD adaptive sizing, N_particles is the initial and largest set
+    nh_.param("pf_min_particles", pf_min_particles, 200);
+    nh_.param("pf_ess_threshold", pfParams.essThreshold, 0.5);
+    nh_.param("pf_kld_epsilon", pfParams.kldEpsilon, 0.05);
+    nh_.param("pf_kld_z", pfParams.kldZ, 2.33);
+    nh_.param("pf_bin_size", pfParams.binSize, 0.5);
+    nh_.param("pf_bin_theta", pfParams.binTheta, 0.2);
+    pfParams.maxParticles = static_cast<size_t>(std::max(1, N_particles));
+    pfParams.minParticles = std::min(pfParams.maxParticles, static_cast<size_t>(std::max(1, pf_min_particles)));
+    pf_.setParams(pfParams);
+
+    // Closed-form initialisation from two or more known tags, the PF is the single-tag fallback
+    nh_.param("useclosedforminit", useclosedforminit, true);
+    nh_.param("closedform_inlier_threshold", alignParams_.inlierThreshold, 0.3);
+    nh_.param("closedform_min_inliers", alignParams_.minInliers, 2);
+    nh_.param("closedform_min_baseline", alignParams_.minBaseline, 0.3);
+    nh_.param("closedform_iterations", alignParams_.maxIterations, 200);
+
+    // Relocalisation monitor, reuses the closed-form alignment for its global search
+    RelocalisationParams& relocParams = options.relocalisation;
+    nh_.param("userelocalisation", options.useRelocalisation, false);
+    nh_.param("reloc_residual_threshold", relocParams.residualThreshold, 1.0);
+    nh_.param("reloc_trigger_count", relocParams.triggerCount, 5);
+    nh_.param("reloc_window", relocParams.window, 10);
+    nh_.param("reloc_min_correction", relocParams.minCorrection, 0.5);
+    nh_.param("reloc_min_heading_correction", relocParams.minHeadingCorrection, 0.2);
+    relocParams.alignment = alignParams_;
+
+    // Convergence test, PFWaitTime is the timeout of one attempt. Unset (0) std thresholds are
+    // twice the spread the filter settles at with one tag in view, so they can be met.
+    nh_.param("pf_converge_pos_std", pfConvergePosStd_, 0.0);
+    nh_.param("pf_converge_theta_std", pfConvergeThetaStd_, 0.0);
+    const Eigen::Vector2d settled = steadyStateStd(pfParams);
+    if (pfConvergePosStd_ <= 0.0) pfConvergePosStd_ = 2.0 * settled(0);
+    if (pfConvergeThetaStd_ <= 0.0) pfConvergeThetaStd_ = 2.0 * settled(1);
+    if (pfConvergePosStd_ < settled(0) || pfConvergeThetaStd_ < settled(1)) {
+        ROS_WARN("PF convergence thresholds (%.3f m, %.3f rad) are below the spread the filter settles at (%.3f m, %.3f rad)",
+                 pfConvergePosStd_, pfConvergeThetaStd_, settled(0), settled(1));
+    }
+    nh_.param("pf_converge_ess", pfConvergeEss_, 0.5);
+    nh_.param("pf_converge_steps", pfConvergeSteps_, 3);
+    nh_.param("pf_max_retries", pfMaxRetries_, 5);
+
     // Read loop closure parameters
-    nh_.getParam("useloopclosure", useloopclosure);
-    nh_.getParam("historyKeyframeSearchRadius", historyKeyframeSearchRadius);
-    nh_.getParam("historyKeyframeSearchNum", historyKeyframeSearchNum);
-    nh_.getParam("requiredReobservedLandmarks", requiredReobservedLandmarks);
+    nh_.getParam("useloopclosure", options.useLoopClosure);
+    nh_.getParam("historyKeyframeSearchRadius", options.historyKeyframeSearchRadius);
+    nh_.getParam("historyKeyframeSearchNum", options.historyKeyframeSearchNum);
+    nh_.getParam("requiredReobservedLandmarks", options.requiredReobservedLandmarks);
 
     // Keyframe parameters
-    nh_.getParam("distanceThreshold", distanceThreshold);
-    nh_.getParam("rotationThreshold", rotationThreshold);
-    nh_.getParam("usekeyframe", usekeyframe);
-    gtsam::Values landmarkEstimates;  // for unwhitten error computing 
+    nh_.getParam("distanceThreshold", options.distanceThreshold);
+    nh_.getParam("rotationThreshold", options.rotationThreshold);
+    nh_.getParam("usekeyframe", options.useKeyframe);
+    // Odometry between keyframes as one factor whose covariance grows along the segment
+    nh_.param("preintegrate_odometry", options.preintegrateOdometry, false);
+    std::vector<double> sigmas_per_metre, min_sigmas;
+    if (nh_.getParam("preintegration_sigmas_per_metre", sigmas_per_metre) && sigmas_per_metre.size() == 3) {
+        options.preintegration.sigmasPerMetre = Eigen::Vector3d(sigmas_per_metre[0], sigmas_per_metre[1], sigmas_per_metre[2]);
+    }
+    if (nh_.getParam("preintegration_min_sigmas", min_sigmas) && min_sigmas.size() == 3) {
+        options.preintegration.minSigmas = Eigen::Vector3d(min_sigmas[0], min_sigmas[1], min_sigmas[2]);
+    }
+    nh_.param("preintegration_theta_sigma_per_radian", options.preintegration.thetaSigmaPerRadian, 0.05);
+    nh_.param("preintegration_max_position_sigma", options.preintegration.maxPositionSigma, 0.0);
+    // Information-driven keyframes instead of distanceThreshold / rotationThreshold
+    nh_.param("adaptive_keyframes", options.adaptiveKeyframes, false);
+    nh_.param("keyframe_min_information_gain", options.keyframePolicy.minInformationGain, 0.1);
+    nh_.param("keyframe_max_rate", options.keyframePolicy.maxRate, 2.0);
+    nh_.param("keyframe_visibility_range", options.keyframePolicy.visibilityRange, 8.0);
+    nh_.param("keyframe_max_distance", options.keyframePolicy.maxDistance, 5.0);
 
     // Stationay conditions
-    nh_.getParam("stationary_position_threshold", stationary_position_threshold);
-    nh_.getParam("stationary_rotation_threshold", stationary_rotation_threshold);
+    nh_.getParam("stationary_position_threshold", options.stationaryPositionThreshold);
+    nh_.getParam("stationary_rotation_threshold", options.stationaryRotationThreshold);
 
     // Read calibration and localisation settings
     std::string package_path = ros::package::getPath("aprilslamcpp");
@@ -84,8 +168,42 @@ aprilslamcpp::aprilslamcpp(ros::NodeHandle node_handle)
     // Construct the full paths
     pathtosavelandmarkcsv = package_path + "/" + save_path;
     pathtoloadlandmarkcsv = package_path + "/" + load_path;
+
+    // Stage latency histograms: publishing period [s] (0 disables the topic) and CSV written on shutdown
+    double metrics_period;
+    std::string metrics_file;
+    nh_.param("metrics_period", metrics_period, 5.0);
+    nh_.param<std::string>("metrics_file", metrics_file, "");
+    if (!metrics_file.empty()) {
+        metricsFile_ = metrics_file[0] == '/' ? metrics_file : package_path + "/" + metrics_file;
+    }
+
+    // Timeline trace of every callback and stage, off unless trace_file is set
+    std::string trace_file;
+    int trace_max_events;
+    nh_.param<std::string>("trace_file", trace_file, "");
+    nh_.param("trace_max_events", trace_max_events, 1000000);
+    if (!trace_file.empty()) {
+        traceFile_ = trace_file[0] == '/' ? trace_file : package_path + "/" + trace_file;
+        trace_.setCapacity(static_cast<size_t>(std::max(trace_max_events, 0)));
+        trace_.setEnabled(true);
+    }
     nh_.getParam("savetaglocation", savetaglocation);
     nh_.getParam("usepriortagtable", usepriortagtable);
+    // Localisation anchors the calibrated tags and ignores any tag missing from the table
+    options.usePriorTagTable = usepriortagtable;
+    options.skipUnknownTags = usepriortagtable;
+
+    // Detections are kept this long (seconds) waiting for the pose they belong to
+    nh_.param("detection_buffer_horizon", detectionBufferHorizon_, 2.0);
+    detectionBuffer_.setHorizon(detectionBufferHorizon_);
+    odomBuffer_.setHorizon(detectionBufferHorizon_);
+
+    // Merge same-tag observations from overlapping cameras into one factor
+    nh_.param("fuseduplicatedetections", options.fuseDuplicateDetections, true);
+    // Bound on the bearing-range factors per pose, the most informative detections are kept
+    nh_.param("max_observations_per_pose", options.observationBudget.maxObservations, 0);
+    nh_.param("budget_estimated_tag_sigma", options.observationBudget.estimatedTagSigma, 0.5);
 
 
     // Load camera topics
@@ -100,64 +218,76 @@ aprilslamcpp::aprilslamcpp(ros::NodeHandle node_handle)
             Eigen::Vector3d transform(0.0, 0.0, 0.0);
 
             camera_infos_.emplace_back(CameraInfo{name, topic, frame_id, transform});
+
+            // Optional extrinsic: [x, y, yaw] in the robot frame, used instead of TF
+            bool known = false;
+            if (camera_list[i].hasMember("extrinsic") && camera_list[i]["extrinsic"].getType() == XmlRpc::XmlRpcValue::TypeArray
+                && camera_list[i]["extrinsic"].size() == 3) {
+                for (int k = 0; k < 3; ++k) {
+                    XmlRpc::XmlRpcValue& v = camera_list[i]["extrinsic"][k];
+                    transform(k) = v.getType() == XmlRpc::XmlRpcValue::TypeInt ? static_cast<int>(v) : static_cast<double>(v);
+                }
+                setCameraExtrinsic(camera_infos_.back(), transform);
+                ROS_INFO("Extrinsic from config for [%s]: (%.2f, %.2f, %.2f rad)",
+                         name.c_str(), transform(0), transform(1), transform(2));
+                known = true;
+            }
+            extrinsicKnown_.push_back(known);
         }
     } else {
         ROS_WARN("Failed to load camera_config/cameras or invalid format.");
     }
 
-    // Wait for static transforms using frame_id
-    for (auto& cam : camera_infos_) {
-        tf2::Transform tf;
-        const int max_attempts = 20;
-        const ros::Duration retry_interval(0.5);
-        bool success = false;
-
-        for (int attempt = 0; attempt < max_attempts; ++attempt) {
-            if (getStaticTransform(robot_frame, cam.frame_id, tf)) {
-                
-                tf2::Vector3 trans = tf.getOrigin();
-                tf2::Quaternion rot = tf.getRotation();
-
-                // Convert to Eigen
-                Eigen::Vector3d tf_trans(trans.x(), trans.y(), trans.z());
-                Eigen::Quaterniond tf_rot(rot.w(), rot.x(), rot.y(), rot.z());
-                Eigen::Matrix3d R = tf_rot.toRotationMatrix();
-
-                Eigen::Vector3d z_axis_robot = R.col(2); 
-                z_axis_robot.z() = 0.0;  
-                z_axis_robot.normalize();  
-                double yaw = std::atan2(z_axis_robot.y(), z_axis_robot.x()); 
-
-                // Final transform
-                cam.transform = Eigen::Vector3d(tf_trans.x(), tf_trans.y(), yaw);
-                ROS_INFO("TF loaded for [%s] (%s): (%.2f, %.2f, %.2f rad)",
-                        cam.name.c_str(), cam.frame_id.c_str(), tf_trans.x(), tf_trans.y(), yaw);
-                success = true;
-                break;
-            } else {
-                ROS_WARN("Waiting for static TF from %s to %s... (attempt %d)",
-                        robot_frame.c_str(), cam.frame_id.c_str(), attempt + 1);
-                retry_interval.sleep();
-            }
+    // Offline replay has no live TF tree: the bag's /tf_static stands in for it and nothing is
+    // waited for
+    std::string replay_bag, replay_odometry_csv;
+    nh_.param<std::string>("replay_bag", replay_bag, "");
+    nh_.param<std::string>("replay_odometry_csv", replay_odometry_csv, "");
+    const bool replaying = !replay_bag.empty() || !replay_odometry_csv.empty();
+    if (!replay_bag.empty()) {
+        ROS_INFO("Read %zu static transforms from %s", loadBagStaticTransforms(replay_bag, tf_buffer_), replay_bag.c_str());
+    }
+
+    // Wait for static transforms using frame_id. Inside a nodelet manager the constructor must
+    // not block, the lookup is tried once here and then retried on a timer.
+    const bool wait = standalone_ && !replaying;
+    const int max_attempts = wait ? 20 : 1;
+    const ros::Duration retry_interval(0.5);
+    bool success = false;
+    for (int attempt = 0; attempt < max_attempts && !success; ++attempt) {
+        success = lookupCameraExtrinsics(wait ? 2.0 : 0.0);
+        if (!success && attempt + 1 < max_attempts) {
+            ROS_WARN("Waiting for static TF from the cameras to %s... (attempt %d)", robot_frame.c_str(), attempt + 1);
+            retry_interval.sleep();
         }
-
-        if (!success) {
-            ROS_ERROR("Failed to get static transform for camera %s (%s). Shutting down.",
-                    cam.name.c_str(), cam.frame_id.c_str());
-            ros::shutdown();
-            return;
+    }
+    if (!success && !standalone_) {
+        ROS_WARN("Camera extrinsics not on TF yet, data is ignored until they are");
+        extrinsic_timer_ = nh_.createTimer(ros::Duration(0.5), [this](const ros::TimerEvent&) {
+            if (!lookupCameraExtrinsics(0.0)) return;
+            ROS_INFO("Camera extrinsics loaded");
+            ready_ = true;
+            extrinsic_timer_.stop();
+        });
+    } else if (!success) {
+        for (size_t c = 0; c < camera_infos_.size(); ++c) {
+            if (extrinsicKnown_[c]) continue;
+            ROS_ERROR("Failed to get static transform for camera %s (%s)%s.", camera_infos_[c].name.c_str(),
+                      camera_infos_[c].frame_id.c_str(), replaying ? ", set its extrinsic in camera_config" : "");
         }
+        return;
     }
+    ready_ = success;
  
     // Load outlier removal conditons
-    nh_.getParam("useoutlierremoval", useoutlierremoval); 
-    nh_.getParam("jumpCombinedThreshold", jumpCombinedThreshold); 
-    nh_.getParam("outlierRemovalStartIndex_", outlierRemovalStartIndex_);
+    nh_.getParam("useoutlierremoval", options.useOutlierRemoval); 
+    nh_.getParam("jumpCombinedThreshold", options.jumpCombinedThreshold); 
+    nh_.getParam("outlierRemovalStartIndex_", options.outlierRemovalStartIndex);
 
-    // Load outlier removal conditons
-    nh_.getParam("usetrajsmoothing", usetrajsmoothing); 
-    nh_.getParam("smoothingwindow", smoothingwindow); 
-    nh_.getParam("smoothingStartIndex_", smoothingStartIndex_);
+    // Load trajectory smoothing conditons
+    nh_.getParam("usetrajsmoothing", options.useTrajSmoothing); 
+    nh_.getParam("smoothingwindow", options.smoothingWindow); 
+    nh_.getParam("smoothingStartIndex_", options.smoothingStartIndex);
 
     // save localisation result
     refined_odom_csv.open("/home/shuoyuan/catkin_slam_ws/src/aprilslamcpp/refined_odometry.csv", std::ios::out);
@@ -165,18 +295,51 @@ aprilslamcpp::aprilslamcpp(ros::NodeHandle node_handle)
     refined_odom_csv << "time,x,y,theta\n";  // Write header
     raw_odom_csv << "time,x,y,theta\n";  // Write header
 
-    // Load saveLandmarks
-    savedLandmarks = loadLandmarksFromCSV(pathtoloadlandmarkcsv);
+    // Load saveLandmarks, or only the tile index of a tiled map (tiles follow the robot)
+    std::string landmark_tile_dir;
+    double landmark_tile_size;
+    TileParams tileParams;
+    nh_.param<std::string>("landmark_tile_dir", landmark_tile_dir, "");
+    nh_.param("landmark_tile_size", landmark_tile_size, 20.0);
+    nh_.param("landmark_tile_load_radius", tileParams.loadRadius, 30.0);
+    nh_.param("landmark_tile_evict_radius", tileParams.evictRadius, 45.0);
+    int landmark_tile_max;
+    nh_.param("landmark_tile_max", landmark_tile_max, 16);
+    tileParams.maxTiles = static_cast<size_t>(std::max(landmark_tile_max, 1));
+    nh_.param("landmark_tile_update_distance", tileUpdateDistance_, 2.0);
+    if (!landmark_tile_dir.empty()) {
+        std::string tileDir = landmark_tile_dir[0] == '/' ? landmark_tile_dir : package_path + "/" + landmark_tile_dir;
+        landmarkTiles_.setParams(tileParams);
+        if (!landmarkTiles_.open(tileDir)) {
+            // First run on this map: split the landmark table once
+            ROS_WARN("No tile index in %s, splitting %s into %.1f m tiles", tileDir.c_str(), pathtoloadlandmarkcsv.c_str(), landmark_tile_size);
+            ::mkdir(tileDir.c_str(), 0755);
+            if (writeLandmarkTiles(loadLandmarksFromCSV(pathtoloadlandmarkcsv), tileDir, landmark_tile_size)) {
+                landmarkTiles_.open(tileDir);
+            }
+        }
+        useLandmarkTiles_ = landmarkTiles_.isOpen();
+        if (useLandmarkTiles_) {
+            MapBounds bounds = landmarkTiles_.bounds();
+            ROS_INFO("Tiled landmark map: %zu tiles in %s, x [%.1f, %.1f], y [%.1f, %.1f]", landmarkTiles_.tileCount(), tileDir.c_str(),
+                     bounds.xmin, bounds.xmax, bounds.ymin, bounds.ymax);
+        } else {
+            ROS_ERROR("Could not open or create the landmark tiles in %s, loading the whole map", tileDir.c_str());
+        }
+    }
+    if (!useLandmarkTiles_) {
+        savedLandmarks = loadLandmarksFromCSV(pathtoloadlandmarkcsv);
+    }
 
-    // Initialize noise models
-    odometryNoise = gtsam::noiseModel::Diagonal::Sigmas((gtsam::Vector(3) << odometry_noise[0], odometry_noise[1], odometry_noise[2]).finished());
-    priorNoise = gtsam::noiseModel::Diagonal::Sigmas((gtsam::Vector(3) << prior_noise[0], prior_noise[1], prior_noise[2]).finished());
-    brNoise = gtsam::noiseModel::Diagonal::Sigmas((gtsam::Vector(2) << bearing_range_noise[0], bearing_range_noise[1]).finished());
-    pointNoise = gtsam::noiseModel::Diagonal::Sigmas((gtsam::Vector(2) << point_noise[0], point_noise[1]).finished());
-    loopClosureNoise = gtsam::noiseModel::Diagonal::Sigmas((gtsam::Vector(3) << loop_ClosureNoise[0], loop_ClosureNoise[1], loop_ClosureNoise[2]).finished());
+    // Noise models
+    options.odometrySigmas = Eigen::Vector3d(odometry_noise[0], odometry_noise[1], odometry_noise[2]);
+    options.priorSigmas = Eigen::Vector3d(prior_noise[0], prior_noise[1], prior_noise[2]);
+    options.bearingRangeSigmas = Eigen::Vector2d(bearing_range_noise[0], bearing_range_noise[1]);
+    options.pointSigmas = Eigen::Vector2d(point_noise[0], point_noise[1]);
+    options.loopClosureSigmas = Eigen::Vector3d(loop_ClosureNoise[0], loop_ClosureNoise[1], loop_ClosureNoise[2]);
 
     // Optimiser selection
-    nh_.getParam("useisam2", useisam2);
+    nh_.getParam("useisam2", options.useIsam2);
 
     // Total number of IDs
     int total_tags;
@@ -188,19 +351,18 @@ aprilslamcpp::aprilslamcpp(ros::NodeHandle node_handle)
     
     ROS_INFO("Parameters loaded.");
 
-    // Initialize GTSAM components
-    initializeGTSAM();
-    // Index to keep track of the sequential pose.
-    index_of_pose = 1;
-    previousframeSymbol = index_of_pose;
-    // Initialize the factor graphs
-    keyframeGraph_ = gtsam::NonlinearFactorGraph();
+    // Localisation solves after every keyframe
+    options.incremental = true;
+    estimator_ = Estimator(options);
+    estimator_.setPriorMap(savedLandmarks);
+    estimator_.setMetrics(&metrics_);
+    estimator_.setTrace(&trace_);
 
     // Initialize camera subscribers
     
     for (const auto& cam : camera_infos_) {
-        ros::Subscriber sub = nh_.subscribe<apriltag_ros::AprilTagDetectionArray>(
-            cam.topic, 1,
+        ros::Subscriber sub = sensor_nh_.subscribe<apriltag_ros::AprilTagDetectionArray>(
+            cam.topic, 10,
             boost::bind(&aprilslamcpp::cameraCallback, this, _1, cam.name)
         );
         camera_subscribers_.push_back(sub);
@@ -208,9 +370,16 @@ aprilslamcpp::aprilslamcpp(ros::NodeHandle node_handle)
     
     // Initialise pose0 using particle filter, set a timer to ensure the initilisation is done properly
     if (usePFinitialise) {
+        pf_status_pub_ = nh_.advertise<std_msgs::String>("pf_init_status", 1, true);
+        pf_progress_pub_ = nh_.advertise<geometry_msgs::PoseWithCovarianceStamped>("pf_init_pose", 1, true);
+        pf_status_srv_ = nh_.advertiseService("pf_init_status", &aprilslamcpp::pfInitStatusService, this);
+        pf_restart_srv_ = nh_.advertiseService("pf_init_restart", &aprilslamcpp::pfInitRestartService, this);
+        publishPFInitStatus("waiting for detections");
         pf_init_timer_ = nh_.createTimer(ros::Duration(0.5), &aprilslamcpp::pfInitCallback, this);
     } else {
         pose0 = gtsam::Pose2(0.0, 0.0, 0.0);
+        estimator_.setInitialPose(pose0);
+        updateLandmarkTiles(pose0, true);
     }
     
     // Subscriptions and Publications
@@ -220,26 +389,21 @@ aprilslamcpp::aprilslamcpp(ros::NodeHandle node_handle)
     landmark_pub_ = nh_.advertise<visualization_msgs::MarkerArray>("landmarks", 1, true);
     path.header.frame_id = map_frame_id; 
     odom_traj_pub_ = nh_.advertise<nav_msgs::Odometry>("/odom_tag", 1, true);
-}
-
-double aprilslamcpp::computePoseDelta(const gtsam::Pose2& oldPose, const gtsam::Pose2& newPose){
-    double dx = newPose.x() - oldPose.x();
-    double dy = newPose.y() - oldPose.y();
-
-    // Get the old heading
-    double oldTheta = oldPose.theta();
-
-    // Project the (dx,dy) onto the axis perpendicular to oldTheta
-    // i.e. dot it with [ -sin(theta), cos(theta) ]
-    double lat = dx * (-std::sin(oldTheta)) + dy * std::cos(oldTheta);
-
-    // Return absolute value to get the magnitude of the lateral jump
-    return std::fabs(lat);
+    reloc_status_pub_ = nh_.advertise<std_msgs::String>("relocalisation_status", 1, true);
+    arrival_latency_pub_ = nh_.advertise<std_msgs::Float64>("latency/detection_arrival", 10);
+    pose_latency_pub_ = nh_.advertise<std_msgs::Float64>("latency/detection_to_pose", 10);
+    metrics_pub_ = nh_.advertise<diagnostic_msgs::DiagnosticArray>("metrics", 1, true);
+    if (metrics_period > 0.0) {
+        metrics_timer_ = nh_.createTimer(ros::Duration(metrics_period), &aprilslamcpp::metricsCallback, this);
+    }
 }
 
 void aprilslamcpp::pfInitCallback(const ros::TimerEvent& event) {
+    if (!ready_) return;
     // Initial debug message for function entry
     ROS_INFO("PF Running");
+    TraceSpan span(&trace_, "pf_init_callback", "callback");
+    std::lock_guard<std::mutex> estimateLock(estimateMutex_);
     // If PF initialization already completed, stop the timer and return.
     if (pfInitialized_) {
         pf_init_timer_.stop();
@@ -247,19 +411,30 @@ void aprilslamcpp::pfInitCallback(const ros::TimerEvent& event) {
     }
 
     // Attempt to get camera detections
-    auto detections = getCamDetections(camera_infos_, camera_detections_);
-    const std::vector<int>& Id = detections.first;
-    const std::vector<Eigen::Vector2d>& tagPos = detections.second;
+    {
+        std::lock_guard<std::mutex> lock(detectionMutex_);
+        getCamDetections(camera_infos_, camera_detections_, detectionBatch_);
+    }
         
     std::vector<int> validIds;
     std::vector<Eigen::Vector2d> validTagPos;
+    // Tiled map: nothing is loaded before the pose is known, fetch the tiles of the seen tags
+    if (useLandmarkTiles_) {
+        bool loaded = false;
+        for (size_t i = 0; i < detectionBatch_.size(); ++i) {
+            if (savedLandmarks.count(detectionBatch_.ids[i]) == 0) {
+                loaded |= landmarkTiles_.loadTileWithTag(detectionBatch_.ids[i]);
+            }
+        }
+        if (loaded) savedLandmarks = landmarkTiles_.active();
+    }
     // Ensure all used tags exists int the prior tag table
-    for (size_t i = 0; i < Id.size(); ++i) {
-        if (savedLandmarks.find(Id[i]) != savedLandmarks.end()) {
-            validIds.push_back(Id[i]);
-            validTagPos.push_back(tagPos[i]);
+    for (size_t i = 0; i < detectionBatch_.size(); ++i) {
+        if (savedLandmarks.find(detectionBatch_.ids[i]) != savedLandmarks.end()) {
+            validIds.push_back(detectionBatch_.ids[i]);
+            validTagPos.push_back(detectionBatch_.tagPos(i));
         } else {
-            ROS_WARN("Skipping unknown tag ID: %d", Id[i]);
+            ROS_WARN("Skipping unknown tag ID: %d", detectionBatch_.ids[i]);
         }
     }
     
@@ -271,84 +446,188 @@ void aprilslamcpp::pfInitCallback(const ros::TimerEvent& event) {
 
     ROS_INFO("Number of tags observed: %zu", validIds.size());
 
+    // Two or more known tags fix the pose directly, no need to run the PF
+    AlignmentResult alignment;
+    if (useclosedforminit && alignTagsToMap(validIds, validTagPos, savedLandmarks, alignParams_, alignment)) {
+        pose0 = alignment.pose;
+        estimator_.setInitialPose(pose0);
+        updateLandmarkTiles(pose0, true);
+        pfInitialized_ = true;
+        pfInitInProgress_ = false;
+        pf_init_timer_.stop();
+        pf_.clear();
+
+        // Residual as the per-tag noise: position variance shrinks with the tag count,
+        // heading variance with the spread of the inlier tags around their centroid
+        double sigma2 = std::max(alignment.rmse * alignment.rmse, 1e-4);
+        Eigen::Vector2d centroid = Eigen::Vector2d::Zero();
+        for (int i : alignment.inliers) centroid += validTagPos[i];
+        centroid /= double(alignment.inliers.size());
+        double spread = 0.0;
+        for (int i : alignment.inliers) spread += (validTagPos[i] - centroid).squaredNorm();
+        Eigen::Matrix3d cov = Eigen::Vector3d(sigma2 / alignment.inliers.size(),
+                                              sigma2 / alignment.inliers.size(),
+                                              sigma2 / std::max(spread, 1e-6)).asDiagonal();
+        publishPoseWithCovariance(pf_progress_pub_, Eigen::Vector3d(pose0.x(), pose0.y(), pose0.theta()), cov, map_frame_id);
+
+        char status[256];
+        std::snprintf(status, sizeof(status), "closed-form: x = %.3f, y = %.3f, theta = %.3f, %zu/%zu tags, rmse = %.3f m",
+                      pose0.x(), pose0.y(), pose0.theta(), alignment.inliers.size(), validIds.size(), alignment.rmse);
+        publishPFInitStatus(std::string("converged, ") + status);
+        ROS_INFO("Initialisation finalized, %s", status);
+        return;
+    }
+
     double currentTime = ros::Time::now().toSec();
 
     // Start PF initialization if not started yet
     if (!pfInitInProgress_) {
         pfInitInProgress_ = true;
         pfInitStartTime_ = currentTime;
+        pfConvergedCount_ = 0;
+        ++pfAttempt_;
 
         // Initialize particles from the first detected tag
-        x_P_pf_ = initParticlesFromFirstTag(validIds, validTagPos, savedLandmarks, PFWaitTime);
+        pf_.setParticles(initParticlesFromFirstTag(validIds, validTagPos, savedLandmarks, N_particles));
+        pfHaveOdom_ = false;
+
+        ROS_INFO("PF initialization started, attempt %d.", pfAttempt_);
+    }
 
-        ROS_INFO("PF initialization started.");
+    // Odometry since the previous step; with one tag only the motion makes the heading observable
+    gtsam::Pose2 motion;
+    gtsam::Pose2 odomNow;
+    if (!odomBuffer_.empty() && odomBuffer_.interpolate(odomBuffer_.latestStamp(), odomNow)) {
+        if (pfHaveOdom_) motion = pfLastOdom_.between(odomNow);
+        pfLastOdom_ = odomNow;
+        pfHaveOdom_ = true;
     }
+    pf_.step(validIds, validTagPos, savedLandmarks, motion);
 
-    double elapsed = currentTime - pfInitStartTime_;
+    // Spread and weight health of the current estimate
+    Eigen::Vector3d x_est_pf = pf_.mean();
+    Eigen::Matrix3d cov_pf = pf_.covariance();
+    double posStd = std::sqrt(std::max(cov_pf(0, 0), cov_pf(1, 1)));
+    double thetaStd = std::sqrt(cov_pf(2, 2));
+    double essRatio = pf_.effectiveSampleSize() / std::max<size_t>(1, pf_.size());
+    publishPoseWithCovariance(pf_progress_pub_, x_est_pf, cov_pf, map_frame_id);
 
-    if (elapsed < PFWaitTime) {
-        // Within the PF init duration, run PF update
-        x_P_pf_ = particleFilter(validIds, validTagPos, savedLandmarks, x_P_pf_, PFWaitTime, rngVar_, brngVar_);
+    if (posStd < pfConvergePosStd_ && thetaStd < pfConvergeThetaStd_ && essRatio >= pfConvergeEss_) {
+        ++pfConvergedCount_;
     } else {
-        // PF initialization time is up. Run PF one last time to get final estimate
-        x_P_pf_ = particleFilter(validIds, validTagPos, savedLandmarks, x_P_pf_, PFWaitTime, rngVar_, brngVar_);
+        pfConvergedCount_ = 0;
+    }
 
-        // Compute x_est as mean of particles
-        Eigen::Vector3d sum_states(0,0,0);
-        for (const auto& particle : x_P_pf_) {
-            sum_states += particle;
-        }
-        Eigen::Vector3d x_est_pf = sum_states / static_cast<double>(PFWaitTime);
+    char status[256];
+    std::snprintf(status, sizeof(status),
+                  "attempt %d: x = %.3f, y = %.3f, theta = %.3f, std = %.3f m / %.3f rad, ESS = %.2f, N = %zu",
+                  pfAttempt_, x_est_pf(0), x_est_pf(1), x_est_pf(2), posStd, thetaStd, essRatio, pf_.size());
+    ROS_INFO("PF %s", status);
+
+    // Accept once the estimate has stayed converged for a few consecutive steps
+    if (pfConvergedCount_ >= pfConvergeSteps_) {
+        pose0 = gtsam::Pose2(x_est_pf(0), x_est_pf(1), x_est_pf(2));
+        estimator_.setInitialPose(pose0);
+        updateLandmarkTiles(pose0, true);
+        pfInitialized_ = true;
+        pfInitInProgress_ = false;
+
+        // Stop the timer now that initialization is complete
+        pf_init_timer_.stop();
 
-        // Report the initialization result
-        ROS_INFO("PF initialization result: x = %f, y = %f, theta = %f", x_est_pf(0), x_est_pf(1), 0.0);
-        ROS_INFO("PLEASE DONT MOVE THE ROBOT!!!");
+        // Free up memory
+        pf_.clear();
 
-        // Ask user for confirmation
-        std::string userInput;
-        ROS_INFO("Are you satisfied with the PF initialization result? (yes/no): ");
-        std::cin >> userInput;
+        publishPFInitStatus(std::string("converged, ") + status);
+        ROS_INFO("PF initialization finalized successfully after %.1f s.", currentTime - pfInitStartTime_);
+        return;
+    }
 
-        if (userInput == "yes") {
-            // Finalize PF initialization using the PF-derived initial pose
-            pose0 = gtsam::Pose2(x_est_pf(0), x_est_pf(1), 0);
-            pfInitialized_ = true;
-            pfInitInProgress_ = false;
+    if (currentTime - pfInitStartTime_ < PFWaitTime) {
+        publishPFInitStatus(std::string("running, ") + status);
+        return;
+    }
 
-            // Stop the timer now that initialization is complete
-            pf_init_timer_.stop();
+    // Attempt timed out without converging: restart from a fresh particle set, or give up
+    pfInitInProgress_ = false;
+    pf_.clear();
+    if (pfMaxRetries_ > 0 && pfAttempt_ >= pfMaxRetries_) {
+        pf_init_timer_.stop();
+        publishPFInitStatus("failed after " + std::to_string(pfAttempt_) + " attempts, call pf_init_restart to try again");
+        ROS_ERROR("PF initialization did not converge after %d attempts.", pfAttempt_);
+    } else {
+        publishPFInitStatus("attempt " + std::to_string(pfAttempt_) + " did not converge, retrying");
+        ROS_WARN("PF initialization did not converge within %.1f s. Restarting initialization process.", PFWaitTime);
+    }
+}
 
-            // Free up memory
-            x_P_pf_.clear();
+void aprilslamcpp::publishPFInitStatus(const std::string& status) {
+    pfStatus_ = status;
+    std_msgs::String msg;
+    msg.data = status;
+    pf_status_pub_.publish(msg);
+}
 
-            ROS_INFO("PF initialization finalized successfully.");
-        } else {
-            // Restart initialization process
-            pfInitInProgress_ = false;
-            ROS_WARN("PF initialization rejected. Restarting initialization process.");
-            x_P_pf_.clear();
-        }
+bool aprilslamcpp::pfInitStatusService(std_srvs::Trigger::Request& req, std_srvs::Trigger::Response& res) {
+    std::lock_guard<std::mutex> estimateLock(estimateMutex_);
+    res.success = pfInitialized_;
+    res.message = pfStatus_;
+    return true;
+}
+
+bool aprilslamcpp::pfInitRestartService(std_srvs::Trigger::Request& req, std_srvs::Trigger::Response& res) {
+    std::lock_guard<std::mutex> estimateLock(estimateMutex_);
+    if (pfInitialized_) {
+        res.success = false;
+        res.message = "already initialised";
+        return true;
     }
+    pfAttempt_ = 0;
+    pfInitInProgress_ = false;
+    pf_.clear();
+    pf_init_timer_.start();
+    publishPFInitStatus("restarted, waiting for detections");
+    res.success = true;
+    res.message = pfStatus_;
+    return true;
 }
 
 void aprilslamcpp::cameraCallback(
     const apriltag_ros::AprilTagDetectionArray::ConstPtr& msg,
     const std::string& camera_name) {
+    if (!ready_) return;
+    TraceSpan span(&trace_, "camera_callback", "callback");
+    span.arg("detections", msg->detections.size());
+    std::lock_guard<std::mutex> lock(detectionMutex_);
     
     if (!msg->detections.empty()) {
         camera_detections_[camera_name] = msg;
+        detectionBuffer_.push(cameraIndex(camera_name), msg->header.stamp.toSec(), msg);
+
+        std_msgs::Float64 latency;
+        latency.data = (ros::Time::now() - msg->header.stamp).toSec();
+        arrival_latency_pub_.publish(latency);
     } else {
         camera_detections_.erase(camera_name);
     }
 }
 
+int aprilslamcpp::cameraIndex(const std::string& camera_name) const {
+    for (size_t c = 0; c < camera_infos_.size(); ++c) {
+        if (camera_infos_[c].name == camera_name) return static_cast<int>(c);
+    }
+    return -1;
+}
+
 bool aprilslamcpp::getStaticTransform(const std::string& target_frame,
                                       const std::string& source_frame,
-                                      tf2::Transform& out_tf) {
+                                      tf2::Transform& out_tf,
+                                      double timeout) {
+    TraceSpan span(&trace_, "tf_lookup", "tf");
     try {
         geometry_msgs::TransformStamped transform_stamped =
             tf_buffer_.lookupTransform(target_frame, source_frame,
-                                       ros::Time(0), ros::Duration(2.0));
+                                       ros::Time(0), ros::Duration(timeout));
         tf2::fromMsg(transform_stamped.transform, out_tf);
         return true;
     } catch (tf2::TransformException& ex) {
@@ -358,170 +637,101 @@ bool aprilslamcpp::getStaticTransform(const std::string& target_frame,
     }
 }
 
-// Applies a moving average filter to smooth the trajectory
-void aprilslamcpp::smoothTrajectory(int window_size) {
-    // If empty, nothing to do
-    if (Estimates_visulisation.empty()) {
-        return;
-    }
-
-    // Collect all X(...) poses in a vector
-    std::vector<std::pair<gtsam::Symbol, gtsam::Pose2>> xPoses;
-    xPoses.reserve(Estimates_visulisation.size()); // minor optimization
-
-    for (const auto& key_value : Estimates_visulisation) {
-        gtsam::Symbol key(key_value.key);
-        if (key.chr() == 'X') {
-            // Convert the stored value to Pose2
-            gtsam::Pose2 pose = key_value.value.cast<gtsam::Pose2>();
-            xPoses.emplace_back(key, pose);
+bool aprilslamcpp::lookupCameraExtrinsics(double timeout) {
+    bool all = true;
+    for (size_t c = 0; c < camera_infos_.size(); ++c) {
+        if (extrinsicKnown_[c]) continue;
+        CameraInfo& cam = camera_infos_[c];
+        tf2::Transform tf;
+        if (!getStaticTransform(robot_frame, cam.frame_id, tf, timeout)) {
+            all = false;
+            continue;
         }
-    }
-
-    // If fewer than window_size, skip smoothing
-    if (xPoses.size() < static_cast<size_t>(window_size)) {
-        return;
-    }
-
-    // Sort by Symbol index so we know which one is "last"
-    std::sort(xPoses.begin(), xPoses.end(),
-              [](const auto& a, const auto& b) {
-                  return a.first.index() < b.first.index();
-              });
-
-    // Sum up the y-coordinates from the last `window_size` poses
-    double sumY = 0.0;
-    double sumX = 0.0;
-    for (size_t i = xPoses.size() - window_size; i < xPoses.size(); ++i) {
-        sumY += xPoses[i].second.y();
-        sumX += xPoses[i].second.x();
-    }
-
-    // Compute the average y
-    double avgY = sumY / window_size;
-    double avgX = sumX / window_size;
-
-    // Grab the final pose's x and theta exactly as-is
-    gtsam::Pose2 lastPose = xPoses.back().second;    // the last stored pose
-    double keepTheta = lastPose.theta();             // no smoothing for orientation
-
-    // Construct a "smoothed" pose for the last key
-    gtsam::Pose2 smoothedPose(avgX, avgY, keepTheta);
-
-    // Overwrite the last pose in the values with our new partial-smooth version
-    gtsam::Symbol lastKey = xPoses.back().first;
-    if (Estimates_visulisation.exists(lastKey)) {
-        Estimates_visulisation.update(lastKey, smoothedPose);
-    }
-}
-
-// Initialization of GTSAM components
-void aprilslamcpp::initializeGTSAM() { 
-    // Initialize graph parameters and stores them in isam_.
-    gtsam::ISAM2Params parameters;
-    parameters.relinearizeThreshold = 0.1;
-    parameters.relinearizeSkip = 1;
-    isam_ = gtsam::ISAM2(parameters);
+        tf2::Vector3 trans = tf.getOrigin();
+        tf2::Quaternion rot = tf.getRotation();
+
+        // Convert to Eigen
+        Eigen::Vector3d tf_trans(trans.x(), trans.y(), trans.z());
+        Eigen::Quaterniond tf_rot(rot.w(), rot.x(), rot.y(), rot.z());
+        Eigen::Matrix3d R = tf_rot.toRotationMatrix();
+
+        Eigen::Vector3d z_axis_robot = R.col(2);
+        z_axis_robot.z() = 0.0;
+        z_axis_robot.normalize();
+        double yaw = std::atan2(z_axis_robot.y(), z_axis_robot.x());
+
+        // Final transform, rotation precomputed once for all detections
+        setCameraExtrinsic(cam, Eigen::Vector3d(tf_trans.x(), tf_trans.y(), yaw));
+        ROS_INFO("TF loaded for [%s] (%s): (%.2f, %.2f, %.2f rad)",
+                 cam.name.c_str(), cam.frame_id.c_str(), tf_trans.x(), tf_trans.y(), yaw);
+        extrinsicKnown_[c] = true;
+    }
+    return all;
 }
 
 aprilslamcpp::~aprilslamcpp() {
         // Empty destructor, no resources to clean up.
         ROS_INFO("Shutting down aprilslamcpp.");
-}
-
-bool aprilslamcpp::shouldAddKeyframe(
-    const gtsam::Pose2& lastPose, 
-    const gtsam::Pose2& currentPose, 
-    std::set<gtsam::Symbol> oldlandmarks, 
-    std::set<gtsam::Symbol> detectedLandmarksCurrentPos) {
-    // Calculate the distance between the current pose and the last keyframe pose
-    double distance = lastPose.range(currentPose);
-    // Iterate over detectedLandmarksCurrentPos, add key if new tag is detected
-    for (const auto& landmark : detectedLandmarksCurrentPos) {
-        // If the landmark is not found in oldLandmarks, return true
-        if (oldlandmarks.find(landmark) == oldlandmarks.end()) {
-            return true;
+        ROS_INFO("Duplicate tag observations fused: %ld factors saved.", estimator_.fusedFactorsSaved());
+        if (poseLatencyCount_ > 0) {
+            ROS_INFO("Detection to pose latency: mean %.1f ms, max %.1f ms over %ld keyframes.",
+                     1e3 * poseLatencySum_ / poseLatencyCount_, 1e3 * poseLatencyMax_, poseLatencyCount_);
         }
-    }
-    // Calculate the difference in orientation (theta) between the current pose and the last keyframe pose
-    double angleDifference = std::abs(wrapToPi(currentPose.theta() - lastPose.theta()));
+        dumpMetrics();
+        writeTrace();
+}
 
-    // Check if either the distance moved or the rotation exceeds the threshold
-    if (distance > distanceThreshold || angleDifference > rotationThreshold) {
-        return true;  // Add a new keyframe
-    }
-    return false;  // Do not add a keyframe
+void aprilslamcpp::metricsCallback(const ros::TimerEvent& event) {
+    TraceSpan span(&trace_, "metrics_callback", "callback");
+    std::lock_guard<std::mutex> estimateLock(estimateMutex_);
+    aprilslam::publishMetrics(metrics_pub_, metrics_, ros::this_node::getName());
 }
 
-void aprilslamcpp::pruneGraphByPoseCount(int maxPoses) {
-    // Extract all pose keys from the graph
-    std::set<gtsam::Key> poseKeys;
-    for (const auto& factor : keyframeGraph_) {
-        for (const auto& key : factor->keys()) {
-            gtsam::Symbol symbol(key);
-            if (symbol.chr() == 'X') { // Assuming 'X' represents pose variables
-                poseKeys.insert(key);
-            }
+void aprilslamcpp::dumpMetrics() {
+    for (size_t i = 0; i < StageMetrics::kStages; ++i) {
+        Stage stage = static_cast<Stage>(i);
+        const LatencyHistogram& hist = metrics_.histogram(stage);
+        if (hist.count() == 0) continue;
+        ROS_INFO("%-20s n = %6lu  p50 %8.2f ms  p95 %8.2f ms  p99 %8.2f ms  max %8.2f ms",
+                 stageName(stage), static_cast<unsigned long>(hist.count()),
+                 1e3 * hist.percentile(0.50), 1e3 * hist.percentile(0.95),
+                 1e3 * hist.percentile(0.99), 1e3 * hist.max());
+    }
+    if (!metricsFile_.empty()) {
+        if (metrics_.writeCSV(metricsFile_)) {
+            ROS_INFO("Stage metrics written to %s", metricsFile_.c_str());
+        } else {
+            ROS_WARN("Could not write stage metrics to %s", metricsFile_.c_str());
         }
     }
+}
 
-    // Check if pruning is needed
-    if (poseKeys.size() <= maxPoses) {
-        // No pruning needed
-        return;
-    }
-
-    // Sort pose keys by their indices
-    std::vector<gtsam::Key> sortedPoseKeys(poseKeys.begin(), poseKeys.end());
-    std::sort(sortedPoseKeys.begin(), sortedPoseKeys.end(), [](gtsam::Key a, gtsam::Key b) {
-        return gtsam::Symbol(a).index() < gtsam::Symbol(b).index();
-    });
-
-    // Identify poses to remove (the oldest ones)
-    std::set<gtsam::Key> keysToRemove(sortedPoseKeys.begin(), sortedPoseKeys.begin() + (poseKeys.size() - maxPoses));
-
-    // Build new graph and estimates without the poses to remove
-    gtsam::NonlinearFactorGraph newGraph;
-    for (const auto& factor : keyframeGraph_) {
-        bool keepFactor = true;
-        for (const auto& key : factor->keys()) {
-            if (keysToRemove.count(key) > 0) {
-                keepFactor = false;
-                break;
-            }
-        }
-        if (keepFactor) {
-            newGraph.add(factor);
-        }
+void aprilslamcpp::writeTrace() {
+    if (traceFile_.empty()) return;
+    if (trace_.dropped() > 0) {
+        ROS_WARN("Trace buffer full, %zu spans were dropped (raise trace_max_events)", trace_.dropped());
     }
-
-    gtsam::Values newEstimates;
-    for (const auto& key_value : keyframeEstimates_) {
-        if (keysToRemove.count(key_value.key) == 0) {
-            newEstimates.insert(key_value.key, key_value.value);
-        }
+    if (trace_.write(traceFile_, ros::this_node::getName())) {
+        ROS_INFO("Trace with %zu spans written to %s", trace_.size(), traceFile_.c_str());
+    } else {
+        ROS_WARN("Could not write the trace to %s", traceFile_.c_str());
     }
+}
 
-    // Update the internal state
-    keyframeGraph_ = newGraph;
-    keyframeEstimates_ = newEstimates;
-
-    // Add a prior to the oldest remaining pose if not already added
-    // Get the oldest remaining pose key
-    gtsam::Key oldestPoseKey = *std::min_element(sortedPoseKeys.begin() + (poseKeys.size() - maxPoses), sortedPoseKeys.end(), [](gtsam::Key a, gtsam::Key b) {
-        return gtsam::Symbol(a).index() < gtsam::Symbol(b).index();
-    });
-
-    gtsam::Symbol oldestPoseSymbol(oldestPoseKey);
-
-    if (!priorAddedToPose[oldestPoseSymbol]) {
-        // Get the current estimate of the pose
-        gtsam::Pose2 oldestPoseEstimate = keyframeEstimates_.at<gtsam::Pose2>(oldestPoseKey);
-        // Add a prior factor
-        keyframeGraph_.add(gtsam::PriorFactor<gtsam::Pose2>(
-            oldestPoseKey, oldestPoseEstimate, priorNoise));
-        // Keep track that we added a prior to this pose
-        priorAddedToPose[oldestPoseSymbol] = true;
+void aprilslamcpp::updateLandmarkTiles(const gtsam::Pose2& pose, bool force) {
+    if (!useLandmarkTiles_) return;
+    if (!force && std::hypot(pose.x() - lastTilePose_.x(), pose.y() - lastTilePose_.y()) < tileUpdateDistance_) return;
+    lastTilePose_ = pose;
+
+    TraceSpan span(&trace_, "update_tiles");
+    TileChange change;
+    if (!landmarkTiles_.update(pose.x(), pose.y(), &change) && !force) return;
+    savedLandmarks = landmarkTiles_.active();
+    estimator_.updatePriorMap(savedLandmarks);
+    span.arg("landmarks", savedLandmarks.size());
+    if (!change.empty()) {
+        ROS_INFO("Landmark tiles: %zu of %zu loaded, %zu tags (+%zu, -%zu)", landmarkTiles_.loadedTiles(), landmarkTiles_.tileCount(),
+                 savedLandmarks.size(), change.loaded.size(), change.evicted.size());
     }
 }
 
@@ -540,370 +750,156 @@ gtsam::Pose2 aprilslamcpp::translateOdomMsg(const nav_msgs::Odometry::ConstPtr&
     return gtsam::Pose2(x, y, yaw);
 }
 
-void aprilslamcpp::ISAM2Optimise() {    
-    if (batchOptimisation_) {
-        gtsam::LevenbergMarquardtOptimizer batchOptimizer(keyframeGraph_, keyframeEstimates_);
-        keyframeEstimates_ = batchOptimizer.optimize();
-        batchOptimisation_ = false; // Only do this once
-    }
+void aprilslam::aprilslamcpp::addOdomFactor(const nav_msgs::Odometry::ConstPtr& msg) {
+    // Camera extrinsics not known yet (nodelet still waiting on TF)
+    if (!ready_) return;
+    // Opened before the lock so waiting on the optimiser shows up in the span
+    TraceSpan span(&trace_, "odom_callback", "callback");
+    std::lock_guard<std::mutex> estimateLock(estimateMutex_);
 
-    // Update the iSAM2 instance with the new measurements
-    isam_.update(keyframeGraph_, keyframeEstimates_);
-    
-    keyframeEstimates_.clear();
-    keyframeGraph_.resize(0);
-}
+    // Convert the incoming odometry message to a simpler (x, y, theta) format using a previously defined method
+    gtsam::Pose2 poseSE2 = translateOdomMsg(msg);
 
-gtsam::Values aprilslamcpp::SAMOptimise() {    
-    // Perform batch optimization using Levenberg-Marquardt optimizer
-    gtsam::LevenbergMarquardtOptimizer batchOptimizer(keyframeGraph_, keyframeEstimates_);
-    gtsam::Values result = batchOptimizer.optimize();
-    return result;
-}
+    // Remember where the robot was, detections are aligned to their own stamp later and the PF
+    // moves its particles by it
+    double odom_stamp = msg->header.stamp.toSec();
+    odomBuffer_.push(odom_stamp, poseSE2);
 
-void aprilslamcpp::checkLoopClosure(const std::set<gtsam::Symbol>& detectedLandmarksCurrentPos) {
-    if (useloopclosure) {
-        // Get the current pose index
-        gtsam::Symbol currentPoseIndex =  gtsam::Symbol('X', index_of_pose);
-        gtsam::Pose2 currentPose =  keyframeEstimates_.at<gtsam::Pose2>(currentPoseIndex);
-        // Loop through each keyframe stored in poseToLandmarks
-        for (const auto& entry : poseToLandmarks) {
-            gtsam::Symbol keyframeSymbol = entry.first;  // Symbol representing the keyframe
-            const std::set<gtsam::Symbol>& keyframeLandmarks = entry.second;  // Landmarks associated with the keyframe
-
-            // Get the keyframe's pose and its index
-            gtsam::Pose2 keyframePose = keyframeEstimates_.at<gtsam::Pose2>(keyframeSymbol);
-            int keyframeIndex = keyframeSymbol.index();  // Assuming index is accessible from the symbol
-
-            // Compute the spatial distance between the current pose and the keyframe pose
-            double distance = lastPose_.range(keyframePose);
-
-            // Check if the spatial distance and index difference meet the loop closure criteria
-            if (distance < historyKeyframeSearchRadius && (currentPoseIndex - keyframeIndex) > historyKeyframeSearchNum) {
-                // Find the intersection of landmarks re-observed at the current pose and the keyframe's landmarks
-                std::set<gtsam::Symbol> intersection;
-                std::set_intersection(detectedLandmarksCurrentPos.begin(), detectedLandmarksCurrentPos.end(),
-                                      keyframeLandmarks.begin(), keyframeLandmarks.end(),
-                                      std::inserter(intersection, intersection.begin()));
-
-                // Count the number of re-observed landmarks
-                int reobservedLandmarks = intersection.size();
-
-                // If the number of re-observed landmarks meets the required threshold, trigger loop closure
-                if (reobservedLandmarks >= requiredReobservedLandmarks) {
-                    ROS_INFO("found LC");
-                    // Add a loop closure constraint between the current pose and the keyframe
-                    keyframeGraph_.add(gtsam::BetweenFactor<gtsam::Pose2>(keyframeSymbol, currentPoseIndex, relPoseFG(keyframePose, currentPose), loopClosureNoise));
-
-                    // Visualize the loop closure
-                    visualizeLoopClosure(lc_pub_, currentPose, keyframePose, currentPoseIndex, map_frame_id);
-
-                    break;  // Exit after adding one loop closure constraint
-                }
-            }
+    // Ignoring odometry because PF is not done yet
+    if (usePFinitialise) {
+        if (!pfInitialized_) {
+            return;
         }
     }
-}
-
-// Check if movement exceeds the stationary thresholds
-bool aprilslam::aprilslamcpp::movementExceedsThreshold(const gtsam::Pose2& poseSE2) {
-    double position_change = std::hypot(poseSE2.x() - lastPoseSE2_.x(), poseSE2.y() - lastPoseSE2_.y());
-    double rotation_change = std::abs(wrapToPi(poseSE2.theta() - lastPoseSE2_.theta()));
-    return position_change >= stationary_position_threshold || rotation_change >= stationary_rotation_threshold;
-}
-
-// Handle initialization of the first pose
-void aprilslam::aprilslamcpp::initializeFirstPose(const gtsam::Pose2& poseSE2, gtsam::Pose2& pose0) {
-    lastPoseSE2_ = poseSE2;
-    lastPoseSE2_vis = poseSE2;
-    keyframeGraph_.add(gtsam::PriorFactor<gtsam::Pose2>(gtsam::Symbol('X', 1), pose0, priorNoise));
-    keyframeEstimates_.insert(gtsam::Symbol('X', 1), pose0);
-    Estimates_visulisation.insert(gtsam::Symbol('X', 1), pose0);
-    lastPose_ = pose0; // Keep track of the last pose for odolandmarkKeymetry calculation
-    lastPose_for_jump = pose0; // For outlier removal
-    // Load calibrated landmarks as priors if available
-    if (usepriortagtable) {
-        for (const auto& landmark : savedLandmarks) {
-            gtsam::Symbol landmarkKey('L', landmark.first);
-            keyframeGraph_.add(gtsam::PriorFactor<gtsam::Point2>(landmarkKey, landmark.second, pointNoise));
-            keyframeEstimates_.insert(landmarkKey, landmark.second);
-            landmarkEstimates.insert(landmarkKey, landmark.second);
-        }
+    
+    // Publishing and logging are spread over the step, their laps are summed and recorded once
+    Stopwatch stopwatch;
+    double publishingTime = 0.0;
+    double loggingTime = 0.0;
+
+    // Stamp of the measurement, not the arrival time, so replays reproduce the same CSV
+    double raw_time = msg->header.stamp.toSec();
+    {
+        TraceSpan csvSpan(&trace_, "raw_odometry_csv", "logging");
+        raw_odom_csv << std::fixed << std::setprecision(6)
+                    << raw_time << ","
+                    << poseSE2.x() << ","
+                    << poseSE2.y() << ","
+                    << poseSE2.theta() << std::endl;
+    }
+    loggingTime += stopwatch.lap();
+                
+    // Publish tf
+    {
+        TraceSpan tfSpan(&trace_, "publish_tf", "publishing");
+        aprilslam::publishMapToOdomTF(tf_broadcaster, estimator_.trajectory(), estimator_.poseIndex(), poseSE2, map_frame_id, odom_frame, robot_frame); 
     }
-    Key_previous_pos = pose0;
-    previousKeyframeSymbol = gtsam::Symbol('X', 1);
-}
-
-// Predict the next pose based on odometry
-gtsam::Pose2 aprilslam::aprilslamcpp::predictNextPose(const gtsam::Pose2& poseSE2) {
-    gtsam::Pose2 odometry = relPoseFG(lastPoseSE2_, poseSE2);
-    return lastPose_.compose(odometry);
-}
-
-// Update odometry without adding a keyframe
-void aprilslam::aprilslamcpp::updateOdometryPose(const gtsam::Pose2& poseSE2) {
-    gtsam::Pose2 odometry = relPoseFG(lastPoseSE2_vis, poseSE2);
-    // gtsam::Pose2 adjustedOdometry = odometryDirection(odometry, linear_x_velocity_);
-    gtsam::Pose2 newPose = Estimates_visulisation.at<gtsam::Pose2>(gtsam::Symbol('X', index_of_pose - 1)).compose(odometry);
-    Estimates_visulisation.insert(gtsam::Symbol('X', index_of_pose), newPose);
-    lastPoseSE2_vis = poseSE2;
-}
+    publishingTime += stopwatch.lap();
 
-void aprilslam::aprilslamcpp::generate2bePublished() {
-    if (useisam2) {
-        // Calculate the current estimate using iSAM2
-        auto result = isam_.calculateEstimate();
-
-        // Extract landmark estimates from the result
-        std::map<int, gtsam::Point2> landmarks;
-        for (const auto& key_value : result) {
-            gtsam::Key key = key_value.key;  // Get the key
-            if (gtsam::Symbol(key).chr() == 'L') {
-                gtsam::Point2 point = result.at<gtsam::Point2>(key); // Directly access the Point2 value
-                landmarks[gtsam::Symbol(key).index()] = point;
-            }
+    OdometryStep step = estimator_.addOdometry(odom_stamp, poseSE2);
+    if (step == OdometryStep::Stationary) {
+        metrics_.record(Stage::Publishing, publishingTime);
+        metrics_.record(Stage::Logging, loggingTime);
+        return;
+    }
+    stopwatch.lap();
+
+    double newest_detection = -1.0;
+    if (step == OdometryStep::Keyframe) {
+        // Detections up to this stamp, expressed in the body frame of the new keyframe
+        int dropped = 0;
+        {
+            StageTimer timer(&metrics_, Stage::DetectionGathering);
+            TraceSpan gatherSpan(&trace_, "collect_detections");
+            std::lock_guard<std::mutex> lock(detectionMutex_);
+            dropped = collectAlignedDetections(detectionBuffer_, odomBuffer_, camera_infos_, odom_stamp, poseSE2, detectionBatch_, &newest_detection);
         }
-
-        // Publish the landmarks
-        aprilslam::publishLandmarks(landmark_pub_, landmarks, map_frame_id);
-
-        // Update the visualized estimates with the current pose
-        Estimates_visulisation.insert(previousKeyframeSymbol, result.at<gtsam::Pose2>(previousKeyframeSymbol));
-    } 
-    else {
-        // Extract landmark estimates from keyframe estimates
-        std::map<int, gtsam::Point2> landmarks;
-        for (const auto& key_value : keyframeEstimates_) {
-            gtsam::Key key = key_value.key;  // Get the key
-            if (gtsam::Symbol(key).chr() == 'L') {
-                gtsam::Point2 point = keyframeEstimates_.at<gtsam::Point2>(key);  // Access the Point2 value
-                landmarks[gtsam::Symbol(key).index()] = point;
-            }
+        KeyframeEvents events = estimator_.addDetections(detectionBatch_);
+        gtsam::Pose2 currentPose;
+        if (useLandmarkTiles_ && estimator_.currentPose(currentPose)) {
+            updateLandmarkTiles(currentPose, false);
         }
+        stopwatch.lap();
 
-        // Publish the landmarks
-        aprilslam::publishLandmarks(landmark_pub_, landmarks, map_frame_id);
-
-        // Update the visualized estimates with the current pose
-        Estimates_visulisation.insert(previousKeyframeSymbol, keyframeEstimates_.at<gtsam::Pose2>(previousKeyframeSymbol));
-    }
-}
-
-// Update the graph with landmarks detections
-std::set<gtsam::Symbol> aprilslam::aprilslamcpp::updateGraphWithLandmarks(
-    std::set<gtsam::Symbol> detectedLandmarksCurrentPos, 
-    const std::pair<std::vector<int>, std::vector<Eigen::Vector2d>>& detections) {
-
-    // Access the elements of the std::pair   
-    const std::vector<int>& Id = detections.first;
-    const std::vector<Eigen::Vector2d>& tagPos = detections.second;
-
-    if (!Id.empty()) {
-        for (size_t n = 0; n < Id.size(); ++n) {
-            int tag_number = Id[n];        
-            Eigen::Vector2d landSE2 = tagPos[n];
-
-            // If using prior table and the current tag_number is not found in savedLandmarks, skip it.
-            if (usepriortagtable && savedLandmarks.find(tag_number) == savedLandmarks.end()) {
-                // This tag is not in the prior table, do not add it to the graph
-                continue;
-            }
-
-            // Compute bearing and range
-            double bearing = std::atan2(landSE2(1), landSE2(0));
-            double range = std::sqrt(landSE2(0) * landSE2(0) + landSE2(1) * landSE2(1));
-
-            // Construct the landmark key
-            gtsam::Symbol landmarkKey('L', tag_number);  
-
-            // Check if the landmark has been observed before
-            if (detectedLandmarksHistoric.find(landmarkKey) != detectedLandmarksHistoric.end()) {
-                // Existing landmark
-                gtsam::BearingRangeFactor<gtsam::Pose2, gtsam::Point2, gtsam::Rot2, double> factor(
-                    gtsam::Symbol('X', index_of_pose), landmarkKey, gtsam::Rot2::fromAngle(bearing), range, brNoise
-                );
-                gtsam::Vector error = factor.unwhitenedError(landmarkEstimates);
-
-                // Threshold for ||projection - measurement||
-                if (fabs(error[0]) < add2graph_threshold) 
-                    keyframeGraph_.add(factor);
-
-                detectedLandmarksCurrentPos.insert(landmarkKey);
-            } else {
-                // Compute prior location of the landmark using the current robot pose
-                double theta = lastPose_.theta();
-                Eigen::Rotation2Dd rotation(theta);  // Create a 2D rotation matrix
-                Eigen::Vector2d rotatedPosition = rotation * landSE2;  // Rotate the position into the robot's frame
-                gtsam::Point2 priorLand(rotatedPosition.x() + lastPose_.x(), rotatedPosition.y() + lastPose_.y());
-
-                // If the current landmark was not detected in the calibration run 
-                // Or it's on calibration mode
-                if (!landmarkEstimates.exists(landmarkKey) || !usepriortagtable) {
-                    // New landmark detected
-                    detectedLandmarksHistoric.insert(landmarkKey);
-
-                    // Insert initial estimate if not already present
-                    if (!keyframeEstimates_.exists(landmarkKey)) {
-                        keyframeEstimates_.insert(landmarkKey, priorLand);
-                    }
-
-                    if (!landmarkEstimates.exists(landmarkKey)) {
-                        landmarkEstimates.insert(landmarkKey, priorLand);
-                    }
-
-                    // Add a prior for the landmark position to help with initial estimation.
-                    keyframeGraph_.add(gtsam::PriorFactor<gtsam::Point2>(
-                        landmarkKey, priorLand, pointNoise)
-                    );
-                }
-
-                // Add a bearing-range observation for this landmark to the graph
-                gtsam::BearingRangeFactor<gtsam::Pose2, gtsam::Point2, gtsam::Rot2, double> factor(
-                    gtsam::Symbol('X', index_of_pose), landmarkKey, gtsam::Rot2::fromAngle(bearing), range, brNoise
-                );
-                keyframeGraph_.add(factor);
-                detectedLandmarksCurrentPos.insert(landmarkKey);
-            }
+        if (dropped > 0) {
+            ROS_WARN("Dropped %d detection arrays without odometry at their stamp", dropped);
         }
-    }
-    return detectedLandmarksCurrentPos;
-}
-
-void aprilslam::aprilslamcpp::addOdomFactor(const nav_msgs::Odometry::ConstPtr& msg) {
-    
-    // Ignoring odometry because PF is not done yet
-    if (usePFinitialise) {
-        if (!pfInitialized_) {
-            return;
+        if (events.fusedDetections > 0) {
+            ROS_DEBUG("Fused duplicate tag observations: %d factors saved (%ld total)", events.fusedDetections, estimator_.fusedFactorsSaved());
         }
-    }    
-
-    double current_time = ros::Time::now().toSec();
-    ros::WallTime start_loop, end_loop; // Declare variables to hold start and end times
-    double elapsed;
-
-    // Convert the incoming odometry message to a simpler (x, y, theta) format using a previously defined method
-    gtsam::Pose2 poseSE2 = translateOdomMsg(msg);
-    
-    // double raw_time = msg->header.stamp.toSec();
-    double raw_time = ros::Time::now().toSec();
-    raw_odom_csv << std::fixed << std::setprecision(6)
-                << raw_time << ","
-                << poseSE2.x() << ","
-                << poseSE2.y() << ","
-                << poseSE2.theta() << std::endl;
-                
-    // Publish tf
-    aprilslam::publishMapToOdomTF(tf_broadcaster, Estimates_visulisation, index_of_pose, poseSE2, map_frame_id, odom_frame, robot_frame); 
-    // Check if the movement exceeds the thresholds
-    if (!movementExceedsThreshold(poseSE2)) return;
-
-    index_of_pose += 1; // Increment the pose index for each new odometry message
-    // Initrialisation of the factor node and variable node
-    if (index_of_pose == 2) initializeFirstPose(poseSE2, pose0);
-
-    // Predict the next pose based on odometry and add it as an initial estimate
-    gtsam::Pose2 predictedPose = predictNextPose(poseSE2);
-
-    // Determine if this pose should be a keyframe
-    gtsam::Symbol currentKeyframeSymbol('X', index_of_pose);
-
-    // Loop closure detection setup
-    std::set<gtsam::Symbol> detectedLandmarksCurrentPos;
-    std::set<gtsam::Symbol> oldlandmarks;
-    oldlandmarks = detectedLandmarksHistoric; 
-
-    // Add odometry factor if keyframe
-    if (shouldAddKeyframe(Key_previous_pos, predictedPose, oldlandmarks, detectedLandmarksCurrentPos) || !usekeyframe) {
-        keyframeEstimates_.insert(gtsam::Symbol('X', index_of_pose), predictedPose);
-        if (previousKeyframeSymbol) {
-            gtsam::Pose2 relativePose = Key_previous_pos.between(predictedPose);
-            keyframeGraph_.add(gtsam::BetweenFactor<gtsam::Pose2>(previousKeyframeSymbol, currentKeyframeSymbol, relativePose, odometryNoise));
+        if (events.budgetDropped > 0) {
+            ROS_DEBUG("Observation budget: %d detections left out (%ld total)", events.budgetDropped, estimator_.budgetDropped());
         }
-         
-        // Update the last pose and initial estimates for the next iteration
-        lastPose_ = predictedPose;
-        landmarkEstimates.insert(gtsam::Symbol('X', index_of_pose), predictedPose);
-
-        // Iterate through all landmark detected IDs
-        start_loop = ros::WallTime::now();
-        auto detections = getCamDetections(camera_infos_, camera_detections_);
-        if (!detections.first.empty()) {
-            detectedLandmarksCurrentPos = updateGraphWithLandmarks(detectedLandmarksCurrentPos, detections);
-        } 
-        // Update the pose to landmarks mapping (for LC conditions)
-        poseToLandmarks[gtsam::Symbol('X', index_of_pose)] = detectedLandmarksCurrentPos;
-
-        // Loging for optimisation time
-        end_loop = ros::WallTime::now();
-        elapsed = (end_loop - start_loop).toSec();
-
-        start_loop = ros::WallTime::now();
-        // ROS_INFO("number of timesteps: %d", index_of_pose);
-        if (index_of_pose % 1 == 0) {
-            if (useisam2) {ISAM2Optimise();}
-            else {gtsam::Values result = SAMOptimise();
-
-                // Retrieve CURRENT optimised pose
-                gtsam::Symbol currentPoseSymbol('X', index_of_pose);
-                gtsam::Pose2 newPose = result.at<gtsam::Pose2>(currentPoseSymbol);
-
-                // Retrieve estimate before current
-                gtsam::Pose2 oldPose = lastPose_for_jump;
-
-                // Compute jumps 
-                double poseJump = computePoseDelta(oldPose, newPose);
-
-                if (index_of_pose < outlierRemovalStartIndex_) {
-                    keyframeEstimates_ = result;
-                } else {        
-                    if (poseJump > jumpCombinedThreshold) {
-                        if (useoutlierremoval) {
-                            ROS_WARN("Large pose jump detected (%.3f). Reverting to odometry or previous estimate for this step!", poseJump);
-                            ROS_WARN("Discarding the newly optimized solution and trusting the old estimate.");
-                            gtsam::Pose2 oldPose = keyframeEstimates_.at<gtsam::Pose2>(gtsam::Symbol('X', index_of_pose));
-                            gtsam::Pose2 odometry = relPoseFG(lastPoseSE2_, poseSE2);
-                            gtsam::Pose2 newPose = lastPose_for_jump.compose(odometry);
-                            keyframeEstimates_.update(gtsam::Symbol('X', index_of_pose), newPose);
-                            gtsam::Pose2 retrievedPose = keyframeEstimates_.at<gtsam::Pose2>(gtsam::Symbol('X', index_of_pose));
-                        }
-                    } else {
-                        keyframeEstimates_ = result;
-                        if (useprunebysize) {
-                            pruneGraphByPoseCount(maxfactors);    
-                        }  
-                    }
-                }
-            }
-            end_loop = ros::WallTime::now();
-            elapsed = (end_loop - start_loop).toSec();
-            ROS_INFO("optimisation: %f seconds", elapsed);
+        if (events.relocalised) {
+            const RelocalisationMonitor& monitor = estimator_.relocalisationMonitor();
+            char status[256];
+            std::snprintf(status, sizeof(status),
+                          "re-anchored at x = %.3f, y = %.3f, theta = %.3f (was %.3f, %.3f, %.3f), %zu tags, rmse = %.3f m, %.2f s after disagreement started",
+                          events.anchor.x(), events.anchor.y(), events.anchor.theta(),
+                          events.previousEstimate.x(), events.previousEstimate.y(), events.previousEstimate.theta(),
+                          monitor.lastSearch().inliers.size(), monitor.lastSearch().rmse,
+                          odom_stamp - monitor.disagreementStart());
+            ROS_WARN("Relocalisation %d: %s", estimator_.relocalisations(), status);
+            std_msgs::String reloc_msg;
+            reloc_msg.data = status;
+            reloc_status_pub_.publish(reloc_msg);
         }
-        lastPose_for_jump = keyframeEstimates_.at<gtsam::Pose2>(currentKeyframeSymbol);
-        // ROS_INFO("transform total: %f seconds", elapsed);
-        lastPoseSE2_ = poseSE2;
-        
-    Key_previous_pos = predictedPose;
-    previousKeyframeSymbol = gtsam::Symbol('X', index_of_pose);  
-    checkLoopClosure(detectedLandmarksCurrentPos);
-    generate2bePublished();
-    }
-    // Use Odometry for pose estimation when not a keyframe, landmarks not updated
-    else{
-        updateOdometryPose(poseSE2);  // Update pose without adding a keyframe
-    }
-    // Smooth the trajectory
-    if (usetrajsmoothing && !usekeyframe) {
-        if (index_of_pose >= smoothingStartIndex_) {
-            smoothTrajectory(smoothingwindow);
-        } 
+        if (events.jumpRejected) {
+            ROS_WARN("Large pose jump detected (%.3f). Reverting to odometry or previous estimate for this step!", events.jump);
+            ROS_WARN("Discarding the newly optimized solution and trusting the old estimate.");
+        }
+        if (events.optimisationTime >= 0.0) {
+            ROS_DEBUG("optimisation: %f seconds", events.optimisationTime);
+        }
+        if (events.loopClosure) {
+            ROS_INFO("found LC");
+        }
+        loggingTime += stopwatch.lap();
+        if (events.loopClosure) {
+            visualizeLoopClosure(lc_pub_, events.loopClosureCurrentPose, events.loopClosureKeyframePose, estimator_.poseIndex(), map_frame_id);
+        }
+        {
+            TraceSpan landmarkSpan(&trace_, "publish_landmarks", "publishing");
+            aprilslam::publishLandmarks(landmark_pub_, estimator_.landmarks(), map_frame_id);
+        }
+        publishingTime += stopwatch.lap();
     }
+
     // Publish path, landmarks, and odometry for visulisation
-    publishRefinedOdom(odom_traj_pub_, Estimates_visulisation, index_of_pose, map_frame_id, robot_frame, refined_odom_csv, ros::Time::now());
-    aprilslam::publishPath(path_pub_, Estimates_visulisation, index_of_pose, map_frame_id);
+    {
+        TraceSpan odomSpan(&trace_, "publish_refined_odom", "publishing");
+        publishRefinedOdom(odom_traj_pub_, estimator_.trajectory(), estimator_.poseIndex(), map_frame_id, robot_frame, refined_odom_csv, msg->header.stamp);
+    }
+    {
+        TraceSpan pathSpan(&trace_, "publish_path", "publishing");
+        pathSpan.arg("poses", estimator_.poseIndex());
+        aprilslam::publishPath(path_pub_, estimator_.trajectory(), estimator_.poseIndex(), map_frame_id);
+    }
+    publishingTime += stopwatch.lap();
+    metrics_.record(Stage::Publishing, publishingTime);
+    metrics_.record(Stage::Logging, loggingTime);
+
+    // End-to-end latency of the newest detection this pose consumed
+    if (newest_detection >= 0.0) {
+        std_msgs::Float64 latency;
+        latency.data = ros::Time::now().toSec() - newest_detection;
+        pose_latency_pub_.publish(latency);
+        poseLatencySum_ += latency.data;
+        poseLatencyMax_ = std::max(poseLatencyMax_, latency.data);
+        ++poseLatencyCount_;
+    }
 }
 }
 
+#ifdef APRILSLAM_NODELET
+#include "aprilslam_nodelet.h"
+#include <pluginlib/class_list_macros.h>
+
+namespace aprilslam {
+class LocalisationNodelet : public SlamNodelet<aprilslamcpp> {};
+}
+PLUGINLIB_EXPORT_CLASS(aprilslam::LocalisationNodelet, nodelet::Nodelet)
+#else
 int main(int argc, char **argv) {
     // Initialize the ROS system and specify the name of the node
     ros::init(argc, argv, "april_slam_cpp");
@@ -913,9 +909,52 @@ int main(int argc, char **argv) {
 
     // Create an instance of the aprilslamcpp class, passing in the node handle
     aprilslam::aprilslamcpp slamNode(nh);
+    if (!slamNode.ready()) {
+        return 1;
+    }
+
+    // Offline replay: feed a recording straight into the callbacks instead of spinning
+    std::string replay_bag, replay_odometry_csv, replay_detections_csv;
+    nh.param<std::string>("replay_bag", replay_bag, "");
+    nh.param<std::string>("replay_odometry_csv", replay_odometry_csv, "");
+    nh.param<std::string>("replay_detections_csv", replay_detections_csv, "");
+    if (!replay_bag.empty() || !replay_odometry_csv.empty()) {
+        std::vector<aprilslam::ReplayMessage> messages;
+        std::string odom_topic;
+        nh.getParam("odom_topic", odom_topic);
+        bool loaded = !replay_bag.empty()
+            ? aprilslam::loadReplayBag(replay_bag, odom_topic, slamNode.cameraInfos(), messages)
+            : aprilslam::loadReplayCSV(replay_odometry_csv, replay_detections_csv, messages);
+        if (!loaded) {
+            return 1;
+        }
 
-    // ROS enters a loop, pumping callbacks. Internally, it will call all the callbacks waiting to be called at that point in time.
-    ros::spin();
+        aprilslam::ReplayStats stats = aprilslam::runReplay(messages,
+            [&slamNode](const aprilslam::ReplayMessage& m) {
+                if (m.odom) slamNode.addOdomFactor(m.odom);
+                else slamNode.cameraCallback(m.detections, m.camera);
+            },
+            0.5, [&slamNode]() {
+                // Same period as pf_init_timer_
+                if (slamNode.needsInitialisation()) slamNode.pfInitCallback(ros::TimerEvent());
+            });
+        ROS_INFO("Replayed %zu messages covering %.1f s in %.1f s (%.1fx real time)",
+                 stats.messages, stats.dataDuration, stats.wallTime,
+                 stats.wallTime > 0.0 ? stats.dataDuration / stats.wallTime : 0.0);
+        return 0;
+    }
+
+    // Detections are ingested on their own threads so they never wait for the solver
+    int sensor_threads = 1, estimation_threads = 1;
+    nh.param("sensor_threads", sensor_threads, 1);
+    nh.param("estimation_threads", estimation_threads, 1);
+    ros::AsyncSpinner sensorSpinner(sensor_threads, slamNode.sensorQueue());
+    ros::AsyncSpinner estimationSpinner(estimation_threads, slamNode.estimationQueue());
+    sensorSpinner.start();
+    estimationSpinner.start();
+
+    ros::waitForShutdown();
 
     return 0;
-}
\ No newline at end of file
+}
+#endif
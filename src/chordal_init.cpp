@@ -0,0 +1,255 @@
+// chordal_init.cpp
+
+#include "chordal_init.h"
+#include "stage_metrics.h"
+#include <gtsam/inference/Symbol.h>
+#include <gtsam/sam/BearingRangeFactor.h>
+#include <gtsam/slam/BetweenFactor.h>
+#include <gtsam/slam/PriorFactor.h>
+#include <Eigen/Sparse>
+#include <cmath>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace aprilslam {
+
+namespace {
+
+typedef gtsam::BearingRangeFactor<gtsam::Pose2, gtsam::Point2, gtsam::Rot2, double> BearingRangeFactor2D;
+
+// Every variable is also pulled towards its current value this weakly, so that poses or tags
+// without enough constraints keep their estimate instead of making the system singular
+constexpr double kRegularisation = 1e-6;
+
+struct PosePrior { int pose; gtsam::Pose2 value; double wt; double wr; };
+struct Odometry { int from; int to; gtsam::Pose2 z; double wt; double wr; };
+struct Observation { int pose; int landmark; double zx; double zy; double w; };
+struct PointPrior { int landmark; gtsam::Point2 value; double w; };
+
+// Standard deviations of a Gaussian noise model, ones for anything else (e.g. robust models)
+Eigen::VectorXd sigmasOf(const gtsam::SharedNoiseModel& model, int dim) {
+    auto gaussian = boost::dynamic_pointer_cast<gtsam::noiseModel::Gaussian>(model);
+    if (!gaussian) return Eigen::VectorXd::Ones(dim);
+    return gaussian->covariance().diagonal().cwiseMax(1e-18).cwiseSqrt();
+}
+
+// Weighted least squares accumulated as rows of A x = b
+class LinearSystem {
+public:
+    explicit LinearSystem(int cols) : cols_(cols), rows_(0) {}
+    void add(std::initializer_list<std::pair<int, double>> terms, double rhs, double weight) {
+        for (const auto& term : terms) {
+            triplets_.emplace_back(rows_, term.first, weight * term.second);
+        }
+        b_.push_back(weight * rhs);
+        ++rows_;
+    }
+    int rows() const { return rows_; }
+    bool solve(Eigen::VectorXd& x) const {
+        Eigen::SparseMatrix<double> A(rows_, cols_);
+        A.setFromTriplets(triplets_.begin(), triplets_.end());
+        Eigen::Map<const Eigen::VectorXd> b(b_.data(), rows_);
+        Eigen::SparseMatrix<double> normal = A.transpose() * A;
+        Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> solver(normal);
+        if (solver.info() != Eigen::Success) return false;
+        x = solver.solve(A.transpose() * b);
+        return solver.info() == Eigen::Success;
+    }
+private:
+    int cols_;
+    int rows_;
+    std::vector<Eigen::Triplet<double>> triplets_;
+    std::vector<double> b_;
+};
+
+}
+
+bool chordalInitialise(const gtsam::NonlinearFactorGraph& graph,
+                       const gtsam::Values& initial,
+                       gtsam::Values& result,
+                       ChordalInitReport* report) {
+    ChordalInitReport unused;
+    ChordalInitReport& rep = report ? *report : unused;
+    rep = ChordalInitReport();
+    Stopwatch watch;
+
+    std::map<gtsam::Key, int> poseIndex, landmarkIndex;
+    std::vector<gtsam::Key> poseKeys, landmarkKeys;
+    auto pose = [&](gtsam::Key key) {
+        auto it = poseIndex.emplace(key, static_cast<int>(poseKeys.size()));
+        if (it.second) poseKeys.push_back(key);
+        return it.first->second;
+    };
+    auto landmark = [&](gtsam::Key key) {
+        auto it = landmarkIndex.emplace(key, static_cast<int>(landmarkKeys.size()));
+        if (it.second) landmarkKeys.push_back(key);
+        return it.first->second;
+    };
+
+    // Measurements of the factor types the linear problem understands
+    std::vector<PosePrior> posePriors;
+    std::vector<Odometry> odometry;
+    std::vector<Observation> observations;
+    std::vector<PointPrior> pointPriors;
+    for (const auto& factor : graph) {
+        if (auto between = boost::dynamic_pointer_cast<gtsam::BetweenFactor<gtsam::Pose2>>(factor)) {
+            Eigen::VectorXd s = sigmasOf(between->noiseModel(), 3);
+            odometry.push_back({pose(between->keys()[0]), pose(between->keys()[1]), between->measured(),
+                                1.0 / std::hypot(s(0), s(1)) * std::sqrt(2.0), 1.0 / s(2)});
+        } else if (auto prior = boost::dynamic_pointer_cast<gtsam::PriorFactor<gtsam::Pose2>>(factor)) {
+            Eigen::VectorXd s = sigmasOf(prior->noiseModel(), 3);
+            posePriors.push_back({pose(prior->keys()[0]), prior->prior(), 1.0 / std::hypot(s(0), s(1)) * std::sqrt(2.0), 1.0 / s(2)});
+        } else if (auto br = boost::dynamic_pointer_cast<BearingRangeFactor2D>(factor)) {
+            Eigen::VectorXd s = sigmasOf(br->noiseModel(), 2);
+            const double bearing = br->measured().bearing().theta();
+            const double range = br->measured().range();
+            // Position error of the tag in the pose frame, averaged over the two directions
+            const double sigma = std::sqrt(0.5 * (s(1) * s(1) + range * range * s(0) * s(0)));
+            observations.push_back({pose(br->keys()[0]), landmark(br->keys()[1]),
+                                    range * std::cos(bearing), range * std::sin(bearing), 1.0 / std::max(sigma, 1e-9)});
+        } else if (auto point = boost::dynamic_pointer_cast<gtsam::PriorFactor<gtsam::Point2>>(factor)) {
+            Eigen::VectorXd s = sigmasOf(point->noiseModel(), 2);
+            pointPriors.push_back({landmark(point->keys()[0]), point->prior(), 1.0 / std::hypot(s(0), s(1)) * std::sqrt(2.0)});
+        }
+    }
+    // Two tags tied to the map fix the frame as well as a pose prior does
+    std::set<int> anchoredTags;
+    for (const PointPrior& prior : pointPriors) anchoredTags.insert(prior.landmark);
+    if (posePriors.empty() && anchoredTags.size() < 2) {
+        rep.skipped = "no pose prior and fewer than two tag priors to fix the frame";
+        return false;
+    }
+    for (gtsam::Key key : poseKeys) {
+        if (!initial.exists(key)) {
+            rep.skipped = "a pose has no initial estimate";
+            return false;
+        }
+    }
+    for (gtsam::Key key : landmarkKeys) {
+        if (!initial.exists(key)) {
+            rep.skipped = "a tag has no initial estimate";
+            return false;
+        }
+    }
+    const int P = static_cast<int>(poseKeys.size());
+    const int L = static_cast<int>(landmarkKeys.size());
+    rep.poses = P;
+    rep.landmarks = L;
+
+    // Orientations: pose i is (c, s, x, y) at 4i, tag l is (x, y) at 4P + 2l
+    LinearSystem rotations(4 * P + 2 * L);
+    auto c = [](int i) { return 4 * i; };
+    auto s = [](int i) { return 4 * i + 1; };
+    auto x = [](int i) { return 4 * i + 2; };
+    auto y = [](int i) { return 4 * i + 3; };
+    auto lx = [P](int l) { return 4 * P + 2 * l; };
+    auto ly = [P](int l) { return 4 * P + 2 * l + 1; };
+    for (const PosePrior& prior : posePriors) {
+        const int i = prior.pose;
+        rotations.add({{c(i), 1.0}}, std::cos(prior.value.theta()), prior.wr);
+        rotations.add({{s(i), 1.0}}, std::sin(prior.value.theta()), prior.wr);
+        rotations.add({{x(i), 1.0}}, prior.value.x(), prior.wt);
+        rotations.add({{y(i), 1.0}}, prior.value.y(), prior.wt);
+    }
+    for (const Odometry& odom : odometry) {
+        const int i = odom.from, j = odom.to;
+        const double dx = odom.z.x(), dy = odom.z.y();
+        const double cz = std::cos(odom.z.theta()), sz = std::sin(odom.z.theta());
+        // t_j = t_i + R_i dt, R_j = R_i R_z
+        rotations.add({{x(j), 1.0}, {x(i), -1.0}, {c(i), -dx}, {s(i), dy}}, 0.0, odom.wt);
+        rotations.add({{y(j), 1.0}, {y(i), -1.0}, {c(i), -dy}, {s(i), -dx}}, 0.0, odom.wt);
+        rotations.add({{c(j), 1.0}, {c(i), -cz}, {s(i), sz}}, 0.0, odom.wr);
+        rotations.add({{s(j), 1.0}, {c(i), -sz}, {s(i), -cz}}, 0.0, odom.wr);
+    }
+    for (const Observation& obs : observations) {
+        const int i = obs.pose, l = obs.landmark;
+        // tag = t_i + R_i z
+        rotations.add({{lx(l), 1.0}, {x(i), -1.0}, {c(i), -obs.zx}, {s(i), obs.zy}}, 0.0, obs.w);
+        rotations.add({{ly(l), 1.0}, {y(i), -1.0}, {c(i), -obs.zy}, {s(i), -obs.zx}}, 0.0, obs.w);
+    }
+    for (const PointPrior& prior : pointPriors) {
+        rotations.add({{lx(prior.landmark), 1.0}}, prior.value.x(), prior.w);
+        rotations.add({{ly(prior.landmark), 1.0}}, prior.value.y(), prior.w);
+    }
+    for (int i = 0; i < P; ++i) {
+        const gtsam::Pose2& current = initial.at<gtsam::Pose2>(poseKeys[i]);
+        rotations.add({{c(i), 1.0}}, std::cos(current.theta()), kRegularisation);
+        rotations.add({{s(i), 1.0}}, std::sin(current.theta()), kRegularisation);
+        rotations.add({{x(i), 1.0}}, current.x(), kRegularisation);
+        rotations.add({{y(i), 1.0}}, current.y(), kRegularisation);
+    }
+    for (int l = 0; l < L; ++l) {
+        const gtsam::Point2& current = initial.at<gtsam::Point2>(landmarkKeys[l]);
+        rotations.add({{lx(l), 1.0}}, current.x(), kRegularisation);
+        rotations.add({{ly(l), 1.0}}, current.y(), kRegularisation);
+    }
+    Eigen::VectorXd relaxed;
+    if (!rotations.solve(relaxed)) {
+        rep.skipped = "the orientation solve failed";
+        return false;
+    }
+    std::vector<double> theta(P);
+    for (int i = 0; i < P; ++i) {
+        theta[i] = std::atan2(relaxed(s(i)), relaxed(c(i)));
+    }
+
+    // Positions with the orientations fixed: pose i is (x, y) at 2i, tag l at 2P + 2l
+    LinearSystem positions(2 * P + 2 * L);
+    auto px = [](int i) { return 2 * i; };
+    auto py = [](int i) { return 2 * i + 1; };
+    auto qx = [P](int l) { return 2 * P + 2 * l; };
+    auto qy = [P](int l) { return 2 * P + 2 * l + 1; };
+    for (const PosePrior& prior : posePriors) {
+        positions.add({{px(prior.pose), 1.0}}, prior.value.x(), prior.wt);
+        positions.add({{py(prior.pose), 1.0}}, prior.value.y(), prior.wt);
+    }
+    for (const Odometry& odom : odometry) {
+        const int i = odom.from, j = odom.to;
+        const double ci = std::cos(theta[i]), si = std::sin(theta[i]);
+        positions.add({{px(j), 1.0}, {px(i), -1.0}}, ci * odom.z.x() - si * odom.z.y(), odom.wt);
+        positions.add({{py(j), 1.0}, {py(i), -1.0}}, si * odom.z.x() + ci * odom.z.y(), odom.wt);
+    }
+    for (const Observation& obs : observations) {
+        const int i = obs.pose, l = obs.landmark;
+        const double ci = std::cos(theta[i]), si = std::sin(theta[i]);
+        positions.add({{qx(l), 1.0}, {px(i), -1.0}}, ci * obs.zx - si * obs.zy, obs.w);
+        positions.add({{qy(l), 1.0}, {py(i), -1.0}}, si * obs.zx + ci * obs.zy, obs.w);
+    }
+    for (const PointPrior& prior : pointPriors) {
+        positions.add({{qx(prior.landmark), 1.0}}, prior.value.x(), prior.w);
+        positions.add({{qy(prior.landmark), 1.0}}, prior.value.y(), prior.w);
+    }
+    for (int i = 0; i < P; ++i) {
+        positions.add({{px(i), 1.0}}, relaxed(x(i)), kRegularisation);
+        positions.add({{py(i), 1.0}}, relaxed(y(i)), kRegularisation);
+    }
+    for (int l = 0; l < L; ++l) {
+        positions.add({{qx(l), 1.0}}, relaxed(lx(l)), kRegularisation);
+        positions.add({{qy(l), 1.0}}, relaxed(ly(l)), kRegularisation);
+    }
+    Eigen::VectorXd solution;
+    if (!positions.solve(solution)) {
+        rep.skipped = "the position solve failed";
+        return false;
+    }
+    rep.rows = rotations.rows() + positions.rows();
+
+    // Variables the linear problem did not cover keep their value
+    result = gtsam::Values();
+    for (int i = 0; i < P; ++i) {
+        result.insert(poseKeys[i], gtsam::Pose2(solution(px(i)), solution(py(i)), theta[i]));
+    }
+    for (int l = 0; l < L; ++l) {
+        result.insert(landmarkKeys[l], gtsam::Point2(solution(qx(l)), solution(qy(l))));
+    }
+    for (const auto& key_value : initial) {
+        if (!result.exists(key_value.key)) result.insert(key_value.key, key_value.value);
+    }
+    rep.errorBefore = graph.error(initial);
+    rep.errorAfter = graph.error(result);
+    rep.time = watch.elapsed();
+    return true;
+}
+
+}
@@ -0,0 +1,203 @@
+// coarse_to_fine.cpp
+
+#include "coarse_to_fine.h"
+#include "se2.h"
+#include "stage_metrics.h"
+#include <gtsam/inference/Symbol.h>
+#include <gtsam/nonlinear/LevenbergMarquardtOptimizer.h>
+#include <gtsam/sam/BearingRangeFactor.h>
+#include <gtsam/slam/BetweenFactor.h>
+#include <gtsam/slam/PriorFactor.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace aprilslam {
+
+namespace {
+
+typedef gtsam::BearingRangeFactor<gtsam::Pose2, gtsam::Point2, gtsam::Rot2, double> BearingRangeFactor2D;
+
+// Odometry factor between consecutive poses, as a measurement from the earlier one
+struct Link {
+    gtsam::Pose2 z;
+    Eigen::Vector3d variances;
+};
+
+Eigen::Vector3d variancesOf(const gtsam::SharedNoiseModel& model) {
+    auto gaussian = boost::dynamic_pointer_cast<gtsam::noiseModel::Gaussian>(model);
+    if (!gaussian) return Eigen::Vector3d::Ones();
+    return gaussian->covariance().diagonal();
+}
+
+// Pose between two poses, t = 0 at a and 1 at b
+gtsam::Pose2 blend(const gtsam::Pose2& a, const gtsam::Pose2& b, double t) {
+    return gtsam::Pose2((1.0 - t) * a.x() + t * b.x(), (1.0 - t) * a.y() + t * b.y(),
+                        se2::wrapAngle(a.theta() + t * se2::wrapAngle(b.theta() - a.theta())));
+}
+
+}
+
+gtsam::Values coarseToFineInitialise(const gtsam::NonlinearFactorGraph& graph,
+                                     const gtsam::Values& initial,
+                                     const CoarseToFineParams& params,
+                                     CoarseToFineReport* report) {
+    CoarseToFineReport unused;
+    CoarseToFineReport& rep = report ? *report : unused;
+    rep = CoarseToFineReport();
+
+    // Poses in drive order
+    std::vector<gtsam::Key> poses;
+    for (const auto& key_value : initial) {
+        if (gtsam::Symbol(key_value.key).chr() == 'X') poses.push_back(key_value.key);
+    }
+    std::sort(poses.begin(), poses.end(), [](gtsam::Key a, gtsam::Key b) {
+        return gtsam::Symbol(a).index() < gtsam::Symbol(b).index();
+    });
+    const int n = static_cast<int>(poses.size());
+    std::map<gtsam::Key, int> order;
+    for (int i = 0; i < n; ++i) {
+        order[poses[i]] = i;
+    }
+    auto position = [&order](gtsam::Key key) {
+        auto it = order.find(key);
+        return it == order.end() ? -1 : it->second;
+    };
+
+    // Odometry chain, links[i] joins pose i to pose i + 1
+    std::set<const gtsam::NonlinearFactor*> chainFactors;
+    std::vector<Link> links(std::max(0, n - 1));
+    std::vector<bool> linked(std::max(0, n - 1), false);
+    for (const auto& factor : graph) {
+        auto between = boost::dynamic_pointer_cast<gtsam::BetweenFactor<gtsam::Pose2>>(factor);
+        if (!between) continue;
+        const int a = position(between->keys()[0]);
+        const int b = position(between->keys()[1]);
+        if (a < 0 || b < 0 || std::abs(a - b) != 1) continue;
+        const int i = std::min(a, b);
+        if (linked[i]) continue;
+        links[i].z = a < b ? between->measured() : between->measured().inverse();
+        links[i].variances = variancesOf(between->noiseModel());
+        linked[i] = true;
+        chainFactors.insert(between.get());
+    }
+
+    gtsam::Values current = initial;
+    for (int k : params.decimation) {
+        if (k < 2 || n < 3) continue;
+        Stopwatch watch;
+
+        // Kept poses: every k-th, the last and both ends of a gap in the odometry chain
+        std::vector<bool> kept(n, false);
+        for (int i = 0; i < n; ++i) {
+            kept[i] = i % k == 0 || i == n - 1 || (i < n - 1 && !linked[i]) || (i > 0 && !linked[i - 1]);
+        }
+
+        // Composed odometry between kept poses; the anchor (previous kept pose) of every dropped
+        // pose and its pose relative to it. Covariances are summed per axis, the rotation
+        // coupling is ignored at this resolution.
+        gtsam::NonlinearFactorGraph coarse;
+        std::vector<int> anchor(n, 0);
+        std::vector<gtsam::Pose2> relative(n);
+        gtsam::Pose2 composed;
+        Eigen::Vector3d variances = Eigen::Vector3d::Zero();
+        int last = 0;
+        for (int i = 1; i < n; ++i) {
+            const bool chained = linked[i - 1];
+            if (chained) {
+                composed = composed.compose(links[i - 1].z);
+                variances += links[i - 1].variances;
+            }
+            if (kept[i]) {
+                if (chained) {
+                    coarse.add(gtsam::BetweenFactor<gtsam::Pose2>(poses[last], poses[i], composed,
+                                                                  gtsam::noiseModel::Diagonal::Variances(variances)));
+                }
+                last = i;
+                composed = gtsam::Pose2();
+                variances.setZero();
+            } else {
+                anchor[i] = last;
+                relative[i] = composed;
+            }
+        }
+
+        // Remaining factors: observations of dropped poses move to their anchor, anything else
+        // touching a dropped pose is left out
+        size_t dropped = 0;
+        for (const auto& factor : graph) {
+            if (chainFactors.count(factor.get())) continue;
+            bool allKept = true;
+            for (gtsam::Key key : factor->keys()) {
+                const int i = position(key);
+                if (i >= 0 && !kept[i]) allKept = false;
+            }
+            if (allKept) {
+                coarse.add(factor);
+                continue;
+            }
+            auto observation = boost::dynamic_pointer_cast<BearingRangeFactor2D>(factor);
+            const int i = observation ? position(observation->keys()[0]) : -1;
+            if (i < 0) {
+                ++dropped;
+                continue;
+            }
+            const double bearing = observation->measured().bearing().theta();
+            const double range = observation->measured().range();
+            const gtsam::Point2 local = relative[i].transformFrom(gtsam::Point2(range * std::cos(bearing), range * std::sin(bearing)));
+            coarse.add(BearingRangeFactor2D(poses[anchor[i]], observation->keys()[1],
+                                            gtsam::Rot2::fromAngle(std::atan2(local.y(), local.x())),
+                                            std::hypot(local.x(), local.y()), observation->noiseModel()));
+        }
+        if (dropped > 0) {
+            std::cerr << "Coarse level " << k << ": " << dropped << " factors on dropped poses left out" << std::endl;
+        }
+
+        gtsam::Values values;
+        for (gtsam::Key key : coarse.keys()) {
+            values.insert(key, current.at(key));
+        }
+        gtsam::Values solved;
+        try {
+            gtsam::LevenbergMarquardtParams lm;
+            if (params.levelIterations > 0) lm.setMaxIterations(params.levelIterations);
+            gtsam::LevenbergMarquardtOptimizer optimizer(coarse, values, lm);
+            solved = optimizer.optimize();
+        } catch (const std::exception& e) {
+            std::cerr << "Coarse level " << k << " failed: " << e.what() << std::endl;
+            continue;
+        }
+
+        // Dropped poses follow both neighbouring kept poses rigidly, blended by their position
+        // between them
+        gtsam::Values next = current;
+        int nextKept = n - 1;
+        for (int i = n - 1; i >= 0; --i) {
+            const gtsam::Pose2& old = current.at<gtsam::Pose2>(poses[i]);
+            if (kept[i]) {
+                nextKept = i;
+                if (solved.exists(poses[i])) next.update(poses[i], solved.at<gtsam::Pose2>(poses[i]));
+                continue;
+            }
+            const int a = anchor[i];
+            const int b = nextKept;
+            if (!solved.exists(poses[a]) || !solved.exists(poses[b])) continue;
+            const gtsam::Pose2 fromA = solved.at<gtsam::Pose2>(poses[a]).compose(current.at<gtsam::Pose2>(poses[a]).between(old));
+            const gtsam::Pose2 fromB = solved.at<gtsam::Pose2>(poses[b]).compose(current.at<gtsam::Pose2>(poses[b]).between(old));
+            next.update(poses[i], blend(fromA, fromB, static_cast<double>(i - a) / (b - a)));
+        }
+        for (const auto& key_value : solved) {
+            if (position(key_value.key) < 0) next.update(key_value.key, key_value.value);
+        }
+        current = next;
+
+        rep.poses.push_back(static_cast<size_t>(std::count(kept.begin(), kept.end(), true)));
+        rep.times.push_back(watch.elapsed());
+    }
+    return current;
+}
+
+}
@@ -0,0 +1,235 @@
+// core_utils.cpp
+
+#include "core_utils.h"
+#include <limits>
+
+namespace aprilslam {
+
+void saveLandmarksToCSV(const std::map<int, gtsam::Point2>& landmarks, const std::string& filename) {
+    std::ofstream file;
+    file.open(filename, std::ios::out); // Open file in write mode
+
+    if (!file) {
+        std::cerr << "Failed to open the file!" << std::endl;
+        return;
+    }
+    // Write the header line
+    file << "id,x,y\n";
+    
+    for (const auto& landmark : landmarks) {
+        int id = landmark.first;
+        gtsam::Point2 point = landmark.second;
+        file << id << "," << point.x() << "," << point.y() << "\n";
+    }
+
+    file.close();
+}
+
+MapBounds landmarkBounds(const std::map<int, gtsam::Point2>& landmarks, double margin) {
+    MapBounds bounds;
+    if (landmarks.empty()) {
+        return bounds;
+    }
+    bounds.xmin = bounds.ymin = std::numeric_limits<double>::infinity();
+    bounds.xmax = bounds.ymax = -std::numeric_limits<double>::infinity();
+    for (const auto& landmark : landmarks) {
+        bounds.xmin = std::min(bounds.xmin, landmark.second.x());
+        bounds.xmax = std::max(bounds.xmax, landmark.second.x());
+        bounds.ymin = std::min(bounds.ymin, landmark.second.y());
+        bounds.ymax = std::max(bounds.ymax, landmark.second.y());
+    }
+    bounds.xmin -= margin;
+    bounds.xmax += margin;
+    bounds.ymin -= margin;
+    bounds.ymax += margin;
+    return bounds;
+}
+
+std::map<int, gtsam::Point2> loadLandmarksFromCSV(const std::string& filename) {
+    std::map<int, gtsam::Point2> landmarks;
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open the file!" << std::endl;
+        return landmarks;
+    }
+
+    std::string line;
+
+    // Skip the header line
+    if (std::getline(file, line)) {
+        // You can print or log the header if needed
+        // std::cout << "Header: " << line << std::endl;
+    }
+
+    while (std::getline(file, line)) {
+        std::istringstream ss(line);
+        std::string id_str, x_str, y_str;
+        if (std::getline(ss, id_str, ',') && std::getline(ss, x_str, ',') && std::getline(ss, y_str, ',')) {
+            try {
+                int id = std::stoi(id_str);
+                double x = std::stod(x_str);
+                double y = std::stod(y_str);
+                landmarks[id] = gtsam::Point2(x, y);
+            } catch (const std::exception& e) {
+                std::cerr << "Error parsing line: " << line << " - " << e.what() << std::endl;
+            }
+        }
+    }
+
+    file.close();
+    return landmarks;
+}
+
+void DetectionBatch::clear() {
+    ids.clear();
+    camera.clear();
+    x.clear();
+    y.clear();
+    bearing.clear();
+    range.clear();
+    count.clear();
+    cov_bb.clear();
+    cov_br.clear();
+    cov_rr.clear();
+}
+
+void DetectionBatch::reserve(size_t n) {
+    ids.reserve(n);
+    camera.reserve(n);
+    x.reserve(n);
+    y.reserve(n);
+    bearing.reserve(n);
+    range.reserve(n);
+    count.reserve(n);
+    cov_bb.reserve(n);
+    cov_br.reserve(n);
+    cov_rr.reserve(n);
+}
+
+void DetectionBatch::resize(size_t n) {
+    ids.resize(n);
+    camera.resize(n);
+    x.resize(n);
+    y.resize(n);
+    bearing.resize(n);
+    range.resize(n);
+    count.resize(n);
+    cov_bb.resize(n);
+    cov_br.resize(n);
+    cov_rr.resize(n);
+}
+
+// Precompute the camera -> base_link rotation so detections only need a multiply-add
+void setCameraExtrinsic(CameraInfo& cam, const Eigen::Vector3d& transform) {
+    cam.transform = transform;
+    const double c = std::cos(transform(2));
+    const double s = std::sin(transform(2));
+    cam.rotation << c, -s,
+                    s,  c;
+    cam.translation = transform.head<2>();
+}
+
+// Merge observations of the same tag within one step (e.g. overlapping cameras) into a single
+// observation. Each (bearing, range) is mapped to a Cartesian point with its first-order covariance,
+// the points are fused by information weighting and the result is mapped back to (bearing, range).
+// Observations from one camera are correlated, so they are averaged without gaining information;
+// only different cameras are fused as independent. Returns the number of observations removed,
+// i.e. the bearing-range factors saved.
+int fuseDuplicateDetections(DetectionBatch& batch, double sigma_bearing, double sigma_range) {
+    const size_t n = batch.size();
+    if (n < 2) {
+        return 0;
+    }
+
+    // Group entries by tag id, keeping the order of first appearance
+    std::map<int, std::vector<size_t>> groups;
+    std::vector<int> order;
+    for (size_t i = 0; i < n; ++i) {
+        auto& group = groups[batch.ids[i]];
+        if (group.empty()) order.push_back(batch.ids[i]);
+        group.push_back(i);
+    }
+    if (order.size() == n) {
+        return 0;
+    }
+
+    const Eigen::Matrix2d R_br = Eigen::Vector2d(sigma_bearing * sigma_bearing, sigma_range * sigma_range).asDiagonal();
+
+    size_t out = 0;
+    for (int id : order) {
+        const std::vector<size_t>& group = groups[id];
+        const size_t first = group.front();
+
+        // Single observation: just compact it into place
+        if (group.size() == 1) {
+            if (out != first) {
+                batch.ids[out] = batch.ids[first];
+                batch.camera[out] = batch.camera[first];
+                batch.x[out] = batch.x[first];
+                batch.y[out] = batch.y[first];
+                batch.bearing[out] = batch.bearing[first];
+                batch.range[out] = batch.range[first];
+                batch.count[out] = batch.count[first];
+                batch.cov_bb[out] = batch.cov_bb[first];
+                batch.cov_br[out] = batch.cov_br[first];
+                batch.cov_rr[out] = batch.cov_rr[first];
+            }
+            ++out;
+            continue;
+        }
+
+        // Information-weighted fusion in Cartesian space, summed per camera first
+        std::map<int, std::pair<Eigen::Matrix2d, Eigen::Vector2d>> perCamera;
+        std::map<int, int> perCameraCount;
+        int merged = 0;
+        for (size_t i : group) {
+            const double b = batch.bearing[i];
+            const double r = std::max(batch.range[i], 1e-3);
+            Eigen::Matrix2d J;
+            J << -r * std::sin(b), std::cos(b),
+                  r * std::cos(b), std::sin(b);
+            const Eigen::Matrix2d cov_br = batch.count[i] > 1 ? batch.covariance(i) : R_br;
+            const Eigen::Matrix2d info_i = (J * cov_br * J.transpose()).inverse();
+            auto& sums = perCamera.emplace(batch.camera[i], std::make_pair(Eigen::Matrix2d::Zero().eval(), Eigen::Vector2d::Zero().eval())).first->second;
+            sums.first += info_i;
+            sums.second += info_i * batch.tagPos(i);
+            ++perCameraCount[batch.camera[i]];
+            merged += batch.count[i];
+        }
+        // One camera contributes the average information of its observations
+        Eigen::Matrix2d info = Eigen::Matrix2d::Zero();
+        Eigen::Vector2d infoVec = Eigen::Vector2d::Zero();
+        for (const auto& camera : perCamera) {
+            const double k = perCameraCount[camera.first];
+            info += camera.second.first / k;
+            infoVec += camera.second.second / k;
+        }
+        const Eigen::Matrix2d cov_xy = info.inverse();
+        const Eigen::Vector2d p = cov_xy * infoVec;
+
+        // Back to bearing/range with the propagated covariance
+        const double r = std::max(p.norm(), 1e-3);
+        const double b = std::atan2(p.y(), p.x());
+        Eigen::Matrix2d Jinv;
+        Jinv << -std::sin(b) / r, std::cos(b) / r,
+                 std::cos(b),     std::sin(b);
+        const Eigen::Matrix2d cov = Jinv * cov_xy * Jinv.transpose();
+
+        batch.ids[out] = id;
+        batch.camera[out] = batch.camera[first];
+        batch.x[out] = p.x();
+        batch.y[out] = p.y();
+        batch.bearing[out] = b;
+        batch.range[out] = p.norm();
+        batch.count[out] = merged;
+        batch.cov_bb[out] = cov(0, 0);
+        batch.cov_br[out] = 0.5 * (cov(0, 1) + cov(1, 0));
+        batch.cov_rr[out] = cov(1, 1);
+        ++out;
+    }
+
+    batch.resize(out);
+    return static_cast<int>(n - out);
+}
+
+} // namespace aprilslam
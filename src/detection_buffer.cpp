@@ -0,0 +1,162 @@
+// detection_buffer.cpp
+
+#include "detection_buffer.h"
+#include "se2.h"
+
+namespace aprilslam {
+
+void OdometryBuffer::push(double stamp, const gtsam::Pose2& pose) {
+    // Odometry normally arrives in order, drop anything that goes back in time
+    if (!buffer_.empty() && stamp <= buffer_.back().first) {
+        return;
+    }
+    buffer_.emplace_back(stamp, pose);
+
+    // Keep only the samples within the horizon of the newest one
+    while (buffer_.size() > 2 && buffer_.front().first < stamp - horizon_) {
+        buffer_.pop_front();
+    }
+}
+
+bool OdometryBuffer::interpolate(double stamp, gtsam::Pose2& pose, double tolerance) const {
+    if (buffer_.empty()) {
+        return false;
+    }
+
+    // Slightly outside the buffered window: clamp to the closest sample
+    if (stamp <= buffer_.front().first) {
+        if (buffer_.front().first - stamp > tolerance) return false;
+        pose = buffer_.front().second;
+        return true;
+    }
+    if (stamp >= buffer_.back().first) {
+        if (stamp - buffer_.back().first > tolerance) return false;
+        pose = buffer_.back().second;
+        return true;
+    }
+
+    // First sample not older than the requested stamp
+    auto upper = std::lower_bound(buffer_.begin(), buffer_.end(), stamp,
+                                  [](const std::pair<double, gtsam::Pose2>& entry, double t) {
+                                      return entry.first < t;
+                                  });
+    auto lower = upper - 1;
+
+    const double dt = upper->first - lower->first;
+    const double alpha = dt > 0.0 ? (stamp - lower->first) / dt : 0.0;
+    const gtsam::Pose2& p0 = lower->second;
+    const gtsam::Pose2& p1 = upper->second;
+
+    pose = gtsam::Pose2(p0.x() + alpha * (p1.x() - p0.x()),
+                        p0.y() + alpha * (p1.y() - p0.y()),
+                        wrapToPi(p0.theta() + alpha * wrapToPi(p1.theta() - p0.theta())));
+    return true;
+}
+
+void DetectionBuffer::push(int camera, double stamp, const apriltag_ros::AprilTagDetectionArray::ConstPtr& msg) {
+    if (camera < 0) {
+        return;
+    }
+    if (queues_.size() <= static_cast<size_t>(camera)) {
+        queues_.resize(camera + 1);
+    }
+
+    // Keep each queue ordered by stamp, out-of-order arrivals are rare
+    std::deque<StampedDetections>& queue = queues_[camera];
+    auto it = queue.end();
+    while (it != queue.begin() && (it - 1)->stamp > stamp) {
+        --it;
+    }
+    queue.insert(it, StampedDetections{stamp, camera, msg});
+    latest_ = std::max(latest_, stamp);
+
+    // Bound the memory when nothing consumes the detections (e.g. before initialisation)
+    for (auto& q : queues_) {
+        while (!q.empty() && q.front().stamp < latest_ - horizon_) {
+            q.pop_front();
+        }
+    }
+}
+
+void DetectionBuffer::popUntil(double stamp, std::vector<StampedDetections>& out) {
+    out.clear();
+    for (auto& q : queues_) {
+        while (!q.empty() && q.front().stamp <= stamp) {
+            out.push_back(q.front());
+            q.pop_front();
+        }
+    }
+}
+
+size_t DetectionBuffer::size() const {
+    size_t total = 0;
+    for (const auto& q : queues_) {
+        total += q.size();
+    }
+    return total;
+}
+
+void transformDetections(DetectionBatch& batch, size_t begin, const gtsam::Pose2& delta) {
+    if (begin >= batch.size()) {
+        return;
+    }
+    const size_t n = batch.size() - begin;
+    double* x = batch.x.data() + begin;
+    double* y = batch.y.data() + begin;
+    se2::transformFrom(se2::Frame(delta), x, y, x, y, n);
+    se2::bearingRange(x, y, batch.bearing.data() + begin, batch.range.data() + begin, n);
+}
+
+int collectAlignedDetections(DetectionBuffer& detection_buffer,
+                             const OdometryBuffer& odom_buffer,
+                             const std::vector<CameraInfo>& camera_infos,
+                             double stamp,
+                             const gtsam::Pose2& odomPose,
+                             DetectionBatch& batch,
+                             double* newest_stamp) {
+    std::vector<StampedDetections> pending;
+    detection_buffer.popUntil(stamp, pending);
+
+    // Only the newest array of each camera that odometry covers: consecutive frames of one camera
+    // share the interpolation error and are not independent observations of the keyframe
+    std::vector<const StampedDetections*> latest(camera_infos.size(), nullptr);
+    std::vector<gtsam::Pose2> latestPose(camera_infos.size());
+    int dropped = 0;
+    for (auto it = pending.rbegin(); it != pending.rend(); ++it) {
+        if (it->camera >= static_cast<int>(camera_infos.size()) || latest[it->camera]) {
+            continue;
+        }
+        // Robot pose (odom frame) at the moment the image was taken
+        if (!odom_buffer.interpolate(it->stamp, latestPose[it->camera])) {
+            ++dropped;
+            continue;
+        }
+        latest[it->camera] = &*it;
+    }
+
+    batch.clear();
+    bool used = false;
+    for (size_t camera = 0; camera < latest.size(); ++camera) {
+        if (!latest[camera]) {
+            continue;
+        }
+        const StampedDetections& entry = *latest[camera];
+        const gtsam::Pose2& detectionPose = latestPose[camera];
+
+        const size_t begin = batch.size();
+        processDetections(entry.msg, camera_infos[entry.camera], entry.camera, batch);
+        if (newest_stamp && (!used || entry.stamp > *newest_stamp)) {
+            *newest_stamp = entry.stamp;
+        }
+        used = true;
+
+        // Motion between the image and the current pose node
+        gtsam::Pose2 delta = odomPose.between(detectionPose);
+        if (std::abs(delta.x()) > 1e-9 || std::abs(delta.y()) > 1e-9 || std::abs(delta.theta()) > 1e-9) {
+            transformDetections(batch, begin, delta);
+        }
+    }
+    return dropped;
+}
+
+} // namespace aprilslam
@@ -0,0 +1,886 @@
+// estimator.cpp
+
+#include "estimator.h"
+
+#include <gtsam/slam/BetweenFactor.h>
+#include <gtsam/slam/PriorFactor.h>
+#include <gtsam/sam/BearingRangeFactor.h>
+#include <gtsam/nonlinear/LevenbergMarquardtOptimizer.h>
+#include <iostream>
+#include <limits>
+
+namespace aprilslam {
+
+Estimator::Estimator(const EstimatorOptions& options)
+    : options_(options),
+      batchPending_(options.batchOptimisation),
+      index_of_pose(1),
+      pendingKeyframe_(false),
+      pendingStamp_(0.0),
+      preintegrator_(options.preintegration),
+      lastKeyframeStamp_(-std::numeric_limits<double>::infinity()),
+      lastInformationGain_(0.0),
+      keyframeCovariance_(Eigen::Matrix3d::Zero()),
+      fusedFactorsSaved_(0),
+      keyframeBudgetDropped_(0),
+      budgetDropped_(0),
+      metrics_(nullptr),
+      gatingTime_(0.0),
+      trace_(nullptr),
+      lastIterations_(0),
+      lastError_(0.0),
+      relocMonitor_(options.relocalisation),
+      relocalisations_(0) {
+    // Initialize noise models
+    odometryNoise = gtsam::noiseModel::Diagonal::Sigmas(options_.odometrySigmas);
+    priorNoise = gtsam::noiseModel::Diagonal::Sigmas(options_.priorSigmas);
+    brNoise = gtsam::noiseModel::Diagonal::Sigmas(options_.bearingRangeSigmas);
+    pointNoise = gtsam::noiseModel::Diagonal::Sigmas(options_.pointSigmas);
+    loopClosureNoise = gtsam::noiseModel::Diagonal::Sigmas(options_.loopClosureSigmas);
+
+    initializeGTSAM();
+}
+
+// Initialization of GTSAM components
+void Estimator::initializeGTSAM() {
+    // Initialize graph parameters and stores them in isam_.
+    gtsam::ISAM2Params parameters;
+    parameters.relinearizeThreshold = 0.1;
+    parameters.relinearizeSkip = 1;
+    isam_ = gtsam::ISAM2(parameters);
+}
+
+OdometryStep Estimator::addOdometry(double stamp, const gtsam::Pose2& poseSE2) {
+    // The caller skipped addDetections(): close the keyframe without observations
+    if (pendingKeyframe_) {
+        DetectionBatch none;
+        addDetections(none);
+    }
+
+    // Check if the movement exceeds the thresholds
+    if (!movementExceedsThreshold(poseSE2)) return OdometryStep::Stationary;
+
+    index_of_pose += 1; // Increment the pose index for each new odometry message
+    // Initrialisation of the factor node and variable node
+    if (index_of_pose == 2) initializeFirstPose(poseSE2);
+
+    // Predict the next pose based on odometry and add it as an initial estimate
+    gtsam::Pose2 predictedPose = predictNextPose(poseSE2);
+    gtsam::Symbol currentKeyframeSymbol('X', index_of_pose);
+    if (options_.preintegrateOdometry || options_.adaptiveKeyframes) {
+        preintegrator_.integrate(se2::toPose2(se2::between(se2::fromPose2(lastIntegratedOdom_), se2::fromPose2(poseSE2))));
+        lastIntegratedOdom_ = poseSE2;
+    }
+
+    // Calibration keeps every pose, localisation only keyframes
+    std::set<gtsam::Symbol> detectedLandmarksCurrentPos;
+    bool keyframe = !options_.incremental || !options_.useKeyframe;
+    if (!keyframe) {
+        keyframe = options_.adaptiveKeyframes
+                       ? informativeKeyframe(stamp, predictedPose)
+                       : shouldAddKeyframe(Key_previous_pos, predictedPose, detectedLandmarksHistoric, detectedLandmarksCurrentPos);
+    }
+    if (keyframe || (options_.preintegrateOdometry && preintegrator_.exceedsUncertainty())) {
+        keyframeEstimates_.insert(currentKeyframeSymbol, predictedPose);
+        if (previousKeyframeSymbol) {
+            gtsam::Pose2 relativePose = Key_previous_pos.between(predictedPose);
+            gtsam::SharedNoiseModel noise = odometryNoise;
+            if (options_.preintegrateOdometry) {
+                noise = preintegrator_.noiseModel();
+            }
+            keyframeGraph_.add(gtsam::BetweenFactor<gtsam::Pose2>(previousKeyframeSymbol, currentKeyframeSymbol, relativePose, noise));
+        }
+        if (options_.adaptiveKeyframes) updateKeyframeUncertainty(predictedPose);
+        preintegrator_.reset();
+        lastKeyframeStamp_ = stamp;
+
+        // Update the last pose and initial estimates for the next iteration
+        lastPose_ = predictedPose;
+        landmarkEstimates.insert(currentKeyframeSymbol, predictedPose);
+
+        pendingKeyframe_ = true;
+        pendingStamp_ = stamp;
+        pendingOdomPose_ = poseSE2;
+        pendingPredictedPose_ = predictedPose;
+        return OdometryStep::Keyframe;
+    }
+
+    // Use Odometry for pose estimation when not a keyframe, landmarks not updated
+    updateOdometryPose(poseSE2);
+    return OdometryStep::Pose;
+}
+
+KeyframeEvents Estimator::addDetections(DetectionBatch& detections) {
+    KeyframeEvents events;
+    if (!pendingKeyframe_) {
+        return events;
+    }
+    pendingKeyframe_ = false;
+    TraceSpan keyframeSpan(trace_, "add_detections");
+    keyframeSpan.arg("pose", index_of_pose);
+    keyframeSpan.arg("detections", detections.size());
+
+    const gtsam::Pose2 poseSE2 = pendingOdomPose_;
+    gtsam::Pose2 predictedPose = pendingPredictedPose_;
+    gtsam::Symbol currentKeyframeSymbol('X', index_of_pose);
+    std::set<gtsam::Symbol> detectedLandmarksCurrentPos;
+
+    Stopwatch watch;
+    if (options_.fuseDuplicateDetections) {
+        events.fusedDetections = fuseDuplicateDetections(detections, brNoise->sigmas()(0), brNoise->sigmas()(1));
+        fusedFactorsSaved_ += events.fusedDetections;
+    }
+
+    // Sustained disagreement between the prior map tags and the estimate: re-anchor the graph
+    gtsam::Pose2 anchor;
+    double graphUpdateTime = watch.lap();
+    if (options_.incremental && options_.useRelocalisation && options_.usePriorTagTable) {
+        TraceSpan span(trace_, "relocalisation");
+        if (relocMonitor_.update(pendingStamp_, poseSE2, predictedPose, detections, savedLandmarks_, anchor)) {
+            ++relocalisations_;
+            events.relocalised = true;
+            events.anchor = anchor;
+            events.previousEstimate = predictedPose;
+            reanchor(anchor);
+            predictedPose = anchor;
+        }
+        if (metrics_) metrics_->record(Stage::Relocalisation, watch.lap());
+    }
+
+    gatingTime_ = 0.0;
+    watch.lap();
+    if (!detections.empty()) {
+        TraceSpan span(trace_, "graph_update");
+        detectedLandmarksCurrentPos = updateGraphWithLandmarks(detectedLandmarksCurrentPos, detections);
+        events.budgetDropped = keyframeBudgetDropped_;
+        span.arg("landmarks", detectedLandmarksCurrentPos.size());
+        span.arg("factors", keyframeGraph_.size());
+    }
+    graphUpdateTime += watch.lap() - gatingTime_;
+    if (metrics_) {
+        metrics_->record(Stage::GraphUpdate, graphUpdateTime);
+        if (gatingTime_ > 0.0) metrics_->record(Stage::Gating, gatingTime_);
+    }
+
+    // Calibration: the graph is only solved once, by optimiseAll()
+    if (!options_.incremental) {
+        lastPoseSE2_ = poseSE2;
+        Key_previous_pos = predictedPose;
+        previousKeyframeSymbol = currentKeyframeSymbol;
+        updateLandmarks(keyframeEstimates_);
+        return events;
+    }
+
+    // Update the pose to landmarks mapping (for LC conditions)
+    poseToLandmarks[currentKeyframeSymbol] = detectedLandmarksCurrentPos;
+
+    Stopwatch solveWatch;
+    TraceSpan solveSpan(trace_, "solve");
+    solveSpan.arg("factors", keyframeGraph_.size());
+    solveSpan.arg("values", keyframeEstimates_.size());
+    double pruningTime = -1.0;
+    if (options_.useIsam2) {
+        ISAM2Optimise();
+    } else {
+        gtsam::Values result = SAMOptimise();
+        solveSpan.arg("iterations", lastIterations_);
+        solveSpan.arg("error", lastError_);
+        solveSpan.stop();  // jump check and pruning are not part of the solve
+
+        // Retrieve CURRENT optimised pose
+        gtsam::Pose2 newPose = result.at<gtsam::Pose2>(currentKeyframeSymbol);
+
+        // Compute jump against the estimate before current
+        double poseJump = computePoseDelta(lastPose_for_jump, newPose);
+
+        if (index_of_pose < options_.outlierRemovalStartIndex) {
+            keyframeEstimates_ = result;
+        } else if (poseJump > options_.jumpCombinedThreshold) {
+            if (options_.useOutlierRemoval) {
+                // Discard the newly optimised solution and propagate the old estimate by odometry
+                events.jumpRejected = true;
+                events.jump = poseJump;
+                gtsam::Pose2 odometry = relPoseFG(lastPoseSE2_, poseSE2);
+                keyframeEstimates_.update(currentKeyframeSymbol, lastPose_for_jump.compose(odometry));
+            }
+        } else {
+            keyframeEstimates_ = result;
+            if (options_.usePruneBySize) {
+                Stopwatch pruneWatch;
+                TraceSpan span(trace_, "pruning");
+                pruneGraphByPoseCount(options_.maxPoses);
+                pruningTime = pruneWatch.elapsed();
+            }
+        }
+    }
+    solveSpan.stop();
+    events.optimisationTime = solveWatch.elapsed();
+    if (pruningTime >= 0.0) events.optimisationTime -= pruningTime;
+
+    lastPose_for_jump = keyframeEstimates_.at<gtsam::Pose2>(currentKeyframeSymbol);
+    lastPoseSE2_ = poseSE2;
+    Key_previous_pos = predictedPose;
+    previousKeyframeSymbol = currentKeyframeSymbol;
+    if (options_.useLoopClosure) {
+        StageTimer timer(metrics_, Stage::LoopClosure);
+        TraceSpan span(trace_, "loop_closure");
+        checkLoopClosure(detectedLandmarksCurrentPos, events);
+    }
+
+    // Reading the estimate back (iSAM2) counts towards the solve
+    solveWatch.lap();
+    {
+        TraceSpan span(trace_, "generate_estimates");
+        generate2bePublished();
+    }
+    if (metrics_) {
+        metrics_->record(Stage::Solve, events.optimisationTime + solveWatch.lap());
+        if (pruningTime >= 0.0) metrics_->record(Stage::Pruning, pruningTime);
+    }
+
+    // Smooth the trajectory
+    if (options_.useTrajSmoothing && !options_.useKeyframe && index_of_pose >= options_.smoothingStartIndex) {
+        StageTimer timer(metrics_, Stage::Smoothing);
+        TraceSpan span(trace_, "smoothing");
+        smoothTrajectory(options_.smoothingWindow);
+    }
+    return events;
+}
+
+const gtsam::Values& Estimator::optimiseAll() {
+    StageTimer timer(metrics_, Stage::Solve);
+    TraceSpan span(trace_, "optimise_all");
+    span.arg("factors", keyframeGraph_.size());
+    span.arg("values", keyframeEstimates_.size());
+    if (options_.useChordalInit) {
+        TraceSpan initSpan(trace_, "chordal_init");
+        gtsam::Values initial;
+        if (chordalInitialise(keyframeGraph_, keyframeEstimates_, initial, &chordalInitReport_)) {
+            keyframeEstimates_ = initial;
+            initSpan.arg("error_before", chordalInitReport_.errorBefore);
+            initSpan.arg("error_after", chordalInitReport_.errorAfter);
+        } else {
+            std::cerr << "Chordal initialisation skipped: " << chordalInitReport_.skipped << std::endl;
+        }
+    }
+    if (!options_.coarseToFine.decimation.empty()) {
+        TraceSpan levelSpan(trace_, "coarse_to_fine");
+        keyframeEstimates_ = coarseToFineInitialise(keyframeGraph_, keyframeEstimates_, options_.coarseToFine, &coarseToFineReport_);
+        levelSpan.arg("levels", coarseToFineReport_.poses.size());
+    }
+    if (options_.submaps.maxPoses > 0) {
+        keyframeEstimates_ = solveInSubmaps(keyframeGraph_, keyframeEstimates_, options_.submaps, &submapReport_);
+        span.arg("submaps", submapReport_.submaps);
+        span.arg("separator_tags", submapReport_.separatorTags);
+    } else {
+        keyframeEstimates_ = SAMOptimise();
+        span.arg("iterations", lastIterations_);
+        span.arg("error", lastError_);
+    }
+    updateLandmarks(keyframeEstimates_);
+    return keyframeEstimates_;
+}
+
+bool Estimator::alignToMap(const std::map<int, gtsam::Point2>& previousMap, const AlignmentParams& params,
+                           double priorSigma, AlignmentResult& result) {
+    // With the prior tag table the session is already in the map frame
+    if (options_.usePriorTagTable) {
+        return false;
+    }
+
+    // The first-sighting guesses of the tags carry the whole odometry drift up to their first
+    // sighting, so the session is solved on its own (anchored by its start pose prior) and its
+    // optimised tags are aligned. One plain LM solve: optimiseAll() refines the aligned session.
+    keyframeEstimates_ = SAMOptimise();
+
+    // Session-frame estimates of the tags the previous map also has
+    std::vector<int> ids;
+    std::vector<Eigen::Vector2d> positions;
+    for (const auto& key_value : keyframeEstimates_) {
+        gtsam::Symbol key(key_value.key);
+        if (key.chr() != 'L' || previousMap.find(static_cast<int>(key.index())) == previousMap.end()) {
+            continue;
+        }
+        const gtsam::Point2& position = keyframeEstimates_.at<gtsam::Point2>(key);
+        ids.push_back(static_cast<int>(key.index()));
+        positions.push_back(Eigen::Vector2d(position.x(), position.y()));
+    }
+    if (!alignTagsToMap(ids, positions, previousMap, params, result)) {
+        return false;
+    }
+    const gtsam::Pose2 sessionToMap = result.pose;
+
+    auto moveToMap = [&sessionToMap](gtsam::Values& values) {
+        gtsam::Values moved;
+        for (const auto& key_value : values) {
+            gtsam::Symbol key(key_value.key);
+            if (key.chr() == 'X') {
+                moved.insert(key, sessionToMap.compose(values.at<gtsam::Pose2>(key)));
+            } else if (key.chr() == 'L') {
+                moved.insert(key, sessionToMap.transformFrom(values.at<gtsam::Point2>(key)));
+            } else {
+                moved.insert(key_value.key, key_value.value);
+            }
+        }
+        values = moved;
+    };
+    moveToMap(keyframeEstimates_);
+    moveToMap(landmarkEstimates);
+    moveToMap(Estimates_visulisation);
+    pose0_ = sessionToMap.compose(pose0_);
+
+    // Relative factors are frame independent, the unary ones move with the session: the start
+    // pose prior (or goes, replaced by the tag priors) and the first-sighting tag priors (or go,
+    // for tags tied to the previous map)
+    std::set<gtsam::Key> tiedTags;
+    if (priorSigma > 0.0) {
+        for (int i : result.inliers) tiedTags.insert(gtsam::Symbol('L', ids[i]));
+    }
+    gtsam::NonlinearFactorGraph graph;
+    for (const auto& factor : keyframeGraph_) {
+        if (factor->size() == 1 && gtsam::Symbol(factor->front()).chr() == 'X') {
+            if (priorSigma <= 0.0) {
+                graph.add(gtsam::PriorFactor<gtsam::Pose2>(factor->front(), pose0_, priorNoise));
+            }
+            continue;
+        }
+        auto tagPrior = boost::dynamic_pointer_cast<gtsam::PriorFactor<gtsam::Point2>>(factor);
+        if (tagPrior) {
+            if (!tiedTags.count(factor->front())) {
+                graph.add(gtsam::PriorFactor<gtsam::Point2>(factor->front(), sessionToMap.transformFrom(tagPrior->prior()),
+                                                            tagPrior->noiseModel()));
+            }
+            continue;
+        }
+        graph.add(factor);
+    }
+    gtsam::SharedNoiseModel previousNoise = gtsam::noiseModel::Isotropic::Sigma(2, std::max(priorSigma, 1e-6));
+    for (int i : result.inliers) {
+        gtsam::Symbol landmarkKey('L', ids[i]);
+        const gtsam::Point2& previous = previousMap.at(ids[i]);
+        keyframeEstimates_.update(landmarkKey, previous);
+        if (priorSigma > 0.0) {
+            graph.add(gtsam::PriorFactor<gtsam::Point2>(landmarkKey, previous, previousNoise));
+        }
+    }
+    keyframeGraph_ = graph;
+    updateLandmarks(keyframeEstimates_);
+    return true;
+}
+
+bool Estimator::currentPose(gtsam::Pose2& pose) const {
+    gtsam::Symbol current('X', index_of_pose);
+    if (Estimates_visulisation.exists(current)) {
+        pose = Estimates_visulisation.at<gtsam::Pose2>(current);
+        return true;
+    }
+    if (keyframeEstimates_.exists(current)) {
+        pose = keyframeEstimates_.at<gtsam::Pose2>(current);
+        return true;
+    }
+    return false;
+}
+
+void Estimator::ISAM2Optimise() {
+    if (batchPending_) {
+        TraceSpan span(trace_, "initial_batch");
+        gtsam::LevenbergMarquardtOptimizer batchOptimizer(keyframeGraph_, keyframeEstimates_);
+        keyframeEstimates_ = batchOptimizer.optimize();
+        span.arg("iterations", batchOptimizer.iterations());
+        batchPending_ = false; // Only do this once
+    }
+
+    // Update the iSAM2 instance with the new measurements
+    TraceSpan span(trace_, "isam2_update");
+    span.arg("new_factors", keyframeGraph_.size());
+    isam_.update(keyframeGraph_, keyframeEstimates_);
+
+    keyframeEstimates_.clear();
+    keyframeGraph_.resize(0);
+}
+
+gtsam::Values Estimator::SAMOptimise() {
+    // Perform batch optimization using Levenberg-Marquardt optimizer
+    gtsam::LevenbergMarquardtOptimizer batchOptimizer(keyframeGraph_, keyframeEstimates_);
+    gtsam::Values result = batchOptimizer.optimize();
+    lastIterations_ = batchOptimizer.iterations();
+    lastError_ = batchOptimizer.error();
+    return result;
+}
+
+// Check if movement exceeds the stationary thresholds
+bool Estimator::movementExceedsThreshold(const gtsam::Pose2& poseSE2) {
+    return se2::movedAtLeast(se2::fromPose2(lastPoseSE2_), se2::fromPose2(poseSE2),
+                             options_.stationaryPositionThreshold, options_.stationaryRotationThreshold);
+}
+
+// Handle initialization of the first pose
+void Estimator::initializeFirstPose(const gtsam::Pose2& poseSE2) {
+    lastPoseSE2_ = poseSE2;
+    lastPoseSE2_vis = poseSE2;
+    lastIntegratedOdom_ = poseSE2;
+    preintegrator_.reset();
+    if (options_.adaptiveKeyframes) updateKeyframeUncertainty(pose0_);
+    keyframeGraph_.add(gtsam::PriorFactor<gtsam::Pose2>(gtsam::Symbol('X', 1), pose0_, priorNoise));
+    keyframeEstimates_.insert(gtsam::Symbol('X', 1), pose0_);
+    Estimates_visulisation.insert(gtsam::Symbol('X', 1), pose0_);
+    lastPose_ = pose0_; // Keep track of the last pose for odometry calculation
+    lastPose_for_jump = pose0_; // For outlier removal
+    addPriorLandmarks();
+    Key_previous_pos = pose0_;
+    previousKeyframeSymbol = gtsam::Symbol('X', 1);
+}
+
+// Load calibrated landmarks as priors if available
+void Estimator::addPriorLandmarks() {
+    if (!options_.usePriorTagTable) {
+        return;
+    }
+    for (const auto& landmark : savedLandmarks_) {
+        gtsam::Symbol landmarkKey('L', landmark.first);
+        keyframeGraph_.add(gtsam::PriorFactor<gtsam::Point2>(landmarkKey, landmark.second, pointNoise));
+        keyframeEstimates_.insert(landmarkKey, landmark.second);
+        landmarkEstimates.insert(landmarkKey, landmark.second);
+    }
+}
+
+void Estimator::updatePriorMap(const std::map<int, gtsam::Point2>& landmarks) {
+    savedLandmarks_ = landmarks;
+    // Before the first pose the priors are added by initializeFirstPose()
+    if (!options_.usePriorTagTable || index_of_pose < 2) {
+        return;
+    }
+    for (const auto& landmark : savedLandmarks_) {
+        gtsam::Symbol landmarkKey('L', landmark.first);
+        if (landmarkEstimates.exists(landmarkKey)) {
+            continue;
+        }
+        keyframeGraph_.add(gtsam::PriorFactor<gtsam::Point2>(landmarkKey, landmark.second, pointNoise));
+        if (!keyframeEstimates_.exists(landmarkKey)) {
+            keyframeEstimates_.insert(landmarkKey, landmark.second);
+        }
+        landmarkEstimates.insert(landmarkKey, landmark.second);
+    }
+
+    // iSAM2 holds its factors itself, evicted priors stay there
+    if (options_.useIsam2) {
+        return;
+    }
+    std::set<gtsam::Key> observed;
+    for (const auto& factor : keyframeGraph_) {
+        if (factor->size() > 1) {
+            observed.insert(factor->keys().begin(), factor->keys().end());
+        }
+    }
+    std::set<gtsam::Key> drop;
+    for (const auto& factor : keyframeGraph_) {
+        if (factor->size() != 1) continue;
+        gtsam::Symbol key(factor->front());
+        if (key.chr() == 'L' && !savedLandmarks_.count(static_cast<int>(key.index())) && !observed.count(key)) {
+            drop.insert(key);
+        }
+    }
+    if (drop.empty()) {
+        return;
+    }
+    gtsam::NonlinearFactorGraph newGraph;
+    for (const auto& factor : keyframeGraph_) {
+        if (factor->size() == 1 && drop.count(factor->front())) continue;
+        newGraph.add(factor);
+    }
+    keyframeGraph_ = newGraph;
+    for (gtsam::Key key : drop) {
+        if (keyframeEstimates_.exists(key)) keyframeEstimates_.erase(key);
+        if (landmarkEstimates.exists(key)) landmarkEstimates.erase(key);
+        detectedLandmarksHistoric.erase(gtsam::Symbol(key));
+    }
+}
+
+void Estimator::reanchor(const gtsam::Pose2& anchor) {
+    gtsam::Symbol currentSymbol('X', index_of_pose);
+
+    keyframeGraph_.resize(0);
+    keyframeEstimates_.clear();
+    landmarkEstimates.clear();
+    detectedLandmarksHistoric.clear();
+    poseToLandmarks.clear();
+    priorAddedToPose.clear();
+    if (options_.useIsam2) {
+        initializeGTSAM();
+        batchPending_ = true;
+    }
+
+    keyframeGraph_.add(gtsam::PriorFactor<gtsam::Pose2>(currentSymbol, anchor, priorNoise));
+    keyframeEstimates_.insert(currentSymbol, anchor);
+    landmarkEstimates.insert(currentSymbol, anchor);
+    priorAddedToPose[currentSymbol] = true;
+    addPriorLandmarks();
+
+    // The previous keyframe is gone, the next odometry factor starts from here
+    lastPose_ = anchor;
+    lastPose_for_jump = anchor;
+    Key_previous_pos = anchor;
+    previousKeyframeSymbol = currentSymbol;
+}
+
+// Predict the next pose based on odometry
+gtsam::Pose2 Estimator::predictNextPose(const gtsam::Pose2& poseSE2) {
+    se2::Pose odometry = se2::between(se2::fromPose2(lastPoseSE2_), se2::fromPose2(poseSE2));
+    return se2::toPose2(se2::compose(se2::fromPose2(lastPose_), odometry));
+}
+
+// Update odometry without adding a keyframe
+void Estimator::updateOdometryPose(const gtsam::Pose2& poseSE2) {
+    se2::Pose odometry = se2::between(se2::fromPose2(lastPoseSE2_vis), se2::fromPose2(poseSE2));
+    const gtsam::Pose2& previous = Estimates_visulisation.at<gtsam::Pose2>(gtsam::Symbol('X', index_of_pose - 1));
+    Estimates_visulisation.insert(gtsam::Symbol('X', index_of_pose), se2::toPose2(se2::compose(se2::fromPose2(previous), odometry)));
+    lastPoseSE2_vis = poseSE2;
+}
+
+void Estimator::generate2bePublished() {
+    if (options_.useIsam2) {
+        // Calculate the current estimate using iSAM2
+        gtsam::Values result = isam_.calculateEstimate();
+        updateLandmarks(result);
+        // Update the visualized estimates with the current pose
+        Estimates_visulisation.insert(previousKeyframeSymbol, result.at<gtsam::Pose2>(previousKeyframeSymbol));
+    } else {
+        updateLandmarks(keyframeEstimates_);
+        Estimates_visulisation.insert(previousKeyframeSymbol, keyframeEstimates_.at<gtsam::Pose2>(previousKeyframeSymbol));
+    }
+}
+
+// Extract landmark estimates by tag id
+void Estimator::updateLandmarks(const gtsam::Values& values) {
+    landmarks_.clear();
+    for (const auto& key_value : values) {
+        gtsam::Symbol symbol(key_value.key);
+        if (symbol.chr() == 'L') {
+            landmarks_[symbol.index()] = values.at<gtsam::Point2>(key_value.key);
+        }
+    }
+}
+
+// Update the graph with landmarks detections
+std::set<gtsam::Symbol> Estimator::updateGraphWithLandmarks(
+    std::set<gtsam::Symbol> detectedLandmarksCurrentPos,
+    const DetectionBatch& detections) {
+
+    // Heading sine / cosine once per keyframe: initial guesses are placed from lastPose_, gating
+    // predicts bearings from the keyframe's pose in landmarkEstimates
+    const se2::Frame guessFrame(lastPose_);
+    const gtsam::Symbol poseKey('X', index_of_pose);
+    const bool havePose = landmarkEstimates.exists(poseKey);
+    const se2::Frame gateFrame(havePose ? landmarkEstimates.at<gtsam::Pose2>(poseKey) : lastPose_);
+
+    // Observation budget: the most informative re-observations become factors, tags anchored by
+    // the prior map are trusted most. Tags seen for the first time tell nothing about the pose,
+    // but dropping them would keep them out of the graph for good: they are always added.
+    std::vector<bool> budgeted;
+    keyframeBudgetDropped_ = 0;
+    const ObservationBudgetParams& budget = options_.observationBudget;
+    if (budget.maxObservations > 0 && detections.size() > static_cast<size_t>(budget.maxObservations)) {
+        std::vector<double> tagSigmas(detections.size(), budget.estimatedTagSigma);
+        std::vector<bool> firstSightings(detections.size(), false);
+        for (size_t n = 0; n < detections.size(); ++n) {
+            const int id = detections.ids[n];
+            if (options_.usePriorTagTable && savedLandmarks_.count(id)) {
+                tagSigmas[n] = options_.pointSigmas.maxCoeff();
+            } else if (!detectedLandmarksHistoric.count(gtsam::Symbol('L', id))) {
+                firstSightings[n] = true;
+            }
+        }
+        const Eigen::Matrix3d poseInformation = options_.odometrySigmas.cwiseAbs2().cwiseInverse().asDiagonal();
+        budgeted = selectInformativeObservations(detections, tagSigmas, options_.bearingRangeSigmas,
+                                                 poseInformation, budget.maxObservations, firstSightings);
+    }
+
+    for (size_t n = 0; n < detections.size(); ++n) {
+        int tag_number = detections.ids[n];
+        Eigen::Vector2d landSE2 = detections.tagPos(n);
+
+        // This tag is not in the prior table, do not add it to the graph
+        if (options_.skipUnknownTags && savedLandmarks_.find(tag_number) == savedLandmarks_.end()) {
+            continue;
+        }
+
+        // Over the budget: no factor, but a tag already in the graph still counts as seen here
+        if (!budgeted.empty() && !budgeted[n]) {
+            ++keyframeBudgetDropped_;
+            ++budgetDropped_;
+            gtsam::Symbol droppedKey('L', tag_number);
+            if (detectedLandmarksHistoric.count(droppedKey)) {
+                detectedLandmarksCurrentPos.insert(droppedKey);
+            }
+            continue;
+        }
+
+        // Bearing and range are precomputed with the batch
+        double bearing = detections.bearing[n];
+        double range = detections.range[n];
+
+        // Fused multi-camera observations carry their own, tighter covariance
+        gtsam::SharedNoiseModel obsNoise = brNoise;
+        if (detections.count[n] > 1) {
+            obsNoise = gtsam::noiseModel::Gaussian::Covariance(detections.covariance(n));
+        }
+
+        // Construct the landmark key
+        gtsam::Symbol landmarkKey('L', tag_number);
+        gtsam::BearingRangeFactor<gtsam::Pose2, gtsam::Point2, gtsam::Rot2, double> factor(
+            gtsam::Symbol('X', index_of_pose), landmarkKey, gtsam::Rot2::fromAngle(bearing), range, obsNoise
+        );
+
+        // Check if the landmark has been observed before
+        if (detectedLandmarksHistoric.find(landmarkKey) != detectedLandmarksHistoric.end()) {
+            // Threshold for ||projection - measurement||
+            // Bearing error of the factor, evaluated directly instead of through unwhitenedError()
+            Stopwatch gate;
+            bool accepted;
+            if (havePose && landmarkEstimates.exists(landmarkKey)) {
+                const gtsam::Point2& landmark = landmarkEstimates.at<gtsam::Point2>(landmarkKey);
+                const double error = se2::wrapAngle(gateFrame.bearingTo(landmark.x(), landmark.y()) - bearing);
+                accepted = std::fabs(error) < options_.add2graphThreshold;
+            } else {
+                gtsam::Vector error = factor.unwhitenedError(landmarkEstimates);
+                accepted = fabs(error[0]) < options_.add2graphThreshold;
+            }
+            gatingTime_ += gate.elapsed();
+            if (accepted)
+                keyframeGraph_.add(factor);
+        } else {
+            // Compute prior location of the landmark using the current robot pose
+            double priorX, priorY;
+            guessFrame.transformFrom(landSE2.x(), landSE2.y(), priorX, priorY);
+            gtsam::Point2 priorLand(priorX, priorY);
+
+            // If the current landmark was not detected in the calibration run
+            // Or it's on calibration mode
+            if (!landmarkEstimates.exists(landmarkKey) || !options_.usePriorTagTable) {
+                // New landmark detected
+                detectedLandmarksHistoric.insert(landmarkKey);
+
+                // Insert initial estimate if not already present
+                if (!keyframeEstimates_.exists(landmarkKey)) {
+                    keyframeEstimates_.insert(landmarkKey, priorLand);
+                }
+                if (!landmarkEstimates.exists(landmarkKey)) {
+                    landmarkEstimates.insert(landmarkKey, priorLand);
+                }
+
+                // Add a prior for the landmark position to help with initial estimation.
+                keyframeGraph_.add(gtsam::PriorFactor<gtsam::Point2>(landmarkKey, priorLand, pointNoise));
+            }
+
+            // Add a bearing-range observation for this landmark to the graph
+            keyframeGraph_.add(factor);
+        }
+        detectedLandmarksCurrentPos.insert(landmarkKey);
+    }
+    return detectedLandmarksCurrentPos;
+}
+
+// Keyframe when the map tags in view are expected to add enough information to the pose,
+// known up to the odometry uncertainty since the latest keyframe, within the rate limit
+bool Estimator::informativeKeyframe(double stamp, const gtsam::Pose2& predictedPose) {
+    const KeyframePolicyParams& policy = options_.keyframePolicy;
+    if (policy.maxRate > 0.0 && stamp - lastKeyframeStamp_ < 1.0 / policy.maxRate) {
+        return false;
+    }
+    // Without tags in view the odometry chain still needs nodes
+    if (policy.maxDistance > 0.0 && preintegrator_.distance() > policy.maxDistance) {
+        return true;
+    }
+    // Scored against what the graph already knows: the candidate is the latest keyframe's
+    // marginal plus the odometry since, and only tags that came into view since then are new.
+    // The others were observed from the keyframe, seeing them again mostly repeats that.
+    const std::map<int, gtsam::Point2>& map = landmarks_.empty() ? savedLandmarks_ : landmarks_;
+    std::vector<Eigen::Vector2d> newTags;
+    for (const auto& tag : visibleTags(predictedPose, map, policy.visibilityRange)) {
+        if (!keyframeTags_.count(tag.first)) newTags.push_back(tag.second);
+    }
+    lastInformationGain_ = expectedInformationGain(
+        propagateCovariance(keyframeCovariance_, preintegrator_.delta(), preintegrator_.covariance()),
+        observationInformation(newTags, options_.bearingRangeSigmas));
+    return lastInformationGain_ > policy.minInformationGain;
+}
+
+// Marginal of a new keyframe, filtered from the previous one, the odometry and the map tags in
+// view. The localisation map is held by tight priors, so its tags are taken as known.
+void Estimator::updateKeyframeUncertainty(const gtsam::Pose2& keyframePose) {
+    const std::map<int, gtsam::Point2>& map = landmarks_.empty() ? savedLandmarks_ : landmarks_;
+    std::vector<Eigen::Vector2d> tags;
+    keyframeTags_.clear();
+    for (const auto& tag : visibleTags(keyframePose, map, options_.keyframePolicy.visibilityRange)) {
+        tags.push_back(tag.second);
+        keyframeTags_.insert(tag.first);
+    }
+    keyframeCovariance_ = observedCovariance(
+        propagateCovariance(keyframeCovariance_, preintegrator_.delta(), preintegrator_.covariance()),
+        observationInformation(tags, options_.bearingRangeSigmas));
+}
+
+bool Estimator::shouldAddKeyframe(
+    const gtsam::Pose2& lastPose,
+    const gtsam::Pose2& currentPose,
+    std::set<gtsam::Symbol> oldlandmarks,
+    std::set<gtsam::Symbol> detectedLandmarksCurrentPos) {
+    // Calculate the distance between the current pose and the last keyframe pose
+    double distance = lastPose.range(currentPose);
+    // Iterate over detectedLandmarksCurrentPos, add key if new tag is detected
+    for (const auto& landmark : detectedLandmarksCurrentPos) {
+        if (oldlandmarks.find(landmark) == oldlandmarks.end()) {
+            return true;
+        }
+    }
+    // Calculate the difference in orientation (theta) between the current pose and the last keyframe pose
+    double angleDifference = std::abs(wrapToPi(currentPose.theta() - lastPose.theta()));
+
+    // Check if either the distance moved or the rotation exceeds the threshold
+    return distance > options_.distanceThreshold || angleDifference > options_.rotationThreshold;
+}
+
+void Estimator::checkLoopClosure(const std::set<gtsam::Symbol>& detectedLandmarksCurrentPos, KeyframeEvents& events) {
+    if (!options_.useLoopClosure) {
+        return;
+    }
+    gtsam::Symbol currentPoseSymbol('X', index_of_pose);
+    gtsam::Pose2 currentPose = keyframeEstimates_.at<gtsam::Pose2>(currentPoseSymbol);
+    // Loop through each keyframe stored in poseToLandmarks
+    for (const auto& entry : poseToLandmarks) {
+        gtsam::Symbol keyframeSymbol = entry.first;  // Symbol representing the keyframe
+        const std::set<gtsam::Symbol>& keyframeLandmarks = entry.second;  // Landmarks associated with the keyframe
+
+        gtsam::Pose2 keyframePose = keyframeEstimates_.at<gtsam::Pose2>(keyframeSymbol);
+        int keyframeIndex = keyframeSymbol.index();
+
+        // Check if the spatial distance and index difference meet the loop closure criteria
+        double distance = lastPose_.range(keyframePose);
+        if (distance < options_.historyKeyframeSearchRadius && (index_of_pose - keyframeIndex) > options_.historyKeyframeSearchNum) {
+            // Find the intersection of landmarks re-observed at the current pose and the keyframe's landmarks
+            std::set<gtsam::Symbol> intersection;
+            std::set_intersection(detectedLandmarksCurrentPos.begin(), detectedLandmarksCurrentPos.end(),
+                                  keyframeLandmarks.begin(), keyframeLandmarks.end(),
+                                  std::inserter(intersection, intersection.begin()));
+
+            // If the number of re-observed landmarks meets the required threshold, trigger loop closure
+            if (static_cast<int>(intersection.size()) >= options_.requiredReobservedLandmarks) {
+                keyframeGraph_.add(gtsam::BetweenFactor<gtsam::Pose2>(keyframeSymbol, currentPoseSymbol, relPoseFG(keyframePose, currentPose), loopClosureNoise));
+                events.loopClosure = true;
+                events.loopClosureKeyframe = keyframeIndex;
+                events.loopClosureCurrentPose = currentPose;
+                events.loopClosureKeyframePose = keyframePose;
+                break;  // Exit after adding one loop closure constraint
+            }
+        }
+    }
+}
+
+void Estimator::pruneGraphByPoseCount(int maxPoses) {
+    // Extract all pose keys from the graph
+    std::set<gtsam::Key> poseKeys;
+    for (const auto& factor : keyframeGraph_) {
+        for (const auto& key : factor->keys()) {
+            if (gtsam::Symbol(key).chr() == 'X') {
+                poseKeys.insert(key);
+            }
+        }
+    }
+
+    // Check if pruning is needed
+    if (poseKeys.size() <= static_cast<size_t>(maxPoses)) {
+        return;
+    }
+
+    // Sort pose keys by their indices
+    std::vector<gtsam::Key> sortedPoseKeys(poseKeys.begin(), poseKeys.end());
+    std::sort(sortedPoseKeys.begin(), sortedPoseKeys.end(), [](gtsam::Key a, gtsam::Key b) {
+        return gtsam::Symbol(a).index() < gtsam::Symbol(b).index();
+    });
+
+    // Identify poses to remove (the oldest ones)
+    std::set<gtsam::Key> keysToRemove(sortedPoseKeys.begin(), sortedPoseKeys.begin() + (poseKeys.size() - maxPoses));
+
+    // Build new graph and estimates without the poses to remove
+    gtsam::NonlinearFactorGraph newGraph;
+    for (const auto& factor : keyframeGraph_) {
+        bool keepFactor = true;
+        for (const auto& key : factor->keys()) {
+            if (keysToRemove.count(key) > 0) {
+                keepFactor = false;
+                break;
+            }
+        }
+        if (keepFactor) {
+            newGraph.add(factor);
+        }
+    }
+
+    gtsam::Values newEstimates;
+    for (const auto& key_value : keyframeEstimates_) {
+        if (keysToRemove.count(key_value.key) == 0) {
+            newEstimates.insert(key_value.key, key_value.value);
+        }
+    }
+
+    keyframeGraph_ = newGraph;
+    keyframeEstimates_ = newEstimates;
+
+    // Add a prior to the oldest remaining pose if not already added
+    gtsam::Symbol oldestPoseSymbol(sortedPoseKeys[poseKeys.size() - maxPoses]);
+    if (!priorAddedToPose[oldestPoseSymbol]) {
+        gtsam::Pose2 oldestPoseEstimate = keyframeEstimates_.at<gtsam::Pose2>(oldestPoseSymbol);
+        keyframeGraph_.add(gtsam::PriorFactor<gtsam::Pose2>(oldestPoseSymbol, oldestPoseEstimate, priorNoise));
+        priorAddedToPose[oldestPoseSymbol] = true;
+    }
+}
+
+// Applies a moving average filter to smooth the trajectory
+void Estimator::smoothTrajectory(int window_size) {
+    if (Estimates_visulisation.empty()) {
+        return;
+    }
+
+    // Collect all X(...) poses in a vector
+    std::vector<std::pair<gtsam::Symbol, gtsam::Pose2>> xPoses;
+    xPoses.reserve(Estimates_visulisation.size());
+    for (const auto& key_value : Estimates_visulisation) {
+        gtsam::Symbol key(key_value.key);
+        if (key.chr() == 'X') {
+            xPoses.emplace_back(key, key_value.value.cast<gtsam::Pose2>());
+        }
+    }
+
+    // If fewer than window_size, skip smoothing
+    if (xPoses.size() < static_cast<size_t>(window_size)) {
+        return;
+    }
+
+    // Sort by Symbol index so we know which one is "last"
+    std::sort(xPoses.begin(), xPoses.end(),
+              [](const auto& a, const auto& b) {
+                  return a.first.index() < b.first.index();
+              });
+
+    // Average x, y over the last `window_size` poses, no smoothing for orientation
+    double sumX = 0.0;
+    double sumY = 0.0;
+    for (size_t i = xPoses.size() - window_size; i < xPoses.size(); ++i) {
+        sumX += xPoses[i].second.x();
+        sumY += xPoses[i].second.y();
+    }
+    gtsam::Pose2 smoothedPose(sumX / window_size, sumY / window_size, xPoses.back().second.theta());
+
+    // Overwrite the last pose in the values with our new partial-smooth version
+    gtsam::Symbol lastKey = xPoses.back().first;
+    if (Estimates_visulisation.exists(lastKey)) {
+        Estimates_visulisation.update(lastKey, smoothedPose);
+    }
+}
+
+double Estimator::computePoseDelta(const gtsam::Pose2& oldPose, const gtsam::Pose2& newPose) {
+    // Magnitude of the jump perpendicular to the old heading
+    return std::fabs(se2::Frame(oldPose).lateralOffset(newPose.x(), newPose.y()));
+}
+
+} // namespace aprilslam
@@ -0,0 +1,58 @@
+#ifndef ESTIMATOR_ACCESS_H
+#define ESTIMATOR_ACCESS_H
+
+// Not installed: the benchmarks and tests set up an Estimator's keyframe history directly and
+// call its maintenance stages on their own, without going through odometry and a solve.
+
+#include "estimator.h"
+#include <gtsam/inference/Symbol.h>
+
+namespace aprilslam {
+namespace detail {
+
+struct EstimatorAccess {
+    // Replace the keyframe history: graph, estimates (poses and tags) and the tags each pose
+    // observes. The latest pose becomes the current one.
+    static void setHistory(Estimator& estimator,
+                           const gtsam::NonlinearFactorGraph& graph,
+                           const gtsam::Values& estimates,
+                           const std::map<gtsam::Symbol, std::set<gtsam::Symbol>>& poseToLandmarks) {
+        estimator.keyframeGraph_ = graph;
+        estimator.keyframeEstimates_ = estimates;
+        estimator.Estimates_visulisation.clear();
+        estimator.poseToLandmarks = poseToLandmarks;
+        estimator.priorAddedToPose.clear();
+        estimator.index_of_pose = 0;
+        for (const auto& key_value : estimates) {
+            gtsam::Symbol key(key_value.key);
+            if (key.chr() != 'X') continue;
+            const gtsam::Pose2& pose = estimates.at<gtsam::Pose2>(key);
+            estimator.Estimates_visulisation.insert(key, pose);
+            if (static_cast<int>(key.index()) >= estimator.index_of_pose) {
+                estimator.index_of_pose = static_cast<int>(key.index());
+                estimator.lastPose_ = pose;
+            }
+        }
+    }
+
+    static const gtsam::NonlinearFactorGraph& graph(const Estimator& estimator) { return estimator.keyframeGraph_; }
+    static const std::map<gtsam::Symbol, std::set<gtsam::Symbol>>& poseToLandmarks(const Estimator& estimator) {
+        return estimator.poseToLandmarks;
+    }
+    static gtsam::SharedNoiseModel odometryNoise(const Estimator& estimator) { return estimator.odometryNoise; }
+    static gtsam::SharedNoiseModel priorNoise(const Estimator& estimator) { return estimator.priorNoise; }
+    static gtsam::SharedNoiseModel bearingRangeNoise(const Estimator& estimator) { return estimator.brNoise; }
+
+    static void prune(Estimator& estimator, int maxPoses) { estimator.pruneGraphByPoseCount(maxPoses); }
+    static void smooth(Estimator& estimator, int window) { estimator.smoothTrajectory(window); }
+    static bool loopClosure(Estimator& estimator, const std::set<gtsam::Symbol>& detected) {
+        KeyframeEvents events;
+        estimator.checkLoopClosure(detected, events);
+        return events.loopClosure;
+    }
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,58 @@
+// keyframe_policy.cpp
+
+#include "keyframe_policy.h"
+#include "se2.h"
+#include <algorithm>
+#include <cmath>
+
+namespace aprilslam {
+
+Eigen::Matrix3d observationInformation(const std::vector<Eigen::Vector2d>& tags,
+                                       const Eigen::Vector2d& bearingRangeSigmas) {
+    const double wb = 1.0 / (bearingRangeSigmas(0) * bearingRangeSigmas(0));
+    const double wr = 1.0 / (bearingRangeSigmas(1) * bearingRangeSigmas(1));
+
+    Eigen::Matrix3d information = Eigen::Matrix3d::Zero();
+    for (const Eigen::Vector2d& tag : tags) {
+        const double r2 = std::max(tag.squaredNorm(), 1e-6);
+        const double r = std::sqrt(r2);
+        const Eigen::Vector3d bearing(tag.y() / r2, -tag.x() / r2, -1.0);
+        const Eigen::Vector3d range(-tag.x() / r, -tag.y() / r, 0.0);
+        information += wb * bearing * bearing.transpose() + wr * range * range.transpose();
+    }
+    return information;
+}
+
+double expectedInformationGain(const Eigen::Matrix3d& poseCovariance, const Eigen::Matrix3d& information) {
+    const Eigen::Matrix3d gain = Eigen::Matrix3d::Identity() + poseCovariance * information;
+    return 0.5 * std::log(std::max(gain.determinant(), 1.0));
+}
+
+Eigen::Matrix3d observedCovariance(const Eigen::Matrix3d& poseCovariance, const Eigen::Matrix3d& information) {
+    // Invertible even for a singular covariance: Sigma J^T R^-1 J has no negative eigenvalues
+    const Eigen::Matrix3d covariance = (Eigen::Matrix3d::Identity() + poseCovariance * information).inverse() * poseCovariance;
+    return 0.5 * (covariance + covariance.transpose());
+}
+
+Eigen::Matrix3d propagateCovariance(const Eigen::Matrix3d& keyframeCovariance, const gtsam::Pose2& delta,
+                                    const Eigen::Matrix3d& segmentCovariance) {
+    const Eigen::Matrix3d adjoint = delta.inverse().AdjointMap();
+    return adjoint * keyframeCovariance * adjoint.transpose() + segmentCovariance;
+}
+
+std::map<int, Eigen::Vector2d> visibleTags(const gtsam::Pose2& pose, const std::map<int, gtsam::Point2>& landmarks, double range) {
+    std::map<int, Eigen::Vector2d> tags;
+    const se2::Frame frame(pose);
+    const double range2 = range * range;
+    for (const auto& landmark : landmarks) {
+        const double dx = landmark.second.x() - pose.x();
+        const double dy = landmark.second.y() - pose.y();
+        if (dx * dx + dy * dy > range2) continue;
+        Eigen::Vector2d tag;
+        frame.transformTo(landmark.second.x(), landmark.second.y(), tag.x(), tag.y());
+        tags[landmark.first] = tag;
+    }
+    return tags;
+}
+
+}
@@ -0,0 +1,218 @@
+// landmark_tiles.cpp
+
+#include "landmark_tiles.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace aprilslam {
+
+LandmarkTileMap::LandmarkTileMap(const TileParams& params) : params_(params), clock_(0), warnedOverBudget_(false) {}
+
+bool LandmarkTileMap::open(const std::string& directory) {
+    tiles_.clear();
+    active_.clear();
+    tileOfId_.clear();
+    missingIds_.clear();
+    bounds_ = MapBounds();
+    directory_ = directory;
+
+    std::ifstream file(directory + "/index.csv");
+    if (!file.is_open()) {
+        std::cerr << "Failed to open the tile index in " << directory << std::endl;
+        return false;
+    }
+
+    std::string line;
+    std::getline(file, line);   // header
+    while (std::getline(file, line)) {
+        std::istringstream ss(line);
+        std::string field;
+        std::vector<std::string> fields;
+        while (std::getline(ss, field, ',')) fields.push_back(field);
+        if (fields.size() < 8) {
+            continue;
+        }
+        try {
+            // file,count,min_x,min_y,max_x,max_y,min_id,max_id
+            Tile tile;
+            tile.file = fields[0];
+            tile.box.xmin = std::stod(fields[2]);
+            tile.box.ymin = std::stod(fields[3]);
+            tile.box.xmax = std::stod(fields[4]);
+            tile.box.ymax = std::stod(fields[5]);
+            tile.minId = std::stoi(fields[6]);
+            tile.maxId = std::stoi(fields[7]);
+            tiles_.push_back(tile);
+        } catch (const std::exception& e) {
+            std::cerr << "Error parsing tile index line: " << line << " - " << e.what() << std::endl;
+        }
+    }
+
+    if (!tiles_.empty()) {
+        bounds_ = tiles_.front().box;
+        for (const Tile& tile : tiles_) {
+            bounds_.xmin = std::min(bounds_.xmin, tile.box.xmin);
+            bounds_.xmax = std::max(bounds_.xmax, tile.box.xmax);
+            bounds_.ymin = std::min(bounds_.ymin, tile.box.ymin);
+            bounds_.ymax = std::max(bounds_.ymax, tile.box.ymax);
+        }
+    }
+    return !tiles_.empty();
+}
+
+size_t LandmarkTileMap::loadedTiles() const {
+    return std::count_if(tiles_.begin(), tiles_.end(), [](const Tile& tile) { return tile.loaded; });
+}
+
+double LandmarkTileMap::distance(const Tile& tile, double x, double y) const {
+    // Zero inside the box
+    const double dx = std::max({tile.box.xmin - x, 0.0, x - tile.box.xmax});
+    const double dy = std::max({tile.box.ymin - y, 0.0, y - tile.box.ymax});
+    return std::hypot(dx, dy);
+}
+
+bool LandmarkTileMap::load(Tile& tile, TileChange* change) {
+    tile.lastUsed = ++clock_;
+    if (tile.loaded) {
+        return false;
+    }
+    std::map<int, gtsam::Point2> landmarks = loadLandmarksFromCSV(directory_ + "/" + tile.file);
+    tile.ids.clear();
+    tile.ids.reserve(landmarks.size());
+    const size_t index = static_cast<size_t>(&tile - tiles_.data());
+    for (const auto& landmark : landmarks) {
+        tileOfId_.emplace(landmark.first, index);
+        // A tag listed in two tiles belongs to the first one loaded
+        if (active_.emplace(landmark.first, landmark.second).second) {
+            tile.ids.push_back(landmark.first);
+            if (change) change->loaded.push_back(landmark.first);
+        }
+    }
+    tile.loaded = true;
+    tile.indexed = true;
+    return true;
+}
+
+void LandmarkTileMap::evict(Tile& tile, TileChange* change) {
+    for (int id : tile.ids) {
+        active_.erase(id);
+        if (change) change->evicted.push_back(id);
+    }
+    tile.ids.clear();
+    tile.ids.shrink_to_fit();
+    tile.loaded = false;
+}
+
+bool LandmarkTileMap::update(double x, double y, TileChange* change) {
+    const size_t maxTiles = std::max<size_t>(params_.maxTiles, 1);
+    bool changed = false;
+    std::vector<std::pair<double, Tile*>> inRange;
+    for (Tile& tile : tiles_) {
+        const double d = distance(tile, x, y);
+        if (d <= params_.loadRadius) {
+            inRange.emplace_back(d, &tile);
+        } else if (tile.loaded && d > params_.evictRadius) {
+            evict(tile, change);
+            changed = true;
+        }
+    }
+
+    // Loading more than the budget would evict part of it again straight away, and the next
+    // update would read those tiles back from disk
+    if (inRange.size() > maxTiles) {
+        if (!warnedOverBudget_) {
+            std::cerr << inRange.size() << " tiles within the load radius of " << params_.loadRadius
+                      << " m but at most " << maxTiles << " may be loaded, only the nearest are."
+                      << " Lower the load radius or raise the tile budget." << std::endl;
+            warnedOverBudget_ = true;
+        }
+        std::nth_element(inRange.begin(), inRange.begin() + maxTiles, inRange.end(),
+                         [](const std::pair<double, Tile*>& a, const std::pair<double, Tile*>& b) { return a.first < b.first; });
+        inRange.resize(maxTiles);
+    }
+    for (const auto& entry : inRange) {
+        changed |= load(*entry.second, change);
+    }
+
+    // Over the budget: drop the least recently used tiles, never one the robot is in
+    size_t loaded = loadedTiles();
+    while (loaded > maxTiles) {
+        Tile* oldest = nullptr;
+        for (Tile& tile : tiles_) {
+            if (tile.loaded && distance(tile, x, y) > 0.0 && (!oldest || tile.lastUsed < oldest->lastUsed)) {
+                oldest = &tile;
+            }
+        }
+        if (!oldest) break;
+        evict(*oldest, change);
+        changed = true;
+        --loaded;
+    }
+    return changed;
+}
+
+bool LandmarkTileMap::loadTileWithTag(int id, TileChange* change) {
+    if (active_.count(id)) {
+        return true;
+    }
+    if (missingIds_.count(id)) {
+        return false;
+    }
+    auto known = tileOfId_.find(id);
+    if (known != tileOfId_.end()) {
+        Tile& tile = tiles_[known->second];
+        load(tile, change);
+        return active_.count(id) > 0;
+    }
+    // The index only keeps id ranges, tiles whose range covers the id are read until it is found.
+    // Tiles read before are already in tileOfId_ and skipped.
+    for (Tile& tile : tiles_) {
+        if (tile.loaded || tile.indexed || id < tile.minId || id > tile.maxId) {
+            continue;
+        }
+        load(tile, nullptr);
+        if (active_.count(id)) {
+            if (change) change->loaded.insert(change->loaded.end(), tile.ids.begin(), tile.ids.end());
+            return true;
+        }
+        evict(tile, nullptr);
+    }
+    missingIds_.insert(id);
+    return false;
+}
+
+bool writeLandmarkTiles(const std::map<int, gtsam::Point2>& landmarks, const std::string& directory, double tileSize) {
+    if (!(tileSize > 0.0)) {
+        std::cerr << "Tile size must be positive" << std::endl;
+        return false;
+    }
+
+    std::map<std::pair<long, long>, std::map<int, gtsam::Point2>> cells;
+    for (const auto& landmark : landmarks) {
+        const long i = static_cast<long>(std::floor(landmark.second.x() / tileSize));
+        const long j = static_cast<long>(std::floor(landmark.second.y() / tileSize));
+        cells[{i, j}].insert(landmark);
+    }
+
+    std::ofstream index(directory + "/index.csv", std::ios::out);
+    if (!index) {
+        std::cerr << "Failed to open the tile index in " << directory << std::endl;
+        return false;
+    }
+    index << "file,count,min_x,min_y,max_x,max_y,min_id,max_id\n";
+    for (const auto& cell : cells) {
+        const std::string name = "tile_" + std::to_string(cell.first.first) + "_" + std::to_string(cell.first.second) + ".csv";
+        saveLandmarksToCSV(cell.second, directory + "/" + name);
+        // Bounds of the tags themselves, tighter than the cell
+        const MapBounds box = landmarkBounds(cell.second);
+        index << name << "," << cell.second.size() << ","
+              << box.xmin << "," << box.ymin << "," << box.xmax << "," << box.ymax << ","
+              << cell.second.begin()->first << "," << cell.second.rbegin()->first << "\n";
+    }
+    return static_cast<bool>(index);
+}
+
+}
@@ -0,0 +1,67 @@
+// observation_budget.cpp
+
+#include "observation_budget.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace aprilslam {
+
+std::vector<bool> selectInformativeObservations(const DetectionBatch& detections,
+                                                const std::vector<double>& tagSigmas,
+                                                const Eigen::Vector2d& bearingRangeSigmas,
+                                                const Eigen::Matrix3d& poseInformation,
+                                                int budget,
+                                                const std::vector<bool>& firstSightings) {
+    const size_t n = detections.size();
+    std::vector<bool> selected(n, false);
+    size_t ranked = 0;
+    for (size_t i = 0; i < n; ++i) {
+        selected[i] = i < firstSightings.size() && firstSightings[i];
+        if (!selected[i]) ++ranked;
+    }
+    if (budget <= 0 || ranked <= static_cast<size_t>(budget)) {
+        return std::vector<bool>(n, true);
+    }
+
+    // Jacobian of (bearing, range) on a body-frame pose perturbation and the effective noise
+    std::vector<Eigen::Matrix<double, 2, 3>> jacobians(n);
+    std::vector<Eigen::Matrix2d> noise(n);
+    const Eigen::Matrix2d defaultNoise = bearingRangeSigmas.cwiseAbs2().asDiagonal();
+    for (size_t i = 0; i < n; ++i) {
+        const double bx = detections.x[i];
+        const double by = detections.y[i];
+        const double r2 = std::max(bx * bx + by * by, 1e-6);
+        const double r = std::sqrt(r2);
+        jacobians[i] << by / r2, -bx / r2, -1.0,
+                        -bx / r, -by / r, 0.0;
+        noise[i] = detections.count[i] > 1 ? detections.covariance(i) : defaultNoise;
+        // An isotropic tag uncertainty seen through (bearing, range) is diag(1 / r^2, 1)
+        const double sigma2 = tagSigmas[i] * tagSigmas[i];
+        noise[i](0, 0) += sigma2 / r2;
+        noise[i](1, 1) += sigma2;
+    }
+
+    // Gain of a detection: log det(R + J P J^T) - log det(R), P the current pose covariance
+    Eigen::Matrix3d information = poseInformation;
+    for (int k = 0; k < budget; ++k) {
+        const Eigen::Matrix3d covariance = information.inverse();
+        size_t best = n;
+        double bestGain = -std::numeric_limits<double>::infinity();
+        for (size_t i = 0; i < n; ++i) {
+            if (selected[i]) continue;
+            const Eigen::Matrix2d predicted = noise[i] + jacobians[i] * covariance * jacobians[i].transpose();
+            const double gain = std::log(predicted.determinant() / noise[i].determinant());
+            if (gain > bestGain) {
+                bestGain = gain;
+                best = i;
+            }
+        }
+        if (best == n) break;
+        selected[best] = true;
+        information += jacobians[best].transpose() * noise[best].inverse() * jacobians[best];
+    }
+    return selected;
+}
+
+}
@@ -0,0 +1,64 @@
+// odometry_preintegration.cpp
+
+#include "odometry_preintegration.h"
+#include <algorithm>
+#include <cmath>
+
+namespace aprilslam {
+
+OdometryPreintegrator::OdometryPreintegrator(const PreintegrationParams& params)
+    : params_(params) {
+    reset();
+}
+
+void OdometryPreintegrator::reset() {
+    delta_ = gtsam::Pose2();
+    covariance_.setZero();
+    distance_ = 0.0;
+    steps_ = 0;
+}
+
+void OdometryPreintegrator::integrate(const gtsam::Pose2& increment) {
+    // Adjoint of the inverse increment moves the segment covariance into the new end frame
+    const double c = std::cos(increment.theta());
+    const double s = std::sin(increment.theta());
+    const double x = increment.x();
+    const double y = increment.y();
+    Eigen::Matrix3d adjoint;
+    adjoint << c, s, x * s - y * c,
+              -s, c, x * c + y * s,
+               0, 0, 1;
+
+    const double length = std::hypot(x, y);
+    const double turn = std::abs(increment.theta());
+    Eigen::Vector3d variances = params_.sigmasPerMetre.cwiseAbs2() * length;
+    variances(2) += params_.thetaSigmaPerRadian * params_.thetaSigmaPerRadian * turn;
+
+    covariance_ = adjoint * covariance_ * adjoint.transpose();
+    covariance_.diagonal() += variances;
+    delta_ = delta_.compose(increment);
+    distance_ += length;
+    ++steps_;
+}
+
+Eigen::Matrix3d OdometryPreintegrator::covariance() const {
+    Eigen::Matrix3d covariance = covariance_;
+    for (int i = 0; i < 3; ++i) {
+        covariance(i, i) = std::max(covariance(i, i), params_.minSigmas(i) * params_.minSigmas(i));
+    }
+    return covariance;
+}
+
+gtsam::SharedNoiseModel OdometryPreintegrator::noiseModel() const {
+    return gtsam::noiseModel::Gaussian::Covariance(covariance());
+}
+
+double OdometryPreintegrator::positionSigma() const {
+    return std::sqrt(std::max(covariance_(0, 0), covariance_(1, 1)));
+}
+
+bool OdometryPreintegrator::exceedsUncertainty() const {
+    return params_.maxPositionSigma > 0.0 && positionSigma() > params_.maxPositionSigma;
+}
+
+}
@@ -0,0 +1,398 @@
+// particle_filter.cpp
+
+#include "particle_filter.h"
+#include "se2.h"
+#include <thread>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <numeric>
+#include <unordered_set>
+
+namespace aprilslam {
+
+namespace {
+
+// Branch-free angle wrap to [-pi, pi), keeps the particle loops free of data-dependent branches
+inline double wrapAngle(double angle) {
+    return se2::wrapAngleBranchless(angle);
+}
+
+} // namespace
+
+void ParticleSet::resize(size_t n) {
+    x.resize(n);
+    y.resize(n);
+    theta.resize(n);
+    w.resize(n);
+}
+
+void ParticleSet::clear() {
+    x.clear();
+    y.clear();
+    theta.clear();
+    w.clear();
+}
+
+ParticleFilter::ParticleFilter(const PFParams& params) : iteration_(0) {
+    setParams(params);
+}
+
+void ParticleFilter::setParams(const PFParams& params) {
+    params_ = params;
+    seed_ = params_.seed != 0 ? params_.seed : (static_cast<std::uint64_t>(std::random_device{}()) << 32) ^ std::random_device{}();
+
+    invRngVar_ = 1.0 / params_.rngVar;
+    invBrngVar_ = 1.0 / params_.brngVar;
+}
+
+Eigen::Vector2d steadyStateStd(const PFParams& params) {
+    auto fixedPoint = [](double q, double m) {
+        return std::sqrt(0.5 * (std::sqrt(q * q + 4.0 * q * m) - q));
+    };
+    return Eigen::Vector2d(fixedPoint(params.sigmaPos * params.sigmaPos, params.rngVar),
+                           fixedPoint(params.sigmaTheta * params.sigmaTheta, params.brngVar));
+}
+
+void ParticleFilter::setParticles(const ParticleSet& particles) {
+    particles_ = particles;
+    if (particles_.w.size() != particles_.size()) {
+        particles_.w.assign(particles_.size(), 1.0 / std::max<size_t>(1, particles_.size()));
+    }
+}
+
+void ParticleFilter::clear() {
+    particles_.clear();
+    scratch_.clear();
+}
+
+std::mt19937_64 ParticleFilter::stream(std::uint64_t block) const {
+    std::seed_seq seq{static_cast<std::uint32_t>(seed_), static_cast<std::uint32_t>(seed_ >> 32),
+                      static_cast<std::uint32_t>(iteration_), static_cast<std::uint32_t>(iteration_ >> 32),
+                      static_cast<std::uint32_t>(block), static_cast<std::uint32_t>(block >> 32)};
+    return std::mt19937_64(seq);
+}
+
+void ParticleFilter::predictAndWeight(size_t begin, size_t end, std::mt19937_64& gen, const gtsam::Pose2& motion,
+                                      const std::vector<double>& lx, const std::vector<double>& ly,
+                                      const std::vector<double>& zr, const std::vector<double>& zb) {
+    double* x = particles_.x.data();
+    double* y = particles_.y.data();
+    double* theta = particles_.theta.data();
+
+    // State prediction: odometry motion in each particle's frame plus diffusion that grows with it
+    std::normal_distribution<double> nd(0.0, 1.0);
+    const double mx = motion.x();
+    const double my = motion.y();
+    const double mtheta = motion.theta();
+    const double sigmaPos = params_.sigmaPos + params_.motionNoise * std::hypot(mx, my);
+    const double sigmaTheta = params_.sigmaTheta + params_.motionNoise * std::abs(mtheta);
+    for (size_t i = begin; i < end; ++i) {
+        const se2::SinCos sc = se2::sinCos(theta[i]);
+        x[i] += sc.c * mx - sc.s * my + sigmaPos * nd(gen);
+        y[i] += sc.s * mx + sc.c * my + sigmaPos * nd(gen);
+        theta[i] = wrapAngle(theta[i] + mtheta + sigmaTheta * nd(gen));
+    }
+
+    // Measurement update, landmark-major so the inner loop runs over contiguous particles.
+    // The tags are independent observations: their log-likelihoods add up in the scratch
+    // weights and are applied to the weights once every block is done.
+    double* lik = scratch_.w.data();
+    std::fill(lik + begin, lik + end, 0.0);
+    const double invRng = invRngVar_;
+    const double invBrng = invBrngVar_;
+    for (size_t l = 0; l < lx.size(); ++l) {
+        const double lxl = lx[l];
+        const double lyl = ly[l];
+        const double zrl = zr[l];
+        const double zbl = zb[l];
+        for (size_t i = begin; i < end; ++i) {
+            const double dx = lxl - x[i];
+            const double dy = lyl - y[i];
+            const double rangeError = std::sqrt(dx * dx + dy * dy) - zrl;
+            const double bearingError = wrapAngle(zbl - (std::atan2(dy, dx) - theta[i]));
+            lik[i] -= 0.5 * (rangeError * rangeError * invRng + bearingError * bearingError * invBrng);
+        }
+    }
+}
+
+void ParticleFilter::step(const std::vector<int>& Id,
+                          const std::vector<Eigen::Vector2d>& tagPos,
+                          const std::map<int, gtsam::Point2>& savedLandmarks,
+                          const gtsam::Pose2& motion) {
+    const size_t n = particles_.size();
+    if (n == 0) {
+        return;
+    }
+
+    // Measurements as (range, bearing) and map positions of the tags that are in the prior table
+    std::vector<double> lx, ly, zr, zb;
+    lx.reserve(Id.size()); ly.reserve(Id.size());
+    zr.reserve(Id.size()); zb.reserve(Id.size());
+    for (size_t l = 0; l < Id.size(); ++l) {
+        auto it = savedLandmarks.find(Id[l]);
+        if (it == savedLandmarks.end()) {
+            continue;
+        }
+        lx.push_back(it->second.x());
+        ly.push_back(it->second.y());
+        zr.push_back(tagPos[l].norm());
+        zb.push_back(std::atan2(tagPos[l].y(), tagPos[l].x()));
+    }
+
+    // Split into fixed blocks; each block always gets the same RNG stream whatever the thread count
+    const size_t nblocks = (n + kBlockSize - 1) / kBlockSize;
+    size_t threads = params_.threads > 0 ? static_cast<size_t>(params_.threads)
+                                         : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, nblocks);
+    scratch_.w.resize(n);
+
+    auto worker = [&](size_t t) {
+        for (size_t b = t; b < nblocks; b += threads) {
+            std::mt19937_64 gen = stream(b);
+            predictAndWeight(b * kBlockSize, std::min(n, (b + 1) * kBlockSize), gen, motion, lx, ly, zr, zb);
+        }
+    };
+
+    if (threads <= 1) {
+        worker(0);
+    } else {
+        std::vector<std::thread> pool;
+        pool.reserve(threads - 1);
+        for (size_t t = 1; t < threads; ++t) {
+            pool.emplace_back(worker, t);
+        }
+        worker(0);
+        for (auto& th : pool) {
+            th.join();
+        }
+    }
+
+    // Likelihoods relative to the best particle so many tags do not underflow every weight.
+    // The previous weights are only uniform right after a resample.
+    const double best = *std::max_element(scratch_.w.begin(), scratch_.w.end());
+    for (size_t i = 0; i < n; ++i) {
+        particles_.w[i] *= std::exp(scratch_.w[i] - best);
+    }
+
+    resample();
+    ++iteration_;
+}
+
+void ParticleFilter::normalise() {
+    std::vector<double>& w = particles_.w;
+    const double sumW = std::accumulate(w.begin(), w.end(), 0.0);
+    if (!(sumW > 0.0) || !std::isfinite(sumW)) {
+        // Every particle is inconsistent with the measurements, start from uniform weights again
+        std::fill(w.begin(), w.end(), 1.0 / w.size());
+        return;
+    }
+    const double inv = 1.0 / sumW;
+    for (double& wi : w) wi *= inv;
+}
+
+Eigen::Matrix3d ParticleFilter::covariance() const {
+    const size_t n = particles_.size();
+    if (n == 0) {
+        return Eigen::Matrix3d::Identity() * std::numeric_limits<double>::infinity();
+    }
+    const Eigen::Vector3d mu = mean();
+    double sw = 0.0;
+    Eigen::Matrix3d cov = Eigen::Matrix3d::Zero();
+    for (size_t i = 0; i < n; ++i) {
+        const double wi = particles_.w[i];
+        const Eigen::Vector3d d(particles_.x[i] - mu(0), particles_.y[i] - mu(1), wrapAngle(particles_.theta[i] - mu(2)));
+        cov.noalias() += wi * d * d.transpose();
+        sw += wi;
+    }
+    return sw > 0.0 ? Eigen::Matrix3d(cov / sw) : cov;
+}
+
+double ParticleFilter::effectiveSampleSize() const {
+    double sumSq = 0.0;
+    for (double wi : particles_.w) sumSq += wi * wi;
+    return sumSq > 0.0 ? 1.0 / sumSq : 0.0;
+}
+
+size_t ParticleFilter::kldSampleCount(size_t bins) const {
+    if (bins <= 1) {
+        return params_.minParticles;
+    }
+    // Wilson-Hilferty approximation of the chi-square quantile (Fox, 2003)
+    const double k = static_cast<double>(bins - 1);
+    const double a = 2.0 / (9.0 * k);
+    const double b = 1.0 - a + std::sqrt(a) * params_.kldZ;
+    const double n = k / (2.0 * params_.kldEpsilon) * b * b * b;
+    return std::min(params_.maxParticles, std::max(params_.minParticles, static_cast<size_t>(std::ceil(n))));
+}
+
+size_t ParticleFilter::occupiedBins(const std::vector<double>& cumsum, size_t draws) const {
+    // Histogram support of a systematic draw of `draws` particles, without copying them
+    std::unordered_set<std::uint64_t> bins;
+    bins.reserve(draws);
+    const double invBin = 1.0 / params_.binSize;
+    const double invBinTheta = 1.0 / params_.binTheta;
+    const double step = 1.0 / draws;
+    double u = 0.5 * step;
+    size_t j = 0;
+    const size_t n = cumsum.size();
+    for (size_t i = 0; i < draws; ++i, u += step) {
+        while (j < n - 1 && cumsum[j] < u) ++j;
+        const std::int64_t bx = static_cast<std::int64_t>(std::floor(particles_.x[j] * invBin));
+        const std::int64_t by = static_cast<std::int64_t>(std::floor(particles_.y[j] * invBin));
+        const std::int64_t bt = static_cast<std::int64_t>(std::floor(particles_.theta[j] * invBinTheta));
+        // Packed unsigned: shifting a negative or sign-reaching signed value is undefined
+        bins.insert(static_cast<std::uint64_t>(bx & 0xFFFFFF) |
+                    (static_cast<std::uint64_t>(by & 0xFFFFFF) << 24) |
+                    (static_cast<std::uint64_t>(bt & 0xFFFF) << 48));
+    }
+    return bins.size();
+}
+
+void ParticleFilter::resample() {
+    const size_t n = particles_.size();
+    normalise();
+
+    // Only resample once the weights have degenerated
+    if (effectiveSampleSize() >= params_.essThreshold * n) {
+        return;
+    }
+
+    std::vector<double>& cumsum = cumsum_;
+    cumsum.resize(n);
+    std::partial_sum(particles_.w.begin(), particles_.w.end(), cumsum.begin());
+    cumsum[n - 1] = 1.0;
+
+    // KLD sizing: shrink the set as the posterior concentrates in fewer bins
+    const size_t m = kldSampleCount(occupiedBins(cumsum, n));
+
+    // Systematic resampling, a single uniform offset and one O(N + M) pass over the weights
+    std::mt19937_64 gen = stream(std::numeric_limits<std::uint64_t>::max());
+    const double step = 1.0 / m;
+    double u = std::uniform_real_distribution<double>(0.0, step)(gen);
+    scratch_.resize(m);
+    size_t j = 0;
+    for (size_t i = 0; i < m; ++i, u += step) {
+        while (j < n - 1 && cumsum[j] < u) ++j;
+        scratch_.x[i] = particles_.x[j];
+        scratch_.y[i] = particles_.y[j];
+        scratch_.theta[i] = particles_.theta[j];
+        scratch_.w[i] = step;
+    }
+    std::swap(particles_, scratch_);
+}
+
+Eigen::Vector3d ParticleFilter::mean() const {
+    const size_t n = particles_.size();
+    if (n == 0) {
+        return Eigen::Vector3d::Zero();
+    }
+    double sw = 0.0, sx = 0.0, sy = 0.0, ss = 0.0, sc = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        const double wi = particles_.w[i];
+        sw += wi;
+        sx += wi * particles_.x[i];
+        sy += wi * particles_.y[i];
+        ss += wi * std::sin(particles_.theta[i]);
+        sc += wi * std::cos(particles_.theta[i]);
+    }
+    if (!(sw > 0.0)) {
+        return Eigen::Vector3d::Zero();
+    }
+    return Eigen::Vector3d(sx / sw, sy / sw, std::atan2(ss, sc));
+}
+
+ParticleSet initParticles(int Ninit, const MapBounds& area) {
+    // Define grid boundaries
+    double xmin = area.xmin, xmax = area.xmax;
+    double ymin = area.ymin, ymax = area.ymax;
+
+    // Compute grid dimensions, a box without height (e.g. collinear tags) becomes a single row
+    const double width = xmax - xmin;
+    const double height = ymax - ymin;
+    const double columns = height > 0.0 ? width / height * std::sqrt(Ninit) : Ninit;
+    int Nx = static_cast<int>(std::max(1.0, std::min(std::round(columns), static_cast<double>(std::max(1, Ninit)))));
+    int Ny = std::max(1, static_cast<int>(std::round(double(Ninit) / Nx)));
+    int N = Nx * Ny;
+
+    // Generate linear spacing
+    Eigen::VectorXd X_lin = Eigen::VectorXd::LinSpaced(Nx, xmin, xmax);
+    Eigen::VectorXd Y_lin = Eigen::VectorXd::LinSpaced(Ny, ymin, ymax);
+
+    // Random orientation generator
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::normal_distribution<double> d_theta(0.0, M_PI);
+
+    ParticleSet particles;
+    particles.resize(N);
+    for (int i = 0; i < Ny; ++i) {
+        for (int j = 0; j < Nx; ++j) {
+            const size_t k = static_cast<size_t>(i) * Nx + j;
+            particles.x[k] = X_lin(j);
+            particles.y[k] = Y_lin(i);
+            particles.theta[k] = wrapAngle(d_theta(gen));
+            particles.w[k] = 1.0 / N;
+        }
+    }
+
+    return particles;
+}
+
+ParticleSet initParticlesFromFirstTag(
+        const std::vector<int>& Id,
+        const std::vector<Eigen::Vector2d>& tagPos,
+        const std::map<int, gtsam::Point2>& savedLandmarks,
+        int Ninit) {
+
+    // If no tags, return empty or handle as needed
+    if (Id.empty()) {
+        return ParticleSet();
+    }
+
+    // Randomly pick a tag from the detected list
+    std::random_device rd;
+    std::mt19937 gen(rd());
+    std::uniform_int_distribution<int> dist_idx(0, (int)Id.size() - 1);
+
+    int random_index = dist_idx(gen);
+    int tag_id = Id[random_index];
+    Eigen::Vector2d landSE2 = tagPos[random_index];
+
+    // Attempt to find the chosen tag in the saved landmarks
+    auto it = savedLandmarks.find(tag_id);
+    if (it == savedLandmarks.end()) {
+        // If the tag isn't found in the landmark table, return empty or fallback to another strategy
+        return ParticleSet();
+    }
+
+    gtsam::Point2 tag_global = it->second;
+
+    // Standard deviations for spreading out particles around the estimated location
+    double stddev_pos = 0.5;      // meters, about the range noise
+    double stddev_theta = M_PI/4; // radians, adjust as needed
+
+    // Random distributions
+    std::normal_distribution<double> dist_pos(0.0, stddev_pos);
+    std::normal_distribution<double> dist_theta(0.0, stddev_theta);
+
+    // Generate particles. For a sampled heading the single observation fixes the position
+    // (tag minus the rotated body-frame vector), so particles lie on the ring around the tag
+    // rather than in a blob that ignores the heading.
+    ParticleSet particles;
+    particles.resize(std::max(0, Ninit));
+    for (int i = 0; i < Ninit; ++i) {
+        const double theta = wrapAngle(dist_theta(gen));
+        const se2::SinCos sc = se2::sinCos(theta);
+        const double c = sc.c;
+        const double s = sc.s;
+        particles.x[i] = tag_global.x() - (c * landSE2(0) - s * landSE2(1)) + dist_pos(gen);
+        particles.y[i] = tag_global.y() - (s * landSE2(0) + c * landSE2(1)) + dist_pos(gen);
+        particles.theta[i] = theta;
+        particles.w[i] = 1.0 / Ninit;
+    }
+
+    return particles;
+}
+
+} // namespace aprilslam
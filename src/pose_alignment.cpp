@@ -0,0 +1,160 @@
+// pose_alignment.cpp
+
+#include "pose_alignment.h"
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace aprilslam {
+
+bool rigidAlign2D(const std::vector<Eigen::Vector2d>& body,
+                  const std::vector<Eigen::Vector2d>& map,
+                  gtsam::Pose2& pose) {
+    const size_t n = std::min(body.size(), map.size());
+    if (n < 2) {
+        return false;
+    }
+
+    // Centroids
+    Eigen::Vector2d cb = Eigen::Vector2d::Zero();
+    Eigen::Vector2d cm = Eigen::Vector2d::Zero();
+    for (size_t i = 0; i < n; ++i) {
+        cb += body[i];
+        cm += map[i];
+    }
+    cb /= double(n);
+    cm /= double(n);
+
+    // In 2D the optimal rotation has a closed form from the centred cross-covariance
+    double sdot = 0.0, scross = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        const Eigen::Vector2d b = body[i] - cb;
+        const Eigen::Vector2d m = map[i] - cm;
+        sdot += b.x() * m.x() + b.y() * m.y();
+        scross += b.x() * m.y() - b.y() * m.x();
+    }
+    const double theta = std::atan2(scross, sdot);
+    const double c = std::cos(theta);
+    const double s = std::sin(theta);
+    const Eigen::Vector2d t = cm - Eigen::Vector2d(c * cb.x() - s * cb.y(), s * cb.x() + c * cb.y());
+
+    pose = gtsam::Pose2(t.x(), t.y(), theta);
+    return true;
+}
+
+namespace {
+
+// Map-frame residual of one observation under a pose hypothesis
+double residual(const gtsam::Pose2& pose, const Eigen::Vector2d& body, const Eigen::Vector2d& map) {
+    const double c = std::cos(pose.theta());
+    const double s = std::sin(pose.theta());
+    const double px = c * body.x() - s * body.y() + pose.x();
+    const double py = s * body.x() + c * body.y() + pose.y();
+    return std::hypot(px - map.x(), py - map.y());
+}
+
+} // namespace
+
+bool alignTagsToMap(const std::vector<int>& Id,
+                    const std::vector<Eigen::Vector2d>& tagPos,
+                    const std::map<int, gtsam::Point2>& savedLandmarks,
+                    const AlignmentParams& params,
+                    AlignmentResult& result) {
+    // Correspondences with a known map position
+    std::vector<Eigen::Vector2d> body, map;
+    std::vector<int> index;
+    for (size_t i = 0; i < Id.size(); ++i) {
+        auto it = savedLandmarks.find(Id[i]);
+        if (it == savedLandmarks.end()) {
+            continue;
+        }
+        body.push_back(tagPos[i]);
+        map.push_back(Eigen::Vector2d(it->second.x(), it->second.y()));
+        index.push_back(static_cast<int>(i));
+    }
+    const int n = static_cast<int>(body.size());
+    const int minInliers = std::max(2, params.minInliers);
+    if (n < minInliers) {
+        return false;
+    }
+
+    // Pair hypotheses: all of them when there are few, random ones otherwise
+    std::vector<std::pair<int, int>> pairs;
+    const long totalPairs = static_cast<long>(n) * (n - 1) / 2;
+    if (totalPairs <= params.maxIterations) {
+        for (int a = 0; a < n; ++a)
+            for (int b = a + 1; b < n; ++b)
+                pairs.emplace_back(a, b);
+    } else {
+        std::mt19937 gen(params.seed != 0 ? params.seed : std::random_device{}());
+        std::uniform_int_distribution<int> pick(0, n - 1);
+        while (static_cast<int>(pairs.size()) < params.maxIterations) {
+            int a = pick(gen), b = pick(gen);
+            if (a != b) pairs.emplace_back(a, b);
+        }
+    }
+
+    std::vector<int> bestInliers;
+    double bestCost = std::numeric_limits<double>::infinity();
+    std::vector<Eigen::Vector2d> pairBody(2), pairMap(2);
+    for (const auto& pr : pairs) {
+        // A rigid motion preserves distances, reject inconsistent or too short pairs before fitting
+        const double db = (body[pr.first] - body[pr.second]).norm();
+        const double dm = (map[pr.first] - map[pr.second]).norm();
+        if (dm < params.minBaseline || std::abs(db - dm) > 2.0 * params.inlierThreshold) {
+            continue;
+        }
+
+        pairBody[0] = body[pr.first]; pairBody[1] = body[pr.second];
+        pairMap[0] = map[pr.first];   pairMap[1] = map[pr.second];
+        gtsam::Pose2 hypothesis;
+        rigidAlign2D(pairBody, pairMap, hypothesis);
+
+        // Score by inlier count, ties broken by the truncated residual
+        std::vector<int> inliers;
+        double cost = 0.0;
+        for (int i = 0; i < n; ++i) {
+            const double r = residual(hypothesis, body[i], map[i]);
+            if (r < params.inlierThreshold) {
+                inliers.push_back(i);
+                cost += r * r;
+            } else {
+                cost += params.inlierThreshold * params.inlierThreshold;
+            }
+        }
+        if (inliers.size() > bestInliers.size() ||
+            (inliers.size() == bestInliers.size() && cost < bestCost)) {
+            bestInliers.swap(inliers);
+            bestCost = cost;
+        }
+    }
+    if (static_cast<int>(bestInliers.size()) < minInliers) {
+        return false;
+    }
+
+    // Least-squares refit over the consensus set
+    std::vector<Eigen::Vector2d> inBody, inMap;
+    for (int i : bestInliers) {
+        inBody.push_back(body[i]);
+        inMap.push_back(map[i]);
+    }
+    gtsam::Pose2 pose;
+    rigidAlign2D(inBody, inMap, pose);
+
+    double sq = 0.0;
+    for (size_t k = 0; k < inBody.size(); ++k) {
+        const double r = residual(pose, inBody[k], inMap[k]);
+        sq += r * r;
+    }
+
+    result.pose = pose;
+    result.rmse = std::sqrt(sq / inBody.size());
+    result.inliers.clear();
+    for (int i : bestInliers) {
+        result.inliers.push_back(index[i]);
+    }
+    return true;
+}
+
+} // namespace aprilslam
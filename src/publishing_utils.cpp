@@ -1,35 +1,10 @@
 // publishing_utils.cpp
 
 #include "publishing_utils.h"
+#include <cstdio>
 
 namespace aprilslam {
 
-// Utility function to normalize an angle to the range [-pi, pi]
-double wrapToPi(double angle) {
-    angle = fmod(angle + M_PI, 2 * M_PI);
-    return angle - M_PI;
-}   
-
-// Computes the relative pose between two Pose2 objects
-gtsam::Pose2 relPoseFG(const gtsam::Pose2& lastPoseSE2, const gtsam::Pose2& PoseSE2) {
-    double dx = PoseSE2.x() - lastPoseSE2.x();
-    double dy = PoseSE2.y() - lastPoseSE2.y();
-    double dtheta = wrapToPi(PoseSE2.theta() - lastPoseSE2.theta());
-
-    // Compute the distance moved along the robot's forward direction
-    double distance = std::sqrt(dx * dx + dy * dy);
-    double direction = std::atan2(dy, dx);
-    // return gtsam::Pose2(distance, 0, dtheta);
-
-    // Adjust the distance based on the robot's heading to account for backward movement
-    double theta = lastPoseSE2.theta();
-    double dx_body = std::cos(theta) * dx + std::sin(theta) * dy;
-    double dy_body = -std::sin(theta) * dx + std::cos(theta) * dy;
-
-    // Return the relative pose assuming robot cant move sideways: dy = 0
-    return gtsam::Pose2(dx_body, dy_body, dtheta);
-} 
-
 void publishLandmarks(ros::Publisher& landmark_pub, const std::map<int, gtsam::Point2>& landmarks, const std::string& frame_id) {
     visualization_msgs::MarkerArray markers;
     int id = 0;
@@ -108,6 +83,62 @@ void publishPath(ros::Publisher& path_pub, const gtsam::Values& result, int max_
     path_pub.publish(path);
 }
 
+void publishPoseWithCovariance(ros::Publisher& pub, const Eigen::Vector3d& pose, const Eigen::Matrix3d& cov, const std::string& frame_id) {
+    geometry_msgs::PoseWithCovarianceStamped msg;
+    msg.header.frame_id = frame_id;
+    msg.header.stamp = ros::Time::now();
+    msg.pose.pose.position.x = pose(0);
+    msg.pose.pose.position.y = pose(1);
+    msg.pose.pose.position.z = 0;
+
+    tf2::Quaternion quat;
+    quat.setRPY(0, 0, pose(2));
+    msg.pose.pose.orientation = tf2::toMsg(quat);
+
+    // Planar covariance into the 6x6 (x, y, z, roll, pitch, yaw) row-major layout
+    const int idx[3] = {0, 1, 5};
+    msg.pose.covariance.fill(0.0);
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 3; ++c) {
+            msg.pose.covariance[idx[r] * 6 + idx[c]] = cov(r, c);
+        }
+    }
+    pub.publish(msg);
+}
+
+void publishMetrics(ros::Publisher& pub, const StageMetrics& metrics, const std::string& node_name) {
+    diagnostic_msgs::DiagnosticArray msg;
+    msg.header.stamp = ros::Time::now();
+    for (size_t i = 0; i < StageMetrics::kStages; ++i) {
+        Stage stage = static_cast<Stage>(i);
+        const LatencyHistogram& hist = metrics.histogram(stage);
+
+        diagnostic_msgs::DiagnosticStatus status;
+        status.level = diagnostic_msgs::DiagnosticStatus::OK;
+        status.name = node_name + ": " + stageName(stage);
+        status.hardware_id = node_name;
+
+        auto addValue = [&status](const std::string& key, double value) {
+            diagnostic_msgs::KeyValue kv;
+            kv.key = key;
+            kv.value = std::to_string(value);
+            status.values.push_back(kv);
+        };
+        addValue("count", static_cast<double>(hist.count()));
+        addValue("mean_ms", hist.mean() * 1e3);
+        addValue("p50_ms", hist.percentile(0.50) * 1e3);
+        addValue("p95_ms", hist.percentile(0.95) * 1e3);
+        addValue("p99_ms", hist.percentile(0.99) * 1e3);
+        addValue("max_ms", hist.max() * 1e3);
+
+        char summary[96];
+        std::snprintf(summary, sizeof(summary), "p50 %.2f ms, p99 %.2f ms", hist.percentile(0.50) * 1e3, hist.percentile(0.99) * 1e3);
+        status.message = hist.count() ? summary : "no samples";
+        msg.status.push_back(status);
+    }
+    pub.publish(msg);
+}
+
 void publishMapToOdomTF(tf2_ros::TransformBroadcaster& tf_broadcaster, 
                         const gtsam::Values& result, int latest_index, 
                         const gtsam::Pose2& poseSE2, 
@@ -206,97 +237,74 @@ void publishRefinedOdom(ros::Publisher& odom_pub,
 
 }
 
-void saveLandmarksToCSV(const std::map<int, gtsam::Point2>& landmarks, const std::string& filename) {
-    std::ofstream file;
-    file.open(filename, std::ios::out); // Open file in write mode
-
-    if (!file) {
-        std::cerr << "Failed to open the file!" << std::endl;
+// funtion for computing tag locations from coordinate transformation
+void processDetections(const apriltag_ros::AprilTagDetectionArray::ConstPtr& cam_msg, 
+                       const CameraInfo& cam,
+                       int camera_index,
+                       DetectionBatch& batch) {
+    if (!cam_msg || cam_msg->detections.empty()) {
         return;
     }
-    // Write the header line
-    file << "id,x,y\n";
-    
-    for (const auto& landmark : landmarks) {
-        int id = landmark.first;
-        gtsam::Point2 point = landmark.second;
-        file << id << "," << point.x() << "," << point.y() << "\n";
-    }
 
-    file.close();
-}
-
-std::map<int, gtsam::Point2> loadLandmarksFromCSV(const std::string& filename) {
-    std::map<int, gtsam::Point2> landmarks;
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        std::cerr << "Failed to open the file!" << std::endl;
-        return landmarks;
-    }
-
-    std::string line;
-
-    // Skip the header line
-    if (std::getline(file, line)) {
-        // You can print or log the header if needed
-        // std::cout << "Header: " << line << std::endl;
+    const size_t begin = batch.size();
+    const size_t n = cam_msg->detections.size();
+    batch.resize(begin + n);
+
+    // Gather the camera-frame positions (optical z forward, -x left) into the batch
+    int* ids = batch.ids.data() + begin;
+    int* camera = batch.camera.data() + begin;
+    double* x = batch.x.data() + begin;
+    double* y = batch.y.data() + begin;
+    for (size_t i = 0; i < n; ++i) {
+        const auto& detection = cam_msg->detections[i];
+        ids[i] = detection.id[0];
+        camera[i] = camera_index;
+        x[i] = detection.pose.pose.pose.position.z;
+        y[i] = -detection.pose.pose.pose.position.x;
+        batch.count[begin + i] = 1;
     }
 
-    while (std::getline(file, line)) {
-        std::istringstream ss(line);
-        std::string id_str, x_str, y_str;
-        if (std::getline(ss, id_str, ',') && std::getline(ss, x_str, ',') && std::getline(ss, y_str, ',')) {
-            try {
-                int id = std::stoi(id_str);
-                double x = std::stod(x_str);
-                double y = std::stod(y_str);
-                landmarks[id] = gtsam::Point2(x, y);
-            } catch (const std::exception& e) {
-                std::cerr << "Error parsing line: " << line << " - " << e.what() << std::endl;
-            }
-        }
+    // Transform into base_link and compute bearing/range in one pass over contiguous arrays
+    const double r00 = cam.rotation(0, 0), r01 = cam.rotation(0, 1);
+    const double r10 = cam.rotation(1, 0), r11 = cam.rotation(1, 1);
+    const double tx = cam.translation(0), ty = cam.translation(1);
+    double* bearing = batch.bearing.data() + begin;
+    double* range = batch.range.data() + begin;
+    for (size_t i = 0; i < n; ++i) {
+        const double cx = x[i];
+        const double cy = y[i];
+        const double px = r00 * cx + r01 * cy + tx;
+        const double py = r10 * cx + r11 * cy + ty;
+        x[i] = px;
+        y[i] = py;
+        range[i] = std::sqrt(px * px + py * py);
+        bearing[i] = std::atan2(py, px);
     }
-
-    file.close();
-    return landmarks;
 }
 
-// funtion for computing tag locations from coordinate transformation
-void processDetections(const apriltag_ros::AprilTagDetectionArray::ConstPtr& cam_msg, 
-                       const Eigen::Vector3d& xyTrans_cam_baselink,
-                       std::vector<int>& Ids, 
-                       std::vector<Eigen::Vector2d>& tagPoss) {
-    if (cam_msg) {
-        for (const auto& detection : cam_msg->detections) {
-            Ids.push_back(detection.id[0]);
-            double rotTheta = xyTrans_cam_baselink(2);
-            Eigen::Matrix2d R;
-            R << cos(rotTheta), -sin(rotTheta),
-                 sin(rotTheta),  cos(rotTheta);
-            Eigen::Vector2d rotP = R * Eigen::Vector2d(detection.pose.pose.pose.position.z, -detection.pose.pose.pose.position.x);
-            tagPoss.push_back(rotP + xyTrans_cam_baselink.head<2>());
-        }
-    }
-}
-
-// funtion for processing tag detection topics into IDs and TagPoss
-std::pair<std::vector<int>, std::vector<Eigen::Vector2d>> getCamDetections(
+// funtion for processing tag detection topics of all cameras into one batch
+void getCamDetections(
     const std::vector<CameraInfo>& camera_infos,
-    const std::map<std::string, apriltag_ros::AprilTagDetectionArray::ConstPtr>& camera_detections) {
+    const std::map<std::string, apriltag_ros::AprilTagDetectionArray::ConstPtr>& camera_detections,
+    DetectionBatch& batch) {
 
-    std::vector<int> Ids;
-    std::vector<Eigen::Vector2d> tagPoss;
+    batch.clear();
+
+    // Size the batch once for all cameras
+    size_t total = 0;
+    for (const auto& entry : camera_detections) {
+        if (entry.second) total += entry.second->detections.size();
+    }
+    batch.reserve(total);
 
-    for (const auto& cam : camera_infos) {
-        auto it = camera_detections.find(cam.name);
+    for (size_t c = 0; c < camera_infos.size(); ++c) {
+        auto it = camera_detections.find(camera_infos[c].name);
         if (it == camera_detections.end()) {
             continue;
         }
 
-        // This calls the original processDetections with the correct transformation
-        processDetections(it->second, cam.transform, Ids, tagPoss);
+        processDetections(it->second, camera_infos[c], static_cast<int>(c), batch);
     }
-    return std::make_pair(Ids, tagPoss);
 }
 
 void visualizeLoopClosure(ros::Publisher& lc_pub, const gtsam::Pose2& currentPose, const gtsam::Pose2& keyframePose, int currentPoseIndex, const std::string& frame_id) {
@@ -334,238 +342,6 @@ void visualizeLoopClosure(ros::Publisher& lc_pub, const gtsam::Pose2& currentPos
     lc_pub.publish(line_marker);
 }
 
-// Particle filter as position initialisation function
-std::vector<Eigen::Vector3d> particleFilter(
-        const std::vector<int>& Id,
-        const std::vector<Eigen::Vector2d>& tagPos,
-        const std::map<int, gtsam::Point2>& savedLandmarks,
-        std::vector<Eigen::Vector3d>& x_P,
-        int N,
-        double rngVar,
-        double brngVar) {
-
-    int numLandmarks_detected = (int)Id.size();
-
-    // z: each landmark measurement as [range, bearing]
-    std::vector<Eigen::Vector2d> z(numLandmarks_detected);
-
-    // Preprocess measurements
-    // Original logic: range = atan2(y, x), bearing = sqrt(x² + y²)
-    for (int n = 0; n < numLandmarks_detected; ++n) {
-        Eigen::Vector2d landSE2 = tagPos[n];
-        double range = std::atan2(landSE2(1), landSE2(0));
-        double brng = std::sqrt(landSE2(0)*landSE2(0) + landSE2(1)*landSE2(1));
-        z[n](0) = range;
-        z[n](1) = brng;
-    }
-
-    // Extract landmark positions (egoPos)
-    std::vector<Eigen::Vector2d> egoPos(numLandmarks_detected);
-    for (int n = 0; n < numLandmarks_detected; ++n) {
-        int tag_number_detected = Id[n];
-        auto it = savedLandmarks.find(tag_number_detected);
-        if (it != savedLandmarks.end()) {
-            const gtsam::Point2& Lpos = it->second;
-            egoPos[n](0) = Lpos.x();
-            egoPos[n](1) = Lpos.y();
-        } else {
-            egoPos[n](0) = std::numeric_limits<double>::quiet_NaN();
-            egoPos[n](1) = std::numeric_limits<double>::quiet_NaN();
-        }
-    }
-
-    // Randomizer setup
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::normal_distribution<double> nd(0.0, 1.0);
-    std::uniform_real_distribution<double> ud(0.0, 1.0);
-
-    // Temporary updates and weights
-    std::vector<Eigen::Vector3d> x_P_update(N);
-    std::vector<double> P_w(N);
-
-    // Particle Filter Update
-    for (int i = 0; i < N; ++i) {
-        // State prediction
-        Eigen::Matrix3d A = Eigen::Matrix3d::Identity();
-        Eigen::Matrix3d Q = Eigen::Matrix3d::Zero();
-        Q(0,0) = 1.0;
-        Q(1,1) = 1.0;
-        Q(2,2) = 0.4;
-
-        Eigen::Vector3d noise(nd(gen), nd(gen), nd(gen));
-        Eigen::Vector3d xplus = A * x_P[i] + Q * noise;
-        xplus(2) = wrapToPi(xplus(2));
-        x_P_update[i] = xplus;
-
-        // Measurement update
-        double weight = 0.0;
-        for (int l = 0; l < numLandmarks_detected; ++l) {
-            if (std::isnan(egoPos[l](0)) || std::isnan(egoPos[l](1))) {
-                // Landmark unknown, skip
-                continue;
-            }
-
-            Eigen::Vector2d targetPos = xplus.head<2>();
-            Eigen::Vector2d error = egoPos[l] - targetPos;
-            double range_pred = error.norm();
-            double bearing_pred = std::atan2(error(1), error(0)) - xplus(2);
-            bearing_pred = std::atan2(std::sin(bearing_pred), std::cos(bearing_pred));
-
-            double bearingError = z[l](1) - bearing_pred;
-            if (bearingError < -M_PI) bearingError += 2*M_PI;
-            else if (bearingError > M_PI) bearingError -= 2*M_PI;
-
-            double rangeError = range_pred - z[l](0);
-            double sr = std::sqrt(rngVar);
-            double sb = std::sqrt(brngVar);
-
-            double rl = std::exp(-0.5 * std::pow(rangeError/sr,2)) / (sr * std::sqrt(2*M_PI));
-            double bl = std::exp(-0.5 * std::pow(bearingError/sb,2)) / (sb * std::sqrt(2*M_PI));
-
-            weight += (rl * bl);
-        }
-        P_w[i] = weight;
-    }
-
-    // Normalize weights
-    double sumW = 0.0;
-    for (double w : P_w) sumW += w;
-
-    if (sumW == 0) {
-        for (int i = 0; i < N; ++i)
-            P_w[i] = 1.0 / N;
-    } else {
-        for (int i = 0; i < N; ++i)
-            P_w[i] /= sumW;
-    }
-
-    // Resampling
-    std::vector<double> cumsum(N);
-    cumsum[0] = P_w[0];
-    for (int i = 1; i < N; ++i) {
-        cumsum[i] = cumsum[i-1] + P_w[i];
-    }
-
-    std::vector<Eigen::Vector3d> x_P_new(N);
-    for (int i = 0; i < N; ++i) {
-        double r = ud(gen);
-        auto it = std::lower_bound(cumsum.begin(), cumsum.end(), r);
-        int idx = (int)std::distance(cumsum.begin(), it);
-        if (idx >= N) idx = N-1;
-        x_P_new[i] = x_P_update[idx];
-    }
-
-    // x_est calculation removed since it caused reference issues and wasn't in snippet
-    // If needed, compute x_est here by averaging particles.
-
-    // Update x_P reference
-    x_P = x_P_new;
-    return x_P_new; // return by value is safe since x_P_new is a local variable
-}
-
-std::vector<Eigen::Vector3d> initParticles(int Ninit) {
-    // Define grid boundaries
-    double xmin = -3.0, xmax = 6.0;
-    double ymin = -25.0, ymax = 145.0;
-
-    // Compute grid dimensions
-    double ratio = (xmax - xmin) / (ymax - ymin);
-    int Nx = static_cast<int>(std::round(ratio * std::sqrt(Ninit)));
-    int Ny = static_cast<int>(std::round(double(Ninit) / Nx));
-    int N = Nx * Ny;
-
-    // Generate linear spacing
-    Eigen::VectorXd X_lin = Eigen::VectorXd::LinSpaced(Nx, xmin, xmax);
-    Eigen::VectorXd Y_lin = Eigen::VectorXd::LinSpaced(Ny, ymin, ymax);
-
-    // Random orientation generator
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::normal_distribution<double> d_theta(0.0, M_PI);
-
-    // Prepare vector to store particles
-    std::vector<Eigen::Vector3d> particles;
-    particles.reserve(N);
-
-    for (int i = 0; i < Ny; ++i) {
-        for (int j = 0; j < Nx; ++j) {
-            Eigen::Vector3d particle;
-            particle(0) = X_lin(j);
-            particle(1) = Y_lin(i);
-            double new_theta = d_theta(gen);
-            particle(2) = wrapToPi(new_theta); // Assuming wrapToPi is defined
-
-            particles.push_back(particle);
-        }
-    }
-
-    return particles;
-}
-
-std::vector<Eigen::Vector3d> initParticlesFromFirstTag(
-        const std::vector<int>& Id,
-        const std::vector<Eigen::Vector2d>& tagPos,
-        const std::map<int, gtsam::Point2>& savedLandmarks,
-        int Ninit) {
-
-    // If no tags, return empty or handle as needed
-    if (Id.empty()) {
-        return std::vector<Eigen::Vector3d>();
-    }
-
-    // Randomly pick a tag from the detected list
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<int> dist_idx(0, (int)Id.size() - 1);
-
-    int random_index = dist_idx(gen);
-    int tag_id = Id[random_index];
-    Eigen::Vector2d landSE2 = tagPos[random_index];
-
-    // Attempt to find the chosen tag in the saved landmarks
-    auto it = savedLandmarks.find(tag_id);
-    if (it == savedLandmarks.end()) {
-        // If the tag isn't found in the landmark table, return empty or fallback to another strategy
-        return std::vector<Eigen::Vector3d>();
-    }
-
-    gtsam::Point2 tag_global = it->second;
-
-    // Compute range and bearing from measurement
-    double range = std::sqrt(landSE2(0)*landSE2(0) + landSE2(1)*landSE2(1));
-    double bearing = std::atan2(landSE2(1), landSE2(0));
-
-    // Estimate robot position:
-    double robot_x = tag_global.x() - range * std::cos(bearing);
-    double robot_y = tag_global.y() - range * std::sin(bearing);
-
-    // Standard deviations for spreading out particles around the estimated location
-    double stddev_pos = 5.0;      // meters, adjust as needed
-    double stddev_theta = M_PI/4; // radians, adjust as needed
-
-    // Random distributions
-    std::normal_distribution<double> dist_x(robot_x, stddev_pos);
-    std::normal_distribution<double> dist_y(robot_y, stddev_pos);
-    std::normal_distribution<double> dist_theta(0.0, stddev_theta);
-
-    // Generate particles
-    std::vector<Eigen::Vector3d> particles;
-    particles.reserve(Ninit);
-
-    for (int i = 0; i < Ninit; ++i) {
-        Eigen::Vector3d particle;
-        particle(0) = dist_x(gen);
-        particle(1) = dist_y(gen);
-        double new_theta = dist_theta(gen);
-        particle(2) = wrapToPi(new_theta);  // Ensure wrapToPi is defined somewhere
-
-        particles.push_back(particle);
-    }
-
-    return particles;
-}
-
 } // namespace aprilslamcpp
 
 
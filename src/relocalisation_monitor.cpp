@@ -0,0 +1,94 @@
+// relocalisation_monitor.cpp
+
+#include "relocalisation_monitor.h"
+#include <algorithm>
+#include <cmath>
+
+namespace aprilslam {
+
+RelocalisationMonitor::RelocalisationMonitor(const RelocalisationParams& params)
+    : params_(params), count_(0), since_(0.0), lastResidual_(0.0) {}
+
+void RelocalisationMonitor::reset() {
+    frames_.clear();
+    count_ = 0;
+    since_ = 0.0;
+    lastResidual_ = 0.0;
+}
+
+bool RelocalisationMonitor::update(double stamp,
+                                   const gtsam::Pose2& odomPose,
+                                   const gtsam::Pose2& estimate,
+                                   const DetectionBatch& detections,
+                                   const std::map<int, gtsam::Point2>& savedLandmarks,
+                                   gtsam::Pose2& anchor) {
+    // Keep the known tags of this keyframe and their residuals under the current estimate
+    Frame frame;
+    frame.odom = odomPose;
+    residuals_.clear();
+    for (size_t i = 0; i < detections.size(); ++i) {
+        auto it = savedLandmarks.find(detections.ids[i]);
+        if (it == savedLandmarks.end()) {
+            continue;
+        }
+        const Eigen::Vector2d tag = detections.tagPos(i);
+        frame.ids.push_back(detections.ids[i]);
+        frame.tagPos.push_back(tag);
+        residuals_.push_back((estimate.transformFrom(gtsam::Point2(tag.x(), tag.y())) - it->second).norm());
+    }
+    if (!frame.ids.empty()) {
+        frames_.push_back(std::move(frame));
+        while (static_cast<int>(frames_.size()) > std::max(1, params_.window)) {
+            frames_.pop_front();
+        }
+    }
+
+    // Keyframes without known tags neither confirm nor contradict the estimate
+    if (residuals_.empty()) {
+        return false;
+    }
+
+    // Median is robust to a single misdetected or moved tag
+    auto mid = residuals_.begin() + residuals_.size() / 2;
+    std::nth_element(residuals_.begin(), mid, residuals_.end());
+    lastResidual_ = *mid;
+    if (lastResidual_ < params_.residualThreshold) {
+        count_ = 0;
+        return false;
+    }
+    if (count_ == 0) {
+        since_ = stamp;
+    }
+    if (++count_ < params_.triggerCount) {
+        return false;
+    }
+
+    // Global search: stack the window into the current body frame through odometry
+    std::vector<int> ids;
+    std::vector<Eigen::Vector2d> tagPos;
+    for (const auto& f : frames_) {
+        const gtsam::Pose2 delta = odomPose.between(f.odom);
+        for (size_t i = 0; i < f.ids.size(); ++i) {
+            gtsam::Point2 p = delta.transformFrom(gtsam::Point2(f.tagPos[i].x(), f.tagPos[i].y()));
+            ids.push_back(f.ids[i]);
+            tagPos.push_back(Eigen::Vector2d(p.x(), p.y()));
+        }
+    }
+    count_ = 0;
+    if (!alignTagsToMap(ids, tagPos, savedLandmarks, params_.alignment, lastSearch_)) {
+        return false;
+    }
+
+    // The map explains the tags without a large correction, the disagreement came from elsewhere
+    const double correction = std::hypot(lastSearch_.pose.x() - estimate.x(), lastSearch_.pose.y() - estimate.y());
+    const double headingCorrection = std::abs(estimate.rotation().between(lastSearch_.pose.rotation()).theta());
+    if (correction < params_.minCorrection && headingCorrection < params_.minHeadingCorrection) {
+        return false;
+    }
+
+    anchor = lastSearch_.pose;
+    frames_.clear();
+    return true;
+}
+
+} // namespace aprilslam
@@ -0,0 +1,198 @@
+// replay.cpp
+
+#include "replay.h"
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <tf2_msgs/TFMessage.h>
+#include <sstream>
+#include <chrono>
+
+namespace aprilslam {
+
+namespace {
+
+void sortByStamp(std::vector<ReplayMessage>& messages) {
+    std::stable_sort(messages.begin(), messages.end(),
+                     [](const ReplayMessage& a, const ReplayMessage& b) { return a.stamp < b.stamp; });
+}
+
+// Split one CSV line on commas
+std::vector<std::string> splitCSV(const std::string& line) {
+    std::vector<std::string> fields;
+    std::stringstream ss(line);
+    std::string field;
+    while (std::getline(ss, field, ',')) {
+        fields.push_back(field);
+    }
+    return fields;
+}
+
+} // namespace
+
+bool loadReplayBag(const std::string& path,
+                   const std::string& odom_topic,
+                   const std::vector<CameraInfo>& camera_infos,
+                   std::vector<ReplayMessage>& messages) {
+    std::map<std::string, std::string> topicToCamera;
+    std::vector<std::string> topics{odom_topic};
+    for (const auto& cam : camera_infos) {
+        topicToCamera[cam.topic] = cam.name;
+        topics.push_back(cam.topic);
+    }
+
+    rosbag::Bag bag;
+    try {
+        bag.open(path, rosbag::bagmode::Read);
+    } catch (const rosbag::BagException& e) {
+        ROS_ERROR("Failed to open bag %s", path.c_str());
+        return false;
+    }
+
+    rosbag::View view(bag, rosbag::TopicQuery(topics));
+    messages.reserve(messages.size() + view.size());
+    for (const rosbag::MessageInstance& m : view) {
+        ReplayMessage entry;
+        if (m.getTopic() == odom_topic) {
+            entry.odom = m.instantiate<nav_msgs::Odometry>();
+            if (!entry.odom) continue;
+            entry.stamp = entry.odom->header.stamp.toSec();
+        } else {
+            entry.detections = m.instantiate<apriltag_ros::AprilTagDetectionArray>();
+            if (!entry.detections) continue;
+            entry.camera = topicToCamera[m.getTopic()];
+            entry.stamp = entry.detections->header.stamp.toSec();
+        }
+        // Some drivers leave the header empty, fall back to the recording time
+        if (entry.stamp <= 0.0) {
+            entry.stamp = m.getTime().toSec();
+        }
+        messages.push_back(entry);
+    }
+    bag.close();
+
+    sortByStamp(messages);
+    return true;
+}
+
+size_t loadBagStaticTransforms(const std::string& path, tf2_ros::Buffer& buffer) {
+    rosbag::Bag bag;
+    try {
+        bag.open(path, rosbag::bagmode::Read);
+    } catch (const rosbag::BagException& e) {
+        ROS_ERROR("Failed to open bag %s", path.c_str());
+        return 0;
+    }
+
+    size_t count = 0;
+    rosbag::View view(bag, rosbag::TopicQuery(std::vector<std::string>{"/tf_static"}));
+    for (const rosbag::MessageInstance& m : view) {
+        tf2_msgs::TFMessage::ConstPtr msg = m.instantiate<tf2_msgs::TFMessage>();
+        if (!msg) continue;
+        for (const auto& transform : msg->transforms) {
+            if (buffer.setTransform(transform, "replay_bag", true)) ++count;
+        }
+    }
+    bag.close();
+    return count;
+}
+
+bool loadReplayCSV(const std::string& odom_csv,
+                   const std::string& detections_csv,
+                   std::vector<ReplayMessage>& messages) {
+    std::ifstream odomFile(odom_csv);
+    if (!odomFile.is_open()) {
+        ROS_ERROR("Failed to open odometry CSV %s", odom_csv.c_str());
+        return false;
+    }
+
+    std::string line;
+    std::getline(odomFile, line); // Skip header
+    while (std::getline(odomFile, line)) {
+        std::vector<std::string> f = splitCSV(line);
+        if (f.size() < 5) continue;
+
+        nav_msgs::Odometry::Ptr odom(new nav_msgs::Odometry);
+        double stamp = std::stod(f[0]);
+        odom->header.stamp = ros::Time(stamp);
+        odom->pose.pose.position.x = std::stod(f[1]);
+        odom->pose.pose.position.y = std::stod(f[2]);
+        odom->pose.pose.position.z = std::stod(f[3]);
+        tf2::Quaternion quat;
+        quat.setRPY(0, 0, std::stod(f[4]) * M_PI / 180.0);
+        odom->pose.pose.orientation = tf2::toMsg(quat);
+        messages.push_back(ReplayMessage{stamp, std::string(), odom, nullptr});
+    }
+
+    // Detections are optional, odometry alone still exercises the pipeline
+    if (!detections_csv.empty()) {
+        std::ifstream detFile(detections_csv);
+        if (!detFile.is_open()) {
+            ROS_ERROR("Failed to open detections CSV %s", detections_csv.c_str());
+            return false;
+        }
+        std::getline(detFile, line); // Skip header
+        apriltag_ros::AprilTagDetectionArray::Ptr array;
+        std::string arrayCamera;
+        double arrayStamp = 0.0;
+        auto flush = [&]() {
+            if (array) messages.push_back(ReplayMessage{arrayStamp, arrayCamera, nullptr, array});
+            array.reset();
+        };
+        while (std::getline(detFile, line)) {
+            std::vector<std::string> f = splitCSV(line);
+            if (f.size() < 6) continue;
+            double stamp = std::stod(f[0]);
+            if (!array || stamp != arrayStamp || f[1] != arrayCamera) {
+                flush();
+                array.reset(new apriltag_ros::AprilTagDetectionArray);
+                array->header.stamp = ros::Time(stamp);
+                arrayStamp = stamp;
+                arrayCamera = f[1];
+            }
+            apriltag_ros::AprilTagDetection detection;
+            detection.id.push_back(std::stoi(f[2]));
+            detection.pose.header.stamp = array->header.stamp;
+            detection.pose.pose.pose.position.x = std::stod(f[3]);
+            detection.pose.pose.pose.position.y = std::stod(f[4]);
+            detection.pose.pose.pose.position.z = std::stod(f[5]);
+            detection.pose.pose.pose.orientation.w = 1.0;
+            array->detections.push_back(detection);
+        }
+        flush();
+    }
+
+    sortByStamp(messages);
+    return true;
+}
+
+ReplayStats runReplay(const std::vector<ReplayMessage>& messages,
+                      const std::function<void(const ReplayMessage&)>& dispatch,
+                      double tick_period,
+                      const std::function<void()>& tick) {
+    ReplayStats stats;
+    if (messages.empty()) {
+        return stats;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    double nextTick = messages.front().stamp + tick_period;
+    for (const auto& message : messages) {
+        if (!ros::ok()) break;
+
+        // Recorded time drives every ros::Time::now() in the estimator
+        ros::Time::setNow(ros::Time(message.stamp));
+        if (tick && tick_period > 0.0) {
+            while (nextTick <= message.stamp) {
+                tick();
+                nextTick += tick_period;
+            }
+        }
+        dispatch(message);
+        ++stats.messages;
+    }
+    stats.wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stats.dataDuration = messages.back().stamp - messages.front().stamp;
+    return stats;
+}
+
+} // namespace aprilslam
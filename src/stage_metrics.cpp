@@ -0,0 +1,91 @@
+// stage_metrics.cpp
+
+#include "stage_metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+namespace aprilslam {
+
+void LatencyHistogram::record(double seconds) {
+    const double us = seconds * 1e6;
+    int index = 0;
+    if (us >= 1.0) {
+        // us = m * 2^e with m in [0.5, 1): octave e - 1, sub-bucket from the mantissa
+        int e;
+        const double m = std::frexp(us, &e);
+        const int sub = static_cast<int>((2.0 * m - 1.0) * kSubBuckets);
+        index = std::min((e - 1) * kSubBuckets + sub, kSubBuckets * kOctaves - 1);
+    }
+    ++buckets_[index];
+    ++count_;
+    sum_ += seconds;
+    max_ = std::max(max_, seconds);
+}
+
+void LatencyHistogram::reset() {
+    buckets_.fill(0);
+    count_ = 0;
+    sum_ = 0.0;
+    max_ = 0.0;
+}
+
+double LatencyHistogram::percentile(double q) const {
+    if (count_ == 0) {
+        return 0.0;
+    }
+    const std::uint64_t rank = static_cast<std::uint64_t>(std::ceil(std::min(std::max(q, 0.0), 1.0) * count_));
+    std::uint64_t seen = 0;
+    for (size_t i = 0; i < buckets_.size(); ++i) {
+        seen += buckets_[i];
+        if (seen >= std::max<std::uint64_t>(rank, 1)) {
+            const int octave = static_cast<int>(i) / kSubBuckets;
+            const int sub = static_cast<int>(i) % kSubBuckets;
+            const double upper = std::ldexp(1.0 + double(sub + 1) / kSubBuckets, octave) * 1e-6;
+            return std::min(upper, max_);
+        }
+    }
+    return max_;
+}
+
+const char* stageName(Stage stage) {
+    switch (stage) {
+        case Stage::DetectionGathering: return "detection_gathering";
+        case Stage::Gating:             return "gating";
+        case Stage::GraphUpdate:        return "graph_update";
+        case Stage::Relocalisation:     return "relocalisation";
+        case Stage::Solve:              return "solve";
+        case Stage::Pruning:            return "pruning";
+        case Stage::LoopClosure:        return "loop_closure";
+        case Stage::Smoothing:          return "smoothing";
+        case Stage::Publishing:         return "publishing";
+        case Stage::Logging:            return "logging";
+        default:                        return "unknown";
+    }
+}
+
+void StageMetrics::reset() {
+    for (auto& histogram : stages_) {
+        histogram.reset();
+    }
+}
+
+bool StageMetrics::writeCSV(const std::string& filename) const {
+    std::ofstream file(filename, std::ios::out);
+    if (!file) {
+        std::cerr << "Failed to open the metrics file " << filename << std::endl;
+        return false;
+    }
+    file << "stage,count,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n";
+    for (size_t s = 0; s < kStages; ++s) {
+        const LatencyHistogram& h = stages_[s];
+        file << stageName(static_cast<Stage>(s)) << "," << h.count() << ","
+             << 1e3 * h.mean() << "," << 1e3 * h.percentile(0.50) << ","
+             << 1e3 * h.percentile(0.95) << "," << 1e3 * h.percentile(0.99) << ","
+             << 1e3 * h.max() << "\n";
+    }
+    return true;
+}
+
+} // namespace aprilslam
@@ -0,0 +1,266 @@
+// submap_solver.cpp
+
+#include "submap_solver.h"
+#include "se2.h"
+#include "stage_metrics.h"
+#include <gtsam/inference/Symbol.h>
+#include <gtsam/nonlinear/LevenbergMarquardtOptimizer.h>
+#include <gtsam/sam/BearingRangeFactor.h>
+#include <gtsam/slam/BetweenFactor.h>
+#include <gtsam/slam/PriorFactor.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <map>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace aprilslam {
+
+namespace {
+
+struct Submap {
+    gtsam::NonlinearFactorGraph graph;
+    gtsam::Values values;
+    gtsam::Values result;
+    gtsam::Key firstPose = 0;
+    bool posePrior = false;
+    std::set<gtsam::Key> tagPriors;
+    bool solved = false;
+
+    // A pose prior or priors on two tags fix the frame, otherwise the gauge is fixed at the first pose
+    bool anchored() const { return posePrior || tagPriors.size() >= 2; }
+};
+
+// False if the solver threw (e.g. a submap with a tag seen once), `result` is then the initial
+// estimate and the refinement sees it all
+bool solve(const gtsam::NonlinearFactorGraph& graph, const gtsam::Values& initial, gtsam::Values& result,
+           const gtsam::LevenbergMarquardtParams& params = gtsam::LevenbergMarquardtParams()) {
+    try {
+        gtsam::LevenbergMarquardtOptimizer optimizer(graph, initial, params);
+        result = optimizer.optimize();
+        return true;
+    } catch (const std::exception&) {
+        result = initial;
+        return false;
+    }
+}
+
+}
+
+gtsam::Values solveInSubmaps(const gtsam::NonlinearFactorGraph& graph,
+                             const gtsam::Values& initial,
+                             const SubmapParams& params,
+                             SubmapReport* report) {
+    SubmapReport unused;
+    SubmapReport& rep = report ? *report : unused;
+    rep = SubmapReport();
+    Stopwatch watch;
+
+    // Poses in drive order
+    std::vector<gtsam::Key> poses;
+    for (const auto& key_value : initial) {
+        if (gtsam::Symbol(key_value.key).chr() == 'X') poses.push_back(key_value.key);
+    }
+    std::sort(poses.begin(), poses.end(), [](gtsam::Key a, gtsam::Key b) {
+        return gtsam::Symbol(a).index() < gtsam::Symbol(b).index();
+    });
+    if (params.maxPoses <= 0 || poses.size() <= static_cast<size_t>(params.maxPoses)) {
+        rep.submaps = 1;
+        gtsam::Values result;
+        if (!solve(graph, initial, result)) ++rep.failedSolves;
+        rep.solveTime = watch.lap();
+        return result;
+    }
+
+    // Cut at row ends (a U-turn relative to the submap start) or when the submap is full
+    std::map<gtsam::Key, int> submapOf;
+    int current = 0;
+    int count = 0;
+    double startTheta = 0.0;
+    for (gtsam::Key pose : poses) {
+        const double theta = initial.at<gtsam::Pose2>(pose).theta();
+        if (count > 0) {
+            const bool full = count >= params.maxPoses;
+            const bool rowEnd = count >= params.minPoses && std::abs(se2::wrapAngle(theta - startTheta)) > params.turnAngle;
+            if (full || rowEnd) {
+                ++current;
+                count = 0;
+            }
+        }
+        if (count == 0) startTheta = theta;
+        submapOf[pose] = current;
+        ++count;
+    }
+    std::vector<Submap> submaps(current + 1);
+    for (gtsam::Key pose : poses) {
+        Submap& submap = submaps[submapOf[pose]];
+        if (submap.firstPose == 0) submap.firstPose = pose;
+    }
+
+    // Submaps observing each tag
+    std::map<gtsam::Key, std::set<int>> seenBy;
+    for (const auto& factor : graph) {
+        std::set<int> in;
+        for (gtsam::Key key : factor->keys()) {
+            auto it = submapOf.find(key);
+            if (it != submapOf.end()) in.insert(it->second);
+        }
+        if (in.size() != 1) continue;
+        for (gtsam::Key key : factor->keys()) {
+            if (gtsam::Symbol(key).chr() == 'L') seenBy[key].insert(*in.begin());
+        }
+    }
+    auto shared = [&seenBy](gtsam::Key key) {
+        auto it = seenBy.find(key);
+        return it != seenBy.end() && it->second.size() > 1;
+    };
+
+    // Factors inside one submap go to it, odometry across a cut and priors on shared tags to the
+    // separator problem
+    gtsam::NonlinearFactorGraph separator;
+    std::vector<boost::shared_ptr<gtsam::BetweenFactor<gtsam::Pose2>>> crossFactors;
+    for (const auto& factor : graph) {
+        std::set<int> in;
+        bool hasPose = false;
+        for (gtsam::Key key : factor->keys()) {
+            auto it = submapOf.find(key);
+            if (it != submapOf.end()) {
+                in.insert(it->second);
+                hasPose = true;
+            }
+        }
+        if (in.size() == 1) {
+            Submap& submap = submaps[*in.begin()];
+            submap.graph.add(factor);
+            if (factor->size() == 1) submap.posePrior = true;
+        } else if (in.size() == 2) {
+            auto between = boost::dynamic_pointer_cast<gtsam::BetweenFactor<gtsam::Pose2>>(factor);
+            if (between) {
+                crossFactors.push_back(between);
+            } else {
+                ++rep.ignoredFactors;
+            }
+        } else if (!hasPose && factor->size() == 1) {
+            const gtsam::Key tag = factor->front();
+            if (shared(tag)) {
+                separator.add(factor);
+            } else {
+                auto it = seenBy.find(tag);
+                Submap& home = submaps[it == seenBy.end() ? 0 : *it->second.begin()];
+                home.graph.add(factor);
+                home.tagPriors.insert(tag);
+            }
+        } else {
+            ++rep.ignoredFactors;
+        }
+    }
+    rep.submaps = static_cast<int>(submaps.size());
+    rep.crossFactors = static_cast<int>(crossFactors.size());
+
+    gtsam::SharedNoiseModel gaugeNoise = gtsam::noiseModel::Isotropic::Sigma(3, 1e-3);
+    for (Submap& submap : submaps) {
+        if (!submap.anchored() && submap.firstPose != 0) {
+            submap.graph.add(gtsam::PriorFactor<gtsam::Pose2>(submap.firstPose, initial.at<gtsam::Pose2>(submap.firstPose), gaugeNoise));
+        }
+        for (gtsam::Key key : submap.graph.keys()) {
+            submap.values.insert(key, initial.at(key));
+        }
+    }
+
+    // Independent solves, the largest submaps are not known in advance so workers pull the next one
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < submaps.size(); i = next++) {
+            submaps[i].solved = solve(submaps[i].graph, submaps[i].values, submaps[i].result);
+        }
+    };
+    size_t threads = params.threads > 0 ? static_cast<size_t>(params.threads)
+                                        : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, submaps.size());
+    if (threads <= 1) {
+        worker();
+    } else {
+        std::vector<std::thread> pool;
+        pool.reserve(threads - 1);
+        for (size_t t = 1; t < threads; ++t) {
+            pool.emplace_back(worker);
+        }
+        worker();
+        for (auto& th : pool) {
+            th.join();
+        }
+    }
+    for (const Submap& submap : submaps) {
+        if (!submap.solved) ++rep.failedSolves;
+    }
+    rep.solveTime = watch.lap();
+
+    // Separator problem: a rigid transform per submap and the shared tags. Each submap sees a
+    // shared tag at the position it solved for, as a bearing-range measurement from its origin
+    // with an isotropic separatorSigma; odometry across a cut links the transforms of its ends.
+    auto frameKey = [](size_t i) { return gtsam::Symbol('S', i); };
+    gtsam::Values separatorValues;
+    for (size_t i = 0; i < submaps.size(); ++i) {
+        separatorValues.insert(frameKey(i), gtsam::Pose2());
+    }
+    separator.add(gtsam::PriorFactor<gtsam::Pose2>(frameKey(0), gtsam::Pose2(), gtsam::noiseModel::Isotropic::Sigma(3, 1e-6)));
+    const double sigma = std::max(params.separatorSigma, 1e-6);
+    for (const auto& tag : seenBy) {
+        if (tag.second.size() < 2) continue;
+        ++rep.separatorTags;
+        for (int i : tag.second) {
+            const gtsam::Point2& local = submaps[i].result.at<gtsam::Point2>(tag.first);
+            const double range = std::hypot(local.x(), local.y());
+            gtsam::SharedNoiseModel noise = gtsam::noiseModel::Diagonal::Sigmas(Eigen::Vector2d(sigma / std::max(range, sigma), sigma));
+            separator.add(gtsam::BearingRangeFactor<gtsam::Pose2, gtsam::Point2, gtsam::Rot2, double>(
+                frameKey(i), tag.first, gtsam::Rot2::fromAngle(std::atan2(local.y(), local.x())), range, noise));
+        }
+        separatorValues.insert(tag.first, submaps[*tag.second.begin()].result.at<gtsam::Point2>(tag.first));
+    }
+    for (const auto& between : crossFactors) {
+        const gtsam::Key a = between->keys()[0];
+        const gtsam::Key b = between->keys()[1];
+        const int i = submapOf.at(a);
+        const int j = submapOf.at(b);
+        // S_i * Pa * z = S_j * Pb
+        const gtsam::Pose2 relative = submaps[i].result.at<gtsam::Pose2>(a).compose(between->measured())
+                                          .compose(submaps[j].result.at<gtsam::Pose2>(b).inverse());
+        separator.add(gtsam::BetweenFactor<gtsam::Pose2>(frameKey(i), frameKey(j), relative, between->noiseModel()));
+    }
+    gtsam::Values frames;
+    if (!solve(separator, separatorValues, frames)) ++rep.failedSolves;
+    rep.mergeTime = watch.lap();
+
+    // Submap estimates through their transforms, shared tags from the separator solution
+    gtsam::Values merged;
+    for (size_t i = 0; i < submaps.size(); ++i) {
+        const gtsam::Pose2 frame = frames.at<gtsam::Pose2>(frameKey(i));
+        for (const auto& key_value : submaps[i].result) {
+            const gtsam::Symbol key(key_value.key);
+            if (merged.exists(key)) continue;
+            if (key.chr() == 'X') {
+                merged.insert(key, frame.compose(submaps[i].result.at<gtsam::Pose2>(key)));
+            } else if (key.chr() == 'L') {
+                merged.insert(key, shared(key) ? frames.at<gtsam::Point2>(key)
+                                               : frame.transformFrom(submaps[i].result.at<gtsam::Point2>(key)));
+            } else {
+                merged.insert(key_value.key, key_value.value);
+            }
+        }
+    }
+    for (const auto& key_value : initial) {
+        if (!merged.exists(key_value.key)) merged.insert(key_value.key, key_value.value);
+    }
+
+    if (params.refineIterations > 0) {
+        gtsam::LevenbergMarquardtParams lm;
+        lm.setMaxIterations(params.refineIterations);
+        if (!solve(graph, merged, merged, lm)) ++rep.failedSolves;
+    }
+    rep.refineTime = watch.lap();
+    return merged;
+}
+
+}
@@ -0,0 +1,100 @@
+// trace_recorder.cpp
+
+#include "trace_recorder.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+namespace aprilslam {
+
+TraceRecorder::TraceRecorder(size_t capacity)
+    : enabled_(false),
+      origin_(std::chrono::steady_clock::now()),
+      capacity_(capacity),
+      dropped_(0) {}
+
+int TraceRecorder::threadIndex(std::thread::id id) {
+    // Few threads record (spinners and the replay loop), a linear search is enough
+    auto it = std::find(threads_.begin(), threads_.end(), id);
+    if (it != threads_.end()) {
+        return static_cast<int>(it - threads_.begin());
+    }
+    threads_.push_back(id);
+    return static_cast<int>(threads_.size()) - 1;
+}
+
+void TraceRecorder::record(Event event) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (events_.size() >= capacity_) {
+        ++dropped_;
+        return;
+    }
+    if (events_.empty()) {
+        events_.reserve(std::min<size_t>(capacity_, 4096));
+    }
+    event.thread = threadIndex(std::this_thread::get_id());
+    events_.push_back(event);
+}
+
+void TraceRecorder::setCapacity(size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = capacity;
+}
+
+size_t TraceRecorder::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return events_.size();
+}
+
+size_t TraceRecorder::dropped() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dropped_;
+}
+
+void TraceRecorder::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    events_.clear();
+    dropped_ = 0;
+}
+
+bool TraceRecorder::write(const std::string& filename, const std::string& processName) const {
+    std::ofstream file(filename, std::ios::out);
+    if (!file) {
+        std::cerr << "Failed to open the trace file " << filename << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Timestamps and durations in microseconds, as the format expects
+    file << std::fixed << std::setprecision(3);
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"" << processName << "\"}}";
+    for (size_t t = 0; t < threads_.size(); ++t) {
+        file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+             << ",\"args\":{\"name\":\"thread " << t << "\"}}";
+    }
+    for (const Event& event : events_) {
+        file << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"" << event.category
+             << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread
+             << ",\"ts\":" << event.begin * 1e6 << ",\"dur\":" << event.duration * 1e6;
+        if (event.numArgs > 0) {
+            file << ",\"args\":{";
+            for (int a = 0; a < event.numArgs; ++a) {
+                file << (a ? "," : "") << "\"" << event.args[a].key << "\":";
+                if (std::isfinite(event.args[a].value)) {
+                    file << event.args[a].value;
+                } else {
+                    file << "null";
+                }
+            }
+            file << "}";
+        }
+        file << "}";
+    }
+    file << "\n]}\n";
+    return static_cast<bool>(file);
+}
+
+}
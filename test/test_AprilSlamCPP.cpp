@@ -0,0 +1,512 @@
+// test_AprilSlamCPP.cpp
+// Unit tests of aprilslam_core: the numeric kernels (inlined SE(2) arithmetic, odometry
+// preintegration, duplicate detection fusion, rigid alignment, the per-pose observation budget,
+// the chordal initialisation, the landmark tile cache) and behaviour: particle filter convergence,
+// the submap solve against the monolithic one and the estimator's warm start.
+
+#include "chordal_init.h"
+#include "core_utils.h"
+#include "estimator.h"
+#include "keyframe_policy.h"
+#include "landmark_tiles.h"
+#include "observation_budget.h"
+#include "odometry_preintegration.h"
+#include "particle_filter.h"
+#include "pose_alignment.h"
+#include "se2.h"
+#include "submap_solver.h"
+#include <gtest/gtest.h>
+#include <gtsam/inference/Symbol.h>
+#include <gtsam/nonlinear/LevenbergMarquardtOptimizer.h>
+#include <gtsam/sam/BearingRangeFactor.h>
+#include <gtsam/slam/BetweenFactor.h>
+#include <gtsam/slam/PriorFactor.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <random>
+
+using namespace aprilslam;
+
+namespace {
+
+double angleDiff(double a, double b) { return std::abs(std::remainder(a - b, 2.0 * M_PI)); }
+
+// One observation of `id` by `camera` at body-frame point (x, y), default noise model
+void addDetection(DetectionBatch& batch, int id, int camera, double x, double y) {
+    const size_t i = batch.size();
+    batch.resize(i + 1);
+    batch.ids[i] = id;
+    batch.camera[i] = camera;
+    batch.x[i] = x;
+    batch.y[i] = y;
+    batch.bearing[i] = std::atan2(y, x);
+    batch.range[i] = std::hypot(x, y);
+    batch.count[i] = 1;
+    batch.cov_bb[i] = batch.cov_br[i] = batch.cov_rr[i] = 0.0;
+}
+
+}
+
+TEST(SE2, KernelsMatchPose2) {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> coord(-50.0, 50.0);
+    std::uniform_real_distribution<double> angle(-20.0, 20.0);
+    for (int i = 0; i < 10000; ++i) {
+        gtsam::Pose2 a(coord(rng), coord(rng), angle(rng)), b(coord(rng), coord(rng), angle(rng));
+        gtsam::Point2 p(coord(rng), coord(rng));
+        const se2::Pose between = se2::between(se2::fromPose2(a), se2::fromPose2(b));
+        const se2::Pose compose = se2::compose(se2::fromPose2(a), se2::fromPose2(b));
+        EXPECT_NEAR(between.x, a.between(b).x(), 1e-9);
+        EXPECT_NEAR(between.y, a.between(b).y(), 1e-9);
+        EXPECT_LT(angleDiff(between.theta, a.between(b).theta()), 1e-9);
+        EXPECT_NEAR(compose.x, a.compose(b).x(), 1e-9);
+        EXPECT_NEAR(compose.y, a.compose(b).y(), 1e-9);
+        EXPECT_LT(angleDiff(compose.theta, a.compose(b).theta()), 1e-9);
+
+        se2::Frame frame(a);
+        double wx, wy, bx, by;
+        frame.transformFrom(p.x(), p.y(), wx, wy);
+        frame.transformTo(p.x(), p.y(), bx, by);
+        EXPECT_NEAR(wx, a.transformFrom(p).x(), 1e-9);
+        EXPECT_NEAR(wy, a.transformFrom(p).y(), 1e-9);
+        EXPECT_NEAR(bx, a.transformTo(p).x(), 1e-9);
+        EXPECT_NEAR(by, a.transformTo(p).y(), 1e-9);
+        EXPECT_LT(angleDiff(frame.bearingTo(p.x(), p.y()), a.bearing(p).theta()), 1e-9);
+
+        const double t = angle(rng);
+        EXPECT_GE(se2::wrapAngle(t), -M_PI);
+        EXPECT_LT(se2::wrapAngle(t), M_PI);
+        EXPECT_LT(angleDiff(se2::wrapAngle(t), t), 1e-9);
+    }
+}
+
+TEST(Preintegration, ComposesIncrementsAndPropagatesByTheAdjoint) {
+    PreintegrationParams params;
+    params.minSigmas.setZero();
+    const std::vector<gtsam::Pose2> increments = {
+        gtsam::Pose2(0.3, 0.02, 0.1), gtsam::Pose2(0.25, -0.01, -0.3), gtsam::Pose2(0.4, 0.0, 0.7)};
+
+    // Covariance each increment adds on its own
+    std::vector<Eigen::Matrix3d> added;
+    for (const auto& increment : increments) {
+        OdometryPreintegrator single(params);
+        single.integrate(increment);
+        added.push_back(single.covariance());
+    }
+
+    // Sigma <- Ad(u^-1) Sigma Ad(u^-1)^T + Q(u), with GTSAM's own adjoint as the reference
+    OdometryPreintegrator preintegrator(params);
+    gtsam::Pose2 delta;
+    Eigen::Matrix3d expected = Eigen::Matrix3d::Zero();
+    for (size_t k = 0; k < increments.size(); ++k) {
+        preintegrator.integrate(increments[k]);
+        delta = delta.compose(increments[k]);
+        const Eigen::Matrix3d adjoint = increments[k].inverse().AdjointMap();
+        expected = adjoint * expected * adjoint.transpose() + added[k];
+    }
+    EXPECT_NEAR(preintegrator.delta().x(), delta.x(), 1e-12);
+    EXPECT_NEAR(preintegrator.delta().y(), delta.y(), 1e-12);
+    EXPECT_NEAR(preintegrator.delta().theta(), delta.theta(), 1e-12);
+    EXPECT_LT((preintegrator.covariance() - expected).cwiseAbs().maxCoeff(), 1e-12);
+    EXPECT_EQ(preintegrator.steps(), 3);
+}
+
+TEST(Fusion, IndependentCamerasGainInformation) {
+    const double sigmaBearing = 0.05, sigmaRange = 0.1;
+    DetectionBatch batch;
+    addDetection(batch, 7, 0, 2.0, 1.0);
+    addDetection(batch, 7, 1, 2.0, 1.0);
+    addDetection(batch, 9, 0, 1.0, -1.0);
+    EXPECT_EQ(fuseDuplicateDetections(batch, sigmaBearing, sigmaRange), 1);
+    ASSERT_EQ(batch.size(), 2u);
+    EXPECT_EQ(batch.ids[0], 7);
+    EXPECT_EQ(batch.count[0], 2);
+    EXPECT_NEAR(batch.x[0], 2.0, 1e-9);
+    EXPECT_NEAR(batch.y[0], 1.0, 1e-9);
+    // Two equal independent observations halve the variance
+    EXPECT_NEAR(batch.cov_bb[0], 0.5 * sigmaBearing * sigmaBearing, 1e-9);
+    EXPECT_NEAR(batch.cov_rr[0], 0.5 * sigmaRange * sigmaRange, 1e-9);
+    EXPECT_EQ(batch.ids[1], 9);
+}
+
+TEST(Fusion, OneCameraDoesNotGainInformation) {
+    const double sigmaBearing = 0.05, sigmaRange = 0.1;
+    DetectionBatch batch;
+    addDetection(batch, 7, 0, 2.0, 1.0);
+    addDetection(batch, 7, 0, 2.1, 1.0);
+    EXPECT_EQ(fuseDuplicateDetections(batch, sigmaBearing, sigmaRange), 1);
+    ASSERT_EQ(batch.size(), 1u);
+    EXPECT_NEAR(batch.x[0], 2.05, 1e-3);
+    EXPECT_NEAR(batch.cov_bb[0], sigmaBearing * sigmaBearing, 1e-4);
+    EXPECT_NEAR(batch.cov_rr[0], sigmaRange * sigmaRange, 1e-4);
+}
+
+TEST(Alignment, RigidAlignRecoversTheTransform) {
+    const gtsam::Pose2 truth(3.0, -2.0, 0.8);
+    std::vector<Eigen::Vector2d> body = {Eigen::Vector2d(1.0, 0.5), Eigen::Vector2d(-2.0, 1.0), Eigen::Vector2d(0.5, -3.0)};
+    std::vector<Eigen::Vector2d> map;
+    for (const auto& b : body) {
+        gtsam::Point2 m = truth.transformFrom(gtsam::Point2(b.x(), b.y()));
+        map.push_back(Eigen::Vector2d(m.x(), m.y()));
+    }
+    gtsam::Pose2 pose;
+    ASSERT_TRUE(rigidAlign2D(body, map, pose));
+    EXPECT_NEAR(pose.x(), truth.x(), 1e-9);
+    EXPECT_NEAR(pose.y(), truth.y(), 1e-9);
+    EXPECT_LT(angleDiff(pose.theta(), truth.theta()), 1e-9);
+    EXPECT_FALSE(rigidAlign2D({body[0]}, {map[0]}, pose));
+}
+
+TEST(Alignment, TagsToMapRejectsAnOutlier) {
+    std::map<int, gtsam::Point2> landmarks;
+    for (int i = 0; i < 10; ++i) {
+        landmarks[2 * i] = gtsam::Point2(-0.75, 0.5 * i);
+        landmarks[2 * i + 1] = gtsam::Point2(0.75, 0.5 * i);
+    }
+    const gtsam::Pose2 truth(0.0, 1.0, M_PI / 2);
+    std::vector<int> ids;
+    std::vector<Eigen::Vector2d> tagPos;
+    for (const auto& lm : landmarks) {
+        gtsam::Point2 local = truth.transformTo(lm.second);
+        if (local.x() <= 0.2 || local.norm() >= 3.0) continue;
+        ids.push_back(lm.first);
+        tagPos.push_back(Eigen::Vector2d(local.x(), local.y()));
+    }
+    ASSERT_GE(ids.size(), 4u);
+    tagPos[0] += Eigen::Vector2d(1.5, -1.0);
+
+    AlignmentParams params;
+    params.seed = 42;
+    AlignmentResult result;
+    ASSERT_TRUE(alignTagsToMap(ids, tagPos, landmarks, params, result));
+    EXPECT_EQ(result.inliers.size(), ids.size() - 1);
+    EXPECT_EQ(std::count(result.inliers.begin(), result.inliers.end(), 0), 0);
+    EXPECT_NEAR(result.pose.x(), truth.x(), 1e-6);
+    EXPECT_NEAR(result.pose.y(), truth.y(), 1e-6);
+    EXPECT_LT(angleDiff(result.pose.theta(), truth.theta()), 1e-6);
+}
+
+TEST(KeyframePolicy, ObservedTagsLeaveLittleToGain) {
+    const Eigen::Vector2d sigmas(0.1, 0.8);
+    std::map<int, gtsam::Point2> map;
+    for (int i = 0; i < 8; ++i) map[i] = gtsam::Point2(i, i % 2 ? 1.5 : -1.5);
+    std::vector<Eigen::Vector2d> tags;
+    for (const auto& tag : visibleTags(gtsam::Pose2(), map, 4.0)) tags.push_back(tag.second);
+    EXPECT_EQ(tags.size(), 4u);
+    const Eigen::Matrix3d information = observationInformation(tags, sigmas);
+
+    // A keyframe that saw the tags is known far better than the odometry alone
+    const Eigen::Matrix3d odometry = Eigen::Vector3d(0.05, 0.05, 0.02).cwiseAbs2().asDiagonal();
+    const Eigen::Matrix3d keyframe = observedCovariance(odometry, information);
+    EXPECT_LT(keyframe.trace(), odometry.trace());
+    EXPECT_LT(expectedInformationGain(keyframe, information), expectedInformationGain(odometry, information));
+
+    // Half a metre on, the keyframe marginal is moved along and the odometry added
+    const Eigen::Matrix3d ahead = propagateCovariance(keyframe, gtsam::Pose2(0.5, 0.0, 0.0), odometry);
+    EXPECT_GT(ahead(1, 1), keyframe(1, 1) + odometry(1, 1));
+    EXPECT_DOUBLE_EQ(expectedInformationGain(ahead, observationInformation({}, sigmas)), 0.0);
+}
+
+TEST(ObservationBudget, KeepsNearTagsAtDifferentBearings) {
+    DetectionBatch batch;
+    addDetection(batch, 1, 0, 1.0, 1.0);     // near, left
+    addDetection(batch, 2, 0, 6.0, 6.2);     // far, almost the bearing of tag 1
+    addDetection(batch, 3, 0, 1.0, -1.0);    // near, right
+    addDetection(batch, 4, 0, 1.0, 0.0);     // near, but its tag is barely known
+    const std::vector<double> tagSigmas = {0.0, 0.0, 0.0, 5.0};
+    const Eigen::Vector2d sigmas(0.05, 0.1);
+    const Eigen::Matrix3d poseInformation = Eigen::Matrix3d::Identity();
+
+    std::vector<bool> kept = selectInformativeObservations(batch, tagSigmas, sigmas, poseInformation, 2);
+    EXPECT_EQ(kept, std::vector<bool>({true, false, true, false}));
+
+    // Within the budget everything is kept
+    kept = selectInformativeObservations(batch, tagSigmas, sigmas, poseInformation, 4);
+    EXPECT_EQ(kept, std::vector<bool>(4, true));
+
+    // First sightings are always kept and leave the budget to the re-observations
+    const std::vector<bool> firstSightings = {false, true, false, true};
+    kept = selectInformativeObservations(batch, tagSigmas, sigmas, poseInformation, 1, firstSightings);
+    EXPECT_EQ(std::count(kept.begin(), kept.end(), true), 3);
+    EXPECT_TRUE(kept[1] && kept[3]);
+    kept = selectInformativeObservations(batch, tagSigmas, sigmas, poseInformation, 2, firstSightings);
+    EXPECT_EQ(kept, std::vector<bool>(4, true));
+}
+
+TEST(ChordalInit, RecoversAConsistentGraphFromABadGuess) {
+    typedef gtsam::BearingRangeFactor<gtsam::Pose2, gtsam::Point2, gtsam::Rot2, double> BearingRange;
+    const std::vector<gtsam::Pose2> poses = {gtsam::Pose2(0.0, 0.0, 0.0), gtsam::Pose2(1.0, 0.2, 0.4),
+                                             gtsam::Pose2(1.8, 1.0, 1.2), gtsam::Pose2(2.0, 2.0, 2.0)};
+    const std::vector<gtsam::Point2> tags = {gtsam::Point2(1.5, -1.0), gtsam::Point2(3.0, 1.0), gtsam::Point2(0.5, 2.5)};
+    auto odometryNoise = gtsam::noiseModel::Diagonal::Sigmas(gtsam::Vector3(0.1, 0.1, 0.05));
+    auto brNoise = gtsam::noiseModel::Diagonal::Sigmas(gtsam::Vector2(0.05, 0.1));
+
+    gtsam::NonlinearFactorGraph graph;
+    gtsam::Values initial;
+    graph.add(gtsam::PriorFactor<gtsam::Pose2>(gtsam::Symbol('X', 0), poses[0],
+                                               gtsam::noiseModel::Diagonal::Sigmas(gtsam::Vector3(0.01, 0.01, 0.01))));
+    for (size_t i = 0; i < poses.size(); ++i) {
+        gtsam::Symbol x('X', i);
+        initial.insert(x, gtsam::Pose2(poses[i].x() + 0.3, poses[i].y() - 0.2, poses[i].theta() + 0.5));
+        if (i > 0) graph.add(gtsam::BetweenFactor<gtsam::Pose2>(gtsam::Symbol('X', i - 1), x, poses[i - 1].between(poses[i]), odometryNoise));
+        for (size_t j = 0; j < tags.size(); ++j) {
+            graph.add(BearingRange(x, gtsam::Symbol('L', j), poses[i].bearing(tags[j]), poses[i].range(tags[j]), brNoise));
+        }
+    }
+    for (size_t j = 0; j < tags.size(); ++j) {
+        initial.insert(gtsam::Symbol('L', j), gtsam::Point2(tags[j].x() - 0.4, tags[j].y() + 0.3));
+    }
+
+    gtsam::Values result;
+    ChordalInitReport report;
+    ASSERT_TRUE(chordalInitialise(graph, initial, result, &report));
+    EXPECT_EQ(report.poses, poses.size());
+    EXPECT_EQ(report.landmarks, tags.size());
+    EXPECT_LT(report.errorAfter, report.errorBefore);
+    for (size_t i = 0; i < poses.size(); ++i) {
+        const gtsam::Pose2& pose = result.at<gtsam::Pose2>(gtsam::Symbol('X', i));
+        EXPECT_NEAR(pose.x(), poses[i].x(), 1e-6);
+        EXPECT_NEAR(pose.y(), poses[i].y(), 1e-6);
+        EXPECT_LT(angleDiff(pose.theta(), poses[i].theta()), 1e-6);
+    }
+    for (size_t j = 0; j < tags.size(); ++j) {
+        EXPECT_LT((result.at<gtsam::Point2>(gtsam::Symbol('L', j)) - tags[j]).norm(), 1e-6);
+    }
+
+    // Without a pose prior one tag prior leaves the rotation free, two fix the frame (warm start)
+    auto tagPriorNoise = gtsam::noiseModel::Isotropic::Sigma(2, 0.01);
+    gtsam::NonlinearFactorGraph unanchored;
+    for (size_t f = 1; f < graph.size(); ++f) unanchored.add(graph[f]);
+    unanchored.add(gtsam::PriorFactor<gtsam::Point2>(gtsam::Symbol('L', 0), tags[0], tagPriorNoise));
+    EXPECT_FALSE(chordalInitialise(unanchored, initial, result, &report));
+    EXPECT_FALSE(report.skipped.empty());
+    unanchored.add(gtsam::PriorFactor<gtsam::Point2>(gtsam::Symbol('L', 1), tags[1], tagPriorNoise));
+    ASSERT_TRUE(chordalInitialise(unanchored, initial, result, &report));
+    EXPECT_TRUE(report.skipped.empty());
+    for (size_t i = 0; i < poses.size(); ++i) {
+        const gtsam::Pose2& pose = result.at<gtsam::Pose2>(gtsam::Symbol('X', i));
+        EXPECT_NEAR(pose.x(), poses[i].x(), 1e-6);
+        EXPECT_NEAR(pose.y(), poses[i].y(), 1e-6);
+        EXPECT_LT(angleDiff(pose.theta(), poses[i].theta()), 1e-6);
+    }
+}
+
+TEST(Submaps, MatchTheMonolithicSolve) {
+    // Noisy calibration graph of a loop around a ring of tags, built like the estimator builds it:
+    // a start pose prior, dead-reckoned poses and first-sighting tag priors of 1 m
+    typedef gtsam::BearingRangeFactor<gtsam::Pose2, gtsam::Point2, gtsam::Rot2, double> BearingRange;
+    std::mt19937 rng(7);
+    std::normal_distribution<double> unit(0.0, 1.0);
+    auto odometryNoise = gtsam::noiseModel::Diagonal::Sigmas(gtsam::Vector3(0.02, 0.02, 0.01));
+    auto brNoise = gtsam::noiseModel::Diagonal::Sigmas(gtsam::Vector2(0.01, 0.03));
+    auto pointNoise = gtsam::noiseModel::Isotropic::Sigma(2, 1.0);
+    std::vector<gtsam::Pose2> poses;
+    for (int i = 0; i < 48; ++i) {
+        const double a = 2.0 * M_PI * i / 48;
+        poses.push_back(gtsam::Pose2(5.0 * std::cos(a), 5.0 * std::sin(a), a + M_PI / 2));
+    }
+    std::vector<gtsam::Point2> tags;
+    for (int j = 0; j < 12; ++j) {
+        tags.push_back(gtsam::Point2(7.0 * std::cos(2.0 * M_PI * j / 12), 7.0 * std::sin(2.0 * M_PI * j / 12)));
+    }
+
+    gtsam::NonlinearFactorGraph graph;
+    gtsam::Values initial;
+    graph.add(gtsam::PriorFactor<gtsam::Pose2>(gtsam::Symbol('X', 0), poses[0],
+                                               gtsam::noiseModel::Diagonal::Sigmas(gtsam::Vector3(0.01, 0.01, 0.01))));
+    gtsam::Pose2 guess = poses[0];
+    for (size_t i = 0; i < poses.size(); ++i) {
+        gtsam::Symbol x('X', i);
+        if (i > 0) {
+            const gtsam::Pose2 truth = poses[i - 1].between(poses[i]);
+            const gtsam::Pose2 z(truth.x() + 0.02 * unit(rng), truth.y() + 0.02 * unit(rng), truth.theta() + 0.01 * unit(rng));
+            graph.add(gtsam::BetweenFactor<gtsam::Pose2>(gtsam::Symbol('X', i - 1), x, z, odometryNoise));
+            guess = guess.compose(z);
+        }
+        initial.insert(x, guess);
+        for (size_t j = 0; j < tags.size(); ++j) {
+            if (poses[i].range(tags[j]) > 5.0) continue;
+            const double bearing = poses[i].bearing(tags[j]).theta() + 0.01 * unit(rng);
+            const double range = poses[i].range(tags[j]) + 0.03 * unit(rng);
+            gtsam::Symbol l('L', j);
+            graph.add(BearingRange(x, l, gtsam::Rot2::fromAngle(bearing), range, brNoise));
+            if (!initial.exists(l)) {
+                const gtsam::Point2 first = guess.transformFrom(gtsam::Point2(range * std::cos(bearing), range * std::sin(bearing)));
+                initial.insert(l, first);
+                graph.add(gtsam::PriorFactor<gtsam::Point2>(l, first, pointNoise));
+            }
+        }
+    }
+    ASSERT_EQ(initial.size(), poses.size() + tags.size());
+
+    const gtsam::Values monolithic = gtsam::LevenbergMarquardtOptimizer(graph, initial).optimize();
+    SubmapParams params;
+    params.maxPoses = 12;
+    params.minPoses = 12;
+    params.threads = 2;
+    SubmapReport report;
+    const gtsam::Values submapped = solveInSubmaps(graph, initial, params, &report);
+    EXPECT_EQ(report.submaps, 4);
+    EXPECT_GT(report.separatorTags, 0);
+    EXPECT_EQ(report.failedSolves, 0);
+    for (size_t j = 0; j < tags.size(); ++j) {
+        gtsam::Symbol l('L', j);
+        EXPECT_LT((submapped.at<gtsam::Point2>(l) - monolithic.at<gtsam::Point2>(l)).norm(), 0.01) << "tag " << j;
+    }
+    for (size_t i = 0; i < poses.size(); ++i) {
+        gtsam::Symbol x('X', i);
+        const gtsam::Pose2 difference = monolithic.at<gtsam::Pose2>(x).between(submapped.at<gtsam::Pose2>(x));
+        EXPECT_LT(std::hypot(difference.x(), difference.y()), 0.01) << "pose " << i;
+    }
+}
+
+TEST(ParticleFilter, ConvergesOnTheTruePose) {
+    // Two rows of tags, the robot drives 0.2 m per step up the aisle between them, fed by
+    // odometry and seeing the tags ahead within 4 m. The filter starts from the first tag only.
+    std::map<int, gtsam::Point2> landmarks;
+    for (int i = 0; i < 20; ++i) {
+        landmarks[2 * i] = gtsam::Point2(-0.75, 0.5 * i);
+        landmarks[2 * i + 1] = gtsam::Point2(0.75, 0.5 * i);
+    }
+    gtsam::Pose2 pose(0.0, 0.5, M_PI / 2);
+    const gtsam::Pose2 motion(0.2, 0.0, 0.0);
+    std::vector<int> ids;
+    std::vector<Eigen::Vector2d> tagPos;
+    auto observe = [&]() {
+        ids.clear();
+        tagPos.clear();
+        for (const auto& lm : landmarks) {
+            const gtsam::Point2 local = pose.transformTo(lm.second);
+            if (local.x() <= 0.2 || local.norm() >= 4.0) continue;
+            ids.push_back(lm.first);
+            tagPos.push_back(Eigen::Vector2d(local.x(), local.y()));
+        }
+    };
+
+    PFParams params;
+    params.seed = 42;
+    ParticleFilter pf(params);
+    observe();
+    ASSERT_FALSE(ids.empty());
+    pf.setParticles(initParticlesFromFirstTag(ids, tagPos, landmarks, 20000));
+
+    // The node's convergence test: spread below twice the settled spread with ESS >= N / 2, three
+    // steps in a row
+    const Eigen::Vector2d settled = steadyStateStd(params);
+    int steps = 0;
+    int inRow = 0;
+    while (steps < 30 && inRow < 3) {
+        pose = pose.compose(motion);
+        observe();
+        pf.step(ids, tagPos, landmarks, motion);
+        ++steps;
+        const Eigen::Matrix3d cov = pf.covariance();
+        const bool settledNow = std::sqrt(std::max(cov(0, 0), cov(1, 1))) < 2.0 * settled(0) &&
+                                std::sqrt(cov(2, 2)) < 2.0 * settled(1) &&
+                                pf.effectiveSampleSize() >= 0.5 * pf.size();
+        inRow = settledNow ? inRow + 1 : 0;
+    }
+    EXPECT_EQ(inRow, 3);
+    const Eigen::Vector3d estimate = pf.mean();
+    EXPECT_LT(std::hypot(estimate(0) - pose.x(), estimate(1) - pose.y()), 0.2);
+    EXPECT_LT(angleDiff(estimate(2), pose.theta()), 0.1);
+    EXPECT_GE(pf.size(), params.minParticles);
+    EXPECT_LE(pf.size(), params.maxParticles);
+}
+
+TEST(WarmStart, AlignedSessionLandsOnThePreviousMap) {
+    // Square drive inside a ring of tags. The previous map holds six of the eight tags in a frame
+    // rotated and shifted against the session's, which starts at the first pose.
+    std::vector<gtsam::Pose2> drive;
+    const double corners[4][2] = {{0.0, 0.0}, {6.0, 0.0}, {6.0, 6.0}, {0.0, 6.0}};
+    for (int side = 0; side < 4; ++side) {
+        const double heading = side * M_PI / 2;
+        for (int k = side == 0 ? 1 : 0; k < 12; ++k) {
+            drive.push_back(gtsam::Pose2(corners[side][0] + 0.5 * k * std::cos(heading),
+                                         corners[side][1] + 0.5 * k * std::sin(heading), heading));
+        }
+    }
+    std::vector<gtsam::Point2> tags;
+    for (int j = 0; j < 8; ++j) {
+        tags.push_back(gtsam::Point2(3.0 + 5.0 * std::cos(j * M_PI / 4), 3.0 + 5.0 * std::sin(j * M_PI / 4)));
+    }
+    const gtsam::Pose2 sessionToMap(4.0, -2.0, 0.7);
+    std::map<int, gtsam::Point2> previousMap;
+    for (int j = 0; j < 6; ++j) {
+        previousMap[j] = sessionToMap.transformFrom(drive.front().transformTo(tags[j]));
+    }
+
+    EstimatorOptions options;
+    options.incremental = false;
+    options.odometrySigmas = Eigen::Vector3d(0.1, 0.1, 0.05);
+    options.bearingRangeSigmas = Eigen::Vector2d(0.05, 0.1);
+    options.pointSigmas = Eigen::Vector2d(1.0, 1.0);   // first-sighting tag priors, as in calibration
+    Estimator estimator(options);
+    for (size_t i = 0; i < drive.size(); ++i) {
+        if (estimator.addOdometry(0.1 * i, drive[i]) != OdometryStep::Keyframe) continue;
+        DetectionBatch batch;
+        for (size_t j = 0; j < tags.size(); ++j) {
+            const gtsam::Point2 local = drive[i].transformTo(tags[j]);
+            if (local.norm() < 6.0) addDetection(batch, static_cast<int>(j), 0, local.x(), local.y());
+        }
+        estimator.addDetections(batch);
+    }
+
+    AlignmentParams params;
+    params.seed = 42;
+    AlignmentResult result;
+    ASSERT_TRUE(estimator.alignToMap(previousMap, params, 0.05, result));
+    EXPECT_EQ(result.inliers.size(), previousMap.size());
+    EXPECT_NEAR(result.pose.x(), sessionToMap.x(), 1e-3);
+    EXPECT_NEAR(result.pose.y(), sessionToMap.y(), 1e-3);
+    EXPECT_LT(angleDiff(result.pose.theta(), sessionToMap.theta()), 1e-3);
+
+    // Noise-free data: every tag, in the previous map or not, lands on the map-frame truth. Priors
+    // left behind in the session frame would pull the tags off by centimetres.
+    estimator.optimiseAll();
+    ASSERT_EQ(estimator.landmarks().size(), tags.size());
+    for (size_t j = 0; j < tags.size(); ++j) {
+        const gtsam::Point2 truth = sessionToMap.transformFrom(drive.front().transformTo(tags[j]));
+        EXPECT_LT((estimator.landmarks().at(static_cast<int>(j)) - truth).norm(), 1e-3) << "tag " << j;
+    }
+}
+
+TEST(LandmarkTiles, StaysWithinTheBudgetWithoutThrashing) {
+    char directory[] = "/tmp/aprilslam_tiles_XXXXXX";
+    ASSERT_NE(mkdtemp(directory), nullptr);
+    std::map<int, gtsam::Point2> landmarks;
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) landmarks[10 * i + j] = gtsam::Point2(10.0 * i + 5.0, 10.0 * j + 5.0);
+    }
+    ASSERT_TRUE(writeLandmarkTiles(landmarks, directory, 10.0));
+
+    TileParams params;
+    params.loadRadius = 12.0;   // the robot's tile and its four neighbours
+    params.evictRadius = 30.0;
+    params.maxTiles = 3;
+    LandmarkTileMap tiles(params);
+    ASSERT_TRUE(tiles.open(directory));
+    EXPECT_EQ(tiles.tileCount(), 16u);
+    EXPECT_TRUE(tiles.update(15.0, 15.0));
+    EXPECT_EQ(tiles.loadedTiles(), 3u);
+    EXPECT_EQ(tiles.active().count(11), 1u);
+    // Same place again: nothing is evicted and read back
+    TileChange change;
+    EXPECT_FALSE(tiles.update(15.0, 15.0, &change));
+    EXPECT_TRUE(change.empty());
+
+    // Ids in no tile are remembered as missing, ids of tiles read once are found directly
+    EXPECT_FALSE(tiles.loadTileWithTag(1000));
+    EXPECT_FALSE(tiles.loadTileWithTag(1000));
+    EXPECT_TRUE(tiles.loadTileWithTag(33));
+    EXPECT_EQ(tiles.active().count(33), 1u);
+    std::filesystem::remove_all(directory);
+}
+
+int main(int argc, char** argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}